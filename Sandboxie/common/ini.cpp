@@ -29,78 +29,82 @@ typedef long NTSTATUS;
 
 #include "ini.h"
 
+extern "C" {
+#include "ini_token.h"
+}
+
+#define INI_MAX_TOKENS 256
+
 
-WCHAR* Ini_Prep_ConfigLine(WCHAR* iniDataPtr, WCHAR* &line, WCHAR* &end)
+static void Ini_Read_ConfigEntry(const WCHAR* iniData, const INI_TOKEN* token, std::list<SIniEntry>& entries)
 {
-    line = iniDataPtr;        
-    // trim leading whitespaces
-    while (*line == L' ' || *line == L'\t' || *line == L'\r') line++; 
-    // find the line ending
-    end = wcschr(line, L'\n');
-    // it is the last line if there is no line ending, so find the string terminator
-    if (end == NULL) iniDataPtr = end = wcschr(line, L'\0');
-    else iniDataPtr = end + 1;
-    // trim trailing whitespaces
-    while (end > line && (*(end-1) == L' ' || *(end-1) == L'\t' || *(end-1) == L'\r')) end--; 
-    // return pointer to next line
-    return iniDataPtr;
+    // text lines, like comments, are kept as entries without a name
+    entries.push_back(SIniEntry{std::wstring(iniData + token->name_ofs, token->name_len), std::wstring(iniData + token->value_ofs, token->value_len)});
 }
 
-void Ini_Read_ConfigEntry(WCHAR* line, WCHAR* end, std::list<SIniEntry>& entries)
+static void Ini_Trim_ConfigSection(std::list<SIniEntry>& entries)
 {
-    if (*line == L'#') goto no_name;
-    WCHAR* separator = wcschr(line, L'=');
-    if (separator > end || separator == NULL)
-    {
-    no_name:
-        entries.push_back(SIniEntry{std::wstring(), std::wstring(line, end - line)});
-    }
-    else 
-    {
-        WCHAR* name_start = line;
-        WCHAR* name_end = separator;
-        // trim trailing whitespaces
-        while (name_end > name_start && (*(name_end-1) == L' ' || *(name_end-1) == L'\t')) name_end--; 
-
-        WCHAR* value_start = separator+1;
-        // trim leading whitespaces
-        while (*value_start == L' ' || *value_start == L'\t') value_start++; 
-        WCHAR* value_end = end;
-
-        entries.push_back(SIniEntry{std::wstring(name_start, name_end - name_start), std::wstring(value_start, value_end - value_start)});
-    }
+    while (entries.size() > 0 && entries.back().Name.size() == 0 && entries.back().Value.size() == 0)
+        entries.pop_back(); // drop empty lines at the very end of a section
 }
 
-void Ini_Read_ConfigSection(WCHAR* &iniDataPtr, std::list<SIniEntry>& entries)
+void Ini_Read_ConfigIni(const WCHAR* iniData, ULONG iniLen, SConfigIni* pIniConfig)
 {
-    for (WCHAR* next = NULL;  *iniDataPtr != L'\0'; iniDataPtr = next)
-    {
-        WCHAR *line, *end;
-        next = Ini_Prep_ConfigLine(iniDataPtr, line, end);
+    INI_TOKENIZER tk;
+    INI_TOKEN tokens[INI_MAX_TOKENS];
+    NTSTATUS status;
 
-        if (*line == L'[')
-            break;
+    // entries before the first section header go into a nameless section
+    pIniConfig->Sections.push_back(SIniSection{});
+    SIniSection* pSection = &pIniConfig->Sections.back();
 
-        Ini_Read_ConfigEntry(line, end, entries);
-    }
-    
-    while (entries.size() > 0 && entries.back().Name.size() == 0 && entries.back().Value.size() == 0)
-        entries.pop_back(); // drop empty lines at the very end of a section
+    Ini_Tokenize_Init(&tk, iniData, iniLen, 0, 0, 0);
+    do {
+        ULONG count = INI_MAX_TOKENS;
+        status = Ini_Tokenize(&tk, tokens, &count);
+
+        for (ULONG i = 0; i < count; i++)
+        {
+            if (tokens[i].type == INI_TOKEN_SECTION)
+            {
+                Ini_Trim_ConfigSection(pSection->Entries);
+                pIniConfig->Sections.push_back(SIniSection{std::wstring(iniData + tokens[i].name_ofs, tokens[i].name_len)});
+                pSection = &pIniConfig->Sections.back();
+            }
+            else
+                Ini_Read_ConfigEntry(iniData, &tokens[i], pSection->Entries);
+        }
+    } while (status == STATUS_SUCCESS);
+
+    Ini_Trim_ConfigSection(pSection->Entries);
 }
 
-SIniSection* Ini_Read_SectionHeader(WCHAR*& iniDataPtr, SConfigIni* pIniConfig)
+void Ini_Read_ConfigSection(WCHAR* &iniDataPtr, std::list<SIniEntry>& entries)
 {
-    WCHAR *line, *end;
-    iniDataPtr = Ini_Prep_ConfigLine(iniDataPtr, line, end);
-
-    if (*line == L'[') // section
-    {
-        WCHAR* start = line + 1;
-        WCHAR* stop = wcschr(line, L']');
-        if (stop == NULL || stop > end)
-            stop = end;
-        pIniConfig->Sections.push_back(SIniSection{std::wstring(start, stop - start)});
-        return &pIniConfig->Sections.back();
-    }
-    return NULL;
-}
\ No newline at end of file
+    INI_TOKENIZER tk;
+    INI_TOKEN tokens[INI_MAX_TOKENS];
+    NTSTATUS status;
+    ULONG iniLen = (ULONG)wcslen(iniDataPtr);
+
+    Ini_Tokenize_Init(&tk, iniDataPtr, iniLen, 0, 0, 0);
+    do {
+        ULONG count = INI_MAX_TOKENS;
+        status = Ini_Tokenize(&tk, tokens, &count);
+
+        for (ULONG i = 0; i < count; i++)
+        {
+            if (tokens[i].type == INI_TOKEN_SECTION) {
+                // stop at the next section header
+                iniDataPtr += tokens[i].name_ofs - 1;
+                goto finish;
+            }
+
+            Ini_Read_ConfigEntry(iniDataPtr, &tokens[i], entries);
+        }
+    } while (status == STATUS_SUCCESS);
+
+    iniDataPtr += iniLen;
+
+finish:
+    Ini_Trim_ConfigSection(entries);
+}
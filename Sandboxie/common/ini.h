@@ -42,9 +42,7 @@ struct SConfigIni
 };
 
 
-WCHAR* Ini_Prep_ConfigLine(WCHAR* iniDataPtr, WCHAR*& line, WCHAR*& end);
-void Ini_Read_ConfigEntry(WCHAR* line, WCHAR* end, std::list<SIniEntry>& entries);
+void Ini_Read_ConfigIni(const WCHAR* iniData, ULONG iniLen, SConfigIni* pIniConfig);
 void Ini_Read_ConfigSection(WCHAR*& iniDataPtr, std::list<SIniEntry>& entries);
-SIniSection* Ini_Read_SectionHeader(WCHAR*& iniDataPtr, SConfigIni* pIniConfig);
 
 #endif // CONFIG_INI_H
\ No newline at end of file
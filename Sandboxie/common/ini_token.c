@@ -0,0 +1,361 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Ini Buffer Tokenizer
+//
+// Splits a whole in memory ini file into a flat array of section, setting
+// and text spans, used by the driver when loading the configuration and
+// by SbieSvc when caching Sandboxie.ini for editing
+//---------------------------------------------------------------------------
+
+#ifndef KERNEL_MODE
+#include "win32_ntddk.h"
+#endif
+#include "ini_token.h"
+
+// SSE2 is always available on x64, 32-bit kernel code would have to
+// save the FPU state first, so there only user mode uses it
+
+#if defined(_M_X64) || (defined(_M_IX86) && !defined(KERNEL_MODE))
+#define INI_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+static ULONG Ini_Find(
+    IN  const WCHAR *text,
+    IN  ULONG pos,
+    IN  ULONG end,
+    IN  WCHAR c1,
+    IN  WCHAR c2,
+    IN  WCHAR c3);
+
+//---------------------------------------------------------------------------
+// Ini_Decode
+//
+// decodes with the same rules as Stream_Read_Wchar, encoding is the value
+// returned by Read_BOM, UTF-16 input may be decoded in place
+//---------------------------------------------------------------------------
+
+ULONG Ini_Decode(
+    IN  const UCHAR *data,
+    IN  ULONG len,
+    IN  ULONG encoding,
+    OUT WCHAR *text)
+{
+    ULONG pos = 0;
+    ULONG num = 0;
+    WCHAR prev = 0;
+
+    if (encoding == 0) // Unicode Little Endian
+    {
+        num = len / sizeof(WCHAR);
+        if ((const UCHAR *)text != data)
+            memmove(text, data, num * sizeof(WCHAR));
+        return num;
+    }
+
+    if (encoding == 2) // Unicode Big Endian
+    {
+        len /= sizeof(WCHAR);
+#ifdef INI_USE_SSE2
+        for (; num + 8 <= len; num += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + num * 2));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128((__m128i *)(text + num), v);
+        }
+#endif
+        for (; num < len; ++num)
+            text[num] = (WCHAR)((data[num * 2] << 8) | data[num * 2 + 1]);
+        return num;
+    }
+
+    if (encoding != 1) // utf 8
+        return 0;
+
+    while (pos < len) {
+
+        UCHAR cur_byte;
+        ULONG unicode;
+
+#ifdef INI_USE_SSE2
+        // plain ASCII runs are widened 16 bytes at a time
+        if (pos + 16 <= len) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + pos));
+            if (_mm_movemask_epi8(v) == 0) {
+                __m128i zero = _mm_setzero_si128();
+                _mm_storeu_si128((__m128i *)(text + num), _mm_unpacklo_epi8(v, zero));
+                _mm_storeu_si128((__m128i *)(text + num + 8), _mm_unpackhi_epi8(v, zero));
+                pos += 16;
+                num += 16;
+                prev = text[num - 1];
+                continue;
+            }
+        }
+#endif
+
+        cur_byte = data[pos++];
+
+        if (cur_byte < 0x80) {
+            unicode = cur_byte;
+        }
+        else if (cur_byte < 0xC0) {
+            continue; // stray continuation byte
+        }
+        else if (cur_byte < 0xE0) {
+            if (pos + 1 > len)
+                break;
+            unicode = ((cur_byte & 0x1F) << 6) | (data[pos] & 0x3F);
+            pos += 1;
+        }
+        else if (cur_byte < 0xF0) {
+            if (pos + 2 > len)
+                break;
+            unicode = ((cur_byte & 0x0F) << 12) | ((data[pos] & 0x3F) << 6) | (data[pos + 1] & 0x3F);
+            pos += 2;
+            // Stream_Read_Wchar leaves the previous character in place for surrogates
+            if (unicode >= 0xD800 && unicode <= 0xDFFF)
+                unicode = prev;
+        }
+        else if (cur_byte < 0xF8) {
+            if (pos + 3 > len)
+                break;
+            unicode = L'_'; // outside the BMP
+            pos += 3;
+        }
+        else {
+            continue;
+        }
+
+        text[num++] = prev = (WCHAR)unicode;
+    }
+
+    return num;
+}
+
+//---------------------------------------------------------------------------
+// Ini_Find
+//---------------------------------------------------------------------------
+
+static ULONG Ini_Find(
+    IN  const WCHAR *text,
+    IN  ULONG pos,
+    IN  ULONG end,
+    IN  WCHAR c1,
+    IN  WCHAR c2,
+    IN  WCHAR c3)
+{
+#ifdef INI_USE_SSE2
+    const __m128i v1 = _mm_set1_epi16((short)c1);
+    const __m128i v2 = _mm_set1_epi16((short)c2);
+    const __m128i v3 = _mm_set1_epi16((short)c3);
+
+    for (; pos + 8 <= end; pos += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + pos));
+        __m128i m = _mm_or_si128(_mm_or_si128(
+            _mm_cmpeq_epi16(v, v1), _mm_cmpeq_epi16(v, v2)), _mm_cmpeq_epi16(v, v3));
+        ULONG mask = (ULONG)_mm_movemask_epi8(m);
+        if (mask) {
+            ULONG bit;
+            _BitScanForward(&bit, mask);
+            return pos + bit / 2;
+        }
+    }
+#endif
+
+    for (; pos < end; ++pos) {
+        WCHAR ch = text[pos];
+        if (ch == c1 || ch == c2 || ch == c3)
+            break;
+    }
+    return pos;
+}
+
+//---------------------------------------------------------------------------
+// Ini_Tokenize_Init
+//---------------------------------------------------------------------------
+
+void Ini_Tokenize_Init(
+    OUT INI_TOKENIZER *tk,
+    IN  const WCHAR *text,
+    IN  ULONG text_len,
+    IN  ULONG flags,
+    IN  ULONG max_line_len,
+    IN  ULONG max_lines)
+{
+    tk->text = text;
+    tk->text_len = text_len;
+    tk->pos = 0;
+    tk->line = 1;
+    tk->flags = flags;
+    tk->max_line_len = max_line_len;
+    tk->max_lines = max_lines;
+}
+
+//---------------------------------------------------------------------------
+// Ini_Tokenize
+//
+// fills up to *count tokens and returns STATUS_SUCCESS if there may be
+// more, STATUS_END_OF_FILE once the text is consumed, or on a limit error
+// the tokens found before it, with tk->line set to the offending line
+//---------------------------------------------------------------------------
+
+#define INI_IS_BLANK(ch) (strict ? (ch) <= 32 : ((ch) == L' ' || (ch) == L'\t'))
+
+NTSTATUS Ini_Tokenize(
+    IN  INI_TOKENIZER *tk,
+    OUT INI_TOKEN *tokens,
+    IN OUT ULONG *count)
+{
+    const WCHAR *text = tk->text;
+    const ULONG text_len = tk->text_len;
+    const BOOLEAN strict = (tk->flags & INI_TOKENIZE_STRICT) != 0;
+    NTSTATUS status = STATUS_SUCCESS;
+    ULONG pos = tk->pos;
+    ULONG num = 0;
+
+    while (num < *count) {
+
+        INI_TOKEN *token;
+        ULONG start, end, eol, sep, name_end;
+        WCHAR ch;
+
+        if (strict) {
+
+            //
+            // same rules as Conf_Read_Line: skip leading control and
+            // whitespace characters, a line ends at '\r' or '\n' and
+            // its content at the first null character
+            //
+
+            while (pos < text_len) {
+                ch = text[pos];
+                if (ch > 32 && ch < 0xFE00)
+                    break;
+                ++pos;
+                if (ch == L'\n') {
+                    ++tk->line;
+                    if (tk->max_lines && tk->line > tk->max_lines) {
+                        status = STATUS_TOO_MANY_COMMANDS;
+                        goto finish;
+                    }
+                }
+            }
+            if (pos >= text_len) {
+                status = STATUS_END_OF_FILE;
+                break;
+            }
+
+            start = pos;
+            end = Ini_Find(text, start, text_len, L'\r', L'\n', L'\0');
+            eol = end;
+            if (eol < text_len && text[eol] == L'\0')
+                eol = Ini_Find(text, eol, text_len, L'\r', L'\n', L'\r');
+
+            if (tk->max_line_len && eol - start >= tk->max_line_len) {
+                status = STATUS_BUFFER_OVERFLOW;
+                goto finish;
+            }
+
+            // the newline ending a line is not counted, as in Conf_Read_Line
+            pos = (eol < text_len) ? eol + 1 : eol;
+
+            while (end > start && text[end - 1] <= 32)
+                --end;
+
+            if (text[start] == L'#')
+                continue;
+
+        } else {
+
+            //
+            // same rules as the SbieSvc ini cache: only '\n' ends a line,
+            // all lines are kept so comments and formatting can be restored
+            //
+
+            if (pos >= text_len) {
+                status = STATUS_END_OF_FILE;
+                break;
+            }
+
+            start = pos;
+            eol = Ini_Find(text, start, text_len, L'\n', L'\n', L'\n');
+            pos = (eol < text_len) ? eol + 1 : eol;
+
+            while (start < eol && (text[start] == L' ' || text[start] == L'\t' || text[start] == L'\r'))
+                ++start;
+            end = eol;
+            while (end > start && (text[end - 1] == L' ' || text[end - 1] == L'\t' || text[end - 1] == L'\r'))
+                --end;
+        }
+
+        token = &tokens[num++];
+        token->type = INI_TOKEN_TEXT;
+        token->line = tk->line;
+        token->name_ofs = start;
+        token->name_len = 0;
+        token->value_ofs = start;
+        token->value_len = end - start;
+
+        if (! strict)
+            ++tk->line;
+
+        if (start == end || text[start] == L'#' || (strict && text[start] == L']'))
+            continue;
+
+        if (text[start] == L'[') {
+
+            sep = Ini_Find(text, start + 1, end, L']', L']', L']');
+            if (sep == end && strict)
+                continue;
+
+            token->type = INI_TOKEN_SECTION;
+            token->name_ofs = start + 1;
+            token->name_len = sep - (start + 1);
+            token->value_len = 0;
+            continue;
+        }
+
+        sep = Ini_Find(text, start, end, L'=', L'=', L'=');
+        if (sep == end)
+            continue;
+
+        token->type = INI_TOKEN_SETTING;
+
+        name_end = sep;
+        while (name_end > start && INI_IS_BLANK(text[name_end - 1]))
+            --name_end;
+        token->name_len = name_end - start;
+
+        ++sep;
+        while (sep < end && INI_IS_BLANK(text[sep]))
+            ++sep;
+        token->value_ofs = sep;
+        token->value_len = end - sep;
+    }
+
+finish:
+
+    tk->pos = pos;
+    *count = num;
+
+    return status;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Ini Buffer Tokenizer
+//---------------------------------------------------------------------------
+
+#ifndef _MY_INI_TOKEN_H
+#define _MY_INI_TOKEN_H
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+#define INI_TOKEN_SECTION       1   // [name]
+#define INI_TOKEN_SETTING       2   // name=value
+#define INI_TOKEN_TEXT          3   // comment, blank or malformed line
+
+// driver rules: '\r' ends a line too, control characters count as blanks,
+// comment and blank lines are dropped and the line limits are enforced
+
+#define INI_TOKENIZE_STRICT     0x0001
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+typedef struct INI_TOKEN {
+
+    ULONG type;
+    ULONG line;
+    ULONG name_ofs;         // section or setting name, empty for text
+    ULONG name_len;
+    ULONG value_ofs;        // setting value, or the whole text line
+    ULONG value_len;
+
+} INI_TOKEN;
+
+typedef struct INI_TOKENIZER {
+
+    const WCHAR *text;
+    ULONG text_len;
+    ULONG pos;
+    ULONG line;
+    ULONG flags;
+    ULONG max_line_len;
+    ULONG max_lines;
+
+} INI_TOKENIZER;
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+ULONG Ini_Decode(
+    IN  const UCHAR *data,
+    IN  ULONG len,
+    IN  ULONG encoding,
+    OUT WCHAR *text);
+
+void Ini_Tokenize_Init(
+    OUT INI_TOKENIZER *tk,
+    IN  const WCHAR *text,
+    IN  ULONG text_len,
+    IN  ULONG flags,
+    IN  ULONG max_line_len,
+    IN  ULONG max_lines);
+
+NTSTATUS Ini_Tokenize(
+    IN  INI_TOKENIZER *tk,
+    OUT INI_TOKEN *tokens,
+    IN OUT ULONG *count);
+
+//---------------------------------------------------------------------------
+
+#endif // _MY_INI_TOKEN_H
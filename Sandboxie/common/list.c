@@ -35,6 +35,7 @@ void List_Init(LIST *list)
    list->head = NULL;
    list->tail = NULL;
    list->count = 0;
+   list->generation = 0;
 #ifdef LIST_WITH_MEMORY_MANAGEMENT
    list->pool = pool;
    list->elem_len = elemlen;
@@ -53,6 +54,7 @@ void List_Insert_Before(LIST *list, void *oldelem, void *newelem)
     curr = (LIST_ELEM *)oldelem;
     nelm = (LIST_ELEM *)newelem;
     ++list->count;
+    ++list->generation;
 
     if (curr == list->head || curr == NULL) {     /* Insert head elem */
       next = list->head;
@@ -84,6 +86,7 @@ void List_Insert_After(LIST *list, void *elem, void *newelem)
     curr = (LIST_ELEM *)elem;
     nelm = (LIST_ELEM *)newelem;
     ++list->count;
+    ++list->generation;
 
     if (curr == list->tail || curr == NULL) {     /* Insert tail elem */
       prev = list->tail;
@@ -116,6 +119,7 @@ void List_Remove(LIST *list, void *elem)
     prev = curr->prev;
     next = curr->next;
     --list->count;
+    ++list->generation;
 
     if (prev == NULL && next == NULL) {         /* Last elem in list? */
         list->tail = NULL;
@@ -43,6 +43,7 @@ typedef struct {
     LIST_ELEM *head;
     LIST_ELEM *tail;
     int count;
+    unsigned int generation;    // changes with every insert and remove
 #ifdef LIST_WITH_MEMORY_MANAGEMENT
     POOL *pool;
     int elem_len;
@@ -52,7 +52,7 @@ VOID* map_alloc(void* pool, size_t size)
 VOID map_free(void* pool, void* ptr)
 {
     size_t* base = (size_t*)ptr;
-    size_t size = *--base;
+    size_t size = sizeof(size_t) + *--base;
 #ifdef KERNEL_MODE
     Mem_Free(base, size);
 #else
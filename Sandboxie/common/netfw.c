@@ -437,6 +437,429 @@ BOOLEAN NetFw_BlockTraffic(LIST* list, IP_ADDRESS* Ip, USHORT Port, int Protocol
 	return FALSE;
 }
 
+// Compiled rule table
+
+//
+// The rule list is flattened into elementary port and address intervals, within 
+// each of them every rule matches on the same level, so the best match can be 
+// decided once per interval. For each protocol class and port interval the verdict 
+// over the address space is a step function, stored as the sorted addresses where 
+// it changes, port intervals sharing the same step function are merged.
+//
+
+#define NETFW_PROT_CLASSES		4			// TCP, UDP, ICMP, other
+#define NETFW_PROT_OTHER		255			// not used by any rule, only matches IPPROTO_ANY
+
+//
+// Rule sets above either limit stay with NetFw_BlockTraffic, the cell count bounds 
+// the time to compile, the byte budget bounds the table and each buffer used to 
+// build it, as every sandboxed process compiles its own copy.
+//
+
+#define NETFW_MAX_CELLS			0x00400000	// protocol classes * port intervals * address intervals
+#define NETFW_MAX_BYTES			0x00100000
+
+typedef struct _NETFW_PORT_SEG
+{
+	USHORT PortBegin;
+	ULONG StepFirst;
+	ULONG StepCount;
+} NETFW_PORT_SEG;
+
+typedef struct _NETFW_IP_STEP
+{
+	IP_ADDRESS IpBegin;
+	BOOLEAN BlockAction;
+} NETFW_IP_STEP;
+
+struct _NETFW_TABLE
+{
+	POOL* pool;
+	ULONG alloc_size;
+
+	ULONG port_first[NETFW_PROT_CLASSES];
+	ULONG port_count[NETFW_PROT_CLASSES];
+
+	NETFW_PORT_SEG* ports;
+	NETFW_IP_STEP* steps;
+};
+
+static void* NetFw_Alloc(POOL* pool, ULONG size)
+{
+#ifdef KERNEL_MODE
+#if (NTDDI_VERSION >= NTDDI_WIN10_VB)
+	return ExAllocatePool2(POOL_FLAG_NON_PAGED, size, tzuk);
+#else
+	return ExAllocatePoolWithTag(NonPagedPool, size, tzuk);
+#endif
+#else
+	return Pool_Alloc(pool, size);
+#endif
+}
+
+static void NetFw_Free(POOL* pool, void* ptr, ULONG size)
+{
+	if (!ptr)
+		return;
+#ifdef KERNEL_MODE
+	ExFreePoolWithTag(ptr, tzuk);
+#else
+	Pool_Free(ptr, size);
+#endif
+}
+
+static int NetFw_ProtClass(int Protocol)
+{
+	switch (Protocol) {
+	case IPPROTO_TCP:	return 0;
+	case IPPROTO_UDP:	return 1;
+	case IPPROTO_ICMP:	return 2;
+	default:			return 3;
+	}
+}
+
+static void NetFw_SiftDown(UCHAR* data, ULONG root, ULONG count, ULONG size, int (*cmp)(const void*, const void*))
+{
+	UCHAR tmp[sizeof(IP_ADDRESS)];
+
+	for (ULONG child; (child = root * 2 + 1) < count; root = child) {
+		if (child + 1 < count && cmp(data + (ULONG_PTR)child * size, data + (ULONG_PTR)(child + 1) * size) < 0)
+			child++;
+		if (cmp(data + (ULONG_PTR)root * size, data + (ULONG_PTR)child * size) >= 0)
+			break;
+		memcpy(tmp, data + (ULONG_PTR)root * size, size);
+		memcpy(data + (ULONG_PTR)root * size, data + (ULONG_PTR)child * size, size);
+		memcpy(data + (ULONG_PTR)child * size, tmp, size);
+	}
+}
+
+static void NetFw_Sort(void* base, ULONG count, ULONG size, int (*cmp)(const void*, const void*))
+{
+	//
+	// in place heap sort, no recursion and no extra memory, size must be <= sizeof(IP_ADDRESS)
+	//
+
+	UCHAR* data = (UCHAR*)base;
+	UCHAR tmp[sizeof(IP_ADDRESS)];
+
+	for (ULONG start = count / 2; start-- > 0; )
+		NetFw_SiftDown(data, start, count, size, cmp);
+
+	for (ULONG end = count; end-- > 1; ) {
+		memcpy(tmp, data, size);
+		memcpy(data, data + (ULONG_PTR)end * size, size);
+		memcpy(data + (ULONG_PTR)end * size, tmp, size);
+		NetFw_SiftDown(data, 0, end, size, cmp);
+	}
+}
+
+static ULONG NetFw_Unique(void* base, ULONG count, ULONG size, int (*cmp)(const void*, const void*))
+{
+	UCHAR* data = (UCHAR*)base;
+	ULONG num = count ? 1 : 0;
+	for (ULONG i = 1; i < count; i++) {
+		if (cmp(data + (ULONG_PTR)(num - 1) * size, data + (ULONG_PTR)i * size) != 0) {
+			if (num != i)
+				memcpy(data + (ULONG_PTR)num * size, data + (ULONG_PTR)i * size, size);
+			num++;
+		}
+	}
+	return num;
+}
+
+static BOOLEAN NetFw_IpIncrement(IP_ADDRESS* ip)
+{
+	for (int i = 15; i >= 0; i--) {
+		if (++ip->Data[i] != 0)
+			return TRUE;
+	}
+	return FALSE; // wrapped around
+}
+
+static ULONG NetFw_FindIpSeg(IP_ADDRESS* bounds, ULONG count, IP_ADDRESS* ip)
+{
+	// index of the last bound <= ip, bounds[0] is always the zero address
+	ULONG lo = 0, hi = count;
+	while (hi - lo > 1) {
+		ULONG mid = (lo + hi) / 2;
+		if (NetFw_IpCmp(&bounds[mid], ip) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static BOOLEAN NetFw_AppendSteps(POOL* pool, NETFW_IP_STEP** steps, ULONG* steps_max, ULONG count)
+{
+	if (count <= *steps_max)
+		return TRUE;
+
+	if ((ULONG64)count * sizeof(NETFW_IP_STEP) > NETFW_MAX_BYTES)
+		return FALSE;
+
+	ULONG new_max = *steps_max ? *steps_max : 64;
+	while (new_max < count)
+		new_max *= 2;
+	if (new_max > NETFW_MAX_BYTES / sizeof(NETFW_IP_STEP))
+		new_max = NETFW_MAX_BYTES / sizeof(NETFW_IP_STEP);
+
+	NETFW_IP_STEP* new_steps = NetFw_Alloc(pool, new_max * sizeof(NETFW_IP_STEP));
+	if (!new_steps)
+		return FALSE;
+	if (*steps) {
+		memcpy(new_steps, *steps, *steps_max * sizeof(NETFW_IP_STEP));
+		NetFw_Free(pool, *steps, *steps_max * sizeof(NETFW_IP_STEP));
+	}
+	*steps = new_steps;
+	*steps_max = new_max;
+	return TRUE;
+}
+
+typedef struct _NETFW_CELL
+{
+	RULE_MATCH Match;
+	BOOLEAN Matched;
+} NETFW_CELL;
+
+NETFW_TABLE* NetFw_CompileRules(LIST* list, POOL* pool)
+{
+	NETFW_TABLE* table = NULL;
+
+	USHORT* port_bounds = NULL;
+	IP_ADDRESS* ip_bounds = NULL;
+	NETFW_RULE** cands = NULL;
+	NETFW_CELL* cells = NULL;
+	NETFW_PORT_SEG* segs = NULL;
+	NETFW_IP_STEP* steps = NULL;
+	ULONG steps_max = 0, steps_num = 0, segs_num = 0;
+	ULONG port_first[NETFW_PROT_CLASSES], port_count[NETFW_PROT_CLASSES];
+
+	//
+	// collect the interval boundaries of all rules
+	//
+
+	ULONG rule_count = 0, port_max = 1, ip_max = 1;
+	ULONG port_num = 0, ip_num = 0;
+	for (NETFW_RULE* rule = List_Head(list); rule; rule = List_Next(rule)) {
+		rule_count++;
+		port_max += rule->port_map.count * 2;
+		ip_max += rule->ip_map.count * 2;
+	}
+	if (rule_count == 0)
+		return NULL;
+
+	port_bounds = NetFw_Alloc(pool, port_max * sizeof(USHORT));
+	ip_bounds = NetFw_Alloc(pool, ip_max * sizeof(IP_ADDRESS));
+	cands = NetFw_Alloc(pool, rule_count * sizeof(NETFW_RULE*));
+	if (!port_bounds || !ip_bounds || !cands)
+		goto finish;
+
+	port_bounds[port_num++] = 0;
+	memzero(&ip_bounds[ip_num++], sizeof(IP_ADDRESS));
+
+	for (NETFW_RULE* rule = List_Head(list); rule; rule = List_Next(rule)) {
+
+		for (NETFW_PORTS* node = (NETFW_PORTS*)rbtree_first(&rule->port_map); ((rbnode_t*)node) != RBTREE_NULL; node = (NETFW_PORTS*)rbtree_next((rbnode_t*)node)) {
+			port_bounds[port_num++] = node->RangeBegin;
+			if (node->RangeEnd != 0xFFFF)
+				port_bounds[port_num++] = node->RangeEnd + 1;
+		}
+
+		for (NETFW_IPS* node = (NETFW_IPS*)rbtree_first(&rule->ip_map); ((rbnode_t*)node) != RBTREE_NULL; node = (NETFW_IPS*)rbtree_next((rbnode_t*)node)) {
+			ip_bounds[ip_num] = node->RangeBegin;
+			ip_num++;
+			ip_bounds[ip_num] = node->RangeEnd;
+			if (NetFw_IpIncrement(&ip_bounds[ip_num]))
+				ip_num++;
+		}
+	}
+
+	NetFw_Sort(port_bounds, port_num, sizeof(USHORT), NetFw_PortCmp);
+	port_num = NetFw_Unique(port_bounds, port_num, sizeof(USHORT), NetFw_PortCmp);
+	NetFw_Sort(ip_bounds, ip_num, sizeof(IP_ADDRESS), NetFw_IpCmp);
+	ip_num = NetFw_Unique(ip_bounds, ip_num, sizeof(IP_ADDRESS), NetFw_IpCmp);
+
+	if ((ULONG64)NETFW_PROT_CLASSES * port_num * ip_num > NETFW_MAX_CELLS)
+		goto finish;
+	if ((ULONG64)NETFW_PROT_CLASSES * port_num * sizeof(NETFW_PORT_SEG) > NETFW_MAX_BYTES || (ULONG64)ip_num * sizeof(NETFW_CELL) > NETFW_MAX_BYTES)
+		goto finish;
+
+	cells = NetFw_Alloc(pool, ip_num * sizeof(NETFW_CELL));
+	segs = NetFw_Alloc(pool, NETFW_PROT_CLASSES * port_num * sizeof(NETFW_PORT_SEG));
+	if (!cells || !segs)
+		goto finish;
+
+	for (int prot_class = 0; prot_class < NETFW_PROT_CLASSES; prot_class++) {
+
+		static const int prot_reps[NETFW_PROT_CLASSES] = { IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP, NETFW_PROT_OTHER };
+		int prot = prot_reps[prot_class];
+
+		port_first[prot_class] = segs_num;
+
+		for (ULONG port_seg = 0; port_seg < port_num; port_seg++) {
+
+			USHORT port = port_bounds[port_seg];
+
+			//
+			// rules without addresses match the same way across the whole 
+			// address space, the best of them is the baseline for every cell
+			//
+
+			ULONG cands_num = 0;
+			NETFW_CELL base = { 0 };
+
+			for (NETFW_RULE* rule = List_Head(list); rule; rule = List_Next(rule)) {
+
+				if (!NetFw_MatchPort(&rule->port_map, port) || !NetFw_MatchProtocol(rule->protocol, prot))
+					continue;
+
+				if (rule->ip_map.count != 0) {
+					cands[cands_num++] = rule;
+					continue;
+				}
+
+				RULE_MATCH match = { 0 };
+				if (NetFw_MatchRule(rule, port, &ip_bounds[0], prot, &match)) {
+					if (!base.Matched || NetFw_IsBetterMatch(&match, &base.Match)) {
+						base.Match = match;
+						base.Matched = TRUE;
+					}
+				}
+			}
+
+			for (ULONG i = 0; i < ip_num; i++)
+				cells[i] = base;
+
+			for (ULONG j = 0; j < cands_num; j++) {
+
+				NETFW_RULE* rule = cands[j];
+
+				for (NETFW_IPS* node = (NETFW_IPS*)rbtree_first(&rule->ip_map); ((rbnode_t*)node) != RBTREE_NULL; node = (NETFW_IPS*)rbtree_next((rbnode_t*)node)) {
+
+					ULONG first = NetFw_FindIpSeg(ip_bounds, ip_num, &node->RangeBegin);
+					ULONG last = NetFw_FindIpSeg(ip_bounds, ip_num, &node->RangeEnd);
+
+					for (ULONG i = first; i <= last; i++) {
+
+						RULE_MATCH match = { 0 };
+						if (!NetFw_MatchRule(rule, port, &ip_bounds[i], prot, &match))
+							continue; // overlapping ranges within one rule, let the rule decide
+						if (!cells[i].Matched || NetFw_IsBetterMatch(&match, &cells[i].Match)) {
+							cells[i].Match = match;
+							cells[i].Matched = TRUE;
+						}
+					}
+				}
+			}
+
+			//
+			// emit the step function, cells without any match are allowed
+			//
+
+			ULONG row_first = steps_num;
+			for (ULONG i = 0; i < ip_num; i++) {
+				BOOLEAN block = cells[i].Matched ? cells[i].Match.BlockAction : FALSE;
+				if (i > 0 && steps[steps_num - 1].BlockAction == block)
+					continue;
+				if (!NetFw_AppendSteps(pool, &steps, &steps_max, steps_num + 1))
+					goto finish;
+				steps[steps_num].IpBegin = ip_bounds[i];
+				steps[steps_num].BlockAction = block;
+				steps_num++;
+			}
+			ULONG row_count = steps_num - row_first;
+
+			if (segs_num > port_first[prot_class]) {
+				NETFW_PORT_SEG* prev = &segs[segs_num - 1];
+				ULONG i = 0;
+				if (prev->StepCount == row_count) {
+					for (; i < row_count; i++) {
+						NETFW_IP_STEP* l = &steps[prev->StepFirst + i];
+						NETFW_IP_STEP* r = &steps[row_first + i];
+						if (l->BlockAction != r->BlockAction || NetFw_IpCmp(&l->IpBegin, &r->IpBegin) != 0)
+							break;
+					}
+				}
+				if (i == row_count) {
+					steps_num = row_first; // same as the previous port interval, extend it
+					continue;
+				}
+			}
+
+			segs[segs_num].PortBegin = port;
+			segs[segs_num].StepFirst = row_first;
+			segs[segs_num].StepCount = row_count;
+			segs_num++;
+		}
+
+		port_count[prot_class] = segs_num - port_first[prot_class];
+	}
+
+	//
+	// pack everything into one allocation
+	//
+
+	ULONG alloc_size = sizeof(NETFW_TABLE) + segs_num * sizeof(NETFW_PORT_SEG) + steps_num * sizeof(NETFW_IP_STEP);
+	table = NetFw_Alloc(pool, alloc_size);
+	if (!table)
+		goto finish;
+
+	table->pool = pool;
+	table->alloc_size = alloc_size;
+	memcpy(table->port_first, port_first, sizeof(port_first));
+	memcpy(table->port_count, port_count, sizeof(port_count));
+	table->steps = (NETFW_IP_STEP*)(table + 1);
+	table->ports = (NETFW_PORT_SEG*)(table->steps + steps_num);
+	memcpy(table->steps, steps, steps_num * sizeof(NETFW_IP_STEP));
+	memcpy(table->ports, segs, segs_num * sizeof(NETFW_PORT_SEG));
+
+finish:
+	NetFw_Free(pool, port_bounds, port_max * sizeof(USHORT));
+	NetFw_Free(pool, ip_bounds, ip_max * sizeof(IP_ADDRESS));
+	NetFw_Free(pool, cands, rule_count * sizeof(NETFW_RULE*));
+	NetFw_Free(pool, cells, ip_num * sizeof(NETFW_CELL));
+	NetFw_Free(pool, segs, NETFW_PROT_CLASSES * port_num * sizeof(NETFW_PORT_SEG));
+	NetFw_Free(pool, steps, steps_max * sizeof(NETFW_IP_STEP));
+	return table;
+}
+
+void NetFw_FreeTable(NETFW_TABLE* table)
+{
+	NetFw_Free(table->pool, table, table->alloc_size);
+}
+
+BOOLEAN NetFw_LookupTable(NETFW_TABLE* table, IP_ADDRESS* Ip, USHORT Port, int Protocol)
+{
+	int prot_class = NetFw_ProtClass(Protocol);
+	NETFW_PORT_SEG* ports = table->ports + table->port_first[prot_class];
+
+	// the last interval starting at or below the port, the first one always starts at 0
+	ULONG lo = 0, hi = table->port_count[prot_class];
+	while (hi - lo > 1) {
+		ULONG mid = (lo + hi) / 2;
+		if (ports[mid].PortBegin <= Port)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	NETFW_IP_STEP* steps = table->steps + ports[lo].StepFirst;
+
+	// same for the address, the first step always starts at the zero address
+	hi = ports[lo].StepCount;
+	lo = 0;
+	while (hi - lo > 1) {
+		ULONG mid = (lo + hi) / 2;
+		if (NetFw_IpCmp(&steps[mid].IpBegin, Ip) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return steps[lo].BlockAction;
+}
+
 // text helpers
 
 const WCHAR* wcsnchr(const WCHAR* str, size_t max, WCHAR ch)
@@ -6,6 +6,8 @@
 
 typedef struct _NETFW_RULE NETFW_RULE;
 
+typedef struct _NETFW_TABLE NETFW_TABLE;
+
 
 typedef struct _IP_ADDRESS
 {
@@ -27,6 +29,12 @@ BOOLEAN NetFw_ParseRule(NETFW_RULE* rule, const WCHAR* RuleStr);
 
 void NetFw_FreeRule(NETFW_RULE* rule);
 
+NETFW_TABLE* NetFw_CompileRules(LIST* list, POOL* pool);
+
+BOOLEAN NetFw_LookupTable(NETFW_TABLE* table, IP_ADDRESS* Ip, USHORT Port, int Protocol);
+
+void NetFw_FreeTable(NETFW_TABLE* table);
+
 
 int _wntoi(const WCHAR* str, ULONG max);
 int _inet_pton(int af, const wchar_t* src, void* dst);
@@ -25,11 +25,28 @@
 #include "common/list.h"
 
 
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#ifdef KERNEL_MODE
+#define PATTERN_INDEX_MAX_CANDIDATES    32
+#else
+#define PATTERN_INDEX_MAX_CANDIDATES    128
+#endif
+
+
 //---------------------------------------------------------------------------
 // Structures and Types
 //---------------------------------------------------------------------------
 
 
+typedef struct _PATTERN_INDEX PATTERN_INDEX;
+typedef struct _PATTERN_INDEX_NODE PATTERN_INDEX_NODE;
+typedef struct _PATTERN_INDEX_LEAF PATTERN_INDEX_LEAF;
+
+
 struct _PATTERN {
 
     // unused list_elem can be used by caller
@@ -61,6 +78,10 @@ struct _PATTERN {
     // optional auxiliary data to be associated with this pattern
     PVOID aux;
 
+    // compiled index for the list which begins with this pattern,
+    // see Pattern_CreateIndex
+    PATTERN_INDEX *index;
+
     // array of pointers to constant parts.  the actual number of
     // elements is indicate by info.num_cons, and the strings are
     // allocated as part of this PATTERN object
@@ -74,6 +95,54 @@ struct _PATTERN {
 };
 
 
+struct _PATTERN_INDEX_LEAF {
+
+    PATTERN_INDEX_LEAF *next;
+    PATTERN *pat;
+
+    // position of the pattern in the list
+    ULONG ordinal;
+
+};
+
+
+struct _PATTERN_INDEX_NODE {
+
+    PATTERN_INDEX_NODE *child;
+    PATTERN_INDEX_NODE *sibling;
+
+    // patterns whose literal prefix ends at this node
+    PATTERN_INDEX_LEAF *leaves;
+
+    // edge label, points into the constant part of some pattern
+    const WCHAR *label;
+    ULONG label_len;
+
+};
+
+
+struct _PATTERN_INDEX {
+
+    // length of the entire PATTERN_INDEX object
+    ULONG length;
+
+    // generation of the list at the time the index was created,
+    // the index is ignored once the list was modified
+    unsigned int generation;
+
+    // patterns which have no literal prefix, in list order
+    PATTERN_INDEX_LEAF *floating;
+
+    // radix tree over the literal prefixes of all other patterns
+    PATTERN_INDEX_NODE root;
+
+    ULONG num_nodes;
+    PATTERN_INDEX_NODE *nodes;
+    PATTERN_INDEX_LEAF *leaves;
+
+};
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -107,6 +176,20 @@ static const WCHAR *Pattern_wcsnstr(
 static const WCHAR *Pattern_wcsnstr_ex(
     const WCHAR *hstr, const WCHAR *nstr, int nlen, int no_bs);
 
+static ULONG Pattern_LiteralPrefix(PATTERN *pat);
+
+static void Pattern_IndexInsert(
+    PATTERN_INDEX *index, PATTERN_INDEX_LEAF *leaf,
+    const WCHAR *key, ULONG key_len);
+
+static int Pattern_IndexLookup(
+    PATTERN_INDEX *index, const WCHAR *path, ULONG path_len,
+    PATTERN_INDEX_LEAF **cands);
+
+static BOOLEAN Pattern_MatchPathListStep(
+    PATTERN *pat, WCHAR *path_lwr, ULONG path_len, int *match_len,
+    ULONG *level, ULONG *flags, USHORT *wildc, PATTERN **found);
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -253,6 +336,8 @@ _FX PATTERN *Pattern_Create(
 
     pat->aux = NULL;
 
+    pat->index = NULL;
+
     pat->info.v = 0;
     pat->info.num_cons = (USHORT)num_cons;
 
@@ -287,6 +372,8 @@ _FX PATTERN *Pattern_Create(
 
 _FX void Pattern_Free(PATTERN *pat)
 {
+    if (pat->index)
+        Pool_Free(pat->index, pat->index->length);
     Pool_Free(pat, pat->length);
 }
 
@@ -665,6 +752,309 @@ _FX const WCHAR *Pattern_wcsnstr_ex(
 }
 
 
+//---------------------------------------------------------------------------
+// Pattern_LiteralPrefix
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Pattern_LiteralPrefix(PATTERN *pat)
+{
+    const WCHAR *ptr, *hex;
+    ULONG len, i;
+
+    //
+    // a pattern which does not begin with a star can only match a string
+    // that begins with the first constant part, up to the first question
+    // mark or __hex__ sequence, see Pattern_MatchX and Pattern_Match3
+    //
+
+    if (pat->info.num_cons == 0 || pat->info.f.star_at_head)
+        return 0;
+
+    ptr = pat->cons[0].ptr;
+    len = pat->cons[0].len;
+
+    if (pat->cons[0].hex) {
+        hex = Pattern_wcsnstr(ptr, Pattern_Hex, 5);
+        if (hex)
+            len = (ULONG)(hex - ptr);
+    }
+
+    for (i = 0; i < len; ++i) {
+        if (ptr[i] == L'?')
+            break;
+    }
+
+    return i;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_CreateIndex
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Pattern_CreateIndex(POOL *pool, LIST *list)
+{
+    PATTERN_INDEX *index;
+    PATTERN_INDEX_LEAF *leaf;
+    PATTERN *pat;
+    ULONG len_idx;
+    ULONG ordinal;
+    ULONG prefix_len;
+
+    pat = (PATTERN*)List_Head(list);
+    if (! pat)
+        return FALSE;
+
+    if (pat->index) {
+        Pool_Free(pat->index, pat->index->length);
+        pat->index = NULL;
+    }
+
+    //
+    // every insert into the radix tree adds at most two nodes,
+    // one for the new edge and one when an existing edge is split
+    //
+
+    len_idx = sizeof(PATTERN_INDEX)
+            + List_Count(list) * 2 * sizeof(PATTERN_INDEX_NODE)
+            + List_Count(list) * sizeof(PATTERN_INDEX_LEAF);
+
+    index = (PATTERN_INDEX*)Pool_Alloc(pool, len_idx);
+    if (! index)
+        return FALSE;
+
+    memzero(index, len_idx);
+    index->length = len_idx;
+    index->generation = list->generation;
+    index->nodes = (PATTERN_INDEX_NODE *)(index + 1);
+    index->leaves = (PATTERN_INDEX_LEAF *)(index->nodes + List_Count(list) * 2);
+
+    //
+    // walk the list backwards so that prepending to the leaf lists
+    // leaves each of them sorted by position in the list
+    //
+
+    ordinal = List_Count(list);
+    pat = (PATTERN*)List_Tail(list);
+    while (pat) {
+
+        --ordinal;
+        leaf = &index->leaves[ordinal];
+        leaf->pat = pat;
+        leaf->ordinal = ordinal;
+
+        prefix_len = Pattern_LiteralPrefix(pat);
+        if (prefix_len)
+            Pattern_IndexInsert(index, leaf, pat->cons[0].ptr, prefix_len);
+        else {
+            leaf->next = index->floating;
+            index->floating = leaf;
+        }
+
+        pat = (PATTERN*)List_Prev(pat);
+    }
+
+    ((PATTERN*)List_Head(list))->index = index;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_IndexInsert
+//---------------------------------------------------------------------------
+
+
+_FX void Pattern_IndexInsert(
+    PATTERN_INDEX *index, PATTERN_INDEX_LEAF *leaf,
+    const WCHAR *key, ULONG key_len)
+{
+    PATTERN_INDEX_NODE *node = &index->root;
+    PATTERN_INDEX_NODE *child, *split, **link;
+    ULONG common;
+
+    while (key_len) {
+
+        link = &node->child;
+        while (*link && (*link)->label[0] != *key)
+            link = &(*link)->sibling;
+        child = *link;
+
+        if (! child) {
+
+            child = &index->nodes[index->num_nodes++];
+            child->label = key;
+            child->label_len = key_len;
+            *link = child;
+
+            node = child;
+            break;
+        }
+
+        for (common = 1; common < child->label_len && common < key_len; ++common) {
+            if (child->label[common] != key[common])
+                break;
+        }
+
+        if (common < child->label_len) {
+
+            //
+            // split the edge at the first differing character
+            //
+
+            split = &index->nodes[index->num_nodes++];
+            split->label = child->label;
+            split->label_len = common;
+            split->sibling = child->sibling;
+            split->child = child;
+
+            child->sibling = NULL;
+            child->label += common;
+            child->label_len -= common;
+
+            *link = split;
+            child = split;
+        }
+
+        node = child;
+        key += common;
+        key_len -= common;
+    }
+
+    leaf->next = node->leaves;
+    node->leaves = leaf;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_IndexLookup
+//---------------------------------------------------------------------------
+
+
+_FX int Pattern_IndexLookup(
+    PATTERN_INDEX *index, const WCHAR *path, ULONG path_len,
+    PATTERN_INDEX_LEAF **cands)
+{
+    PATTERN_INDEX_NODE *node, *child;
+    PATTERN_INDEX_LEAF *leaf;
+    ULONG text_len, pos, i;
+    int num_cands, j;
+
+    //
+    // Pattern_MatchPathListStep also tries the path with a suffixing
+    // backslash, so walk the tree as if that backslash was present
+    //
+
+#define PATH_CHAR(i) ((i) < path_len ? path[i] : L'\\')
+
+    text_len = path_len;
+    if (path_len && path[path_len - 1] != L'\\')
+        ++text_len;
+
+    num_cands = 0;
+    node = &index->root;
+    pos = 0;
+
+    while (1) {
+
+        for (leaf = node->leaves; leaf; leaf = leaf->next) {
+
+            if (num_cands == PATTERN_INDEX_MAX_CANDIDATES)
+                return -1;
+
+            for (j = num_cands; j > 0 && cands[j - 1]->ordinal > leaf->ordinal; --j)
+                cands[j] = cands[j - 1];
+            cands[j] = leaf;
+            ++num_cands;
+        }
+
+        if (pos >= text_len)
+            break;
+
+        for (child = node->child; child; child = child->sibling) {
+            if (child->label[0] == PATH_CHAR(pos))
+                break;
+        }
+
+        if ((! child) || child->label_len > text_len - pos)
+            break;
+
+        for (i = 1; i < child->label_len; ++i) {
+            if (child->label[i] != PATH_CHAR(pos + i))
+                break;
+        }
+
+        if (i < child->label_len)
+            break;
+
+        node = child;
+        pos += child->label_len;
+    }
+
+#undef PATH_CHAR
+
+    return num_cands;
+}
+
+
+//---------------------------------------------------------------------------
+// Pattern_MatchPathListStep
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Pattern_MatchPathListStep(
+    PATTERN *pat, WCHAR *path_lwr, ULONG path_len, int *match_len,
+    ULONG *level, ULONG *flags, USHORT *wildc, PATTERN **found)
+{
+    ULONG cur_level = Pattern_Level(pat);
+    if (cur_level > *level)
+        return FALSE; // no point testing patterns with a to weak level
+
+    BOOLEAN cur_exact = Pattern_Exact(pat);
+    if (!cur_exact && (*flags & MATCH_FLAG_EXACT))
+        return FALSE;
+
+    USHORT cur_wildc = Pattern_Wildcards(pat);
+
+    int cur_len = Pattern_MatchX(pat, path_lwr, path_len);
+    if (cur_len > *match_len) {
+        *match_len = cur_len;
+        *level = cur_level;
+        *flags = cur_exact ? MATCH_FLAG_EXACT : 0;
+        *wildc = cur_wildc;
+        if (found) *found = pat;
+
+        // we need to test all entries to find the best match, so we don't break here
+        // unless we found an exact match, than there can't be a batter one
+        if (cur_exact)
+            return TRUE;
+    }
+
+    //
+    // if we have a pattern like C:\Windows\,
+    // we still want it to match a path like C:\Windows,
+    // hence we add a L'\\' to the path and check again
+    //
+
+    else if (path_lwr[path_len - 1] != L'\\') { 
+        path_lwr[path_len] = L'\\';
+        cur_len = Pattern_MatchX(pat, path_lwr, path_len + 1);
+        path_lwr[path_len] = L'\0';
+        if (cur_len > *match_len) {
+            *match_len = cur_len;
+            *level = cur_level;
+            *flags = MATCH_FLAG_AUX | (cur_exact ? MATCH_FLAG_EXACT : 0);
+            *wildc = cur_wildc;
+            if (found) *found = pat;
+        }
+    }
+
+    return FALSE;
+}
+
+
 //---------------------------------------------------------------------------
 // Pattern_MatchPathList
 //---------------------------------------------------------------------------
@@ -674,61 +1064,60 @@ _FX int Pattern_MatchPathList(
     WCHAR *path_lwr, ULONG path_len, LIST *list, ULONG* plevel, ULONG* pflags, USHORT* pwildc, PATTERN **found)
 {
     PATTERN *pat;
+    PATTERN_INDEX *index;
     int match_len = 0;
     ULONG level = plevel ? *plevel : -1; // lower is better, 3 is max value
     ULONG flags = pflags ? *pflags : 0;
     USHORT wildc = pwildc ? *pwildc : -1; // lower is better
 
     pat = (PATTERN*)List_Head(list);
-    while (pat) {
 
-        ULONG cur_level = Pattern_Level(pat);
-        if (cur_level > level)
-            goto next; // no point testing patterns with a to weak level
+    //
+    // if the list was compiled with Pattern_CreateIndex, only test the
+    // patterns which can possibly match, in the same order as they
+    // appear in the list, so the result is the same as a full scan
+    //
 
-        BOOLEAN cur_exact = Pattern_Exact(pat);
-        if (!cur_exact && (flags & MATCH_FLAG_EXACT))
-            goto next;
+    index = pat ? pat->index : NULL;
+    if (index && index->generation == list->generation) {
 
-        USHORT cur_wildc = Pattern_Wildcards(pat);
+        PATTERN_INDEX_LEAF *cands[PATTERN_INDEX_MAX_CANDIDATES];
+        PATTERN_INDEX_LEAF *floating = index->floating;
+        int num_cands, i = 0;
 
-        int cur_len = Pattern_MatchX(pat, path_lwr, path_len);
-        if (cur_len > match_len) {
-            match_len = cur_len;
-            level = cur_level;
-            flags = cur_exact ? MATCH_FLAG_EXACT : 0;
-            wildc = cur_wildc;
-            if (found) *found = pat;
-            
-            // we need to test all entries to find the best match, so we don't break here
-            // unless we found an exact match, than there can't be a batter one
-            if (cur_exact)
-                break;
-        }
+        num_cands = Pattern_IndexLookup(index, path_lwr, path_len, cands);
+        if (num_cands >= 0) {
 
-        //
-        // if we have a pattern like C:\Windows\,
-        // we still want it to match a path like C:\Windows,
-        // hence we add a L'\\' to the path and check again
-        //
+            while (1) {
+
+                if (floating && (i == num_cands || floating->ordinal < cands[i]->ordinal)) {
+                    pat = floating->pat;
+                    floating = floating->next;
+                } else if (i < num_cands)
+                    pat = cands[i++]->pat;
+                else
+                    break;
 
-        else if (path_lwr[path_len - 1] != L'\\') { 
-            path_lwr[path_len] = L'\\';
-            cur_len = Pattern_MatchX(pat, path_lwr, path_len + 1);
-            path_lwr[path_len] = L'\0';
-            if (cur_len > match_len) {
-                match_len = cur_len;
-                level = cur_level;
-                flags = MATCH_FLAG_AUX | (cur_exact ? MATCH_FLAG_EXACT : 0);
-                wildc = cur_wildc;
-                if (found) *found = pat;
+                if (Pattern_MatchPathListStep(pat, path_lwr, path_len, &match_len, &level, &flags, &wildc, found))
+                    break;
             }
+
+            goto finish;
         }
 
-    next:
+        // too many candidates, fall back to a full scan
+    }
+
+    while (pat) {
+
+        if (Pattern_MatchPathListStep(pat, path_lwr, path_len, &match_len, &level, &flags, &wildc, found))
+            break;
+
         pat = (PATTERN*)List_Next(pat);
     }
 
+finish:
+
     if (plevel) *plevel = level;
     if (pflags) *pflags = flags;
     if (pwildc) *pwildc = wildc;
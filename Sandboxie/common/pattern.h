@@ -109,6 +109,17 @@ int Pattern_MatchPathList(
 BOOLEAN Pattern_MatchPathListEx(
     WCHAR* path_lwr, ULONG path_len, LIST* list, ULONG* plevel, int* pmatch_len, ULONG* pflags, USHORT* pwildc, const WCHAR** patsrc);
 
+//
+// Pattern_CreateIndex:  compiles the literal prefixes of all patterns in
+// 'list' into a prefix tree allocated from 'pool', which is attached to
+// the first pattern in the list.  Pattern_MatchPathList then only tests
+// the patterns which can possibly match, with the same result as a full
+// scan.  The index is ignored once the list is modified, and is freed
+// along with the first pattern.
+//
+
+BOOLEAN Pattern_CreateIndex(POOL *pool, LIST *list);
+
 //---------------------------------------------------------------------------
 
 
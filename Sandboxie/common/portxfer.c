@@ -0,0 +1,624 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Port Message Transfer
+//
+// Splits service messages into chunks that fit a short message port and
+// reassembles them on the other end, used by SbieDll_CallServer and by
+// the PipeServer in SbieSvc.  When the service accepted a view shared by
+// the client thread on connect, requests and long replies are written to
+// the view and only a short doorbell chunk travels on the port.
+//
+// Only depends on the C runtime outside of Windows, see Sandboxie/tests
+//---------------------------------------------------------------------------
+
+#ifdef _WIN32
+#include "win32_ntddk.h"
+#endif
+#include "defines.h"
+#include "portxfer.h"
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+#define PORT_XFER_MAX_CHUNK             MAX_PORTMSG_LENGTH
+
+#define PORT_XFER_LENGTH(p)             (((ULONG *)(p))[0])
+#define PORT_XFER_MSGID(p)              (((ULONG *)(p))[1])
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+static void *PortXfer_CallChunks(
+    PORT_XFER *xfer, const void *msg, UCHAR sequence,
+    ULONG *error, LONG *status);
+
+static void *PortXfer_CallView(
+    PORT_XFER *xfer, const void *msg, UCHAR sequence,
+    ULONG *error, LONG *status);
+
+static void *PortXfer_ReceiveReply(
+    PORT_XFER *xfer, UCHAR *rpl, ULONG rpl_len, UCHAR sequence,
+    ULONG *error, LONG *status);
+
+static BOOLEAN PortXfer_CopyView(void *dst, const void *src, ULONG len);
+
+static LONG PortXfer_LoopbackExchange(
+    PORT_XFER *xfer, const void *req, ULONG req_len, void *rpl, ULONG *rpl_len);
+
+
+//---------------------------------------------------------------------------
+// PortXfer_Call
+//---------------------------------------------------------------------------
+
+
+_FX void *PortXfer_Call(
+    PORT_XFER *xfer, const void *msg, UCHAR sequence,
+    ULONG *error, LONG *status)
+{
+    *error = 0;
+    *status = 0;
+
+    //
+    // the view is only set when the service accepted it on connect, then
+    // every request goes through the view, so that the service can place
+    // a long reply there as well, whatever the length of the request
+    //
+
+    if (xfer->View && PORT_XFER_LENGTH(msg) <= xfer->ViewSize)
+        return PortXfer_CallView(xfer, msg, sequence, error, status);
+
+    return PortXfer_CallChunks(xfer, msg, sequence, error, status);
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_CallView
+//---------------------------------------------------------------------------
+
+
+_FX void *PortXfer_CallView(
+    PORT_XFER *xfer, const void *msg, UCHAR sequence,
+    ULONG *error, LONG *status)
+{
+    PORT_XFER_BELL bell;
+    UCHAR rpl[PORT_XFER_MAX_CHUNK];
+    ULONG rpl_len;
+
+    if (! PortXfer_CopyView(xfer->View, msg, PORT_XFER_LENGTH(msg))) {
+        xfer->View = NULL;
+        return PortXfer_CallChunks(xfer, msg, sequence, error, status);
+    }
+
+    bell.length = sizeof(PORT_XFER_BELL);
+    bell.msgid = PORT_XFER_MSGID_VIEW;
+    bell.magic = PORT_XFER_MAGIC;
+    bell.view_length = PORT_XFER_LENGTH(msg);
+
+    ((UCHAR *)&bell)[3] = sequence;
+
+    rpl_len = 0;
+    *status = xfer->Exchange(xfer, &bell, sizeof(bell), rpl, &rpl_len);
+    if (*status < 0) {
+        *error = PORT_XFER_ERR_REQUEST;
+        return NULL;
+    }
+
+    return PortXfer_ReceiveReply(xfer, rpl, rpl_len, sequence, error, status);
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_CallChunks
+//---------------------------------------------------------------------------
+
+
+_FX void *PortXfer_CallChunks(
+    PORT_XFER *xfer, const void *msg, UCHAR sequence,
+    ULONG *error, LONG *status)
+{
+    UCHAR req[PORT_XFER_MAX_CHUNK], rpl[PORT_XFER_MAX_CHUNK];
+    const UCHAR *buf;
+    ULONG buf_len, send_len, rpl_len;
+
+    //
+    // transmit the request message on the port.  LPC ports are designed
+    // for short messages so we have to break the message into chunks.
+    //
+
+    buf = (const UCHAR *)msg;
+    buf_len = PORT_XFER_LENGTH(msg);
+    rpl_len = 0;
+
+    while (buf_len) {
+
+        if (buf_len > xfer->MaxDataLen)
+            send_len = xfer->MaxDataLen;
+        else
+            send_len = buf_len;
+
+        memcpy(req, buf, send_len);
+
+        if (buf == (const UCHAR *)msg) {
+
+            //
+            // a service message must be shorter than 0x00FFFFFF bytes
+            // (as defined in core/svc/PipeServer.h) so we can use the
+            // high byte of MSG_HEADER.length (offset 3 in the first chunk)
+            // to store a verification sequenece number
+            //
+
+            req[3] = sequence;
+        }
+
+        buf += send_len;
+        buf_len -= send_len;
+
+        //
+        // send the chunk on the port and wait for acknowledgement.
+        // while the service is collecting the incoming chunks on its end,
+        // it replies with zero length chunks.  when sending the last chunk,
+        // we should get a non-zero reply which contains the first chunk
+        // of the response message from the service
+        //
+
+        rpl_len = 0;
+        *status = xfer->Exchange(xfer, req, send_len, rpl, &rpl_len);
+        if (*status < 0) {
+            *error = PORT_XFER_ERR_REQUEST;
+            return NULL;
+        }
+
+        if (buf_len && rpl_len) {
+            *error = PORT_XFER_ERR_EARLY;
+            return NULL;
+        }
+    }
+
+    return PortXfer_ReceiveReply(xfer, rpl, rpl_len, sequence, error, status);
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_ReceiveReply
+//---------------------------------------------------------------------------
+
+
+_FX void *PortXfer_ReceiveReply(
+    PORT_XFER *xfer, UCHAR *rpl, ULONG rpl_len, UCHAR sequence,
+    ULONG *error, LONG *status)
+{
+    UCHAR req[sizeof(ULONG) * 2];
+    UCHAR *msg, *buf;
+    ULONG buf_len;
+
+    //
+    // inspect the first chunks of the response message,
+    // it should have a matching sequence number, and valid length
+    //
+
+    if (rpl_len >= sizeof(ULONG) * 2) {
+
+        if (rpl[3] != sequence) {
+            *error = PORT_XFER_ERR_MISMATCH;
+            return NULL;
+        }
+
+        rpl[3] = 0;
+        buf_len = PORT_XFER_LENGTH(rpl);
+
+    } else
+        buf_len = 0;
+
+    if (buf_len == 0) {
+        *error = PORT_XFER_ERR_NULL;
+        return NULL;
+    }
+
+    //
+    // a first chunk which is shorter than both the reply and a full chunk
+    // is a doorbell, the service has placed the reply in the shared view
+    //
+
+    if (rpl_len == sizeof(PORT_XFER_BELL) && buf_len > rpl_len &&
+            buf_len > xfer->MaxDataLen && xfer->View) {
+
+        PORT_XFER_BELL *bell = (PORT_XFER_BELL *)rpl;
+
+        if (bell->magic != PORT_XFER_MAGIC || bell->view_length != buf_len ||
+                buf_len > xfer->ViewSize) {
+            *error = PORT_XFER_ERR_NULL;
+            return NULL;
+        }
+
+        msg = (UCHAR *)xfer->Alloc(xfer, buf_len + 8);
+        if (! msg) {
+            *error = PORT_XFER_ERR_NULL;
+            return NULL;
+        }
+
+        if (! PortXfer_CopyView(msg, xfer->View, buf_len)) {
+            xfer->Free(xfer, msg);
+            *error = PORT_XFER_ERR_REPLY;
+            return NULL;
+        }
+
+        PORT_XFER_LENGTH(msg) = buf_len;
+
+        memzero(msg + buf_len, 8);
+        return msg;
+    }
+
+    //
+    // collect the chunks of the response message.  we have to keep sending
+    // short dummy chunks on the port in order to receive the next chunk
+    // of the response
+    //
+
+    msg = (UCHAR *)xfer->Alloc(xfer, buf_len + 8);
+    if (! msg) {
+        *error = PORT_XFER_ERR_NULL;
+        return NULL;
+    }
+
+    buf = msg;
+
+    while (1) {
+
+        if ((ULONG)(buf - msg) + rpl_len > buf_len)
+            *status = STATUS_PORT_MESSAGE_TOO_LONG;
+        else {
+
+            memcpy(buf, rpl, rpl_len);
+
+            buf += rpl_len;
+            if ((ULONG)(buf - msg) >= buf_len)
+                break;
+
+            rpl_len = 0;
+            *status = xfer->Exchange(xfer, req, 0, rpl, &rpl_len);
+
+            //
+            // an empty chunk means the service has nothing more to send,
+            // so it lost track of the reply, don't ask it forever
+            //
+
+            if (*status >= 0 && ! rpl_len)
+                *status = STATUS_UNSUCCESSFUL;
+        }
+
+        if (*status < 0) {
+
+            xfer->Free(xfer, msg);
+
+            *error = PORT_XFER_ERR_REPLY;
+            return NULL;
+        }
+    }
+
+    memzero(buf, 8);
+    return msg;
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_Receive
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN PortXfer_Receive(
+    PORT_XFER *xfer, PORT_XFER_STATE *state, const void *data, ULONG len)
+{
+    ULONG buf_len;
+
+    if (! state->buf) {
+
+        ULONG msgid;
+
+        if (len < sizeof(ULONG) * 2)
+            goto fail;
+
+        msgid = PORT_XFER_MSGID(data);
+
+        state->sequence = ((const UCHAR *)data)[3];
+        state->via_view = FALSE;
+
+        buf_len = PORT_XFER_LENGTH(data) & 0x00FFFFFF;
+
+        if (msgid && buf_len &&
+                buf_len < PORT_XFER_MAX_LENGTH &&
+                buf_len >= sizeof(ULONG) * 2 &&
+                buf_len >= len) {
+
+            state->buf = (UCHAR *)xfer->Alloc(xfer, buf_len);
+            state->ptr = state->buf;
+        }
+
+        if (! state->buf) {
+            state->sequence = 0;
+            goto fail;
+        }
+
+        memcpy(state->ptr, data, len);
+        state->buf[3] = 0;
+
+    } else {
+
+        buf_len = (ULONG)(state->ptr - state->buf);
+
+        if (buf_len + len > PORT_XFER_LENGTH(state->buf))
+            goto fail;
+
+        memcpy(state->ptr, data, len);
+    }
+
+    state->ptr += len;
+
+    if ((ULONG)(state->ptr - state->buf) < PORT_XFER_LENGTH(state->buf))
+        return FALSE;
+
+    //
+    // a complete doorbell is replaced by a private copy of the request
+    // in the shared view.  the client can still write to the view, so the
+    // copy is checked again, and only the copy is used from here on
+    //
+
+    if (PORT_XFER_MSGID(state->buf) == PORT_XFER_MSGID_VIEW &&
+            PORT_XFER_LENGTH(state->buf) == sizeof(PORT_XFER_BELL) &&
+            xfer->View) {
+
+        PORT_XFER_BELL *bell = (PORT_XFER_BELL *)state->buf;
+        UCHAR *buf;
+
+        buf_len = bell->view_length;
+
+        if (bell->magic != PORT_XFER_MAGIC ||
+                buf_len < sizeof(ULONG) * 2 ||
+                buf_len >= PORT_XFER_MAX_LENGTH ||
+                buf_len > xfer->ViewSize)
+            goto fail;
+
+        buf = (UCHAR *)xfer->Alloc(xfer, buf_len);
+        if (! buf)
+            goto fail;
+
+        if (! PortXfer_CopyView(buf, xfer->View, buf_len) ||
+                PORT_XFER_LENGTH(buf) != buf_len || ! PORT_XFER_MSGID(buf)) {
+            PORT_XFER_LENGTH(buf) = buf_len;
+            xfer->Free(xfer, buf);
+            goto fail;
+        }
+
+        xfer->Free(xfer, state->buf);
+        state->buf = buf;
+        state->ptr = buf + buf_len;
+        state->via_view = TRUE;
+    }
+
+    return TRUE;
+
+fail:
+
+    if (state->buf) {
+        xfer->Free(xfer, state->buf);
+        state->buf = NULL;
+        state->ptr = NULL;
+    }
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_SetReply
+//---------------------------------------------------------------------------
+
+
+_FX void PortXfer_SetReply(
+    PORT_XFER *xfer, PORT_XFER_STATE *state, void *msg)
+{
+    if (state->buf)
+        xfer->Free(xfer, state->buf);
+
+    state->buf = (UCHAR *)msg;
+    state->ptr = (UCHAR *)msg;
+    state->replying = TRUE;
+    state->in_view = FALSE;
+
+    //
+    // a reply which would take more than one chunk goes to the shared
+    // view, if the client used the view for the request.  a client which
+    // sent its request in chunks expects the reply in chunks
+    //
+
+    if (msg && state->via_view && xfer->View &&
+            PORT_XFER_LENGTH(msg) > xfer->MaxDataLen &&
+            PORT_XFER_LENGTH(msg) <= xfer->ViewSize) {
+
+        if (PortXfer_CopyView(xfer->View, msg, PORT_XFER_LENGTH(msg)))
+            state->in_view = TRUE;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_Send
+//---------------------------------------------------------------------------
+
+
+_FX void PortXfer_Send(
+    PORT_XFER *xfer, PORT_XFER_STATE *state, void *data, ULONG *len)
+{
+    ULONG buf_len;
+
+    if (! state->replying) {
+        *len = 0;
+        return;
+    }
+
+    if (! state->buf) {
+        *len = 0;
+        state->replying = FALSE;
+        return;
+    }
+
+    if (state->in_view) {
+
+        PORT_XFER_BELL *bell = (PORT_XFER_BELL *)data;
+
+        bell->length = PORT_XFER_LENGTH(state->buf);
+        bell->msgid = PORT_XFER_MSGID(state->buf);
+        bell->magic = PORT_XFER_MAGIC;
+        bell->view_length = bell->length;
+
+        ((UCHAR *)data)[3] = state->sequence;
+
+        *len = sizeof(PORT_XFER_BELL);
+
+        PortXfer_Reset(xfer, state);
+        return;
+    }
+
+    buf_len = PORT_XFER_LENGTH(state->buf) - (ULONG)(state->ptr - state->buf);
+    if (buf_len > xfer->MaxDataLen)
+        buf_len = xfer->MaxDataLen;
+
+    memcpy(data, state->ptr, buf_len);
+
+    if (state->ptr == state->buf)
+        ((UCHAR *)data)[3] = state->sequence;
+
+    state->ptr += buf_len;
+
+    *len = buf_len;
+
+    if ((ULONG)(state->ptr - state->buf) >= PORT_XFER_LENGTH(state->buf))
+        PortXfer_Reset(xfer, state);
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_Reset
+//---------------------------------------------------------------------------
+
+
+_FX void PortXfer_Reset(PORT_XFER *xfer, PORT_XFER_STATE *state)
+{
+    if (state->buf)
+        xfer->Free(xfer, state->buf);
+
+    state->buf = NULL;
+    state->ptr = NULL;
+    state->sequence = 0;
+    state->replying = FALSE;
+    state->via_view = FALSE;
+    state->in_view = FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_CopyView
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN PortXfer_CopyView(void *dst, const void *src, ULONG len)
+{
+    //
+    // the view is a section of the client, which may be backed by a file
+    // that can fail to page in, so a fault while copying to or from the
+    // view only fails the message, or sends it in chunks instead
+    //
+
+#ifdef _MSC_VER
+    __try {
+
+        memcpy(dst, src, len);
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+
+        return FALSE;
+    }
+#else
+    memcpy(dst, src, len);
+#endif
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_InitLoopback
+//---------------------------------------------------------------------------
+
+
+_FX void PortXfer_InitLoopback(
+    PORT_XFER *client, PORT_XFER_LOOPBACK *loop,
+    PORT_XFER_HANDLER handler, void *context)
+{
+    memzero(loop, sizeof(PORT_XFER_LOOPBACK));
+
+    loop->Server.Alloc = client->Alloc;
+    loop->Server.Free = client->Free;
+    loop->Server.View = client->View;
+    loop->Server.ViewSize = client->ViewSize;
+    loop->Server.MaxDataLen = client->MaxDataLen;
+    loop->Server.Context = client->Context;
+
+    loop->Handler = handler;
+    loop->HandlerContext = context;
+
+    client->Exchange = PortXfer_LoopbackExchange;
+    client->Context = loop;
+}
+
+
+//---------------------------------------------------------------------------
+// PortXfer_LoopbackExchange
+//---------------------------------------------------------------------------
+
+
+_FX LONG PortXfer_LoopbackExchange(
+    PORT_XFER *xfer, const void *req, ULONG req_len, void *rpl, ULONG *rpl_len)
+{
+    PORT_XFER_LOOPBACK *loop = (PORT_XFER_LOOPBACK *)xfer->Context;
+
+    if (req_len > loop->Server.MaxDataLen)
+        return STATUS_PORT_MESSAGE_TOO_LONG;
+
+    //
+    // the same steps as the PipeServer takes for each message on the port
+    //
+
+    if (! loop->State.replying) {
+
+        if (PortXfer_Receive(&loop->Server, &loop->State, req, req_len)) {
+
+            void *msg = NULL;
+            if (loop->State.buf)
+                msg = loop->Handler(loop->HandlerContext, loop->State.buf);
+
+            PortXfer_SetReply(&loop->Server, &loop->State, msg);
+        }
+    }
+
+    PortXfer_Send(&loop->Server, &loop->State, rpl, rpl_len);
+
+    return 0;
+}
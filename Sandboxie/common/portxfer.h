@@ -0,0 +1,171 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Port Message Transfer
+//---------------------------------------------------------------------------
+
+#ifndef _MY_PORTXFER_H
+#define _MY_PORTXFER_H
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+#define PORT_XFER_MAX_LENGTH    (2048 * 1024)   // longest request accepted
+#define PORT_XFER_VIEW_SIZE     (512 * 1024)    // shared view per client thread
+
+// message id of a request which was placed in the shared view, it is
+// outside the range of all sub-servers
+
+#define PORT_XFER_MSGID_VIEW    0x1001
+#define PORT_XFER_MAGIC         0x56587850      // 'PxXV'
+
+// errors returned by PortXfer_Call
+
+#define PORT_XFER_ERR_REQUEST   1   // port failed while sending
+#define PORT_XFER_ERR_EARLY     2   // reply before the request was complete
+#define PORT_XFER_ERR_MISMATCH  3   // reply with the wrong sequence number
+#define PORT_XFER_ERR_NULL      4   // empty reply
+#define PORT_XFER_ERR_REPLY     5   // port failed while receiving
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+// all messages begin with the layout of MSG_HEADER from core/svc/msgids.h,
+// the high byte of the length in the first chunk carries a sequence number
+
+typedef struct _PORT_XFER_BELL {
+
+    ULONG length;           // request: sizeof(PORT_XFER_BELL), reply: view_length
+    ULONG msgid;            // request: PORT_XFER_MSGID_VIEW, reply: status
+    ULONG magic;
+    ULONG view_length;      // length of the message in the shared view
+
+} PORT_XFER_BELL;
+
+// connection information of a client which offers the shared view, the
+// service sets magic when it mapped the view and will answer doorbells.
+// a service which does not know the view returns it unchanged
+
+typedef struct _PORT_XFER_CONNECT {
+
+    ULONG magic;            // client: zero, service: PORT_XFER_MAGIC
+
+} PORT_XFER_CONNECT;
+
+typedef struct _PORT_XFER PORT_XFER;
+
+struct _PORT_XFER {
+
+    // sends one chunk of at most MaxDataLen bytes, then waits for the
+    // reply chunk, which is stored in rpl.  returns an NTSTATUS
+
+    LONG (*Exchange)(PORT_XFER *xfer,
+        const void *req, ULONG req_len, void *rpl, ULONG *rpl_len);
+
+    void *(*Alloc)(PORT_XFER *xfer, ULONG len);
+    void (*Free)(PORT_XFER *xfer, void *ptr);
+
+    UCHAR *View;            // shared view, or NULL
+    ULONG ViewSize;
+    ULONG MaxDataLen;       // largest chunk the port can carry
+    void *Context;
+};
+
+// server side state of one client thread
+
+typedef struct _PORT_XFER_STATE {
+
+    UCHAR *buf;             // request being collected, or reply being sent
+    UCHAR *ptr;
+    UCHAR sequence;
+    BOOLEAN replying;
+    BOOLEAN via_view;       // request came through the shared view
+    BOOLEAN in_view;        // reply was placed in the shared view
+
+} PORT_XFER_STATE;
+
+typedef void *(*PORT_XFER_HANDLER)(void *context, void *msg);
+
+// in process stand in for a service, to run both ends of the framing
+// without a port, e.g. to benchmark or fuzz it
+
+typedef struct _PORT_XFER_LOOPBACK {
+
+    PORT_XFER Server;
+    PORT_XFER_STATE State;
+    PORT_XFER_HANDLER Handler;
+    void *HandlerContext;
+
+} PORT_XFER_LOOPBACK;
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// client:  transmits the request msg and returns the reply allocated
+// with xfer->Alloc, or NULL and a PORT_XFER_ERR_ code in *error.
+// xfer->View is set only once the service accepted the shared view,
+// it is cleared if the view can't be written
+
+void *PortXfer_Call(
+    PORT_XFER *xfer, const void *msg, UCHAR sequence,
+    ULONG *error, LONG *status);
+
+// server:  collects one request chunk, returns TRUE once the request
+// is complete, or failed in which case state->buf is NULL
+
+BOOLEAN PortXfer_Receive(
+    PORT_XFER *xfer, PORT_XFER_STATE *state, const void *data, ULONG len);
+
+// server:  replaces the complete request with the reply msg, which
+// may be NULL, and which then belongs to the transfer state.  the reply
+// goes through the shared view only if the request came through it
+
+void PortXfer_SetReply(
+    PORT_XFER *xfer, PORT_XFER_STATE *state, void *msg);
+
+// server:  fills the next reply chunk into data, at most MaxDataLen
+// bytes.  *len is zero while a request is still being collected
+
+void PortXfer_Send(
+    PORT_XFER *xfer, PORT_XFER_STATE *state, void *data, ULONG *len);
+
+// server:  releases a partial request or reply
+
+void PortXfer_Reset(PORT_XFER *xfer, PORT_XFER_STATE *state);
+
+// sets up client and loop so that client exchanges chunks directly with
+// a server which invokes handler, both sides share the same view
+
+void PortXfer_InitLoopback(
+    PORT_XFER *client, PORT_XFER_LOOPBACK *loop,
+    PORT_XFER_HANDLER handler, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+//---------------------------------------------------------------------------
+
+#endif // _MY_PORTXFER_H
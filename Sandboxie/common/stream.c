@@ -240,6 +240,32 @@ NTSTATUS Stream_Flush(
     return status;
 }
 
+//---------------------------------------------------------------------------
+// Stream_Query_Size
+//---------------------------------------------------------------------------
+
+NTSTATUS Stream_Query_Size(
+    IN  STREAM *stream,
+    OUT ULONG64 *size)
+{
+    NTSTATUS status;
+    IO_STATUS_BLOCK MyIoStatusBlock;
+    FILE_STANDARD_INFORMATION info;
+
+#ifndef KERNEL_MODE
+    status = NtQueryInformationFile(
+#else
+    status = ZwQueryInformationFile(
+#endif
+        stream->handle, &MyIoStatusBlock,
+        &info, sizeof(info), FileStandardInformation);
+
+    if (NT_SUCCESS(status))
+        *size = info.EndOfFile.QuadPart;
+
+    return status;
+}
+
 //---------------------------------------------------------------------------
 // Byte-oriented Access Macros
 //---------------------------------------------------------------------------
@@ -275,10 +301,49 @@ NTSTATUS Stream_Read_Bytes(
     IN  ULONG len,
     OUT UCHAR *v)
 {
+    NTSTATUS status;
+    IO_STATUS_BLOCK MyIoStatusBlock;
+    ULONG copy_len;
+
     while (len) {
-        STREAM_GET_BYTE(*v);
-        ++v;
-        --len;
+
+        if (stream->data_len != 0) {
+
+            copy_len = min(len, stream->data_len);
+            memcpy(v, stream->data_ptr, copy_len);
+            stream->data_ptr += copy_len;
+            stream->data_len -= copy_len;
+            v += copy_len;
+            len -= copy_len;
+
+        } else if (len >= STREAM_DATA_SIZE) {
+
+            //
+            // large reads bypass the stream buffer
+            //
+
+#ifndef KERNEL_MODE
+            status = NtReadFile(
+#else
+            status = ZwReadFile(
+#endif
+                stream->handle, NULL, NULL, NULL, &MyIoStatusBlock,
+                v, len, NULL, NULL);
+
+            if (NT_SUCCESS(status) && MyIoStatusBlock.Information == 0)
+                status = STATUS_END_OF_FILE;
+            if (! NT_SUCCESS(status))
+                return status;
+
+            v += MyIoStatusBlock.Information;
+            len -= (ULONG)MyIoStatusBlock.Information;
+
+        } else {
+
+            status = Stream_Read_More(stream);
+            if (! NT_SUCCESS(status))
+                return status;
+        }
     }
     return STATUS_SUCCESS;
 }
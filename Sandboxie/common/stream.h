@@ -58,6 +58,10 @@ void Stream_Close(
 NTSTATUS Stream_Flush(
     IN  STREAM *stream);
 
+NTSTATUS Stream_Query_Size(
+    IN  STREAM *stream,
+    OUT ULONG64 *size);
+
 NTSTATUS Stream_Read_Bytes(
     IN  STREAM *stream,
     IN  ULONG len,
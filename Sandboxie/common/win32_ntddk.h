@@ -1734,6 +1734,23 @@ typedef void *PLPC_SECTION_OWNER_MEMORY;
 typedef void *PPORT_VIEW;
 typedef void *PREMOTE_PORT_VIEW;
 
+// section views passed to NtConnectPort and NtAcceptConnectPort
+
+typedef struct _PORT_VIEW_INFO {
+    ULONG Length;
+    HANDLE SectionHandle;
+    ULONG SectionOffset;
+    SIZE_T ViewSize;
+    PVOID ViewBase;
+    PVOID ViewRemoteBase;
+} PORT_VIEW_INFO;
+
+typedef struct _REMOTE_PORT_VIEW_INFO {
+    ULONG Length;
+    SIZE_T ViewSize;
+    PVOID ViewBase;
+} REMOTE_PORT_VIEW_INFO;
+
 // begin ALPC_INFO structure from LPC-ALPC-paper.pdf
 
 #define PORT_INFO_LPCMODE               0x001000    // Behave like an LPC port
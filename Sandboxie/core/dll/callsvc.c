@@ -26,6 +26,20 @@
 #include "core/svc/SbieIniWire.h"
 #include "core/svc/ProcessWire.h"
 #include "common/my_version.h"
+#include "common/portxfer.h"
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static LONG SbieDll_PortExchange(
+    PORT_XFER *xfer, const void *req, ULONG req_len, void *rpl, ULONG *rpl_len);
+
+static void *SbieDll_PortAlloc(PORT_XFER *xfer, ULONG len);
+
+static void SbieDll_PortFree(PORT_XFER *xfer, void *ptr);
 
 
 //---------------------------------------------------------------------------
@@ -90,6 +104,10 @@ _FX NTSTATUS SbieDll_ConnectPort()
         NTSTATUS status;
         SECURITY_QUALITY_OF_SERVICE QoS;
         UNICODE_STRING PortName;
+        PORT_VIEW_INFO View, *pView;
+        LARGE_INTEGER ViewSize;
+        PORT_XFER_CONNECT Connect;
+        ULONG ConnectLen;
 
         QoS.Length = sizeof(SECURITY_QUALITY_OF_SERVICE);
         QoS.ImpersonationLevel = SecurityImpersonation;
@@ -98,15 +116,76 @@ _FX NTSTATUS SbieDll_ConnectPort()
 
         RtlInitUnicodeString(&PortName, SbieDll_PortName());
 
+        //
+        // offer the service a section view which is shared for the lifetime
+        // of the connection, so long requests and replies need not be split
+        // into chunks.  the layout of PORT_VIEW_INFO differs for WoW64,
+        // so a 32-bit process on a 64-bit OS keeps using chunks only
+        //
+
+        memzero(&View, sizeof(View));
+        pView = NULL;
+
+        Connect.magic = 0;
+        ConnectLen = sizeof(Connect);
+
+#ifndef _WIN64
+        if (! Dll_BoxName)
+            SbieDll_IsWow64();
+
+        if (! Dll_IsWow64)
+#endif
+        {
+            ViewSize.QuadPart = PORT_XFER_VIEW_SIZE;
+            status = NtCreateSection(&View.SectionHandle, SECTION_ALL_ACCESS,
+                                     NULL, &ViewSize, PAGE_READWRITE,
+                                     SEC_COMMIT, NULL);
+            if (NT_SUCCESS(status)) {
+                View.Length = sizeof(PORT_VIEW_INFO);
+                View.ViewSize = PORT_XFER_VIEW_SIZE;
+                pView = &View;
+            }
+        }
+
         status = NtConnectPort(
             &data->PortHandle, &PortName, &QoS,
-            NULL, NULL, &data->MaxDataLen, NULL, NULL);
+            pView, NULL, &data->MaxDataLen, &Connect, &ConnectLen);
+
+        if (pView && ! NT_SUCCESS(status)) {
+
+            data->PortHandle = NULL;
+            pView = NULL;
+
+            status = NtConnectPort(
+                &data->PortHandle, &PortName, &QoS,
+                NULL, NULL, &data->MaxDataLen, NULL, NULL);
+        }
+
+        if (View.SectionHandle)
+            NtClose(View.SectionHandle);
 
         if (! NT_SUCCESS(status)) 
             return status;
 
         NtRegisterThreadTerminatePort(data->PortHandle);
 
+        //
+        // use the view only if the service confirmed it in the connection
+        // information and it was mapped on both ends, a service which does
+        // not know the view maps it as well but returns Connect unchanged
+        //
+
+        if (pView && View.ViewBase && View.ViewRemoteBase &&
+                View.ViewSize >= PORT_XFER_VIEW_SIZE &&
+                ConnectLen >= sizeof(Connect) &&
+                Connect.magic == PORT_XFER_MAGIC) {
+            data->PortView = (UCHAR *)View.ViewBase;
+            data->PortViewSize = PORT_XFER_VIEW_SIZE;
+        } else {
+            data->PortView = NULL;
+            data->PortViewSize = 0;
+        }
+
         //
         // compute sizes and offsets
         //
@@ -137,6 +216,68 @@ _FX NTSTATUS SbieDll_ConnectPort()
 }
 
 
+//---------------------------------------------------------------------------
+// SbieDll_PortExchange
+//---------------------------------------------------------------------------
+
+
+_FX LONG SbieDll_PortExchange(
+    PORT_XFER *xfer, const void *req, ULONG req_len, void *rpl, ULONG *rpl_len)
+{
+    THREAD_DATA *data = (THREAD_DATA *)xfer->Context;
+    UCHAR spaceReq[MAX_PORTMSG_LENGTH], spaceRpl[MAX_PORTMSG_LENGTH];
+    PORT_MESSAGE *msg;
+    NTSTATUS status;
+
+    msg = (PORT_MESSAGE *)spaceReq;
+
+    memzero(msg, data->SizeofPortMsg);
+    msg->u1.s1.DataLength = (USHORT)req_len;
+    msg->u1.s1.TotalLength = (USHORT)(data->SizeofPortMsg + req_len);
+
+    memcpy((UCHAR *)msg + data->SizeofPortMsg, req, req_len);
+
+    status = NtRequestWaitReplyPort(data->PortHandle,
+                    (PORT_MESSAGE *)spaceReq, (PORT_MESSAGE *)spaceRpl);
+
+    if (NT_SUCCESS(status)) {
+
+        msg = (PORT_MESSAGE *)spaceRpl;
+
+        if (msg->u1.s1.DataLength > data->MaxDataLen)
+            status = STATUS_PORT_MESSAGE_TOO_LONG;
+        else {
+            *rpl_len = msg->u1.s1.DataLength;
+            memcpy(rpl, (UCHAR *)msg + data->SizeofPortMsg, *rpl_len);
+        }
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// SbieDll_PortAlloc
+//---------------------------------------------------------------------------
+
+
+_FX void *SbieDll_PortAlloc(PORT_XFER *xfer, ULONG len)
+{
+    return Dll_AllocTemp(len);
+}
+
+
+//---------------------------------------------------------------------------
+// SbieDll_PortFree
+//---------------------------------------------------------------------------
+
+
+_FX void SbieDll_PortFree(PORT_XFER *xfer, void *ptr)
+{
+    Dll_Free(ptr);
+}
+
+
 //---------------------------------------------------------------------------
 // SbieDll_CallServer
 //---------------------------------------------------------------------------
@@ -147,11 +288,9 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
     static volatile ULONG last_sequence = 0;
     UCHAR curr_sequence;
     THREAD_DATA *data = Dll_GetTlsData(NULL);
-    UCHAR spaceReq[MAX_PORTMSG_LENGTH], spaceRpl[MAX_PORTMSG_LENGTH];
+    PORT_XFER xfer;
     NTSTATUS status;
-    PORT_MESSAGE *msg;
-    UCHAR *buf, *msg_data;
-    ULONG buf_len, send_len;
+    ULONG error;
     MSG_HEADER *rpl;
 
     if (Dll_SbieTrace) {
@@ -198,153 +337,46 @@ _FX MSG_HEADER *SbieDll_CallServer(MSG_HEADER *req)
     }
 
     //
-    // transmit the request message on the port.  LPC ports are designed
-    // for short messages so we have to break the message into chunks.
+    // transmit the request message on the port, see common/portxfer.c
     //
 
     curr_sequence = (UCHAR) InterlockedIncrement(&last_sequence);
 
-    buf = (UCHAR *)req;
-    buf_len = req->length;
-
-    while (buf_len) {
-
-        msg = (PORT_MESSAGE *)spaceReq;
-
-        memzero(msg, data->SizeofPortMsg);
-        msg_data = (UCHAR *)msg + data->SizeofPortMsg;
+    xfer.Exchange = SbieDll_PortExchange;
+    xfer.Alloc = SbieDll_PortAlloc;
+    xfer.Free = SbieDll_PortFree;
+    xfer.View = data->PortView;
+    xfer.ViewSize = data->PortViewSize;
+    xfer.MaxDataLen = data->MaxDataLen;
+    xfer.Context = data;
 
-        if (buf_len > data->MaxDataLen)
-            send_len = data->MaxDataLen;
-        else
-            send_len = buf_len;
+    rpl = (MSG_HEADER *)PortXfer_Call(
+                            &xfer, req, curr_sequence, &error, &status);
 
-        msg->u1.s1.DataLength = (USHORT)send_len;
-        msg->u1.s1.TotalLength = (USHORT)(data->SizeofPortMsg + send_len);
+    data->PortView = xfer.View;
 
-        memcpy(msg_data, buf, send_len);
+    if (! rpl) {
 
-        if (buf == (UCHAR *)req) {
+        if (error == PORT_XFER_ERR_REQUEST || error == PORT_XFER_ERR_REPLY) {
 
-            //
-            // a service message must be shorter than 0x00FFFFFF bytes
-            // (as defined in core/svc/PipeServer.h) so we can use the
-            // high byte of MSG_HEADER.length (offset 3 in the first chunk)
-            // to store a verification sequenece number
-            //
-
-            msg_data[3] = curr_sequence;
+            NtClose(data->PortHandle);
+            data->PortHandle = NULL;
+            data->PortView = NULL;
         }
 
-        buf += send_len;
-        buf_len -= send_len;
-
-        //
-        // send the chunk on the LPC port and wait for acknowledgement.
-        // while the service is collecting the incoming chunks on its end,
-        // it replies with zero length chunks.  when sending the last chunk,
-        // we should get a non-zero reply which contains the first chunk
-        // of the response message from the service
-        //
-
-        status = NtRequestWaitReplyPort(data->PortHandle,
-                        (PORT_MESSAGE *)spaceReq, (PORT_MESSAGE *)spaceRpl);
-        if (! NT_SUCCESS(status))
-            break;
-
-        msg = (PORT_MESSAGE *)spaceRpl;
-
-        if (buf_len && msg->u1.s1.DataLength) {
+        if (error == PORT_XFER_ERR_REQUEST)
+            SbieApi_Log(2203, L"request %08X", status);
+        else if (error == PORT_XFER_ERR_EARLY)
             SbieApi_Log(2203, L"early reply");
-            return NULL;
-        }
-    }
-
-    if (! NT_SUCCESS(status)) {
-
-        NtClose(data->PortHandle);
-        data->PortHandle = NULL;
-
-        SbieApi_Log(2203, L"request %08X", status);
-        return NULL;
-    }
-
-    //
-    // inspect the first chunks of the response message,
-    // it should have a matching sequence number, and valid length
-    //
-
-    msg = (PORT_MESSAGE *)spaceRpl;
-
-    msg_data = ((UCHAR *)msg + data->SizeofPortMsg);
-
-    if (msg->u1.s1.DataLength >= sizeof(MSG_HEADER)) {
-
-        if (msg_data[3] != curr_sequence) {
+        else if (error == PORT_XFER_ERR_MISMATCH)
             SbieApi_Log(2203, L"mismatched reply");
-            return NULL;
-        }
-
-        msg_data[3] = 0;
-        buf_len = ((MSG_HEADER *)msg_data)->length;
-
-    } else
-        buf_len = 0;
-
-    if (buf_len == 0) {
-        SbieApi_Log(2203, L"null reply (msg %08X len %d)",
-                    req->msgid, req->length);
-        return NULL;
-    }
-
-    //
-    // collect the chunks of the response message.  we have to keep sending
-    // short dummy LPC chunks on the port in order to receive the next chunk
-    // of the response
-    //
-
-    rpl = Dll_AllocTemp(buf_len + 8);
-    buf = (UCHAR *)rpl;
-
-    while (1) {
-
-        ULONG buf_len_plus_msg = (ULONG)(ULONG_PTR)(buf - (UCHAR *)rpl)
-                               + msg->u1.s1.DataLength;
-        if (buf_len_plus_msg > buf_len)
-            status = STATUS_PORT_MESSAGE_TOO_LONG;
-        else {
-
-            msg_data = ((UCHAR *)msg + data->SizeofPortMsg);
-            memcpy(buf, msg_data, msg->u1.s1.DataLength);
-
-            buf += msg->u1.s1.DataLength;
-            if ((ULONG_PTR)(buf - (UCHAR *)rpl) >= buf_len)
-                break;
-
-            msg = (PORT_MESSAGE *)spaceReq;
-
-            memzero(msg, data->SizeofPortMsg);
-            msg->u1.s1.TotalLength = (USHORT)data->SizeofPortMsg;
-
-            status = NtRequestWaitReplyPort(data->PortHandle,
-                        (PORT_MESSAGE *)spaceReq, (PORT_MESSAGE *)spaceRpl);
-
-            msg = (PORT_MESSAGE *)spaceRpl;
-        }
-
-        if (! NT_SUCCESS(status)) {
-
-            Dll_Free(rpl);
-
-            NtClose(data->PortHandle);
-            data->PortHandle = NULL;
-
+        else if (error == PORT_XFER_ERR_REPLY)
             SbieApi_Log(2203, L"reply %08X", status);
-            return NULL;
-        }
+        else
+            SbieApi_Log(2203, L"null reply (msg %08X len %d)",
+                        req->msgid, req->length);
     }
 
-    memzero(buf, 8);
     return rpl;
 }
 
@@ -231,6 +231,8 @@ typedef struct _THREAD_DATA {
     HANDLE          PortHandle;
     ULONG           MaxDataLen;
     ULONG           SizeofPortMsg;
+    UCHAR          *PortView;
+    ULONG           PortViewSize;
     BOOLEAN         bOperaFileDlgThread;
 
     //
@@ -475,6 +477,8 @@ void Handle_SetupDuplicate(HANDLE OldFileHandle, HANDLE NewFileHandle);
 
 void File_DoAutoRecover(BOOLEAN force);
 
+void File_FlushNameCache(void);
+
 NTSTATUS File_CreateBoxedPath(const WCHAR *PathToCreate);
 
 HANDLE File_GetTrueHandle(HANDLE FileHandle, BOOLEAN *pIsOpenPath);
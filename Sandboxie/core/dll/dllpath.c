@@ -253,6 +253,9 @@ _FX BOOLEAN Dll_InitPathList3(POOL *pool, ULONG path_code, LIST *list)
         ptr += wcslen(ptr) + 1;
     }
 
+    if (ok)
+        Pattern_CreateIndex(pool, list);
+
     Dll_Free(path);
     return ok;
 }
@@ -752,6 +755,8 @@ _FX void Dll_RefreshPathList(void)
 #endif
 
             Dll_PathListAnchor->file_paths_initialized = TRUE;
+
+            File_FlushNameCache();
         }
     }
 
@@ -86,6 +86,8 @@
 
 #define NO_RELOCATION               ((PUNICODE_STRING)-1)
 
+#define FILE_NAME_CACHE_TTL         (10 * 1000) // same as for File_TempLinks
+
 #ifndef  _WIN64
 #define WOW64_FS_REDIR
 #endif ! _WIN64
@@ -104,6 +106,24 @@ typedef struct _FILE_DRIVE FILE_DRIVE;
 typedef struct _FILE_GUID FILE_GUID;
 
 
+typedef struct _FILE_NAME_CACHE_ENTRY {
+
+    LIST_ELEM list_elem;        // lru order, most recently used first
+    struct _FILE_NAME_CACHE_ENTRY *hash_next;
+    ULONG hash;
+    ULONG generation;
+    ULONG ticks;
+    NTSTATUS status;
+    ULONG flags;
+    BOOLEAN has_flags;          // FALSE if resolved without OutFlags
+    ULONG name_len;
+    ULONG true_len;
+    ULONG copy_len;             // -1 if there is no copy path
+    WCHAR data[1];              // object name, true path, copy path
+
+} FILE_NAME_CACHE_ENTRY;
+
+
 
 //---------------------------------------------------------------------------
 // Functions
@@ -121,6 +141,24 @@ SBIEDLL_EXPORT NTSTATUS File_GetName(
     HANDLE RootDirectory, UNICODE_STRING *ObjectName,
     WCHAR **OutTruePath, WCHAR **OutCopyPath, ULONG *OutFlags);
 
+static NTSTATUS File_GetNameImpl(
+    HANDLE RootDirectory, UNICODE_STRING *ObjectName,
+    WCHAR **OutTruePath, WCHAR **OutCopyPath, ULONG *OutFlags);
+
+static void File_InitNameCache(void);
+
+static BOOLEAN File_GetNameFromCache(
+    const WCHAR *objname_buf, ULONG objname_len,
+    WCHAR **OutTruePath, WCHAR **OutCopyPath, ULONG *OutFlags,
+    NTSTATUS *OutStatus);
+
+static void File_AddNameToCache(
+    const WCHAR *objname_buf, ULONG objname_len, ULONG generation,
+    NTSTATUS status, const WCHAR *TruePath, const WCHAR *CopyPath,
+    const ULONG *Flags);
+
+BOOL File_TestBoxRootChange(ULONG WatchBit);
+
 static WCHAR *File_TranslateDosToNtPath2(
     const WCHAR *DosPath, ULONG DosPathLen);
 
@@ -435,6 +473,16 @@ BOOLEAN File_Delete_v2 = FALSE;
 static WCHAR *File_AltBoxPath = NULL;
 static ULONG File_AltBoxPathLen = 0;
 
+static CRITICAL_SECTION File_NameCache_CritSec;
+static LIST File_NameCache;
+static FILE_NAME_CACHE_ENTRY **File_NameCache_Buckets = NULL;
+static ULONG File_NameCache_BucketCount = 0;
+static ULONG File_NameCache_Limit = 0;
+static ULONG File_NameCache_CheckTicks = 0;
+static volatile LONG File_NameCache_Generation = 0;
+static ULONG64 File_NameCache_Hits = 0;
+static ULONG64 File_NameCache_Misses = 0;
+
 
 
 //---------------------------------------------------------------------------
@@ -980,6 +1028,69 @@ _FX NTSTATUS File_GetTruePath(WCHAR *CopyPath, WCHAR **OutTruePath)
 _FX NTSTATUS File_GetName(
     HANDLE RootDirectory, UNICODE_STRING *ObjectName,
     WCHAR **OutTruePath, WCHAR **OutCopyPath, ULONG *OutFlags)
+{
+    NTSTATUS status;
+    const WCHAR *objname_buf;
+    ULONG objname_len;
+    ULONG generation;
+
+    //
+    // only plain object names are cached, names relative to a handle
+    // depend on the handle, and in a wow64 process the translation of
+    // System32 depends on the per thread file system redirection state
+    //
+
+    if (! File_NameCache_Buckets || RootDirectory ||
+            (! ObjectName) || ObjectName == NO_RELOCATION ||
+            File_Wow64FileLink) {
+
+        return File_GetNameImpl(
+            RootDirectory, ObjectName, OutTruePath, OutCopyPath, OutFlags);
+    }
+
+    objname_buf = ObjectName->Buffer;
+    objname_len = (ObjectName->Length & ~1) / sizeof(WCHAR);
+    if ((! objname_len) || wmemchr(objname_buf, L'~', objname_len)) {
+
+        return File_GetNameImpl(
+            RootDirectory, ObjectName, OutTruePath, OutCopyPath, OutFlags);
+    }
+
+    if (File_GetNameFromCache(objname_buf, objname_len,
+                OutTruePath, OutCopyPath, OutFlags, &status))
+        return status;
+
+    generation = File_NameCache_Generation;
+
+    status = File_GetNameImpl(
+        RootDirectory, ObjectName, OutTruePath, OutCopyPath, OutFlags);
+
+    //
+    // cache successful translations, and negative results for paths
+    // we don't sandbox, but only those which did not produce a partial
+    // copy path, and not if short names could not be expanded
+    //
+
+    if ((status == STATUS_SUCCESS ||
+            (status == STATUS_BAD_INITIAL_PC && ! *OutCopyPath))
+            && *OutTruePath && ! wcschr(*OutTruePath, L'~')) {
+
+        File_AddNameToCache(objname_buf, objname_len, generation,
+            status, *OutTruePath, *OutCopyPath, OutFlags);
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// File_GetNameImpl
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_GetNameImpl(
+    HANDLE RootDirectory, UNICODE_STRING *ObjectName,
+    WCHAR **OutTruePath, WCHAR **OutCopyPath, ULONG *OutFlags)
 {	
     THREAD_DATA *TlsData = Dll_GetTlsData(NULL);
 
@@ -1524,6 +1635,273 @@ check_sandbox_prefix:
 }
 
 
+//---------------------------------------------------------------------------
+// File_InitNameCache
+//---------------------------------------------------------------------------
+
+
+_FX void File_InitNameCache(void)
+{
+    ULONG count;
+
+    File_NameCache_Limit =
+        SbieApi_QueryConfNumber(NULL, L"FileNameCacheSize", 1024);
+    if (! File_NameCache_Limit)
+        return;
+    if (File_NameCache_Limit > 0x10000)
+        File_NameCache_Limit = 0x10000;
+
+    count = 16;
+    while (count < File_NameCache_Limit)
+        count <<= 1;
+
+    InitializeCriticalSectionAndSpinCount(&File_NameCache_CritSec, 1000);
+    List_Init(&File_NameCache);
+
+    File_NameCache_BucketCount = count;
+    File_NameCache_Buckets =
+        Dll_Alloc(count * sizeof(FILE_NAME_CACHE_ENTRY *));
+    memzero(File_NameCache_Buckets, count * sizeof(FILE_NAME_CACHE_ENTRY *));
+}
+
+
+//---------------------------------------------------------------------------
+// File_FlushNameCache
+//---------------------------------------------------------------------------
+
+
+_FX void File_FlushNameCache(void)
+{
+    //
+    // entries from an older generation are discarded on their next lookup
+    // or evicted as the least recently used ones
+    //
+
+    InterlockedIncrement(&File_NameCache_Generation);
+}
+
+
+//---------------------------------------------------------------------------
+// File_HashName
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_HashName(const WCHAR *name, ULONG name_len)
+{
+    ULONG hash = 5381;
+    while (name_len--)
+        hash = ((hash << 5) + hash) ^ *name++;
+    return hash;
+}
+
+
+//---------------------------------------------------------------------------
+// File_RemoveNameFromCache
+//---------------------------------------------------------------------------
+
+
+_FX void File_RemoveNameFromCache(FILE_NAME_CACHE_ENTRY *entry)
+{
+    FILE_NAME_CACHE_ENTRY **ptr = &File_NameCache_Buckets[
+                        entry->hash & (File_NameCache_BucketCount - 1)];
+
+    while (*ptr) {
+        if (*ptr == entry) {
+            *ptr = entry->hash_next;
+            break;
+        }
+        ptr = &(*ptr)->hash_next;
+    }
+
+    List_Remove(&File_NameCache, entry);
+    Dll_Free(entry);
+}
+
+
+//---------------------------------------------------------------------------
+// File_FindNameInCache
+//---------------------------------------------------------------------------
+
+
+_FX FILE_NAME_CACHE_ENTRY *File_FindNameInCache(
+    const WCHAR *objname_buf, ULONG objname_len, ULONG hash)
+{
+    FILE_NAME_CACHE_ENTRY *entry = File_NameCache_Buckets[
+                        hash & (File_NameCache_BucketCount - 1)];
+
+    while (entry) {
+        if (entry->hash == hash && entry->name_len == objname_len
+                && wmemcmp(entry->data, objname_buf, objname_len) == 0)
+            break;
+        entry = entry->hash_next;
+    }
+
+    return entry;
+}
+
+
+//---------------------------------------------------------------------------
+// File_GetNameFromCache
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_GetNameFromCache(
+    const WCHAR *objname_buf, ULONG objname_len,
+    WCHAR **OutTruePath, WCHAR **OutCopyPath, ULONG *OutFlags,
+    NTSTATUS *OutStatus)
+{
+    THREAD_DATA *TlsData = Dll_GetTlsData(NULL);
+    FILE_NAME_CACHE_ENTRY *entry;
+    ULONG hash = File_HashName(objname_buf, objname_len);
+    ULONG ticks = GetTickCount();
+    WCHAR *name;
+
+    EnterCriticalSection(&File_NameCache_CritSec);
+
+    //
+    // the box root watcher is a syscall, so don't poll it on every lookup
+    //
+
+    if (ticks - File_NameCache_CheckTicks > 100) {
+
+        File_NameCache_CheckTicks = ticks;
+
+        if (File_TestBoxRootChange(2))
+            File_FlushNameCache();
+    }
+
+    entry = File_FindNameInCache(objname_buf, objname_len, hash);
+
+    if (entry && (entry->generation != (ULONG)File_NameCache_Generation
+                    || ticks - entry->ticks > FILE_NAME_CACHE_TTL)) {
+
+        File_RemoveNameFromCache(entry);
+        entry = NULL;
+    }
+
+    if ((! entry) || (OutFlags && ! entry->has_flags)) {
+
+        ++File_NameCache_Misses;
+        LeaveCriticalSection(&File_NameCache_CritSec);
+        return FALSE;
+    }
+
+    ++File_NameCache_Hits;
+
+    if (List_Head(&File_NameCache) != entry) {
+        List_Remove(&File_NameCache, entry);
+        List_Insert_Before(&File_NameCache, NULL, entry);
+    }
+
+    //
+    // callers expect the results in the thread's name buffers
+    //
+
+    name = Dll_GetTlsNameBuffer(TlsData, TRUE_NAME_BUFFER,
+                                (entry->true_len + 2) * sizeof(WCHAR));
+    wmemcpy(name, entry->data + entry->name_len, entry->true_len + 1);
+    *OutTruePath = name;
+
+    if (entry->copy_len != -1) {
+
+        name = Dll_GetTlsNameBuffer(TlsData, COPY_NAME_BUFFER,
+                                    (entry->copy_len + 2) * sizeof(WCHAR));
+        wmemcpy(name, entry->data + entry->name_len + entry->true_len + 1,
+                entry->copy_len + 1);
+        *OutCopyPath = name;
+
+    } else
+        *OutCopyPath = NULL;
+
+    if (OutFlags)
+        *OutFlags = entry->flags;
+
+    *OutStatus = entry->status;
+
+    LeaveCriticalSection(&File_NameCache_CritSec);
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_AddNameToCache
+//---------------------------------------------------------------------------
+
+
+_FX void File_AddNameToCache(
+    const WCHAR *objname_buf, ULONG objname_len, ULONG generation,
+    NTSTATUS status, const WCHAR *TruePath, const WCHAR *CopyPath,
+    const ULONG *Flags)
+{
+    FILE_NAME_CACHE_ENTRY *entry;
+    ULONG hash = File_HashName(objname_buf, objname_len);
+    ULONG true_len = wcslen(TruePath);
+    ULONG copy_len = CopyPath ? wcslen(CopyPath) : -1;
+    ULONG data_len = objname_len + true_len + 1
+                   + (CopyPath ? copy_len + 1 : 0);
+
+    entry = Dll_Alloc(sizeof(FILE_NAME_CACHE_ENTRY) + data_len * sizeof(WCHAR));
+
+    entry->hash = hash;
+    entry->generation = generation;
+    entry->ticks = GetTickCount();
+    entry->status = status;
+    entry->flags = Flags ? *Flags : 0;
+    entry->has_flags = Flags ? TRUE : FALSE;
+    entry->name_len = objname_len;
+    entry->true_len = true_len;
+    entry->copy_len = copy_len;
+
+    wmemcpy(entry->data, objname_buf, objname_len);
+    wmemcpy(entry->data + objname_len, TruePath, true_len + 1);
+    if (CopyPath)
+        wmemcpy(entry->data + objname_len + true_len + 1, CopyPath, copy_len + 1);
+
+    EnterCriticalSection(&File_NameCache_CritSec);
+
+    if (generation != (ULONG)File_NameCache_Generation) {
+
+        //
+        // the configuration changed while we were resolving the name
+        //
+
+        LeaveCriticalSection(&File_NameCache_CritSec);
+        Dll_Free(entry);
+        return;
+    }
+
+    {
+        FILE_NAME_CACHE_ENTRY *old_entry =
+            File_FindNameInCache(objname_buf, objname_len, hash);
+        if (old_entry)
+            File_RemoveNameFromCache(old_entry);
+    }
+
+    while (List_Count(&File_NameCache) >= File_NameCache_Limit)
+        File_RemoveNameFromCache(List_Tail(&File_NameCache));
+
+    List_Insert_Before(&File_NameCache, NULL, entry);
+
+    entry->hash_next = File_NameCache_Buckets[hash & (File_NameCache_BucketCount - 1)];
+    File_NameCache_Buckets[hash & (File_NameCache_BucketCount - 1)] = entry;
+
+    LeaveCriticalSection(&File_NameCache_CritSec);
+}
+
+
+//---------------------------------------------------------------------------
+// SbieDll_GetNameCacheStats
+//---------------------------------------------------------------------------
+
+
+_FX void SbieDll_GetNameCacheStats(ULONG64 *Hits, ULONG64 *Misses)
+{
+    *Hits = File_NameCache_Hits;
+    *Misses = File_NameCache_Misses;
+}
+
+
 //---------------------------------------------------------------------------
 // File_GetName_TranslateSymlinks
 //---------------------------------------------------------------------------
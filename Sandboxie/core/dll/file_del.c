@@ -26,6 +26,18 @@
 //---------------------------------------------------------------------------
 
 #define FILE_PATH_FILE_NAME     L"FilePaths.dat"
+#define FILE_PATH_CACHE_NAME    L"FilePaths.bin"
+
+// binary path tree snapshot
+#define FILE_PATH_CACHE_MAGIC   'TPbS'
+#define FILE_PATH_CACHE_VERSION 2
+#define FILE_PATH_CACHE_ALIGN(x) (((x) + sizeof(ULONG) - 1) & ~(sizeof(ULONG) - 1))
+
+// children lists longer than this get a hash index
+#define FILE_PATH_HASH_MIN      16
+
+// rewrite the file once appended records make up more than half of it
+#define FILE_PATH_JOURNAL_SLACK 0x10000
 
 // path flags, saved to file
 #define FILE_DELETED_FLAG       0x0001
@@ -53,10 +65,33 @@ typedef struct _PATH_NODE {
     LIST items;
     ULONG flags;
     WCHAR* relocation;
+    struct _PATH_NODE** buckets;    // hash index for items, or NULL
+    ULONG bucket_count;
+    struct _PATH_NODE* hash_next;   // next entry in the parent's bucket
+    ULONG hash;
     ULONG name_len;
     WCHAR name[1];
 } PATH_NODE;
 
+typedef struct _PATH_CACHE_HEADER {
+    ULONG magic;
+    ULONG version;
+    ULONG64 text_size;      // FilePaths.dat this snapshot was created from
+    ULONG64 text_date;
+    ULONG64 base_size;      // text file size after the last full save
+    ULONG drive_hash;       // drive layout used to translate the paths
+    ULONG epoch;            // epoch of the text file, see File_SavePathTree
+    ULONG count;            // number of top level entries
+} PATH_CACHE_HEADER;
+
+typedef struct _PATH_CACHE_ENTRY {
+    ULONG flags;
+    ULONG count;            // number of child entries which follow
+    USHORT name_len;
+    USHORT relocation_len;
+    // WCHAR name[name_len], WCHAR relocation[relocation_len], padded to ULONG
+} PATH_CACHE_ENTRY;
+
 
 //---------------------------------------------------------------------------
 // Variables
@@ -73,6 +108,8 @@ static ULONG File_BoxRootChangeBits = 0;
 
 static ULONG64 File_PathsFileSize = 0;
 static ULONG64 File_PathsFileDate = 0;
+static ULONG64 File_PathsBaseSize = 0;
+static ULONG File_PathsEpoch = 0;
 
 //---------------------------------------------------------------------------
 // Functions
@@ -82,6 +119,8 @@ static ULONG File_GetPathFlags(const WCHAR* Path, WCHAR** pRelocation);
 static BOOLEAN File_SavePathTree();
 static BOOLEAN File_LoadPathTree();
 static VOID File_RefreshPathTree();
+static VOID File_SyncPathTree();
+static VOID File_AppendPathJournal(const WCHAR* Path, ULONG Flags, const WCHAR* Relocation, const WCHAR* MovedFrom);
 BOOLEAN File_InitDelete_v2();
 
 static NTSTATUS File_MarkDeleted_v2(const WCHAR *TruePath);
@@ -95,6 +134,12 @@ BOOL File_TestBoxRootChange(ULONG WatchBit);
 
 BOOL File_GetAttributes_internal(const WCHAR *name, ULONG64 *size, ULONG64 *date, ULONG *attrs);
 
+VOID File_AppendPathEntryEx_internal(HANDLE hPathsFile, const WCHAR* Path, ULONG SetFlags, const WCHAR* Relocation, const WCHAR* MovedFrom, WCHAR* (*TranslatePath)(const WCHAR*));
+VOID File_SavePathTreeEx_internal(LIST* Root, const WCHAR* name, ULONG Epoch, WCHAR* (*TranslatePath)(const WCHAR *));
+BOOLEAN File_LoadPathTreeEx_internal(LIST* Root, const WCHAR* name, ULONG64 Offset, ULONG* pEpoch, WCHAR* (*TranslatePath)(const WCHAR *));
+BOOLEAN File_MarkDeleted_internal(LIST* Root, const WCHAR* Path, BOOLEAN* pTruncated);
+VOID File_SetRelocation_internal(LIST* Root, const WCHAR* OldTruePath, const WCHAR* NewTruePath);
+
 HANDLE File_AcquireMutex(const WCHAR* MutexName);
 void File_ReleaseMutex(HANDLE hMutex);
 #define FILE_VFS_MUTEX SBIE L"_VFS_Mutex"
@@ -115,6 +160,7 @@ _FX VOID File_ClearPathBranche_internal(LIST* parent)
 
         List_Remove(parent, child);
         if(child->relocation) Dll_Free(child->relocation);
+        if(child->buckets) Dll_Free(child->buckets);
         Dll_Free(child);
 
         child = next_child;
@@ -122,22 +168,167 @@ _FX VOID File_ClearPathBranche_internal(LIST* parent)
 }
 
 
+//---------------------------------------------------------------------------
+// File_HashPathName_internal
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_HashPathName_internal(const WCHAR* name, ULONG name_len)
+{
+    //
+    // names are compared with _wcsnicmp, so only fold ascii letters and
+    // leave out other characters, which may be case folded differently
+    //
+
+    ULONG hash = 5381;
+    for (ULONG i = 0; i < name_len; i++) {
+        WCHAR c = name[i];
+        if (c >= L'A' && c <= L'Z')
+            c += L'a' - L'A';
+        else if (c >= 0x80)
+            continue;
+        hash = ((hash << 5) + hash) ^ c;
+    }
+    return hash;
+}
+
+
+//---------------------------------------------------------------------------
+// File_GetPathOwner_internal
+//---------------------------------------------------------------------------
+
+
+_FX PATH_NODE* File_GetPathOwner_internal(LIST* Root, LIST* parent)
+{
+    //
+    // every children list except the root is the items member of a node
+    //
+
+    if (parent == Root)
+        return NULL;
+    return CONTAINING_RECORD(parent, PATH_NODE, items);
+}
+
+
+//---------------------------------------------------------------------------
+// File_RehashPathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_RehashPathNode_internal(PATH_NODE* owner)
+{
+    ULONG bucket_count = FILE_PATH_HASH_MIN;
+    while (bucket_count < (ULONG)owner->items.count)
+        bucket_count <<= 1;
+
+    PATH_NODE** buckets = Dll_Alloc(bucket_count * sizeof(PATH_NODE*));
+    memzero(buckets, bucket_count * sizeof(PATH_NODE*));
+
+    PATH_NODE* child = List_Head(&owner->items);
+    while (child) {
+        ULONG idx = child->hash & (bucket_count - 1);
+        child->hash_next = buckets[idx];
+        buckets[idx] = child;
+        child = List_Next(child);
+    }
+
+    if (owner->buckets) Dll_Free(owner->buckets);
+    owner->buckets = buckets;
+    owner->bucket_count = bucket_count;
+}
+
+
+//---------------------------------------------------------------------------
+// File_InsertPathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_InsertPathNode_internal(LIST* Root, LIST* parent, PATH_NODE* child)
+{
+    List_Insert_After(parent, NULL, child);
+
+    PATH_NODE* owner = File_GetPathOwner_internal(Root, parent);
+    if (!owner)
+        return;
+
+    if (owner->buckets && (ULONG)parent->count <= owner->bucket_count * 2) {
+        ULONG idx = child->hash & (owner->bucket_count - 1);
+        child->hash_next = owner->buckets[idx];
+        owner->buckets[idx] = child;
+    }
+    else if (parent->count >= FILE_PATH_HASH_MIN)
+        File_RehashPathNode_internal(owner);
+}
+
+
+//---------------------------------------------------------------------------
+// File_RemovePathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_RemovePathNode_internal(LIST* Root, LIST* parent, PATH_NODE* child)
+{
+    List_Remove(parent, child);
+
+    PATH_NODE* owner = File_GetPathOwner_internal(Root, parent);
+    if (!owner || !owner->buckets)
+        return;
+
+    PATH_NODE** link = &owner->buckets[child->hash & (owner->bucket_count - 1)];
+    while (*link && *link != child)
+        link = &(*link)->hash_next;
+    if (*link)
+        *link = child->hash_next;
+    child->hash_next = NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// File_FreePathNode_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_FreePathNode_internal(PATH_NODE* Node)
+{
+    File_ClearPathBranche_internal(&Node->items);
+    if (Node->relocation) Dll_Free(Node->relocation);
+    if (Node->buckets) Dll_Free(Node->buckets);
+    Dll_Free(Node);
+}
+
+
 //---------------------------------------------------------------------------
 // File_GetPathNode_internal
 //---------------------------------------------------------------------------
 
 
-_FX PATH_NODE* File_GetPathNode_internal(LIST* parent, const WCHAR* name, ULONG name_len, BOOLEAN can_add) 
+_FX PATH_NODE* File_GetPathNode_internal(LIST* Root, LIST* parent, const WCHAR* name, ULONG name_len, BOOLEAN can_add) 
 {
+    PATH_NODE* owner = File_GetPathOwner_internal(Root, parent);
     PATH_NODE* child;
-    
-    child = List_Head(parent);
-    while (child) {
+    ULONG hash = File_HashPathName_internal(name, name_len);
 
-        if (child->name_len == name_len && _wcsnicmp(child->name, name, name_len) == 0)
-            break;
+    if (owner && owner->buckets) {
 
-        child = List_Next(child);
+        child = owner->buckets[hash & (owner->bucket_count - 1)];
+        while (child) {
+
+            if (child->hash == hash && child->name_len == name_len && _wcsnicmp(child->name, name, name_len) == 0)
+                break;
+
+            child = child->hash_next;
+        }
+
+    } else {
+
+        child = List_Head(parent);
+        while (child) {
+
+            if (child->hash == hash && child->name_len == name_len && _wcsnicmp(child->name, name, name_len) == 0)
+                break;
+
+            child = List_Next(child);
+        }
     }
 
     if (!child && can_add) {
@@ -145,11 +336,12 @@ _FX PATH_NODE* File_GetPathNode_internal(LIST* parent, const WCHAR* name, ULONG
         child = Dll_Alloc(sizeof(PATH_NODE) + name_len*sizeof(WCHAR));
         memzero(child, sizeof(PATH_NODE));
         //List_Init(child->items); // done by memzero
+        child->hash = hash;
         child->name_len = name_len;
         wmemcpy(child->name, name, name_len);
         child->name[name_len] = L'\0';
 
-        List_Insert_After(parent, NULL, child);
+        File_InsertPathNode_internal(Root, parent, child);
     }
 
     return child;
@@ -172,7 +364,7 @@ _FX PATH_NODE* File_FindPathBranche_internal(LIST* Root, const WCHAR* Path, LIST
             continue;
         if(!next) next = wcschr(ptr, L'\0'); // last
         
-        Node = File_GetPathNode_internal(Parent, ptr, (ULONG)(next - ptr), can_add);
+        Node = File_GetPathNode_internal(Root, Parent, ptr, (ULONG)(next - ptr), can_add);
         if (!Node)
             return NULL;
 
@@ -194,7 +386,7 @@ _FX PATH_NODE* File_FindPathBranche_internal(LIST* Root, const WCHAR* Path, LIST
 
 _FX VOID File_SetPathFlags_internal(LIST* Root, const WCHAR* Path, ULONG setFlags, ULONG clrFlags, const WCHAR* Relocation)
 {
-    PATH_NODE* Parent = Root;
+    LIST* Parent = Root;
     PATH_NODE* Node;
     const WCHAR* next;
     for (const WCHAR* ptr = Path; *ptr; ptr = next + 1) {
@@ -203,7 +395,7 @@ _FX VOID File_SetPathFlags_internal(LIST* Root, const WCHAR* Path, ULONG setFlag
             continue;
         if(!next) next = wcschr(ptr, L'\0'); // last
         
-        Node = File_GetPathNode_internal(Parent, ptr, (ULONG)(next - ptr), TRUE);
+        Node = File_GetPathNode_internal(Root, Parent, ptr, (ULONG)(next - ptr), TRUE);
 
         if (*next == L'\0') { // set flag always on the last element only
 
@@ -251,7 +443,7 @@ _FX ULONG File_GetPathFlags_internal(LIST* Root, const WCHAR* Path, WCHAR** pRel
             continue;
         if(!next) next = wcschr(ptr, L'\0'); // last
         
-        Node = File_GetPathNode_internal(Parent, ptr, (ULONG)(next - ptr), FALSE);
+        Node = File_GetPathNode_internal(Root, Parent, ptr, (ULONG)(next - ptr), FALSE);
         if (!Node)
             break;
 
@@ -406,6 +598,17 @@ _FX ULONG File_GetPathFlags(const WCHAR* Path, WCHAR** pRelocation)
 
 
 _FX VOID File_AppendPathEntry_internal(HANDLE hPathsFile, const WCHAR* Path, ULONG SetFlags, const WCHAR* Relocation, WCHAR* (*TranslatePath)(const WCHAR*))
+{
+    File_AppendPathEntryEx_internal(hPathsFile, Path, SetFlags, Relocation, NULL, TranslatePath);
+}
+
+
+//---------------------------------------------------------------------------
+// File_AppendPathEntryEx_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_AppendPathEntryEx_internal(HANDLE hPathsFile, const WCHAR* Path, ULONG SetFlags, const WCHAR* Relocation, const WCHAR* MovedFrom, WCHAR* (*TranslatePath)(const WCHAR*))
 {
     const WCHAR CrLf[] = L"\r\n";
     WCHAR FlagStr[16] = L"|";
@@ -429,6 +632,20 @@ _FX VOID File_AppendPathEntry_internal(HANDLE hPathsFile, const WCHAR* Path, ULO
         WCHAR* RelocationEx = TranslatePath ? TranslatePath(Relocation) : NULL;
         NtWriteFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, RelocationEx ? RelocationEx : (WCHAR*)Relocation, wcslen(RelocationEx ? RelocationEx : Relocation) * sizeof(WCHAR), NULL, NULL);
         if (RelocationEx) Dll_Free(RelocationEx);
+
+        //
+        // a journal record for a move carries the moved path in a 4th field,
+        // readers which only look at the first three see a plain relocation
+        //
+
+        if (MovedFrom != NULL) {
+
+            NtWriteFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, FlagStr, sizeof(WCHAR), NULL, NULL); // write |
+
+            WCHAR* MovedFromEx = TranslatePath ? TranslatePath(MovedFrom) : NULL;
+            NtWriteFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, MovedFromEx ? MovedFromEx : (WCHAR*)MovedFrom, wcslen(MovedFromEx ? MovedFromEx : MovedFrom) * sizeof(WCHAR), NULL, NULL);
+            if (MovedFromEx) Dll_Free(MovedFromEx);
+        }
     }
 
     // write line ending
@@ -533,10 +750,35 @@ _FX BOOLEAN File_OpenDataFile(const WCHAR* name, HANDLE* hPathsFile, BOOLEAN App
 
 
 _FX VOID File_SavePathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *))
+{
+    File_SavePathTreeEx_internal(Root, name, 0, TranslatePath);
+}
+
+
+//---------------------------------------------------------------------------
+// File_SavePathTreeEx_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_SavePathTreeEx_internal(LIST* Root, const WCHAR* name, ULONG Epoch, WCHAR* (*TranslatePath)(const WCHAR *))
 {
     HANDLE hPathsFile;
     if (!File_OpenDataFile(name, &hPathsFile, FALSE))
         return;
+
+    //
+    // the epoch line has an empty path, so readers skip it, it lets us tell
+    // if a file was only appended to or rewritten since we last read it
+    //
+
+    if (Epoch) {
+
+        WCHAR EpochStr[32];
+        Sbie_snwprintf(EpochStr, ARRAYSIZE(EpochStr), L"|0|%08X\r\n", Epoch);
+
+        IO_STATUS_BLOCK IoStatusBlock;
+        NtWriteFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, EpochStr, wcslen(EpochStr) * sizeof(WCHAR), NULL, NULL);
+    }
     
     WCHAR* Path = (WCHAR *)Dll_Alloc((0x7FFF + 1)*sizeof(WCHAR)); // max nt path
 
@@ -548,6 +790,238 @@ _FX VOID File_SavePathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*Tran
 }
 
 
+//---------------------------------------------------------------------------
+// File_MeasurePathCache_internal
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_MeasurePathCache_internal(LIST* parent)
+{
+    ULONG size = 0;
+
+    PATH_NODE* child = List_Head(parent);
+    while (child) {
+
+        ULONG relocation_len = child->relocation ? wcslen(child->relocation) : 0;
+
+        size += sizeof(PATH_CACHE_ENTRY) + FILE_PATH_CACHE_ALIGN((child->name_len + relocation_len) * sizeof(WCHAR));
+        size += File_MeasurePathCache_internal(&child->items);
+
+        child = List_Next(child);
+    }
+
+    return size;
+}
+
+
+//---------------------------------------------------------------------------
+// File_WritePathCache_internal
+//---------------------------------------------------------------------------
+
+
+_FX UCHAR* File_WritePathCache_internal(LIST* parent, UCHAR* ptr)
+{
+    PATH_NODE* child = List_Head(parent);
+    while (child) {
+
+        PATH_CACHE_ENTRY* entry = (PATH_CACHE_ENTRY*)ptr;
+        entry->flags = child->flags;
+        entry->count = child->items.count;
+        entry->name_len = (USHORT)child->name_len;
+        entry->relocation_len = (USHORT)(child->relocation ? wcslen(child->relocation) : 0);
+
+        WCHAR* str = (WCHAR*)(entry + 1);
+        wmemcpy(str, child->name, entry->name_len);
+        if (entry->relocation_len)
+            wmemcpy(str + entry->name_len, child->relocation, entry->relocation_len);
+
+        ptr += sizeof(PATH_CACHE_ENTRY) + FILE_PATH_CACHE_ALIGN((entry->name_len + entry->relocation_len) * sizeof(WCHAR));
+        ptr = File_WritePathCache_internal(&child->items, ptr);
+
+        child = List_Next(child);
+    }
+
+    return ptr;
+}
+
+
+//---------------------------------------------------------------------------
+// File_SavePathCache_internal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_SavePathCache_internal(LIST* Root, const WCHAR* name, ULONG64 TextSize, ULONG64 TextDate, ULONG64 BaseSize, ULONG DriveHash, ULONG Epoch)
+{
+    //
+    // the binary snapshot holds the already translated tree in pre-order,
+    // it is only a cache, the text file remains the authoritative record
+    //
+
+    HANDLE hCacheFile;
+    if (!File_OpenDataFile(name, &hCacheFile, FALSE))
+        return;
+
+    ULONG size = sizeof(PATH_CACHE_HEADER) + File_MeasurePathCache_internal(Root);
+    UCHAR* Buffer = (UCHAR*)Dll_Alloc(size);
+
+    PATH_CACHE_HEADER* header = (PATH_CACHE_HEADER*)Buffer;
+    header->magic = FILE_PATH_CACHE_MAGIC;
+    header->version = FILE_PATH_CACHE_VERSION;
+    header->text_size = TextSize;
+    header->text_date = TextDate;
+    header->base_size = BaseSize;
+    header->drive_hash = DriveHash;
+    header->epoch = Epoch;
+    header->count = Root->count;
+
+    File_WritePathCache_internal(Root, (UCHAR*)(header + 1));
+
+    IO_STATUS_BLOCK IoStatusBlock;
+    NtWriteFile(hCacheFile, NULL, NULL, NULL, &IoStatusBlock, Buffer, size, NULL, NULL);
+
+    Dll_Free(Buffer);
+
+    NtClose(hCacheFile);
+}
+
+
+//---------------------------------------------------------------------------
+// File_ReadPathCache_internal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_ReadPathCache_internal(LIST* Root, LIST* parent, ULONG count, UCHAR** pptr, UCHAR* end)
+{
+    for (ULONG i = 0; i < count; i++) {
+
+        PATH_CACHE_ENTRY* entry = (PATH_CACHE_ENTRY*)*pptr;
+        if ((UCHAR*)(entry + 1) > end)
+            return FALSE;
+
+        ULONG str_size = FILE_PATH_CACHE_ALIGN((entry->name_len + entry->relocation_len) * sizeof(WCHAR));
+        if ((UCHAR*)(entry + 1) + str_size > end || entry->name_len == 0)
+            return FALSE;
+        *pptr = (UCHAR*)(entry + 1) + str_size;
+
+        const WCHAR* str = (const WCHAR*)(entry + 1);
+
+        PATH_NODE* child = Dll_Alloc(sizeof(PATH_NODE) + entry->name_len*sizeof(WCHAR));
+        memzero(child, sizeof(PATH_NODE));
+        child->flags = entry->flags;
+        child->hash = File_HashPathName_internal(str, entry->name_len);
+        child->name_len = entry->name_len;
+        wmemcpy(child->name, str, entry->name_len);
+        child->name[entry->name_len] = L'\0';
+
+        if (entry->relocation_len) {
+            child->relocation = Dll_Alloc((entry->relocation_len + 1) * sizeof(WCHAR));
+            wmemcpy(child->relocation, str + entry->name_len, entry->relocation_len);
+            child->relocation[entry->relocation_len] = L'\0';
+        }
+
+        File_InsertPathNode_internal(Root, parent, child);
+
+        if (!File_ReadPathCache_internal(Root, &child->items, entry->count, pptr, end))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_LoadPathCache_internal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_LoadPathCache_internal(LIST* Root, const WCHAR* name, ULONG64 TextSize, ULONG64 TextDate, ULONG DriveHash, ULONG* pEpoch, ULONG64* pCacheSize, ULONG64* pBaseSize)
+{
+    //
+    // the snapshot is also usable when records were appended to the text
+    // file since, the caller then applies the tail starting at *pCacheSize
+    //
+
+    WCHAR CacheFile[MAX_PATH] = { 0 };
+    wcscpy(CacheFile, Dll_BoxFilePath);
+    wcscat(CacheFile, L"\\");
+    wcscat(CacheFile, name);
+
+    UNICODE_STRING objname;
+    RtlInitUnicodeString(&objname, CacheFile);
+
+    OBJECT_ATTRIBUTES objattrs;
+    InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    HANDLE hCacheFile;
+    IO_STATUS_BLOCK IoStatusBlock;
+    if (!NT_SUCCESS(NtCreateFile(&hCacheFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0)))
+        return FALSE;
+
+    BOOLEAN ok = FALSE;
+
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(hCacheFile, &fileSize) && fileSize.QuadPart >= sizeof(PATH_CACHE_HEADER) && fileSize.QuadPart < 0x40000000) {
+
+        UCHAR* Buffer = (UCHAR*)Dll_Alloc((ULONG)fileSize.QuadPart);
+        DWORD bytesRead;
+        if (ReadFile(hCacheFile, Buffer, (DWORD)fileSize.QuadPart, &bytesRead, NULL) && bytesRead == (DWORD)fileSize.QuadPart) {
+
+            PATH_CACHE_HEADER* header = (PATH_CACHE_HEADER*)Buffer;
+            if (header->magic == FILE_PATH_CACHE_MAGIC && header->version == FILE_PATH_CACHE_VERSION && header->drive_hash == DriveHash
+              && ((header->text_size == TextSize && header->text_date == TextDate) || (header->epoch != 0 && header->text_size < TextSize))) {
+
+                File_ClearPathBranche_internal(Root);
+
+                UCHAR* ptr = (UCHAR*)(header + 1);
+                ok = File_ReadPathCache_internal(Root, Root, header->count, &ptr, Buffer + bytesRead);
+                if (!ok)
+                    File_ClearPathBranche_internal(Root);
+                else {
+                    *pEpoch = header->epoch;
+                    *pCacheSize = header->text_size;
+                    *pBaseSize = header->base_size;
+                }
+            }
+        }
+
+        Dll_Free(Buffer);
+    }
+
+    NtClose(hCacheFile);
+
+    return ok;
+}
+
+
+//---------------------------------------------------------------------------
+// File_GetDriveHash
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_GetDriveHash()
+{
+    //
+    // the snapshot contains translated nt paths, so it is only valid
+    // as long as the drive letters map to the same devices
+    //
+
+    ULONG hash = 5381 ^ File_DriveAddSN;
+    for (WCHAR letter = L'A'; letter <= L'Z'; letter++) {
+
+        FILE_DRIVE* drive = File_GetDriveForLetter(letter);
+        if (!drive)
+            continue;
+
+        hash = ((hash << 5) + hash) ^ letter;
+        hash = ((hash << 5) + hash) ^ File_HashPathName_internal(drive->path, drive->len);
+        hash = ((hash << 5) + hash) ^ File_HashPathName_internal(drive->sn, wcslen(drive->sn));
+
+        LeaveCriticalSection(File_DrivesAndLinks_CritSec);
+    }
+    return hash;
+}
+
+
 //---------------------------------------------------------------------------
 // File_TranslateNtToDosPathForDatFile
 //---------------------------------------------------------------------------
@@ -635,9 +1109,23 @@ _FX BOOLEAN File_SavePathTree()
 {
     EnterCriticalSection(File_PathRoot_CritSec);
 
-    File_SavePathTree_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_TranslateNtToDosPathForDatFile);
+    //
+    // every full rewrite starts a new epoch, processes which still track
+    // the old one will then reload the whole file instead of its tail
+    //
+
+    ULONG Epoch = GetTickCount() ^ (Dll_ProcessId << 16);
+    if (Epoch == 0 || Epoch == File_PathsEpoch)
+        Epoch = File_PathsEpoch + 1;
+    File_PathsEpoch = Epoch;
 
-    File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
+    File_SavePathTreeEx_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_PathsEpoch, File_TranslateNtToDosPathForDatFile);
+
+    if (File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL)) {
+
+        File_PathsBaseSize = File_PathsFileSize;
+        File_SavePathCache_internal(&File_PathRoot, FILE_PATH_CACHE_NAME, File_PathsFileSize, File_PathsFileDate, File_PathsBaseSize, File_GetDriveHash(), File_PathsEpoch);
+    }
 
     LeaveCriticalSection(File_PathRoot_CritSec);
 
@@ -679,41 +1167,12 @@ _FX void File_ReleaseMutex(HANDLE hMutex)
 
 
 //---------------------------------------------------------------------------
-// File_LoadPathTree_internal
+// File_ApplyPathEntries_internal
 //---------------------------------------------------------------------------
 
 
-_FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *))
+_FX VOID File_ApplyPathEntries_internal(LIST* Root, WCHAR* Buffer, WCHAR* (*TranslatePath)(const WCHAR *))
 {
-    WCHAR PathsFile[MAX_PATH] = { 0 };
-    wcscpy(PathsFile, Dll_BoxFilePath);
-    wcscat(PathsFile, L"\\");
-    wcscat(PathsFile, name);
-
-    UNICODE_STRING objname;
-    RtlInitUnicodeString(&objname, PathsFile);
-
-    OBJECT_ATTRIBUTES objattrs;
-    InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
-
-    HANDLE hPathsFile;
-    IO_STATUS_BLOCK IoStatusBlock;
-    if (!NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0))) {
-        if (NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_WRITE | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_CREATE, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0)))
-            NtClose(hPathsFile);
-        return FALSE;
-    }
-
-    File_ClearPathBranche_internal(Root);
-
-    LARGE_INTEGER fileSize;
-    GetFileSizeEx(hPathsFile, &fileSize);
-
-    WCHAR* Buffer = (WCHAR *)Dll_Alloc((ULONG)fileSize.QuadPart + 128);
-    DWORD bytesRead;
-    ReadFile(hPathsFile, Buffer, (DWORD)fileSize.QuadPart, &bytesRead, NULL);
-    Buffer[bytesRead/sizeof(WCHAR)] = L'\0';
-
     WCHAR* Next = Buffer;
     while (*Next) {
         WCHAR* Line = Next;
@@ -734,26 +1193,141 @@ _FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*T
 
         WCHAR* Sep = wcschr(Line, L'|');
         if (!Sep || Sep > Next) continue; // invalid line, flags field missing
+        if (Sep == Path) continue; // epoch line
         *Sep = L'\0';
 
         WCHAR* Relocation = NULL;
+        WCHAR* MovedFrom = NULL;
 
         WCHAR* endptr;
         ULONG Flags = wcstoul(Sep + 1, &endptr, 16);
-        if (endptr && *endptr == L'|') 
+        if (endptr && *endptr == L'|') {
             Relocation = endptr + 1;
+            MovedFrom = wcschr(Relocation, L'|');
+            if (MovedFrom)
+                *MovedFrom++ = L'\0';
+        }
 
         WCHAR* PathEx = TranslatePath ? TranslatePath(Path) : NULL;
         WCHAR* RelocationEx = TranslatePath ? TranslatePath(Relocation) : NULL;
+        WCHAR* MovedFromEx = TranslatePath ? TranslatePath(MovedFrom) : NULL;
+
+        //
+        // a full save lists every node in pre-order, replaying the appended
+        // records with the original operations yields the same tree for those.
+        // a move is replayed from the moved path, the relocation field holds
+        // the already resolved target for readers which do not know of moves
+        //
 
-        File_SetPathFlags_internal(Root, PathEx ? PathEx : Path, Flags, 0, RelocationEx ? RelocationEx : Relocation);
+        if (MovedFrom && (Flags & FILE_RELOCATION_FLAG) != 0)
+            File_SetRelocation_internal(Root, MovedFromEx ? MovedFromEx : MovedFrom, PathEx ? PathEx : Path);
+        else if (Flags == FILE_DELETED_FLAG && !Relocation)
+            File_MarkDeleted_internal(Root, PathEx ? PathEx : Path, NULL);
+        else
+            File_SetPathFlags_internal(Root, PathEx ? PathEx : Path, Flags, 0, RelocationEx ? RelocationEx : Relocation);
 
         if (PathEx) Dll_Free(PathEx);
         if (RelocationEx) Dll_Free(RelocationEx);
+        if (MovedFromEx) Dll_Free(MovedFromEx);
 
+        if (MovedFrom) MovedFrom[-1] = L'|';
         *Sep = L'|';
         Line[LineLen] = savechar;
     }
+}
+
+
+//---------------------------------------------------------------------------
+// File_ParsePathEpoch_internal
+//---------------------------------------------------------------------------
+
+
+_FX ULONG File_ParsePathEpoch_internal(const WCHAR* Buffer)
+{
+    if (wcsncmp(Buffer, L"|0|", 3) != 0)
+        return 0;
+    return wcstoul(Buffer + 3, NULL, 16);
+}
+
+
+//---------------------------------------------------------------------------
+// File_LoadPathTree_internal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_LoadPathTree_internal(LIST* Root, const WCHAR* name, WCHAR* (*TranslatePath)(const WCHAR *))
+{
+    return File_LoadPathTreeEx_internal(Root, name, 0, NULL, TranslatePath);
+}
+
+
+//---------------------------------------------------------------------------
+// File_LoadPathTreeEx_internal
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_LoadPathTreeEx_internal(LIST* Root, const WCHAR* name, ULONG64 Offset, ULONG* pEpoch, WCHAR* (*TranslatePath)(const WCHAR *))
+{
+    //
+    // with Offset == 0 the tree is replaced with the file content,
+    // otherwise only the records appended past Offset are applied,
+    // this fails if the file was rewritten in the mean time
+    //
+
+    WCHAR PathsFile[MAX_PATH] = { 0 };
+    wcscpy(PathsFile, Dll_BoxFilePath);
+    wcscat(PathsFile, L"\\");
+    wcscat(PathsFile, name);
+
+    UNICODE_STRING objname;
+    RtlInitUnicodeString(&objname, PathsFile);
+
+    OBJECT_ATTRIBUTES objattrs;
+    InitializeObjectAttributes(&objattrs, &objname, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    HANDLE hPathsFile;
+    IO_STATUS_BLOCK IoStatusBlock;
+    if (!NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_READ | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_OPEN, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0))) {
+        if (Offset == 0 && NT_SUCCESS(NtCreateFile(&hPathsFile, GENERIC_WRITE | SYNCHRONIZE, &objattrs, &IoStatusBlock, NULL, 0, FILE_SHARE_READ, FILE_CREATE, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE, NULL, 0)))
+            NtClose(hPathsFile);
+        return FALSE;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(hPathsFile, &fileSize);
+
+    LARGE_INTEGER ByteOffset;
+
+    if (Offset != 0) {
+
+        WCHAR EpochStr[16];
+        ByteOffset.QuadPart = 0;
+        if (!pEpoch || *pEpoch == 0 || (ULONG64)fileSize.QuadPart < Offset
+          || !NT_SUCCESS(NtReadFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, EpochStr, sizeof(EpochStr) - sizeof(WCHAR), &ByteOffset, NULL))) {
+            NtClose(hPathsFile);
+            return FALSE;
+        }
+        EpochStr[IoStatusBlock.Information / sizeof(WCHAR)] = L'\0';
+
+        if (File_ParsePathEpoch_internal(EpochStr) != *pEpoch) {
+            NtClose(hPathsFile);
+            return FALSE;
+        }
+
+    } else
+        File_ClearPathBranche_internal(Root);
+
+    ULONG Length = (ULONG)(fileSize.QuadPart - Offset);
+    WCHAR* Buffer = (WCHAR *)Dll_Alloc(Length + 128);
+    ByteOffset.QuadPart = Offset;
+    if (!NT_SUCCESS(NtReadFile(hPathsFile, NULL, NULL, NULL, &IoStatusBlock, Buffer, Length, &ByteOffset, NULL)))
+        IoStatusBlock.Information = 0;
+    Buffer[IoStatusBlock.Information / sizeof(WCHAR)] = L'\0';
+
+    if (Offset == 0 && pEpoch)
+        *pEpoch = File_ParsePathEpoch_internal(Buffer);
+
+    File_ApplyPathEntries_internal(Root, Buffer, TranslatePath);
 
     Dll_Free(Buffer);
 
@@ -834,7 +1408,41 @@ _FX BOOLEAN File_LoadPathTree()
 
     EnterCriticalSection(File_PathRoot_CritSec);
 
-    File_LoadPathTree_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_TranslateDosToNtPathForDatFile);
+    //
+    // load the binary snapshot and apply the records appended to the text
+    // file since it was taken, if that is not possible parse the whole file,
+    // in both cases create a new snapshot for the next process
+    //
+
+    ULONG64 PathsFileSize = 0;
+    ULONG64 PathsFileDate = 0;
+    BOOLEAN HasAttributes = File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL);
+    ULONG DriveHash = File_GetDriveHash();
+
+    ULONG64 CacheSize = 0;
+    BOOLEAN UpdateCache = TRUE;
+
+    if (HasAttributes && File_LoadPathCache_internal(&File_PathRoot, FILE_PATH_CACHE_NAME, PathsFileSize, PathsFileDate, DriveHash, &File_PathsEpoch, &CacheSize, &File_PathsBaseSize)) {
+
+        if (CacheSize == PathsFileSize)
+            UpdateCache = FALSE;
+        else if (!File_LoadPathTreeEx_internal(&File_PathRoot, FILE_PATH_FILE_NAME, CacheSize, &File_PathsEpoch, File_TranslateDosToNtPathForDatFile))
+            CacheSize = 0;
+    }
+
+    if (CacheSize == 0) {
+
+        File_PathsEpoch = 0;
+        if (!File_LoadPathTreeEx_internal(&File_PathRoot, FILE_PATH_FILE_NAME, 0, &File_PathsEpoch, File_TranslateDosToNtPathForDatFile))
+            UpdateCache = FALSE;
+        File_PathsBaseSize = PathsFileSize;
+    }
+
+    if (UpdateCache && HasAttributes)
+        File_SavePathCache_internal(&File_PathRoot, FILE_PATH_CACHE_NAME, PathsFileSize, PathsFileDate, File_PathsBaseSize, DriveHash, File_PathsEpoch);
+
+    File_PathsFileSize = PathsFileSize;
+    File_PathsFileDate = PathsFileDate;
 
     LeaveCriticalSection(File_PathRoot_CritSec);
 
@@ -858,16 +1466,88 @@ _FX VOID File_RefreshPathTree()
         if (File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
             && (File_PathsFileSize != PathsFileSize || File_PathsFileDate != PathsFileDate)) {
 
-            File_PathsFileSize = PathsFileSize;
-            File_PathsFileDate = PathsFileDate;
-
             //
-            // something changed, reload the path tree
+            // something changed, update the path tree
             //
 
+            HANDLE hMutex = File_AcquireMutex(FILE_VFS_MUTEX);
+
+            File_SyncPathTree();
+
+            File_ReleaseMutex(hMutex);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// File_SyncPathTree
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_SyncPathTree()
+{
+    //
+    // the caller must hold FILE_VFS_MUTEX, as long as the file was only
+    // appended to since we last read it, apply just the new records
+    //
+
+    EnterCriticalSection(File_PathRoot_CritSec);
+
+    ULONG64 PathsFileSize = 0;
+    ULONG64 PathsFileDate = 0;
+    if (File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
+        && (File_PathsFileSize != PathsFileSize || File_PathsFileDate != PathsFileDate)) {
+
+        if (PathsFileSize > File_PathsFileSize && File_LoadPathTreeEx_internal(&File_PathRoot, FILE_PATH_FILE_NAME, File_PathsFileSize, &File_PathsEpoch, File_TranslateDosToNtPathForDatFile)) {
+
+            File_PathsFileSize = PathsFileSize;
+            File_PathsFileDate = PathsFileDate;
+        }
+        else
             File_LoadPathTree();
+    }
+
+    LeaveCriticalSection(File_PathRoot_CritSec);
+}
+
+
+//---------------------------------------------------------------------------
+// File_AppendPathJournal
+//---------------------------------------------------------------------------
+
+
+_FX VOID File_AppendPathJournal(const WCHAR* Path, ULONG Flags, const WCHAR* Relocation, const WCHAR* MovedFrom)
+{
+    //
+    // the caller must hold FILE_VFS_MUTEX and have the tree in sync with
+    // the file, append a single record if possible instead of re creating
+    // the entire file, compact it once the records pile up
+    //
+
+    EnterCriticalSection(File_PathRoot_CritSec);
+
+    ULONG64 PathsFileSize = 0;
+    ULONG64 PathsFileDate = 0;
+    if (File_PathsEpoch != 0
+        && File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
+        && (File_PathsFileSize == PathsFileSize && File_PathsFileDate == PathsFileDate)
+        && PathsFileSize < File_PathsBaseSize * 2 + FILE_PATH_JOURNAL_SLACK) {
+
+        HANDLE hPathsFile;
+        if (File_OpenDataFile(FILE_PATH_FILE_NAME, &hPathsFile, TRUE))
+        {
+            File_AppendPathEntryEx_internal(hPathsFile, Path, Flags, Relocation, MovedFrom, File_TranslateNtToDosPathForDatFile);
+
+            NtClose(hPathsFile);
+
+            File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
         }
     }
+    else
+        File_SavePathTree();
+
+    LeaveCriticalSection(File_PathRoot_CritSec);
 }
 
 
@@ -889,8 +1569,6 @@ _FX BOOLEAN File_InitDelete_v2()
 //    File_SavePathTree();
 //#endif
 
-    File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
-
     File_InitBoxRootWatcher();
 
     return TRUE;
@@ -977,11 +1655,9 @@ _FX BOOLEAN File_MarkDeleted_internal(LIST* Root, const WCHAR* Path, BOOLEAN* pT
         if (Node->flags == FILE_DELETED_FLAG && Node->items.count == 0)
             return FALSE; // already marked deleted
 
-        List_Remove(Parent, Node);
+        File_RemovePathNode_internal(Root, Parent, Node);
 
-        File_ClearPathBranche_internal(&Node->items);
-        if (Node->relocation) Dll_Free(Node->relocation);
-        Dll_Free(Node);
+        File_FreePathNode_internal(Node);
         if (pTruncated) *pTruncated = TRUE;
     }
 
@@ -1010,37 +1686,19 @@ _FX NTSTATUS File_MarkDeleted_v2(const WCHAR* TruePath)
 
     EnterCriticalSection(File_PathRoot_CritSec);
 
+    File_SyncPathTree();
+
     const WCHAR* Path = File_NormalizePath(TruePath, NORM_NAME_BUFFER);
-    BOOLEAN bTruncated = FALSE;
-    BOOLEAN bSet = File_MarkDeleted_internal(&File_PathRoot, Path, &bTruncated);
+    BOOLEAN bSet = File_MarkDeleted_internal(&File_PathRoot, Path, NULL);
 
-    LeaveCriticalSection(File_PathRoot_CritSec);
+    //
+    // replaying the record drops the children just like we did here
+    //
 
     if (bSet)
-    {
-        //
-        // Optimization: When marking a lot of host files as deleted, only append single line entries if possible instead of re creating the entire file
-        //
-
-        ULONG64 PathsFileSize = 0;
-        ULONG64 PathsFileDate = 0;
-        if (!bTruncated 
-            && File_GetAttributes_internal(FILE_PATH_FILE_NAME, &PathsFileSize, &PathsFileDate, NULL)
-            && (File_PathsFileSize == PathsFileSize && File_PathsFileDate == PathsFileDate)) {
+        File_AppendPathJournal(Path, FILE_DELETED_FLAG, NULL, NULL);
 
-            HANDLE hPathsFile;
-            if (File_OpenDataFile(FILE_PATH_FILE_NAME, &hPathsFile, TRUE))
-            {
-                File_AppendPathEntry_internal(hPathsFile, Path, FILE_DELETED_FLAG, NULL, File_TranslateNtToDosPathForDatFile);
-
-                NtClose(hPathsFile);
-
-                File_GetAttributes_internal(FILE_PATH_FILE_NAME, &File_PathsFileSize, &File_PathsFileDate, NULL);
-            }
-        }
-        else
-            File_SavePathTree();
-    }
+    LeaveCriticalSection(File_PathRoot_CritSec);
 
     File_ReleaseMutex(hMutex);
 
@@ -1143,9 +1801,9 @@ _FX VOID File_SetRelocation_internal(LIST* Root, const WCHAR *OldTruePath, const
 
             PATH_NODE* next_child = List_Next(child);
 
-            List_Remove(&Node->items, child);
+            File_RemovePathNode_internal(Root, &Node->items, child);
                 
-            List_Insert_After(&NewNode->items, NULL, child);
+            File_InsertPathNode_internal(Root, &NewNode->items, child);
 
             child = next_child;
         }
@@ -1179,11 +1837,36 @@ _FX NTSTATUS File_SetRelocation(const WCHAR* OldTruePath, const WCHAR* NewTruePa
 
     EnterCriticalSection(File_PathRoot_CritSec);
 
-    File_SetRelocation_internal(&File_PathRoot, File_NormalizePath(OldTruePath, NORM_NAME_BUFFER), File_NormalizePath(NewTruePath, MISC_NAME_BUFFER));
+    File_SyncPathTree();
 
-    LeaveCriticalSection(File_PathRoot_CritSec);
+    //
+    // File_SetRelocation_internal reuses the name buffers, so keep a copy
+    // of both paths for the journal record
+    //
+
+    const WCHAR* OldPath = File_NormalizePath(OldTruePath, NORM_NAME_BUFFER);
+    WCHAR* OldCopy = Dll_Alloc((wcslen(OldPath) + 1) * sizeof(WCHAR));
+    wcscpy(OldCopy, OldPath);
+
+    const WCHAR* NewPath = File_NormalizePath(NewTruePath, MISC_NAME_BUFFER);
+    WCHAR* NewCopy = Dll_Alloc((wcslen(NewPath) + 1) * sizeof(WCHAR));
+    wcscpy(NewCopy, NewPath);
+
+    File_SetRelocation_internal(&File_PathRoot, OldCopy, NewCopy);
 
-    File_SavePathTree();
+    //
+    // journal the resolved target, when the old path was itself relocated
+    // the new path points to the original true path, not to the old one
+    //
+
+    PATH_NODE* NewNode = File_FindPathBranche_internal(&File_PathRoot, NewCopy, NULL, FALSE);
+    if (NewNode && (NewNode->flags & FILE_RELOCATION_FLAG) != 0 && NewNode->relocation)
+        File_AppendPathJournal(NewCopy, FILE_RELOCATION_FLAG, NewNode->relocation, OldCopy);
+
+    Dll_Free(OldCopy);
+    Dll_Free(NewCopy);
+
+    LeaveCriticalSection(File_PathRoot_CritSec);
 
     File_ReleaseMutex(hMutex);
 
@@ -24,6 +24,7 @@
 #include "common/pool.h"
 #include "common/map.h"
 #include "common/pattern.h"
+#include "common/rbtree.h"
 
 //---------------------------------------------------------------------------
 // Structures and Types
@@ -41,6 +42,24 @@ typedef struct _FILE_MERGE_CACHE_FILE {
 } FILE_MERGE_CACHE_FILE;
 
 
+typedef struct _FILE_MERGE_CACHE_NODE {
+
+    rbnode_t node;
+    FILE_MERGE_CACHE_FILE *cache_file;
+    ULONG seq;              // arrival order, orders entries with equal names
+
+} FILE_MERGE_CACHE_NODE;
+
+
+typedef struct _FILE_MERGE_CACHE_SORT {
+
+    rbtree_t tree;
+    POOL *pool;             // holds the nodes, only while the listing is read
+    ULONG seq;
+
+} FILE_MERGE_CACHE_SORT;
+
+
 typedef struct _FILE_MERGE_FILE {
 
     HANDLE handle;
@@ -70,6 +89,9 @@ typedef struct _FILE_MERGE {
     BOOLEAN cant_merge;
     BOOLEAN first_request;
 
+    LONG refs;              // one for File_DirHandles, one for each user
+    CRITICAL_SECTION lock;  // held while the merge is used
+
     UNICODE_STRING file_mask;
 	FILE_MERGE_FILE* files; // copy file, snapshot_1 file, snapshot_2 file, ..., true file
 	ULONG files_count;
@@ -142,13 +164,29 @@ static NTSTATUS File_MergeCache(
 
 static NTSTATUS File_MergeCacheWin2000(
     FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask,
-    FILE_ID_BOTH_DIR_INFORMATION *info_area, ULONG info_area_len);
+    FILE_ID_BOTH_DIR_INFORMATION *info_area, ULONG info_area_len,
+    FILE_MERGE_CACHE_SORT *sort);
 
 static NTSTATUS File_MergeDummy(
     WCHAR *TruePath, FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask);
 
+static int File_MergeCacheCompare(const void *key1, const void *key2);
+
+static BOOLEAN File_MergeCacheSortInit(FILE_MERGE_CACHE_SORT *sort);
+
+static NTSTATUS File_MergeCacheSortInsert(
+    FILE_MERGE_CACHE_SORT *sort, FILE_MERGE_CACHE_FILE *cache_file,
+    BOOLEAN InsertDuplicate);
+
+static void File_MergeCacheSortDone(
+    FILE_MERGE_CACHE_SORT *sort, LIST *cache_list);
+
 static void File_MergeFree(FILE_MERGE *merge);
 
+static void File_MergeRemove(FILE_MERGE *merge);
+
+static void File_MergeRelease(FILE_MERGE *merge);
+
 static NTSTATUS File_GetMergedInformation(
     FILE_MERGE *merge, WCHAR *TruePath, WCHAR *CopyPath,
     IO_STATUS_BLOCK *IoStatusBlock,
@@ -206,6 +244,7 @@ static WCHAR *File_CurDir_LastInput = NULL;
 static WCHAR *File_CurDir_LastOutput = NULL;
 
 static LIST File_DirHandles;
+static HASH_MAP File_DirHandleMap;
 static CRITICAL_SECTION File_DirHandles_CritSec;
 
 
@@ -394,7 +433,7 @@ _FX NTSTATUS File_NtQueryDirectoryFile(
         merge->first_request = FALSE;
     }
 
-    LeaveCriticalSection(&File_DirHandles_CritSec);
+    File_MergeRelease(merge);
     merge_lock = FALSE;
 
     if (Event)
@@ -418,7 +457,7 @@ _FX NTSTATUS File_NtQueryDirectoryFile(
     }
 
     if (merge_lock)
-        LeaveCriticalSection(&File_DirHandles_CritSec);
+        File_MergeRelease(merge);
 
     if (file_mask)
         Dll_Free(file_mask);
@@ -457,46 +496,27 @@ _FX NTSTATUS File_Merge(
     FILE_MERGE *merge;
 
     //
-    // if we have information cached for this handle, return it
+    // if we have information cached for this handle, return it.
+    // File_DirHandles_CritSec only guards the index of merges by handle,
+    // the merge itself has its own lock, which the caller keeps
     //
 
     TruePath_len = wcslen(TruePath) * sizeof(WCHAR);
 
     EnterCriticalSection(&File_DirHandles_CritSec);
 
-    merge = List_Head(&File_DirHandles);
-    while (merge) {
-
-        FILE_MERGE *next = List_Next(merge);
-
-        if (merge->handle == FileHandle) {
+    merge = map_get(&File_DirHandleMap, FileHandle);
 
-            if ((! RestartScan) &&
-                merge->name_len == TruePath_len &&
-                _wcsicmp(merge->name, TruePath) == 0) {
+    if (merge && (RestartScan ||
+                  merge->name_len != TruePath_len ||
+                  _wcsicmp(merge->name, TruePath) != 0)) {
 
-                //
-                // we found a cached entry for the same handle, and
-                // the same file path, so we are going to use it.
-                //
-
-                break;
-
-            } else {
-
-                Handle_UnRegisterHandler(merge->handle, File_NtCloseDir, NULL);
-                List_Remove(&File_DirHandles, merge);
-                File_MergeFree(merge);
-            }
-        }
-
-        merge = next;
+        File_MergeRemove(merge);
+        merge = NULL;
     }
 
     //
-    // if we don't have a merge entry, create one.  it is inserted
-    // at the end of the list, so the loop above always gets to
-    // look at all existing merge entries and discard stale ones
+    // if we don't have a merge entry, create one
     //
 
     if (! merge) {
@@ -511,6 +531,9 @@ _FX NTSTATUS File_Merge(
         merge->cant_merge = FALSE;
         merge->first_request = TRUE;
 
+        merge->refs = 1;
+        InitializeCriticalSection(&merge->lock);
+
         if (*FileMask) {
             RtlInitUnicodeString(&merge->file_mask, *FileMask);
             *FileMask = NULL;
@@ -528,9 +551,16 @@ _FX NTSTATUS File_Merge(
         }
 
         List_Insert_After(&File_DirHandles, NULL, merge);
+        map_insert(&File_DirHandleMap, FileHandle, merge, 0);
         Handle_RegisterHandler(merge->handle, File_NtCloseDir, NULL, FALSE);
     }
 
+    InterlockedIncrement(&merge->refs);
+
+    LeaveCriticalSection(&File_DirHandles_CritSec);
+
+    EnterCriticalSection(&merge->lock);
+
     //
     // open the directory for the true path
     //
@@ -562,11 +592,14 @@ _FX NTSTATUS File_Merge(
         status = STATUS_SUCCESS;
 
     //
-    // finish
+    // finish.  if we return STATUS_SUCCESS, the merge stays locked and
+    // referenced, and the caller has to release it with File_MergeRelease
     //
 
-    if (! NT_SUCCESS(status))
-        LeaveCriticalSection(&File_DirHandles_CritSec);
+    if (! NT_SUCCESS(status)) {
+        File_MergeRelease(merge);
+        merge = NULL;
+    }
 
     *out_merge = merge;
     return status;
@@ -1057,8 +1090,8 @@ _FX NTSTATUS File_MergeCache(
     FILE_ID_BOTH_DIR_INFORMATION *info_area;
     FILE_ID_BOTH_DIR_INFORMATION *info_ptr;
     LIST *cache_list;
+    FILE_MERGE_CACHE_SORT sort;
     FILE_MERGE_CACHE_FILE *cache_file;
-    FILE_MERGE_CACHE_FILE *ins_point;
     ULONG len;
     const ULONG INFO_AREA_LEN = 0x10000;  // the size used by cmd.exe
 
@@ -1101,6 +1134,11 @@ _FX NTSTATUS File_MergeCache(
     if (! info_area)
         return STATUS_INSUFFICIENT_RESOURCES;
 
+    if (! File_MergeCacheSortInit(&sort)) {
+        Pool_Free(info_area, INFO_AREA_LEN);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     //
     // read entire directory, build a sorted files list
     //
@@ -1137,7 +1175,7 @@ _FX NTSTATUS File_MergeCache(
                 //
 
                 status = File_MergeCacheWin2000(qfile, FileMask,
-                                                info_area, INFO_AREA_LEN);
+                                                info_area, INFO_AREA_LEN, &sort);
             }
 
             break;
@@ -1147,7 +1185,6 @@ _FX NTSTATUS File_MergeCache(
 
         info_ptr = info_area;
         while (1) {
-            int cmp;
 
             len = sizeof(FILE_MERGE_CACHE_FILE)
                 + info_ptr->FileNameLength;
@@ -1169,31 +1206,21 @@ _FX NTSTATUS File_MergeCache(
             cache_file->name_uni.MaximumLength = cache_file->name_uni.Length;
             cache_file->name_uni.Buffer = cache_file->info.FileName;
 
-            // insert file into the ordered list
+            // insert file into the ordered tree
+
+            status = File_MergeCacheSortInsert(&sort, cache_file, FALSE);
 
-            ins_point = List_Head(cache_list);
-            cmp = -1;
-            while (ins_point) {
-                cmp = RtlCompareUnicodeString(
-                    &ins_point->name_uni, &cache_file->name_uni,
-                    TRUE);                      // CaseInSensitive
-                if ( (cmp > 0) || (cmp == 0) )
-                    break;
-                ins_point = List_Next(ins_point);
-            }
             // There is a bug with Isilon drives.  NtQueryDirectoryFile does not return STATUS_NO_MORE_FILES but always returns STATUS_SUCCESS with the same file name.
-            // This causes an infinite loop in this code.  So, if the name_uni we just received is the same as what we just added to the list, assume it is the Isilon bug
+            // This causes an infinite loop in this code.  So, if the name_uni we just received is the same as what we already added to the list, assume it is the Isilon bug
             // and break out of this loop.
-            if (cmp == 0)
+            if (status == STATUS_OBJECT_NAME_COLLISION)
             {
                 status = STATUS_NO_MORE_FILES;
                 break;
             }
 
-            if (ins_point)
-                List_Insert_Before(cache_list, ins_point, cache_file);
-            else
-                List_Insert_After(cache_list, NULL, cache_file);
+            if (! NT_SUCCESS(status))
+                break;
 
             // process next file
 
@@ -1210,6 +1237,8 @@ _FX NTSTATUS File_MergeCache(
     if (status == STATUS_NO_MORE_FILES || status == STATUS_NO_SUCH_FILE)
         status = STATUS_SUCCESS;
 
+    File_MergeCacheSortDone(&sort, cache_list);
+
     Pool_Free(info_area, INFO_AREA_LEN);
 
     return status;
@@ -1223,14 +1252,13 @@ _FX NTSTATUS File_MergeCache(
 
 _FX NTSTATUS File_MergeCacheWin2000(
     FILE_MERGE_FILE *qfile, UNICODE_STRING *FileMask,
-    FILE_ID_BOTH_DIR_INFORMATION *info_area, ULONG info_area_len)
+    FILE_ID_BOTH_DIR_INFORMATION *info_area, ULONG info_area_len,
+    FILE_MERGE_CACHE_SORT *sort)
 {
     NTSTATUS status;
     IO_STATUS_BLOCK IoStatusBlock;
     FILE_BOTH_DIRECTORY_INFORMATION *info_ptr;
-    LIST *cache_list;
     FILE_MERGE_CACHE_FILE *cache_file;
-    FILE_MERGE_CACHE_FILE *ins_point;
     ULONG len;
 
     //
@@ -1244,8 +1272,6 @@ _FX NTSTATUS File_MergeCacheWin2000(
     // see File_GetFullInformation
     //
 
-    cache_list = &qfile->cache_list;
-
     //
     // read entire directory, build a sorted files list
     //
@@ -1312,22 +1338,13 @@ _FX NTSTATUS File_MergeCacheWin2000(
             cache_file->name_uni.MaximumLength = cache_file->name_uni.Length;
             cache_file->name_uni.Buffer = cache_file->info.FileName;
 
-            // insert file into the ordered list
+            // insert file into the ordered tree, after files of the same name
 
-            ins_point = List_Head(cache_list);
-            while (ins_point) {
-                int cmp = RtlCompareUnicodeString(
-                    &ins_point->name_uni, &cache_file->name_uni,
-                    TRUE);                      // CaseInSensitive
-                if (cmp > 0)
-                    break;
-                ins_point = List_Next(ins_point);
-            }
-
-            if (ins_point)
-                List_Insert_Before(cache_list, ins_point, cache_file);
-            else
-                List_Insert_After(cache_list, NULL, cache_file);
+            status = File_MergeCacheSortInsert(sort, cache_file, TRUE);
+            if (status == STATUS_OBJECT_NAME_COLLISION)
+                status = STATUS_SUCCESS;
+            if (! NT_SUCCESS(status))
+                break;
 
             // process next file
 
@@ -1357,8 +1374,8 @@ _FX NTSTATUS File_MergeDummy(
     FILE_ID_BOTH_DIR_INFORMATION *info_area;
     FILE_ID_BOTH_DIR_INFORMATION *info_ptr;
     LIST *cache_list;
+    FILE_MERGE_CACHE_SORT sort;
     FILE_MERGE_CACHE_FILE *cache_file;
-    FILE_MERGE_CACHE_FILE *ins_point;
     ULONG len;
     const ULONG INFO_AREA_LEN = 0x10000;  // the size used by cmd.exe
 
@@ -1514,9 +1531,13 @@ _FX NTSTATUS File_MergeDummy(
 
     qfile->RestartScan = FALSE;
 
+    if (! File_MergeCacheSortInit(&sort)) {
+        Pool_Free(info_area, INFO_AREA_LEN);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     info_ptr = info_area;
     while (1) {
-        int cmp;
 
         len = sizeof(FILE_MERGE_CACHE_FILE)
             + info_ptr->FileNameLength;
@@ -1538,26 +1559,13 @@ _FX NTSTATUS File_MergeDummy(
         cache_file->name_uni.MaximumLength = cache_file->name_uni.Length;
         cache_file->name_uni.Buffer = cache_file->info.FileName;
 
-        // insert file into the ordered list
+        // insert file into the ordered tree, skip duplicates
 
-        ins_point = List_Head(cache_list);
-        cmp = -1;
-        while (ins_point) {
-            cmp = RtlCompareUnicodeString(
-                &ins_point->name_uni, &cache_file->name_uni,
-                TRUE);                      // CaseInSensitive
-            if ( (cmp > 0) || (cmp == 0) )
-                break;
-            ins_point = List_Next(ins_point);
-        }
-
-        if (cmp != 0) { // skip duplicates
-
-            if (ins_point)
-                List_Insert_Before(cache_list, ins_point, cache_file);
-            else
-                List_Insert_After(cache_list, NULL, cache_file);
-        }
+        status = File_MergeCacheSortInsert(&sort, cache_file, FALSE);
+        if (status == STATUS_OBJECT_NAME_COLLISION)
+            status = STATUS_SUCCESS;
+        if (! NT_SUCCESS(status))
+            break;
 
         if (info_ptr->NextEntryOffset == 0)
             break;
@@ -1565,12 +1573,119 @@ _FX NTSTATUS File_MergeDummy(
             ((UCHAR *)info_ptr + info_ptr->NextEntryOffset);
     }
 
+    File_MergeCacheSortDone(&sort, cache_list);
+
     Pool_Free(info_area, INFO_AREA_LEN);
 
     return status;
 }
 
 
+//---------------------------------------------------------------------------
+// File_MergeCacheCompare
+//---------------------------------------------------------------------------
+
+
+_FX int File_MergeCacheCompare(const void *key1, const void *key2)
+{
+    const FILE_MERGE_CACHE_NODE *node1 = (const FILE_MERGE_CACHE_NODE *)key1;
+    const FILE_MERGE_CACHE_NODE *node2 = (const FILE_MERGE_CACHE_NODE *)key2;
+
+    int cmp = RtlCompareUnicodeString(
+        &node1->cache_file->name_uni, &node2->cache_file->name_uni,
+        TRUE);                      // CaseInSensitive
+    if (cmp == 0 && node1->seq != node2->seq)
+        cmp = (node1->seq < node2->seq) ? -1 : 1;
+    return cmp;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MergeCacheSortInit
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN File_MergeCacheSortInit(FILE_MERGE_CACHE_SORT *sort)
+{
+    //
+    // the listing is sorted through a red-black tree, an ordered list
+    // would take quadratic time to build for large unsorted directories
+    //
+
+    sort->pool = Pool_Create();
+    if (! sort->pool)
+        return FALSE;
+
+    rbtree_init(&sort->tree, File_MergeCacheCompare);
+    sort->seq = 0;
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MergeCacheSortInsert
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS File_MergeCacheSortInsert(
+    FILE_MERGE_CACHE_SORT *sort, FILE_MERGE_CACHE_FILE *cache_file,
+    BOOLEAN InsertDuplicate)
+{
+    FILE_MERGE_CACHE_NODE *node;
+    rbnode_t *prev;
+    BOOLEAN duplicate;
+
+    node = Pool_Alloc(sort->pool, sizeof(FILE_MERGE_CACHE_NODE));
+    if (! node)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    node->node.key = node;
+    node->cache_file = cache_file;
+    node->seq = ++sort->seq;
+
+    //
+    // the new node comes after all nodes present, so the closest
+    // node before it has the same name, if there is such a node
+    //
+
+    rbtree_find_less_equal(&sort->tree, node, &prev);
+    duplicate = (prev && RtlCompareUnicodeString(
+                    &((FILE_MERGE_CACHE_NODE *)prev)->cache_file->name_uni,
+                    &cache_file->name_uni, TRUE) == 0);
+
+    if (duplicate && ! InsertDuplicate) {
+        Pool_Free(node, sizeof(FILE_MERGE_CACHE_NODE));
+        return STATUS_OBJECT_NAME_COLLISION;
+    }
+
+    rbtree_insert(&sort->tree, &node->node);
+
+    return duplicate ? STATUS_OBJECT_NAME_COLLISION : STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// File_MergeCacheSortDone
+//---------------------------------------------------------------------------
+
+
+_FX void File_MergeCacheSortDone(
+    FILE_MERGE_CACHE_SORT *sort, LIST *cache_list)
+{
+    FILE_MERGE_CACHE_NODE *node;
+
+    //
+    // append the sorted files to the list and release the tree
+    //
+
+    RBTREE_FOR(node, FILE_MERGE_CACHE_NODE *, &sort->tree)
+        List_Insert_After(cache_list, NULL, node->cache_file);
+
+    Pool_Delete(sort->pool);
+    sort->pool = NULL;
+}
+
+
 //---------------------------------------------------------------------------
 // File_MergeFree
 //---------------------------------------------------------------------------
@@ -1601,6 +1716,48 @@ _FX void File_MergeFree(FILE_MERGE *merge)
 }
 
 
+//---------------------------------------------------------------------------
+// File_MergeRemove
+//---------------------------------------------------------------------------
+
+
+_FX void File_MergeRemove(FILE_MERGE *merge)
+{
+    //
+    // caller must hold File_DirHandles_CritSec, the merge is freed
+    // once the last user released it
+    //
+
+    if (merge->handle) {
+        Handle_UnRegisterHandler(merge->handle, File_NtCloseDir, NULL);
+        map_remove(&File_DirHandleMap, merge->handle);
+    }
+
+    List_Remove(&File_DirHandles, merge);
+
+    if (InterlockedDecrement(&merge->refs) == 0) {
+        DeleteCriticalSection(&merge->lock);
+        File_MergeFree(merge);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// File_MergeRelease
+//---------------------------------------------------------------------------
+
+
+_FX void File_MergeRelease(FILE_MERGE *merge)
+{
+    LeaveCriticalSection(&merge->lock);
+
+    if (InterlockedDecrement(&merge->refs) == 0) {
+        DeleteCriticalSection(&merge->lock);
+        File_MergeFree(merge);
+    }
+}
+
+
 //---------------------------------------------------------------------------
 // File_GetMergedInformation
 //---------------------------------------------------------------------------
@@ -2410,14 +2567,11 @@ _FX VOID File_NtCloseDir(HANDLE FileHandle, void* CloseParams)
 
     EnterCriticalSection(&File_DirHandles_CritSec);
 
-    merge = List_Head(&File_DirHandles);
-    while (merge) {
-        FILE_MERGE *next = List_Next(merge);
-        if (merge->handle == FileHandle) {
-            List_Remove(&File_DirHandles, merge);
-            File_MergeFree(merge);
-        }
-        merge = next;
+    merge = map_get(&File_DirHandleMap, FileHandle);
+    if (merge) {
+        merge->handle = NULL; // the close handler is already being run
+        map_remove(&File_DirHandleMap, FileHandle);
+        File_MergeRemove(merge);
     }
 
     LeaveCriticalSection(&File_DirHandles_CritSec);
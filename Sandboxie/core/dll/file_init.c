@@ -137,6 +137,7 @@ _FX BOOLEAN File_Init(void)
 
     InitializeCriticalSection(&File_DirHandles_CritSec);
     List_Init(&File_DirHandles);
+    map_init(&File_DirHandleMap, Dll_Pool);
 
     File_ProxyPipes = Dll_Alloc(sizeof(ULONG) * 256);
     memzero(File_ProxyPipes, sizeof(ULONG) * 256);
@@ -150,6 +151,8 @@ _FX BOOLEAN File_Init(void)
     if (! File_InitDrives(0xFFFFFFFF))
         return FALSE;
 
+    File_InitNameCache();
+
     File_Delete_v2 = SbieApi_QueryConfBool(NULL, L"UseFileDeleteV2", FALSE);
     if (File_Delete_v2)
         File_InitDelete_v2();
@@ -725,6 +728,8 @@ _FX BOOLEAN File_InitDrives(ULONG DriveMask)
 
     LeaveCriticalSection(File_DrivesAndLinks_CritSec);
 
+    File_FlushNameCache();
+
     return TRUE;
 }
 
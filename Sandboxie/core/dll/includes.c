@@ -48,4 +48,8 @@ extern const ULONG tzuk;
 
 /* StrUtil */
 
-#include "common/str_util.c"
\ No newline at end of file
+#include "common/str_util.c"
+
+/* PortXfer */
+
+#include "common/portxfer.c"
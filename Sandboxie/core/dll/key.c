@@ -414,6 +414,7 @@ _FX BOOLEAN Key_Init(void)
     Key_UseObjectNames = SbieApi_QueryConfBool(NULL, L"UseObjectNameForKeys", FALSE);
 
     List_Init(&Key_Handles);
+    map_init(&Key_HandleMap, Dll_Pool);
     List_Init(&Key_MergeCacheList);
 
     //
@@ -2887,6 +2888,7 @@ _FX NTSTATUS Key_NtQueryKeyImpl(
     ULONG MaxValueNameLen;
     ULONG MaxValueDataLen;
     ULONG NumValues;
+    LARGE_INTEGER LastWriteTime;
     KEY_MERGE_SUBKEY *subkey;
     KEY_MERGE_VALUE *value;
 
@@ -3059,7 +3061,9 @@ _FX NTSTATUS Key_NtQueryKeyImpl(
         value = List_Next(value);
     }
 
-    LeaveCriticalSection(&Key_Handles_CritSec);
+    LastWriteTime.QuadPart = merge->last_write_time.QuadPart;
+
+    Key_MergeRelease(merge);
 
     //
     // here we use the merge entry to fill the caller's output buffer
@@ -3077,7 +3081,7 @@ _FX NTSTATUS Key_NtQueryKeyImpl(
             status = STATUS_BUFFER_TOO_SMALL;
         else {
 
-            info->LastWriteTime.QuadPart = merge->last_write_time.QuadPart;
+            info->LastWriteTime.QuadPart = LastWriteTime.QuadPart;
             info->TitleIndex = 0;
             info->ClassOffset = -1;
             info->ClassLength = 0;
@@ -3103,7 +3107,7 @@ _FX NTSTATUS Key_NtQueryKeyImpl(
             status = STATUS_BUFFER_TOO_SMALL;
         else {
 
-            info->LastWriteTime.QuadPart = merge->last_write_time.QuadPart;
+            info->LastWriteTime.QuadPart = LastWriteTime.QuadPart;
             info->TitleIndex = 0;
             info->SubKeys = NumSubkeys;
             info->MaxNameLen = MaxNameLen;
@@ -3160,6 +3164,8 @@ _FX NTSTATUS Key_NtEnumerateKey(
     HANDLE SubkeyHandle;
     LARGE_INTEGER SubkeyLastWriteTime;
 
+    merge = NULL;
+
     Dll_PushTlsNameBuffer(TlsData);
 
     __try {
@@ -3262,7 +3268,8 @@ _FX NTSTATUS Key_NtEnumerateKey(
     }
 
     //
-    // unlock the Key_Handles list before we query the subkey.
+    // unlock the merge before we query the subkey, it stays
+    // referenced until we are done with the subkey.
     //
     // if access to the subkey is denied, we fake a result that
     // only contains the name of the subkey, in Key_NtEnumerateKeyFake.
@@ -3273,20 +3280,25 @@ _FX NTSTATUS Key_NtEnumerateKey(
     // the name of some of the hives below \REGISTRY\USER)
     //
 
-    LeaveCriticalSection(&Key_Handles_CritSec);
-
     if (! subkey) {
 
         merge->last_index = 0;
         merge->last_subkey = NULL;
 
+    } else {
+
+        merge->last_index = SaveIndex;
+        merge->last_subkey = subkey;
+    }
+
+    Key_MergeUnlock(merge);
+
+    if (! subkey) {
+
         status = STATUS_NO_MORE_ENTRIES;
         __leave;
     }
 
-    merge->last_index = SaveIndex;
-    merge->last_subkey = subkey;
-
     //
     // for some keys that are a hive root, the registry returns correct
     // names when the keys are enumerated from the parent key, but returns
@@ -3404,6 +3416,9 @@ _FX NTSTATUS Key_NtEnumerateKey(
         status = GetExceptionCode();
     }
 
+    if (merge)
+        Key_MergeDereference(merge);
+
     Dll_PopTlsNameBuffer(TlsData);
     SetLastError(LastError);
     return status;
@@ -3658,7 +3673,7 @@ _FX NTSTATUS Key_NtQueryValueKey(
     }
 
     if (key_handles_locked)
-        LeaveCriticalSection(&Key_Handles_CritSec);
+        Key_MergeRelease(merge);
 
     Dll_PopTlsNameBuffer(TlsData);
     SetLastError(LastError);
@@ -4025,7 +4040,7 @@ _FX NTSTATUS Key_NtEnumerateValueKey(
     }
 
     if (key_handles_locked)
-        LeaveCriticalSection(&Key_Handles_CritSec);
+        Key_MergeRelease(merge);
 
     Dll_PopTlsNameBuffer(TlsData);
     SetLastError(LastError);
@@ -4205,7 +4220,7 @@ _FX NTSTATUS Key_NtQueryMultipleValueKey(
     }
 
     if (key_handles_locked)
-        LeaveCriticalSection(&Key_Handles_CritSec);
+        Key_MergeRelease(merge);
 
     Dll_PopTlsNameBuffer(TlsData);
     SetLastError(LastError);
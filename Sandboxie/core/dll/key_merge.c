@@ -21,6 +21,7 @@
 //---------------------------------------------------------------------------
 
 #include "common/pattern.h"
+#include "common/map.h"
 
 //---------------------------------------------------------------------------
 // Structures and Types
@@ -35,6 +36,9 @@ typedef struct _KEY_MERGE {
     ULONG ticks;
     BOOLEAN cant_merge;
 
+    LONG refs;              // one for Key_Handles, one for each user
+    CRITICAL_SECTION lock;  // held by the user of a merge for a handle
+
     BOOLEAN subkeys_merged;
     LARGE_INTEGER last_write_time;
     ULONGLONG last_paths_version;
@@ -110,6 +114,14 @@ static NTSTATUS Key_MergeValues(
 
 static void Key_MergeFree(KEY_MERGE *merge, BOOLEAN FreeMergeItself);
 
+static void Key_MergeRemove(KEY_MERGE *merge);
+
+static void Key_MergeUnlock(KEY_MERGE *merge);
+
+static void Key_MergeDereference(KEY_MERGE *merge);
+
+static void Key_MergeRelease(KEY_MERGE *merge);
+
 static NTSTATUS Key_GetMergedValue(
     KEY_MERGE_VALUE *value,
     KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
@@ -127,7 +139,8 @@ NTSTATUS File_NtCloseImpl(HANDLE FileHandle);
 //---------------------------------------------------------------------------
 
 
-static LIST Key_Handles;
+static LIST Key_Handles;         // ordered by creation time, oldest first
+static HASH_MAP Key_HandleMap;
 static LIST Key_MergeCacheList;
 static CRITICAL_SECTION Key_Handles_CritSec;
 
@@ -147,9 +160,13 @@ _FX NTSTATUS Key_Merge(
     KEY_MERGE *merge;
     KEY_MERGE *TrueMerge;
     HANDLE CopyHandle;
+    BOOLEAN true_locked = FALSE;
 
     //
-    // if we have information cached for this handle, return it
+    // Key_Handles_CritSec guards the index of merges by handle and the
+    // cache of true merges, each merge for a handle has its own lock,
+    // which is taken after the index lock was released, and which the
+    // caller keeps, so threads using different handles do not serialize
     //
 
     ticks_now = GetTickCount();
@@ -157,66 +174,51 @@ _FX NTSTATUS Key_Merge(
 
     EnterCriticalSection(&Key_Handles_CritSec);
 
-    merge = List_Head(&Key_Handles);
-    while (merge) {
-
-        KEY_MERGE *next = List_Next(merge);
-
-            /*
-        if (1) {
-            WCHAR txt[512];
-            Sbie_snwprintf(txt, 512, L"Merge at %08X Handle %08X Name (%d) %s Cmp => %d\n",
-                merge, merge->handle, merge->name_len, merge->name,
-                merge->name_len == TruePath_len ?
-                    RtlEqualMemory(merge->name, TruePath, TruePath_len)
-                : -1);
-            OutputDebugString(txt);
-        }
-            */
+    //
+    // discard entries that are too old.  the timeout should be fairly
+    // small, so that changes that are made to this key outside this
+    // process, will become visible even if the merge was cached.
+    // Key_Handles is ordered by age, so only its head needs to be checked.
+    // the entry for the requested handle is kept, but moved to the end
+    //
 
-        if (merge->handle != KeyHandle) {
+    merge = NULL;
+    while (1) {
 
-            //
-            // this isn't the cached entry we want, but if we find
-            // an entry that is too old, we must discard it.  the
-            // timeout should be fairly small, so that changes that
-            // are made to this key outside this process, will become
-            // visible even if the merge was cached
-            //
+        KEY_MERGE *head = List_Head(&Key_Handles);
+        if (! head || head == merge || ticks_now - head->ticks <= 5 * 1000)
+            break;
 
-            if (ticks_now - merge->ticks <= 5 * 1000) {
-                merge = next;
-                continue;
-            }
+        if (head->handle == KeyHandle) {
 
-        } else if (merge->name_len == TruePath_len &&
-                        _wcsnicmp(merge->name, TruePath,
-                                  TruePath_len / sizeof(WCHAR)) == 0) {
+            List_Remove(&Key_Handles, head);
+            List_Insert_After(&Key_Handles, NULL, head);
+            merge = head;
+            continue;
+        }
 
-            //
-            // we found a cached entry for the same handle, and
-            // the same key path, so we are going to use it.
-            //
+        Key_MergeRemove(head);
+    }
 
-            if(Key_PathsVersion == merge->last_paths_version)
-                break;
-        }
+    //
+    // if we have information cached for this handle and the same key
+    // path, use it, otherwise discard the stale entry
+    //
 
-        //
-        // if we got here, we need to discard the stale entry
-        //
+    merge = map_get(&Key_HandleMap, KeyHandle);
 
-        Handle_UnRegisterHandler(merge->handle, Key_NtClose, NULL);
-        List_Remove(&Key_Handles, merge);
-        Key_MergeFree(merge, TRUE);
+    if (merge && (merge->name_len != TruePath_len ||
+                  _wcsnicmp(merge->name, TruePath,
+                            TruePath_len / sizeof(WCHAR)) != 0 ||
+                  Key_PathsVersion != merge->last_paths_version)) {
 
-        merge = next;
+        Key_MergeRemove(merge);
+        merge = NULL;
     }
 
     //
     // if we don't have a merge entry, create one.  it is inserted
-    // at the end of the list, so the loop above always gets to
-    // look at all existing merge entries and discard stale ones
+    // at the end of the list, which keeps the list ordered by age
     //
 
     if (! merge) {
@@ -228,15 +230,25 @@ _FX NTSTATUS Key_Merge(
         merge->ticks = ticks_now;
         // merge->cant_merge = FALSE;       // memzero takes care of this
 
+        merge->refs = 1;
+        InitializeCriticalSection(&merge->lock);
+
         merge->last_paths_version = Key_PathsVersion;
 
         merge->name_len = TruePath_len;
         memcpy(merge->name, TruePath, TruePath_len + sizeof(WCHAR));
 
-        List_Insert_Before(&Key_Handles, NULL, merge);
+        List_Insert_After(&Key_Handles, NULL, merge);
+        map_insert(&Key_HandleMap, KeyHandle, merge, 0);
         Handle_RegisterHandler(merge->handle, Key_NtClose, NULL, FALSE);
     }
 
+    InterlockedIncrement(&merge->refs);
+
+    LeaveCriticalSection(&Key_Handles_CritSec);
+
+    EnterCriticalSection(&merge->lock);
+
     //
     // if cant_merge is set, then we already know that either TruePath
     // or CopyPath exist, but not both, so return special status
@@ -245,18 +257,23 @@ _FX NTSTATUS Key_Merge(
     if(!Key_Delete_v2 || !Key_HasDeleted_v2(TruePath))
     if (merge->cant_merge) {
 
-        LeaveCriticalSection(&Key_Handles_CritSec);
+        Key_MergeRelease(merge);
+        *out_merge = NULL;
         return STATUS_BAD_INITIAL_PC;
     }
 
     //
     // merge the subkeys and values, if caller asked for them.
-    // we will first need to open the copy key and get the true merge
+    // we will first need to open the copy key and get the true merge,
+    // the true merge is shared, so keep the index lock while using it
     //
 
     if (    (want_subkeys && (! merge->subkeys_merged)) ||
             (want_values  && (! merge->values_merged)))
     {
+        EnterCriticalSection(&Key_Handles_CritSec);
+        true_locked = TRUE;
+
         status = Key_OpenForMerge(
             KeyHandle, TruePath, CopyPath, &TrueMerge, &CopyHandle);
 
@@ -293,16 +310,22 @@ _FX NTSTATUS Key_Merge(
         merge->values_merged = TRUE;
     }
 
+    if (true_locked)
+        LeaveCriticalSection(&Key_Handles_CritSec);
+
     //
     // finish.  IMPORTANT:  if we return STATUS_SUCCESS, we return
-    // without unlocking Key_Handles_CritSec !
+    // with the merge locked and referenced, the caller has to
+    // release it with Key_MergeRelease
     //
 
     if (CopyHandle)
         File_NtCloseImpl(CopyHandle);
 
-    if (! NT_SUCCESS(status))
-        LeaveCriticalSection(&Key_Handles_CritSec);
+    if (! NT_SUCCESS(status)) {
+        Key_MergeRelease(merge);
+        merge = NULL;
+    }
 
     *out_merge = merge;
     return status;
@@ -1390,6 +1413,65 @@ _FX void Key_MergeFree(
 }
 
 
+//---------------------------------------------------------------------------
+// Key_MergeRemove
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeRemove(KEY_MERGE *merge)
+{
+    //
+    // caller must hold Key_Handles_CritSec
+    //
+
+    if (merge->handle != (HANDLE)-1) {
+        Handle_UnRegisterHandler(merge->handle, Key_NtClose, NULL);
+        map_remove(&Key_HandleMap, merge->handle);
+    }
+
+    List_Remove(&Key_Handles, merge);
+    Key_MergeDereference(merge);
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeUnlock
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeUnlock(KEY_MERGE *merge)
+{
+    LeaveCriticalSection(&merge->lock);
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeDereference
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeDereference(KEY_MERGE *merge)
+{
+    if (InterlockedDecrement(&merge->refs) == 0) {
+
+        DeleteCriticalSection(&merge->lock);
+        Key_MergeFree(merge, TRUE);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Key_MergeRelease
+//---------------------------------------------------------------------------
+
+
+_FX void Key_MergeRelease(KEY_MERGE *merge)
+{
+    Key_MergeUnlock(merge);
+    Key_MergeDereference(merge);
+}
+
+
 //---------------------------------------------------------------------------
 // Key_GetMergedValue
 //---------------------------------------------------------------------------
@@ -1557,9 +1639,7 @@ _FX void Key_DiscardMergeByPath(const WCHAR *TruePath, BOOLEAN Recurse)
                 }
             }
 
-            Handle_UnRegisterHandler(merge->handle, Key_NtClose, NULL);
-            List_Remove(&Key_Handles, merge);
-            Key_MergeFree(merge, TRUE);
+            Key_MergeRemove(merge);
         }
 
         merge = next;
@@ -1611,21 +1691,18 @@ _FX void Key_NtClose(HANDLE KeyHandle, void* CloseParams)
 
     //
     // this routine should be called from NtClose or NtDuplicateObject.
-    // it marks the merge associated with KeyHandle as unused,
-    // causing it to be deleted by Key_Merge at some later point
+    // it removes the merge associated with KeyHandle from the index,
+    // the merge is freed once the last user released it
     //
 
     if (! TryEnterCriticalSection(&Key_Handles_CritSec))
         return;
 
-    merge = List_Head(&Key_Handles);
-    while (merge) {
-        if (merge->handle == KeyHandle) {
-            merge->handle = (HANDLE)-1;
-            merge->ticks = 0;
-            break;
-        }
-        merge = List_Next(merge);
+    merge = map_get(&Key_HandleMap, KeyHandle);
+    if (merge) {
+        map_remove(&Key_HandleMap, KeyHandle);
+        merge->handle = (HANDLE)-1; // the close handler is already being run
+        Key_MergeRemove(merge);
     }
 
     LeaveCriticalSection(&Key_Handles_CritSec);
@@ -74,7 +74,11 @@ static BOOLEAN WSA_InitBindIP();
 
 BOOLEAN WSA_InitNetDnsFilter(HMODULE module);
 
-static int WSA_IsBlockedTraffic(const short *addr, int addrlen, int protocol);
+static int WSA_IsBlockedTraffic(SOCKET s, const short *addr, int addrlen, int protocol);
+
+static BOOLEAN WSA_GetCachedVerdict(SOCKET s, IP_ADDRESS* ip, USHORT port, int protocol, BOOLEAN* block);
+
+static void WSA_SetCachedVerdict(SOCKET s, IP_ADDRESS* ip, USHORT port, int protocol, BOOLEAN block);
 
 static int WSA_WSAStartup(
     WORD wVersionRequested,
@@ -324,6 +328,23 @@ struct NETPROXY_RULE {
 extern POOL*            Dll_Pool;
 
 static LIST             WSA_FwList;
+static NETFW_TABLE*     WSA_FwTable           = NULL;
+
+typedef struct _WSA_FW_VERDICT {
+
+    volatile LONG seq;      // odd while the entry is being written
+    SOCKET s;
+    IP_ADDRESS ip;
+    USHORT port;
+    UCHAR protocol;
+    UCHAR block;
+
+} WSA_FW_VERDICT;
+
+#define WSA_FW_CACHE_SIZE 64
+#define WSA_FW_CACHE_SLOT(s) ((((ULONG_PTR)(s)) >> 2) % WSA_FW_CACHE_SIZE)
+
+static WSA_FW_VERDICT   WSA_FwCache[WSA_FW_CACHE_SIZE];
 
 static BOOLEAN          WSA_WFPisEnabled      = FALSE;
 static BOOLEAN          WSA_WFPisBlocking     = FALSE;
@@ -881,12 +902,63 @@ _FX void WSA_DumpIP(ADDRESS_FAMILY af, IP_ADDRESS* pIP, wchar_t* pStr)
 }
 
 
+//---------------------------------------------------------------------------
+// WSA_GetCachedVerdict
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN WSA_GetCachedVerdict(SOCKET s, IP_ADDRESS* ip, USHORT port, int protocol, BOOLEAN* block)
+{
+    //
+    // datagram sockets tend to talk to the same peer over and over,
+    // remember the last verdict per socket, the rules never change
+    //
+
+    WSA_FW_VERDICT* entry = &WSA_FwCache[WSA_FW_CACHE_SLOT(s)];
+
+    LONG seq = entry->seq;
+    if (seq & 1)
+        return FALSE;
+    MemoryBarrier();
+
+    BOOLEAN hit = entry->s == s && entry->port == port && entry->protocol == (UCHAR)protocol
+        && memcmp(&entry->ip, ip, sizeof(IP_ADDRESS)) == 0;
+    *block = entry->block;
+
+    MemoryBarrier();
+    return hit && entry->seq == seq;
+}
+
+
+//---------------------------------------------------------------------------
+// WSA_SetCachedVerdict
+//---------------------------------------------------------------------------
+
+
+_FX void WSA_SetCachedVerdict(SOCKET s, IP_ADDRESS* ip, USHORT port, int protocol, BOOLEAN block)
+{
+    WSA_FW_VERDICT* entry = &WSA_FwCache[WSA_FW_CACHE_SLOT(s)];
+
+    LONG seq = entry->seq;
+    if ((seq & 1) || InterlockedCompareExchange(&entry->seq, seq + 1, seq) != seq)
+        return; // an other thread is updating this entry, skip
+
+    entry->s = s;
+    entry->ip = *ip;
+    entry->port = port;
+    entry->protocol = (UCHAR)protocol;
+    entry->block = block;
+
+    InterlockedExchange(&entry->seq, seq + 2);
+}
+
+
 //---------------------------------------------------------------------------
 // WSA_IsBlockedTraffic
 //---------------------------------------------------------------------------
 
 
-_FX int WSA_IsBlockedTraffic(const short *addr, int addrlen, int protocol)
+_FX int WSA_IsBlockedTraffic(SOCKET s, const short *addr, int addrlen, int protocol)
 {
 
     if (WSA_FwList.count > 0 && addrlen >= sizeof(USHORT) * 2 && addr && (addr[0] == AF_INET || addr[0] == AF_INET6)) {
@@ -897,7 +969,16 @@ _FX int WSA_IsBlockedTraffic(const short *addr, int addrlen, int protocol)
         if(!WSA_GetIP(addr, addrlen, &ip))
             return 1;  // lets block it
 
-        BOOLEAN block = NetFw_BlockTraffic(&WSA_FwList, &ip, port, protocol);
+        BOOLEAN block;
+        if (!WSA_GetCachedVerdict(s, &ip, port, protocol, &block)) {
+
+            if (WSA_FwTable)
+                block = NetFw_LookupTable(WSA_FwTable, &ip, port, protocol);
+            else
+                block = NetFw_BlockTraffic(&WSA_FwList, &ip, port, protocol);
+
+            WSA_SetCachedVerdict(s, &ip, port, protocol, block);
+        }
 
         if (WSA_TraceFlag){
             WCHAR msg[256];
@@ -1093,7 +1174,7 @@ _FX int WSA_connect(
     const void     *name,
     int            namelen)
 {
-    if (WSA_IsBlockedTraffic(name, namelen, IPPROTO_TCP))
+    if (WSA_IsBlockedTraffic(s, name, namelen, IPPROTO_TCP))
         return SOCKET_ERROR;
 
     void* proxy;
@@ -1156,7 +1237,7 @@ _FX int WSA_WSAConnect(
     LPQOS          lpSQOS,
     LPQOS          lpGQOS)
 {
-    if (WSA_IsBlockedTraffic(name, namelen, IPPROTO_TCP))
+    if (WSA_IsBlockedTraffic(s, name, namelen, IPPROTO_TCP))
         return SOCKET_ERROR;
 
     void* proxy;
@@ -1219,7 +1300,7 @@ _FX int WSA_ConnectEx(
     LPDWORD lpdwBytesSent,
     LPOVERLAPPED lpOverlapped)
 {
-    if (WSA_IsBlockedTraffic(name, namelen, IPPROTO_TCP))
+    if (WSA_IsBlockedTraffic(s, name, namelen, IPPROTO_TCP))
         return SOCKET_ERROR;
 
     void* proxy;
@@ -1307,7 +1388,7 @@ _FX SOCKET WSA_accept(
     void     *addr,
     int      *addrlen)
 {
-    if (WSA_IsBlockedTraffic(addr, addrlen, IPPROTO_TCP)) {
+    if (WSA_IsBlockedTraffic(s, addr, addrlen, IPPROTO_TCP)) {
         __sys_closesocket(s);
         return SOCKET_ERROR;
     }
@@ -1327,7 +1408,7 @@ _FX SOCKET WSA_WSAAccept(
     LPCONDITIONPROC lpfnCondition,
     DWORD_PTR       dwCallbackData)
 {
-    if (WSA_IsBlockedTraffic(addr, addrlen, IPPROTO_TCP)) {
+    if (WSA_IsBlockedTraffic(s, addr, addrlen, IPPROTO_TCP)) {
         __sys_closesocket(s);
         return SOCKET_ERROR;
     }
@@ -1379,7 +1460,7 @@ _FX int WSA_sendto(
     const void     *to,
     int            tolen)
 {
-    if (WSA_IsBlockedTraffic(to, tolen, IPPROTO_UDP))
+    if (WSA_IsBlockedTraffic(s, to, tolen, IPPROTO_UDP))
         return SOCKET_ERROR;
 
     if (WSA_BindIP) {
@@ -1407,7 +1488,7 @@ _FX int WSA_WSASendTo(
     LPWSAOVERLAPPED                    lpOverlapped,
     LPWSAOVERLAPPED_COMPLETION_ROUTINE lpCompletionRoutine)
 {
-    if (WSA_IsBlockedTraffic(lpTo, iTolen, IPPROTO_UDP))
+    if (WSA_IsBlockedTraffic(s, lpTo, iTolen, IPPROTO_UDP))
         return SOCKET_ERROR;
 
     if (WSA_BindIP) {
@@ -1447,7 +1528,7 @@ _FX int WSA_recvfrom(
 
     int ret = __sys_recvfrom(s, buf, len, flags, from, fromlen);
 
-    if (WSA_IsBlockedTraffic(from, *fromlen, IPPROTO_UDP))
+    if (WSA_IsBlockedTraffic(s, from, *fromlen, IPPROTO_UDP))
         return SOCKET_ERROR;
 
     return ret;
@@ -1485,7 +1566,7 @@ _FX int WSA_WSARecvFrom(
     int ret = __sys_WSARecvFrom(s, lpBuffers, dwBufferCount, lpNumberOfBytesRecvd,
         lpFlags, lpFrom, lpFromlen, lpOverlapped, lpCompletionRoutine);
 
-    if (WSA_IsBlockedTraffic(lpFrom, *lpFromlen, IPPROTO_UDP))
+    if (WSA_IsBlockedTraffic(s, lpFrom, *lpFromlen, IPPROTO_UDP))
         return SOCKET_ERROR;
 
     return ret;
@@ -1536,6 +1617,14 @@ _FX void WSA_InitNetFwRules()
 
         NetFw_AddRule(&WSA_FwList, rule);
     }
+
+    //
+    // flatten the rules into a lookup table, if the rule set is to large
+    // for that, WSA_IsBlockedTraffic keeps walking the list
+    //
+
+    if (WSA_FwList.count > 0)
+        WSA_FwTable = NetFw_CompileRules(&WSA_FwList, Dll_Pool);
 }
 
 
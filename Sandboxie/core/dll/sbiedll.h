@@ -87,6 +87,8 @@ SBIEDLL_EXPORT  BOOL SbieDll_QueryFileAttributes(const WCHAR *NtPath, ULONG64 *s
 
 SBIEDLL_EXPORT  const WCHAR *SbieDll_GetDrivePath(ULONG DriveIndex);
 
+SBIEDLL_EXPORT  void SbieDll_GetNameCacheStats(ULONG64 *Hits, ULONG64 *Misses);
+
 SBIEDLL_EXPORT  const WCHAR *SbieDll_GetUserPathEx(WCHAR which);
 
 SBIEDLL_EXPORT  BOOLEAN SbieDll_TranslateNtToDosPath(WCHAR *path);
@@ -677,6 +677,7 @@ const wchar_t* Trace_SbieSvcFunc2Str(ULONG func)
         case MSGID_SBIE_INI_DEL_SETTING:        return L"MSGID_SBIE_INI_DEL_SETTING";
         case MSGID_SBIE_INI_GET_VERSION:        return L"MSGID_SBIE_INI_GET_VERSION";
         case MSGID_SBIE_INI_GET_WAIT_HANDLE:    return L"MSGID_SBIE_INI_GET_WAIT_HANDLE";
+        case MSGID_SBIE_INI_GET_WORK_STATS:     return L"MSGID_SBIE_INI_GET_WORK_STATS";
         case MSGID_SBIE_INI_RUN_SBIE_CTRL:      return L"MSGID_SBIE_INI_RUN_SBIE_CTRL";
 
         case MSGID_NETAPI_USE_ADD:              return L"MSGID_NETAPI_USE_ADD";
@@ -166,6 +166,8 @@ enum {
     API_MONITOR_PUT_EX,
     API_UPDATE_CONF,
     API_VERIFY,
+    API_MONITOR_MAP,
+    API_QUERY_CONF_SECTION,
 
     API_LAST
 };
@@ -282,6 +284,15 @@ API_ARGS_FIELD(BOOLEAN,prepend_level)
 API_ARGS_CLOSE(API_QUERY_PATH_LIST_ARGS)
 
 
+API_ARGS_BEGIN(API_QUERY_CONF_SECTION_ARGS)
+API_ARGS_FIELD(WCHAR *,section_name)
+API_ARGS_FIELD(ULONG,flags)
+API_ARGS_FIELD(ULONG *,buffer_len)
+API_ARGS_FIELD(WCHAR *,buffer_ptr)
+API_ARGS_FIELD(ULONG *,generation)
+API_ARGS_CLOSE(API_QUERY_CONF_SECTION_ARGS)
+
+
 API_ARGS_BEGIN(API_CREATE_DIR_OR_LINK_ARGS)
 API_ARGS_FIELD(UNICODE_STRING64 *,objname)
 API_ARGS_FIELD(UNICODE_STRING64 *,target)
@@ -374,6 +385,11 @@ API_ARGS_FIELD(WCHAR *, buffer_ptr)
 API_ARGS_FIELD(ULONG *, buffer_len)
 API_ARGS_CLOSE(API_MONITOR_GET2_ARGS)
 
+API_ARGS_BEGIN(API_MONITOR_MAP_ARGS)
+API_ARGS_FIELD(ULONG64 *, map_base)
+API_ARGS_FIELD(ULONG *, map_size)
+API_ARGS_CLOSE(API_MONITOR_MAP_ARGS)
+
 API_ARGS_BEGIN(API_GET_UNMOUNT_HIVE_ARGS)
 API_ARGS_FIELD(WCHAR *,path)
 API_ARGS_CLOSE(API_GET_UNMOUNT_HIVE_ARGS)
@@ -30,6 +30,7 @@
 
 #define KERNEL_MODE
 #include "common/stream.h"
+#include "common/ini_token.h"
 
 #include "common/my_version.h"
 
@@ -45,6 +46,8 @@
 
 #define CONF_TMPL_LINE_BASE         0x01000000
 
+#define CONF_MAX_LAYERS             4096        // guards against templates including themselves
+
 
 //---------------------------------------------------------------------------
 // Structures
@@ -56,6 +59,12 @@
 //          instead we use both, here the hash map is used only for lookups
 //          the keys in the map are only pointers to the name fields in the list entries
 //
+// Note: templates are not copied into the sections which use them,
+//          instead each section holds an ordered list of layers referencing
+//          the shared template sections, which are never modified after reading,
+//          the effective settings are the own settings followed by the settings
+//          of each layer in order, except for the Tmpl.* settings
+//
 
 typedef struct _CONF_DATA {
 
@@ -80,6 +89,8 @@ typedef struct _CONF_SECTION {
 #ifdef USE_CONF_MAP
     HASH_MAP settings_map;
 #endif
+    LIST layers;        // CONF_LAYER
+    ULONG layer_count;
     BOOLEAN from_template;
 
 } CONF_SECTION;
@@ -91,11 +102,28 @@ typedef struct _CONF_SETTING {
     WCHAR *name;
     WCHAR *value;
     BOOLEAN from_template;
-    BOOLEAN template_handled;
 
 } CONF_SETTING;
 
 
+typedef struct _CONF_LAYER {
+
+    LIST_ELEM list_elem;
+    CONF_SECTION *tmpl;
+
+} CONF_LAYER;
+
+
+typedef struct _CONF_ITER {
+
+    CONF_SECTION *section;
+    CONF_LAYER *layer;  // NULL while in the section's own settings
+    CONF_SETTING *setting;
+    BOOLEAN skip_tmpl;
+
+} CONF_ITER;
+
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -103,12 +131,15 @@ typedef struct _CONF_SETTING {
 
 static NTSTATUS Conf_Read(ULONG session_id);
 
+static NTSTATUS Conf_Read_File(
+    STREAM *stream, CONF_DATA *data, ULONG *encoding, int *linenum);
+
 static NTSTATUS Conf_Read_Sections(
-    STREAM *stream, CONF_DATA *data, int *linenum);
+    CONF_DATA *data, const WCHAR *text, ULONG text_len, int *linenum);
 
 static NTSTATUS Conf_Read_Settings(
-    STREAM *stream, CONF_DATA *data, CONF_SECTION *section,
-    WCHAR *line, int *linenum);
+    CONF_DATA *data, CONF_SECTION *section,
+    const WCHAR *text, const INI_TOKEN *token, int linenum);
 
 NTSTATUS Conf_Read_Line(STREAM *stream, WCHAR *line, int *linenum);
 
@@ -122,6 +153,11 @@ static NTSTATUS Conf_Merge_Template(
     CONF_DATA *data, ULONG session_id,
     const WCHAR *tmpl_name, CONF_SECTION *section, const WCHAR* name);
 
+static void Conf_Iter_Init(
+    CONF_ITER *iter, CONF_SECTION *section, BOOLEAN skip_tmpl);
+
+static CONF_SETTING *Conf_Iter_Next(CONF_ITER *iter);
+
 static const WCHAR *Conf_Get_Helper(
     const WCHAR *section_name, const WCHAR *setting_name,
     ULONG *index, BOOLEAN skip_tmpl);
@@ -151,6 +187,11 @@ static const WCHAR *Conf_Get_Setting_Name(
 static CONF_DATA Conf_Data;
 static PERESOURCE Conf_Lock = NULL;
 
+// incremented each time Conf_Data is replaced, lets clients
+// tell whether a cached copy of a section is still current
+
+static volatile ULONG Conf_Generation = 1;
+
 static const WCHAR *Conf_GlobalSettings   = L"GlobalSettings";
 static const WCHAR *Conf_UserSettings_    = L"UserSettings_";
 static const WCHAR *Conf_Template_        = L"Template_";
@@ -188,6 +229,17 @@ _FX void Conf_AdjustUseCount(BOOLEAN increase)
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_GetGeneration
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Conf_GetGeneration(void)
+{
+    return Conf_Generation;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Read
 //---------------------------------------------------------------------------
@@ -313,13 +365,8 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
 
     if (stream) {
 
-        status = Stream_Read_BOM(stream, &data.encoding);
-
         linenum = 1;
-        while (NT_SUCCESS(status))
-            status = Conf_Read_Sections(stream, &data, &linenum);
-        if (status == STATUS_END_OF_FILE)
-            status = STATUS_SUCCESS;
+        status = Conf_Read_File(stream, &data, &data.encoding, &linenum);
     }
 
     if (stream) Stream_Close(stream);
@@ -343,14 +390,9 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
 
         } else {
 
-            status = Stream_Read_BOM(stream, NULL);
-
             linenum = 1 + CONF_TMPL_LINE_BASE;
 
-            while (NT_SUCCESS(status))
-                status = Conf_Read_Sections(stream, &data, &linenum);
-            if (status == STATUS_END_OF_FILE)
-                status = STATUS_SUCCESS;
+            status = Conf_Read_File(stream, &data, NULL, &linenum);
 
             Stream_Close(stream);
 
@@ -386,6 +428,7 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
 
                 pool = Conf_Data.pool;
                 memcpy(&Conf_Data, &data, sizeof(CONF_DATA));
+                InterlockedIncrement(&Conf_Generation);
 
                 done = TRUE;
             }
@@ -438,118 +481,235 @@ _FX NTSTATUS Conf_Read(ULONG session_id)
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Read_File
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Conf_Read_File(
+    STREAM *stream, CONF_DATA *data, ULONG *encoding, int *linenum)
+{
+    NTSTATUS status;
+    ULONG64 file_size;
+    ULONG data_len;
+    UCHAR *data_buf;
+    UCHAR *data_ptr;
+    WCHAR *text = NULL;
+    ULONG text_len;
+    ULONG text_size = 0;
+    ULONG enc = 0;
+
+    //
+    // read the whole file in one go, and decode it in place unless it
+    // is UTF-8, the size limit is the same as in SbieIniServer
+    //
+
+    status = Stream_Query_Size(stream, &file_size);
+    if (! NT_SUCCESS(status))
+        return status;
+
+    if (file_size == 0) {
+        if (encoding)
+            *encoding = 0;
+        return STATUS_SUCCESS;
+    }
+
+    if (file_size >= CONF_LINE_LEN * 2 * CONF_MAX_LINES)
+        return STATUS_TOO_MANY_COMMANDS;
+
+    data_len = (ULONG)file_size;
+    data_buf = Mem_Alloc(data->pool, data_len);
+    if (! data_buf)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    status = Stream_Read_Bytes(stream, data_len, data_buf);
+
+    data_ptr = data_buf;
+
+    if (NT_SUCCESS(status)) {
+
+        enc = Read_BOM(&data_ptr, &data_len);
+        if (encoding)
+            *encoding = enc;
+
+        if (enc == 1) {
+            // each byte decodes to at most one character
+            text_size = data_len * sizeof(WCHAR) + sizeof(WCHAR);
+            text = Mem_Alloc(data->pool, text_size);
+            if (! text) {
+                text_size = 0;
+                status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+        } else
+            text = (WCHAR *)data_ptr;
+    }
+
+    if (NT_SUCCESS(status)) {
+
+        text_len = Ini_Decode(data_ptr, data_len, enc, text);
+
+        status = Conf_Read_Sections(data, text, text_len, linenum);
+    }
+
+    if (text_size)
+        Mem_Free(text, text_size);
+    Mem_Free(data_buf, (ULONG)file_size);
+
+    return status;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Read_Sections
 //---------------------------------------------------------------------------
 
 
 _FX NTSTATUS Conf_Read_Sections(
-    STREAM *stream, CONF_DATA *data, int *linenum)
+    CONF_DATA *data, const WCHAR *text, ULONG text_len, int *linenum)
 {
     const int line_len = (CONF_LINE_LEN + 2) * sizeof(WCHAR);
+    const ULONG max_tokens = 256;
+    const int line_base = *linenum - 1;
     NTSTATUS status;
+    NTSTATUS tk_status;
+    INI_TOKENIZER tk;
+    INI_TOKEN *tokens;
+    INI_TOKEN *token;
+    ULONG count, i;
     WCHAR *line;
-    WCHAR *ptr;
-    CONF_SECTION *section;
+    CONF_SECTION *section = NULL;
 
     line = Mem_Alloc(data->pool, line_len);
     if (! line)
         return STATUS_INSUFFICIENT_RESOURCES;
 
-    status = Conf_Read_Line(stream, line, linenum);
-    //DbgPrint("Conf_Read_Line (%d/%X) --> %S\n", *linenum, status, line);
-    while (NT_SUCCESS(status)) {
+    tokens = Mem_Alloc(data->pool, max_tokens * sizeof(INI_TOKEN));
+    if (! tokens) {
+        Mem_Free(line, line_len);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-        //
-        // extract the section name from the section name
-        //
+    Ini_Tokenize_Init(&tk, text, text_len,
+        INI_TOKENIZE_STRICT, CONF_LINE_LEN, CONF_MAX_LINES);
 
-        if (line[0] != L'[') {
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
-        ptr = &line[1];
-        while (*ptr && *ptr != L']')
-            ++ptr;
-        if (*ptr != L']') {
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
-        *ptr = L'\0';
+    do {
+
+        count = max_tokens;
+        tk_status = Ini_Tokenize(&tk, tokens, &count);
+        status = STATUS_SUCCESS;
+
+        for (i = 0; i < count && NT_SUCCESS(status); ++i) {
 
-        if (_wcsnicmp(&line[1], Conf_UserSettings_, 13) == 0) {
-            if (! line[14]) {
+            token = &tokens[i];
+            *linenum = line_base + token->line;
+
+            if (token->type == INI_TOKEN_SETTING && section) {
+
+                status = Conf_Read_Settings(
+                            data, section, text, token, *linenum);
+                continue;
+            }
+
+            if (token->type != INI_TOKEN_SECTION) {
                 status = STATUS_INVALID_PARAMETER;
                 break;
             }
-        } else if (_wcsnicmp(&line[1], Conf_Template_, 9) == 0) {
-            if (! line[10]) {
+
+            //
+            // validate the section name
+            //
+
+            wmemcpy(line, text + token->name_ofs, token->name_len);
+            line[token->name_len] = L'\0';
+
+            if (_wcsnicmp(line, Conf_UserSettings_, 13) == 0) {
+                if (! line[13]) {
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+            } else if (_wcsnicmp(line, Conf_Template_, 9) == 0) {
+                if (! line[9]) {
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+            } else if (! Box_IsValidName(line)) {
                 status = STATUS_INVALID_PARAMETER;
                 break;
             }
-        } else if (! Box_IsValidName(&line[1])) {
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
 
-        //
-        // find an existing section by that name or create a new one
-        //
+            //
+            // find an existing section by that name or create a new one
+            //
 #ifdef USE_CONF_MAP
-        section = map_get(&data->sections_map, &line[1]);
+            section = map_get(&data->sections_map, line);
 #else
-        section = List_Head(&data->sections);
-        while (section) {
-            if (_wcsicmp(section->name, &line[1]) == 0)
-                break;
-            section = List_Next(section);
-        }
+            section = List_Head(&data->sections);
+            while (section) {
+                if (_wcsicmp(section->name, line) == 0)
+                    break;
+                section = List_Next(section);
+            }
 #endif
 
-        if (! section) {
-
-            section = Mem_Alloc(data->pool, sizeof(CONF_SECTION));
             if (! section) {
-                status = STATUS_INSUFFICIENT_RESOURCES;
-                break;
-            }
 
-            if ((*linenum) >= CONF_TMPL_LINE_BASE)
-                section->from_template = TRUE;
-            else
-                section->from_template = FALSE;
+                section = Mem_Alloc(data->pool, sizeof(CONF_SECTION));
+                if (! section) {
+                    status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
 
-            section->name = Mem_AllocString(data->pool, &line[1]);
-            if (! section->name) {
-                status = STATUS_INSUFFICIENT_RESOURCES;
-                break;
-            }
+                if ((*linenum) >= CONF_TMPL_LINE_BASE)
+                    section->from_template = TRUE;
+                else
+                    section->from_template = FALSE;
+
+                section->name = Mem_AllocString(data->pool, line);
+                if (! section->name) {
+                    status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
 
-            List_Init(&section->settings);
+                List_Init(&section->settings);
+                List_Init(&section->layers);
+                section->layer_count = 0;
 #ifdef USE_CONF_MAP
-            map_init(&section->settings_map, data->pool);
-            section->settings_map.func_key_size = NULL;
-            section->settings_map.func_match_key = &str_map_match;
-            section->settings_map.func_hash_key = &str_map_hash;
-            map_resize(&section->settings_map, 16); // prepare some buckets for better performance
-#endif			
-
-            List_Insert_After(&data->sections, NULL, section);
+                map_init(&section->settings_map, data->pool);
+                section->settings_map.func_key_size = NULL;
+                section->settings_map.func_match_key = &str_map_match;
+                section->settings_map.func_hash_key = &str_map_hash;
+                map_resize(&section->settings_map, 16); // prepare some buckets for better performance
+#endif
+
+                List_Insert_After(&data->sections, NULL, section);
 #ifdef USE_CONF_MAP
-            if(map_insert(&data->sections_map, section->name, section, 0) == NULL) {
-                status = STATUS_INSUFFICIENT_RESOURCES;
-                break;
-            }
+                if(map_insert(&data->sections_map, section->name, section, 0) == NULL) {
+                    status = STATUS_INSUFFICIENT_RESOURCES;
+                    break;
+                }
 #endif
+            }
         }
 
-        // read settings for this section
+        //
+        // a limit error from the tokenizer counts only if all lines
+        // before it were fine, same as when reading line by line
+        //
+
+        if (NT_SUCCESS(status)) {
+            status = tk_status;
+            if (! NT_SUCCESS(status))
+                *linenum = line_base + tk.line;
+        }
 
-        status = Conf_Read_Settings(stream, data, section, line, linenum);
-    }
+    } while (status == STATUS_SUCCESS);
 
+    Mem_Free(tokens, max_tokens * sizeof(INI_TOKEN));
     Mem_Free(line, line_len);
 
+    if (status == STATUS_END_OF_FILE)
+        status = STATUS_SUCCESS;
+
     return status;
 }
 
@@ -560,110 +720,54 @@ _FX NTSTATUS Conf_Read_Sections(
 
 
 _FX NTSTATUS Conf_Read_Settings(
-    STREAM *stream, CONF_DATA *data, CONF_SECTION *section,
-    WCHAR *line, int *linenum)
+    CONF_DATA *data, CONF_SECTION *section,
+    const WCHAR *text, const INI_TOKEN *token, int linenum)
 {
-    NTSTATUS status;
-    WCHAR *ptr;
-    WCHAR *value;
     CONF_SETTING *setting;
 
-    while (1) {
-
-        status = Conf_Read_Line(stream, line, linenum);
-        if (! NT_SUCCESS(status))
-            break;
-
-        if (line[0] == L'[' || line[0] == L']')
-            break;
-
-        // parse setting name=value
-
-        ptr = wcschr(line, L'=');
-        if ((! ptr) || ptr == line) {
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
-        value = &ptr[1];
-
-        // eliminate trailing whitespace in the setting name
-
-        while (ptr > line) {
-            --ptr;
-            if (*ptr > 32) {
-                ++ptr;
-                break;
-            }
-        }
-        *ptr = L'\0';
-
-        // eliminate leading and trailing whitespace in value
-
-        while (*value <= 32) {
-            if (! (*value))
-                break;
-            ++value;
-        }
-
-        if (*value == L'\0') {
-            status = STATUS_INVALID_PARAMETER;
-            break;
-        }
-
-        ptr = value + wcslen(value);
-        while (ptr > value) {
-            --ptr;
-            if (*ptr > 32) {
-                ++ptr;
-                break;
-            }
-        }
-        *ptr = L'\0';
-
-        //
-        // add the new setting
-        //
+    if (token->name_len == 0 || token->value_len == 0)
+        return STATUS_INVALID_PARAMETER;
 
-        setting = Mem_Alloc(data->pool, sizeof(CONF_SETTING));
-        if (! setting) {
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            break;
-        }
+    //
+    // add the new setting
+    //
 
-        if ((*linenum) >= CONF_TMPL_LINE_BASE)
-            setting->from_template = TRUE;
-        else
-            setting->from_template = FALSE;
+    setting = Mem_Alloc(data->pool, sizeof(CONF_SETTING));
+    if (! setting)
+        return STATUS_INSUFFICIENT_RESOURCES;
 
-        setting->template_handled = FALSE;
+    if (linenum >= CONF_TMPL_LINE_BASE)
+        setting->from_template = TRUE;
+    else
+        setting->from_template = FALSE;
 
-        setting->name = Mem_AllocString(data->pool, line);
-        if (! setting->name) {
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            break;
-        }
+    setting->name = Mem_Alloc(data->pool, (token->name_len + 1) * sizeof(WCHAR));
+    if (! setting->name)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    wmemcpy(setting->name, text + token->name_ofs, token->name_len);
+    setting->name[token->name_len] = L'\0';
 
-        setting->value = Mem_AllocString(data->pool, value);
-        if (! setting->value) {
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            break;
-        }
+    setting->value = Mem_Alloc(data->pool, (token->value_len + 1) * sizeof(WCHAR));
+    if (! setting->value)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    wmemcpy(setting->value, text + token->value_ofs, token->value_len);
+    setting->value[token->value_len] = L'\0';
 
-        List_Insert_After(&section->settings, NULL, setting);
+    List_Insert_After(&section->settings, NULL, setting);
 #ifdef USE_CONF_MAP
-        if(map_append(&section->settings_map, setting->name, setting, 0) == NULL) {
-            status = STATUS_INSUFFICIENT_RESOURCES;
-            break;
-        }
+    if(map_append(&section->settings_map, setting->name, setting, 0) == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
 #endif
-    }
 
-    return status;
+    return STATUS_SUCCESS;
 }
 
 
 //---------------------------------------------------------------------------
 // Conf_Read_Line
+//
+// the configuration goes through Ini_Tokenize now, but verify.c still
+// reads Certificate.dat line by line with the same rules
 //---------------------------------------------------------------------------
 
 
@@ -780,6 +884,7 @@ _FX NTSTATUS Conf_Merge_Templates(CONF_DATA *data, ULONG session_id)
     NTSTATUS status;
     CONF_SECTION *sandbox;
     CONF_SETTING *setting;
+    CONF_LAYER *layer;
 
     //
     // first handle the global section
@@ -834,58 +939,56 @@ _FX NTSTATUS Conf_Merge_Templates(CONF_DATA *data, ULONG session_id)
             continue;
         }
 
-#ifdef USE_CONF_MAP
-
         //
-        // use a keyed iterator to quickly go through all Template=Xxx settings
+        // merge the templates named by Template=Xxx settings, first those of
+        // the section itself, then those found in its layers in order,
+        // including the layers added along the way, as new layers are
+        // appended at the end of the chain nested templates follow in the
+        // same order as when the template settings were copied over
         //
 
+#ifdef USE_CONF_MAP
         map_iter_t iter2 = map_key_iter(&sandbox->settings_map, Conf_Template);
 	    while (map_next(&sandbox->settings_map, &iter2)) {
             setting = iter2.value;
 #else
-
-        //
-        // scan the section for a Template=Xxx setting
-        //
-
         setting = List_Head(&sandbox->settings);
-        while (setting) {
-
-            if (_wcsicmp(setting->name, Conf_Template) != 0) {
+        for (; setting; setting = List_Next(setting)) {
 
-                setting = List_Next(setting);
+            if (_wcsicmp(setting->name, Conf_Template) != 0)
                 continue;
-            }
-#endif
-
-            if (setting->template_handled) {
-
-#ifndef USE_CONF_MAP
-                setting = List_Next(setting);
 #endif
-                continue;
-            }
-
-            //
-            // merge the template into the sandbox section
-            //
 
             status = Conf_Merge_Template(
                 data, session_id, setting->value, sandbox, NULL);
 
             if (! NT_SUCCESS(status))
                 return status;
+        }
 
-            setting->template_handled = TRUE;
+        layer = List_Head(&sandbox->layers);
+        while (layer) {
 
-#ifndef USE_CONF_MAP
-            //
-            // advance to next setting
-            //
+#ifdef USE_CONF_MAP
+            map_iter_t iter3 = map_key_iter(&layer->tmpl->settings_map, Conf_Template);
+	        while (map_next(&layer->tmpl->settings_map, &iter3)) {
+                setting = iter3.value;
+#else
+            setting = List_Head(&layer->tmpl->settings);
+            for (; setting; setting = List_Next(setting)) {
 
-            setting = List_Head(&sandbox->settings);
+                if (_wcsicmp(setting->name, Conf_Template) != 0)
+                    continue;
 #endif
+
+                status = Conf_Merge_Template(
+                    data, session_id, setting->value, sandbox, NULL);
+
+                if (! NT_SUCCESS(status))
+                    return status;
+            }
+
+            layer = List_Next(layer);
         }
 
         //
@@ -911,19 +1014,17 @@ _FX NTSTATUS Conf_Merge_Global(
     NTSTATUS status;
     CONF_SECTION *sandbox;
     CONF_SETTING *setting;
+    CONF_ITER iter;
 
     //
     // scan the section for a Template=Xxx setting
     //
 
-    setting = List_Head(&global->settings);
-    while (setting) {
+    Conf_Iter_Init(&iter, global, FALSE);
+    while ((setting = Conf_Iter_Next(&iter)) != NULL) {
 
-        if (_wcsicmp(setting->name, Conf_Template) != 0) {
-
-            setting = List_Next(setting);
+        if (_wcsicmp(setting->name, Conf_Template) != 0)
             continue;
-        }
 
         //
         // scan sections to find a sandbox section
@@ -972,12 +1073,6 @@ _FX NTSTATUS Conf_Merge_Global(
 
             sandbox = next_sandbox;
         }
-
-        //
-        // advance to next setting
-        //
-
-        setting = List_Next(setting);
     }
 
     return STATUS_SUCCESS;
@@ -1003,41 +1098,23 @@ _FX NTSTATUS Conf_Merge_Template(
     }
 
     //
-    // copy settings from template section into sandbox section
+    // add the template section as a layer of the sandbox section
     //
 
     if (tmpl) {
 
-        CONF_SETTING *oset, *nset;
-
-        oset = List_Head(&tmpl->settings);
-        while (oset) {
+        CONF_LAYER *layer;
 
-            if (_wcsnicmp(oset->name, Conf_Tmpl, 5) == 0) {
-                oset = List_Next(oset);
-                continue;
-            }
+        if (section->layer_count >= CONF_MAX_LAYERS)
+            return STATUS_INSUFFICIENT_RESOURCES;
 
-            nset = Mem_Alloc(data->pool, sizeof(CONF_SETTING));
-            if (! nset)
-                return STATUS_INSUFFICIENT_RESOURCES;
-            nset->from_template = TRUE;
-            nset->template_handled = FALSE;
-            nset->name = Mem_AllocString(data->pool, oset->name);
-            if (! nset->name)
-                return STATUS_INSUFFICIENT_RESOURCES;
-            nset->value = Mem_AllocString(data->pool, oset->value);
-            if (! nset->value)
-                return STATUS_INSUFFICIENT_RESOURCES;
-
-            List_Insert_After(&section->settings, NULL, nset);
-#ifdef USE_CONF_MAP
-            if(map_append(&section->settings_map, nset->name, nset, 0) == NULL)
-                return STATUS_INSUFFICIENT_RESOURCES;
-#endif
+        layer = Mem_Alloc(data->pool, sizeof(CONF_LAYER));
+        if (! layer)
+            return STATUS_INSUFFICIENT_RESOURCES;
+        layer->tmpl = tmpl;
 
-            oset = List_Next(oset);
-        }
+        List_Insert_After(&section->layers, NULL, layer);
+        ++section->layer_count;
 
     } else {
 
@@ -1049,6 +1126,85 @@ _FX NTSTATUS Conf_Merge_Template(
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Iter_Init
+//---------------------------------------------------------------------------
+
+
+_FX void Conf_Iter_Init(
+    CONF_ITER *iter, CONF_SECTION *section, BOOLEAN skip_tmpl)
+{
+    iter->section = section;
+    iter->layer = NULL;
+    iter->setting = NULL;
+    iter->skip_tmpl = skip_tmpl;
+}
+
+
+//---------------------------------------------------------------------------
+// Conf_Iter_Next
+//---------------------------------------------------------------------------
+
+
+_FX CONF_SETTING *Conf_Iter_Next(CONF_ITER *iter)
+{
+    CONF_SETTING *setting;
+
+    if (! iter->section)
+        return NULL;
+
+    if (! iter->layer) {
+
+        //
+        // walk the own settings of the section first
+        //
+
+        setting = iter->setting ? List_Next(iter->setting)
+                                : List_Head(&iter->section->settings);
+
+        if (setting && !(iter->skip_tmpl && setting->from_template)) {
+            iter->setting = setting;
+            return setting;
+        }
+
+        // we can stop because template settings come after
+        // all non-template settings, and all layers are templates
+
+        if (iter->skip_tmpl)
+            goto finish;
+
+        iter->layer = List_Head(&iter->section->layers);
+        setting = iter->layer ? List_Head(&iter->layer->tmpl->settings) : NULL;
+
+    } else
+        setting = List_Next(iter->setting);
+
+    //
+    // then the settings of each layer, the Tmpl.* settings describe
+    // the template itself and are not part of the layer
+    //
+
+    while (iter->layer) {
+
+        while (setting && _wcsnicmp(setting->name, Conf_Tmpl, 5) == 0)
+            setting = List_Next(setting);
+
+        if (setting) {
+            iter->setting = setting;
+            return setting;
+        }
+
+        iter->layer = List_Next(iter->layer);
+        setting = iter->layer ? List_Head(&iter->layer->tmpl->settings) : NULL;
+    }
+
+finish:
+
+    iter->section = NULL;
+    return NULL;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Get_Helper
 //---------------------------------------------------------------------------
@@ -1061,6 +1217,11 @@ _FX const WCHAR *Conf_Get_Helper(
     WCHAR *value;
     CONF_SECTION *section;
     CONF_SETTING *setting;
+#ifdef USE_CONF_MAP
+    CONF_LAYER *layer;
+#else
+    CONF_ITER iter;
+#endif
 
     value = NULL;
 
@@ -1091,29 +1252,56 @@ _FX const WCHAR *Conf_Get_Helper(
         map_iter_t iter2 = map_key_iter(&section->settings_map, setting_name);
 	    while (map_next(&section->settings_map, &iter2)) {
             setting = iter2.value;
-#else
-        setting = List_Head(&section->settings);
-        while (setting) {
-            //DbgPrint("        Examining setting at %X name %S (looking for %S)\n", setting, setting->name, setting_name);
-#endif
+
             if (skip_tmpl && setting->from_template) {
                 // we can break because template settings come after
                 // all non-template settings
                 break;
             }
-#ifndef USE_CONF_MAP
+
+            if (*index == 0) {
+                value = setting->value;
+                break;
+            }
+            --(*index);
+        }
+
+        //
+        // continue with the matching settings of each layer
+        //
+
+        if (!value && !skip_tmpl && _wcsnicmp(setting_name, Conf_Tmpl, 5) != 0) {
+
+            layer = List_Head(&section->layers);
+            while (layer && !value) {
+
+                map_iter_t iter3 = map_key_iter(&layer->tmpl->settings_map, setting_name);
+	            while (map_next(&layer->tmpl->settings_map, &iter3)) {
+                    setting = iter3.value;
+
+                    if (*index == 0) {
+                        value = setting->value;
+                        break;
+                    }
+                    --(*index);
+                }
+
+                layer = List_Next(layer);
+            }
+        }
+#else
+        Conf_Iter_Init(&iter, section, skip_tmpl);
+        while ((setting = Conf_Iter_Next(&iter)) != NULL) {
+            //DbgPrint("        Examining setting at %X name %S (looking for %S)\n", setting, setting->name, setting_name);
             if (_wcsicmp(setting->name, setting_name) == 0) {
-#endif
                 if (*index == 0) {
                     value = setting->value;
                     break;
                 }
                 --(*index);
-#ifndef USE_CONF_MAP
             }
-            setting = List_Next(setting);
-#endif
         }
+#endif
     }
 
     return value;
@@ -1169,6 +1357,7 @@ _FX const WCHAR *Conf_Get_Setting_Name(
     WCHAR *value;
     CONF_SECTION *section;
     CONF_SETTING *setting, *setting2;
+    CONF_ITER iter, iter2;
     BOOLEAN dup;
 
     value = NULL;
@@ -1191,27 +1380,24 @@ _FX const WCHAR *Conf_Get_Setting_Name(
         section = NULL;
 
     if (section) {
-        setting = List_Head(&section->settings);
-        while (setting) {
-
-            if (skip_tmpl && setting->from_template) {
-                // we can break because template settings come after
-                // all non-template settings
-                break;
-            }
+        Conf_Iter_Init(&iter, section, skip_tmpl);
+        while ((setting = Conf_Iter_Next(&iter)) != NULL) {
 
             //
-            // check if we already processed this name
+            // check if we already processed this name, note that the same
+            // template may be layered more than once, so the position in
+            // the chain is compared and not just the setting
             //
 
             dup = FALSE;
-            setting2 = List_Head(&section->settings);
-            while (setting2 && setting2 != setting) {
+            Conf_Iter_Init(&iter2, section, skip_tmpl);
+            while ((setting2 = Conf_Iter_Next(&iter2)) != NULL) {
+                if (setting2 == setting && iter2.layer == iter.layer)
+                    break;
                 if (_wcsicmp(setting2->name, setting->name) == 0) {
                     dup = TRUE;
                     break;
-                } else
-                    setting2 = List_Next(setting2);
+                }
             }
 
             if (! dup) {
@@ -1221,8 +1407,6 @@ _FX const WCHAR *Conf_Get_Setting_Name(
                 } else
                     --index;
             }
-
-            setting = List_Next(setting);
         }
     }
 
@@ -1464,6 +1648,8 @@ _FX NTSTATUS Conf_Api_Reload(PROCESS *proc, ULONG64 *parms)
         Conf_Data.path = NULL;
         Conf_Data.encoding = 0;
 
+        InterlockedIncrement(&Conf_Generation);
+
         ExReleaseResourceLite(Conf_Lock);
         KeLowerIrql(irql);
 
@@ -1603,7 +1789,7 @@ _FX NTSTATUS Conf_Api_Query(PROCESS *proc, ULONG64 *parms)
 
     Conf_AdjustUseCount(TRUE);
 
-    if ((setting && setting[0] == L'%') || (index & CONF_JUST_EXPAND))
+    if ((setting[0] == L'%') || (index & CONF_JUST_EXPAND))
         value1 = setting; // shortcut to expand a variable
     else
         value1 = Conf_Get(boxname, setting, index);
@@ -1683,6 +1869,118 @@ release_and_return:
 }
 
 
+//---------------------------------------------------------------------------
+// Conf_Api_QuerySection
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Conf_Api_QuerySection(PROCESS *proc, ULONG64 *parms)
+{
+    API_QUERY_CONF_SECTION_ARGS *args = (API_QUERY_CONF_SECTION_ARGS *)parms;
+    NTSTATUS status;
+    WCHAR *parm;
+    WCHAR section_name[70];
+    CONF_SECTION *section;
+    CONF_SETTING *setting;
+    CONF_ITER iter;
+    BOOLEAN skip_tmpl;
+    ULONG buf_len;
+    WCHAR *buf;
+    KIRQL irql;
+
+    //
+    // prepare parameters
+    //
+
+    memzero(section_name, sizeof(section_name));
+    parm = args->section_name.val;
+    if (parm) {
+        ProbeForRead(parm, sizeof(WCHAR) * 64, sizeof(WCHAR));
+        wcsncpy(section_name, parm, 64);
+    }
+    if (! section_name[0]) {
+        if (! proc)
+            return STATUS_INVALID_PARAMETER;
+        wcscpy(section_name, proc->box->name);
+    }
+
+    if (! args->buffer_len.val)
+        return STATUS_INVALID_PARAMETER;
+
+    skip_tmpl = ((args->flags.val & CONF_GET_NO_TEMPLS) != 0);
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceSharedLite(Conf_Lock, TRUE);
+
+    //
+    // section format: ([name][0x0000][value][0x0000])*[0x0000]
+    // settings are returned unexpanded and in the order used by Conf_Get,
+    // a section which does not exist is returned as an empty list
+    //
+
+#ifdef USE_CONF_MAP
+    section = map_get(&Conf_Data.sections_map, section_name);
+#else
+    section = List_Head(&Conf_Data.sections);
+    while (section) {
+        if (_wcsicmp(section->name, section_name) == 0)
+            break;
+        section = List_Next(section);
+    }
+#endif
+    if (skip_tmpl && section && section->from_template)
+        section = NULL;
+
+    buf_len = sizeof(WCHAR);
+
+    Conf_Iter_Init(&iter, section, skip_tmpl);
+    while ((setting = Conf_Iter_Next(&iter)) != NULL)
+        buf_len += (wcslen(setting->name) + wcslen(setting->value) + 2) * sizeof(WCHAR);
+
+    __try {
+
+        if (args->generation.val) {
+            ProbeForWrite(args->generation.val, sizeof(ULONG), sizeof(ULONG));
+            *args->generation.val = Conf_Generation;
+        }
+
+        ProbeForWrite(args->buffer_len.val, sizeof(ULONG), sizeof(ULONG));
+        if (! args->buffer_ptr.val || *args->buffer_len.val < buf_len) {
+
+            *args->buffer_len.val = buf_len;
+            status = STATUS_BUFFER_TOO_SMALL;
+            __leave;
+        }
+
+        buf = args->buffer_ptr.val;
+        ProbeForWrite(buf, buf_len, sizeof(WCHAR));
+
+        Conf_Iter_Init(&iter, section, skip_tmpl);
+        while ((setting = Conf_Iter_Next(&iter)) != NULL) {
+            ULONG len;
+            len = wcslen(setting->name) + 1;
+            wmemcpy(buf, setting->name, len);
+            buf += len;
+            len = wcslen(setting->value) + 1;
+            wmemcpy(buf, setting->value, len);
+            buf += len;
+        }
+        *buf = L'\0';
+
+        *args->buffer_len.val = buf_len;
+        status = STATUS_SUCCESS;
+
+    } __except (EXCEPTION_EXECUTE_HANDLER) {
+        status = GetExceptionCode();
+    }
+
+    ExReleaseResourceLite(Conf_Lock);
+    KeLowerIrql(irql);
+
+    return status;
+}
+
+
 //---------------------------------------------------------------------------
 // Conf_Init
 //---------------------------------------------------------------------------
@@ -1717,6 +2015,7 @@ _FX BOOLEAN Conf_Init(void)
 
     Api_SetFunction(API_RELOAD_CONF,        Conf_Api_Reload);
     Api_SetFunction(API_QUERY_CONF,         Conf_Api_Query);
+    Api_SetFunction(API_QUERY_CONF_SECTION, Conf_Api_QuerySection);
 
     return TRUE;
 }
@@ -1738,3 +2037,4 @@ _FX void Conf_Unload(void)
 
     Mem_FreeLockResource(&Conf_Lock);
 }
+
@@ -68,6 +68,13 @@ void Conf_Unload(void);
 
 void Conf_AdjustUseCount(BOOLEAN increase);
 
+// Conf_GetGeneration:  returns a number which changes every time the
+// configuration is reloaded, data derived from the configuration can
+// be cached as long as this number stays the same.  read it while the
+// use count is raised, to get the generation of the strings in use
+
+ULONG Conf_GetGeneration(void);
+
 
 // Conf_Get:  returns a pointer to string configuration data.  use
 // with Conf_AdjustUseCount to make sure the returned pointer is valid
@@ -128,6 +135,8 @@ NTSTATUS Conf_Api_Reload(PROCESS *proc, ULONG64 *parms);
 
 NTSTATUS Conf_Api_Query(PROCESS *proc, ULONG64 *parms);
 
+NTSTATUS Conf_Api_QuerySection(PROCESS *proc, ULONG64 *parms);
+
 
 //---------------------------------------------------------------------------
 
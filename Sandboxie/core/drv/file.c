@@ -977,6 +977,18 @@ _FX BOOLEAN File_InitPaths(PROCESS *proc,
         }
     }
 
+    //
+    // compile the path lists for faster matching in Process_MatchPathEx
+    //
+
+#ifdef USE_MATCH_PATH_EX
+    Pattern_CreateIndex(proc->pool, normal_file_paths);
+#endif
+    Pattern_CreateIndex(proc->pool, open_file_paths);
+    Pattern_CreateIndex(proc->pool, closed_file_paths);
+    Pattern_CreateIndex(proc->pool, read_file_paths);
+    Pattern_CreateIndex(proc->pool, write_file_paths);
+
     //
     // finish
     //
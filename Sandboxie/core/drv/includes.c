@@ -48,6 +48,10 @@ extern const ULONG tzuk;
 
 #include "common/stream.c"
 
+/* Ini Tokenizer */
+
+#include "common/ini_token.c"
+
 /* Pattern */
 
 #include "mem.h"
@@ -390,6 +390,18 @@ _FX BOOLEAN Key_InitProcess(PROCESS *proc)
         return FALSE;
     }
 
+    //
+    // compile the path lists for faster matching in Process_MatchPathEx
+    //
+
+#ifdef USE_MATCH_PATH_EX
+    Pattern_CreateIndex(proc->pool, &proc->normal_key_paths);
+#endif
+    Pattern_CreateIndex(proc->pool, &proc->open_key_paths);
+    Pattern_CreateIndex(proc->pool, &proc->closed_key_paths);
+    Pattern_CreateIndex(proc->pool, &proc->read_key_paths);
+    Pattern_CreateIndex(proc->pool, &proc->write_key_paths);
+
     //
     // finish
     //
@@ -15,20 +15,20 @@
  *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#ifdef KERNEL_MODE
 #include "driver.h"
+#else
+#include <windows.h>
+#endif
 #include "log_buff.h"
 
+#ifdef KERNEL_MODE
 LOG_BUFFER* log_buffer_init(SIZE_T buffer_size)
 {
-	//LOG_BUFFER* ptr_buffer = (LOG_BUFFER*)malloc(sizeof(LOG_BUFFER) + buffer_size);
-	LOG_BUFFER* ptr_buffer = (LOG_BUFFER*)ExAllocatePoolWithTag(PagedPool, sizeof(LOG_BUFFER) + buffer_size, tzuk);
+	//LOG_BUFFER* ptr_buffer = (LOG_BUFFER*)malloc(sizeof(LOG_BUFFER) + LOG_BUFFER_VIEW_SIZE(buffer_size));
+	LOG_BUFFER* ptr_buffer = (LOG_BUFFER*)ExAllocatePoolWithTag(PagedPool, sizeof(LOG_BUFFER) + LOG_BUFFER_VIEW_SIZE(buffer_size), tzuk);
 	if (ptr_buffer != NULL)
-	{
-		ptr_buffer->seq_counter = 0;
-		ptr_buffer->buffer_used = 0;
-		ptr_buffer->buffer_size = buffer_size;
-		ptr_buffer->buffer_start_ptr = ptr_buffer->buffer_data;
-	}
+		log_buffer_init_ex(ptr_buffer, (LOG_BUFFER_VIEW*)(ptr_buffer + 1), buffer_size);
 	return ptr_buffer;
 }
 
@@ -37,6 +37,18 @@ void log_buffer_free(LOG_BUFFER* ptr_buffer)
 	//free(ptr_buffer);
 	ExFreePoolWithTag(ptr_buffer, tzuk);
 }
+#endif
+
+void log_buffer_init_ex(LOG_BUFFER* ptr_buffer, LOG_BUFFER_VIEW* ptr_view, SIZE_T buffer_size)
+{
+	memset(ptr_buffer, 0, sizeof(LOG_BUFFER));
+	ptr_buffer->buffer_size = (ULONG)buffer_size;
+	ptr_buffer->buffer_data = ptr_view->buffer_data;
+	ptr_buffer->view = ptr_view;
+
+	memset(ptr_view, 0, sizeof(LOG_BUFFER_VIEW));
+	ptr_view->buffer_size = (ULONG)buffer_size;
+}
 
 CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOLEAN can_pop)
 {
@@ -52,8 +64,8 @@ CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOL
 		log_buffer_pop_entry(ptr_buffer);
 	}
 
-	CHAR* write_ptr = ptr_buffer->buffer_start_ptr + ptr_buffer->buffer_used;
-	ptr_buffer->buffer_used += total_size;
+	CHAR* write_ptr = LOG_BUFFER_START_PTR(ptr_buffer) + ptr_buffer->buffer_used;
+	ptr_buffer->buffer_used += (ULONG)total_size;
 	log_buffer_push_bytes((CHAR*)&size, sizeof(LOG_BUFFER_SIZE_T), &write_ptr, ptr_buffer);
 	log_buffer_push_bytes((CHAR*)&ptr_buffer->seq_counter, sizeof(LOG_BUFFER_SEQ_T), &write_ptr, ptr_buffer);
 
@@ -63,18 +75,38 @@ CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOL
 	return write_ptr;
 }
 
+void log_buffer_commit_entry(LOG_BUFFER* ptr_buffer)
+{
+	// publish the entry to mapped readers only once its data is complete
+	MemoryBarrier();
+	ptr_buffer->view->commit_pos = ptr_buffer->start_pos + ptr_buffer->buffer_used;
+}
+
 void log_buffer_pop_entry(LOG_BUFFER* ptr_buffer)
 {
 	if (ptr_buffer->buffer_used)
 	{
-		CHAR* start_ptr = ptr_buffer->buffer_start_ptr;
+		CHAR* start_ptr = LOG_BUFFER_START_PTR(ptr_buffer);
 		LOG_BUFFER_SIZE_T size = log_buffer_get_size(&start_ptr, ptr_buffer);
-		SIZE_T total_size = size + sizeof(LOG_BUFFER_SIZE_T) * 2 + sizeof(LOG_BUFFER_SEQ_T);
+		ULONG total_size = size + sizeof(LOG_BUFFER_SIZE_T) * 2 + sizeof(LOG_BUFFER_SEQ_T);
+		if (size > ptr_buffer->buffer_used || total_size > ptr_buffer->buffer_used) // corrupt size tag, drop all entries
+			total_size = ptr_buffer->buffer_used;
 
-		ptr_buffer->buffer_start_ptr += total_size;
-		if (ptr_buffer->buffer_start_ptr >= ptr_buffer->buffer_data + ptr_buffer->buffer_size) // wrap around
-			ptr_buffer->buffer_start_ptr -= ptr_buffer->buffer_size;
+		// mapped readers must see the new start before the space gets reused
+		ptr_buffer->view->start_lock = ++ptr_buffer->start_lock;
+		MemoryBarrier();
+
+		ptr_buffer->buffer_start += total_size;
+		if (ptr_buffer->buffer_start >= ptr_buffer->buffer_size) // wrap around
+			ptr_buffer->buffer_start -= ptr_buffer->buffer_size;
 		ptr_buffer->buffer_used -= total_size;
+		ptr_buffer->start_pos += total_size;
+
+		ptr_buffer->view->buffer_start = ptr_buffer->buffer_start;
+		ptr_buffer->view->start_pos = ptr_buffer->start_pos;
+
+		MemoryBarrier();
+		ptr_buffer->view->start_lock = ++ptr_buffer->start_lock;
 	}
 }
 
@@ -122,9 +154,11 @@ CHAR* log_buffer_get_next(LOG_BUFFER_SEQ_T seq_number, LOG_BUFFER* ptr_buffer)
 	// traverse the list backwards to find the next entry
 	for (SIZE_T size_left = ptr_buffer->buffer_used; size_left > 0;)
 	{
-		CHAR* end_ptr = ptr_buffer->buffer_start_ptr + size_left - sizeof(LOG_BUFFER_SIZE_T);
+		CHAR* end_ptr = LOG_BUFFER_START_PTR(ptr_buffer) + size_left - sizeof(LOG_BUFFER_SIZE_T);
 		LOG_BUFFER_SIZE_T size = log_buffer_get_size(&end_ptr, ptr_buffer);
 		SIZE_T total_size = size + sizeof(LOG_BUFFER_SIZE_T) * 2 + sizeof(LOG_BUFFER_SEQ_T);
+		if (total_size > size_left)
+			break; // corrupt size tag
 
 		CHAR* read_ptr = end_ptr - total_size;
 
@@ -141,7 +175,7 @@ CHAR* log_buffer_get_next(LOG_BUFFER_SEQ_T seq_number, LOG_BUFFER* ptr_buffer)
 	}
 
 	if (ptr_buffer->buffer_used != 0)
-		return ptr_buffer->buffer_start_ptr; // we haven't found the next entry and we have entries, so return the first entry
+		return LOG_BUFFER_START_PTR(ptr_buffer); // we haven't found the next entry and we have entries, so return the first entry
 	return NULL; // the buffer is apparently empty, return NULL
 }
 
@@ -190,4 +224,4 @@ int main(int argc, char *argv[])
 
 	return 0;
 }
-*/
\ No newline at end of file
+*/
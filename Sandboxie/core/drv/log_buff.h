@@ -21,19 +21,57 @@
 #define LOG_BUFFER_SIZE_T ULONG
 #define LOG_BUFFER_SEQ_T ULONG
 
+#define LOG_BUFFER_ENTRY_OVERHEAD (sizeof(LOG_BUFFER_SIZE_T) * 2 + sizeof(LOG_BUFFER_SEQ_T))
+
+#define LOG_BUFFER_FLAG_CLOSED 0x00000001 // the producer has released the buffer
+
+//
+// Note: the view header uses only 32 bit fields and offsets so that the same
+// layout can be mapped read-only into a 32 or 64 bit consumer process.
+// start_pos and commit_pos are absolute byte positions which wrap at 4 GB,
+// they are only ever compared by their signed difference.
+//
+
+typedef struct _LOG_BUFFER_VIEW
+{
+	ULONG buffer_size;
+	volatile ULONG buffer_flags;
+	volatile ULONG start_lock;		// odd while buffer_start and start_pos are being updated
+	volatile ULONG start_pos;		// absolute position of the first entry
+	volatile ULONG buffer_start;	// offset of the first entry in buffer_data
+	volatile ULONG commit_pos;		// absolute position past the last completely written entry
+	CHAR buffer_data[0]; // [[SIZE 4][SEQ 4][DATA n][SIZE 4]][...] // Note 2nd size tags allows to traverse the ring in both directions
+} LOG_BUFFER_VIEW;
+
+//
+// The producer keeps its own copy of the positions and never reads them
+// back from the view, which may be shared with a consumer process
+//
+
 typedef struct _LOG_BUFFER
 {
 	LOG_BUFFER_SEQ_T seq_counter;
-	SIZE_T buffer_size;
-	SIZE_T buffer_used;
-	CHAR* buffer_start_ptr;
-	CHAR buffer_data[0]; // [[SIZE 4][DATA n][SEQ 4][SITE 4]][...] // Note 2nd size tags allows to traverse the ring in both directions
+	ULONG buffer_size;
+	ULONG buffer_used;
+	ULONG buffer_start;
+	ULONG start_pos;
+	ULONG start_lock;
+	CHAR* buffer_data;				// view->buffer_data
+	LOG_BUFFER_VIEW* view;
 } LOG_BUFFER;
 
+#define LOG_BUFFER_START_PTR(b) ((b)->buffer_data + (b)->buffer_start)
+
+#define LOG_BUFFER_VIEW_SIZE(s) (sizeof(LOG_BUFFER_VIEW) + (s))
+
+#ifdef KERNEL_MODE
 LOG_BUFFER* log_buffer_init(SIZE_T buffer_size);
 void log_buffer_free(LOG_BUFFER* ptr_buffer);
+#endif
+void log_buffer_init_ex(LOG_BUFFER* ptr_buffer, LOG_BUFFER_VIEW* ptr_view, SIZE_T buffer_size);
 
 CHAR* log_buffer_push_entry(LOG_BUFFER_SIZE_T size, LOG_BUFFER* ptr_buffer, BOOLEAN can_pop);
+void log_buffer_commit_entry(LOG_BUFFER* ptr_buffer);
 void log_buffer_pop_entry(LOG_BUFFER* ptr_buffer);
 CHAR* log_buffer_byte_at(CHAR** data_ptr, LOG_BUFFER* ptr_buffer);
 BOOLEAN log_buffer_push_bytes(CHAR* data, SIZE_T size, CHAR** write_ptr, LOG_BUFFER* ptr_buffer);
@@ -42,4 +80,160 @@ LOG_BUFFER_SIZE_T log_buffer_get_size(CHAR** read_ptr, LOG_BUFFER* ptr_buffer);
 LOG_BUFFER_SEQ_T log_buffer_get_seq_num(CHAR** read_ptr, LOG_BUFFER* ptr_buffer);
 CHAR* log_buffer_get_next(LOG_BUFFER_SEQ_T seq_number, LOG_BUFFER* ptr_buffer);
 
+
+//---------------------------------------------------------------------------
+// Mapped Reader
+//---------------------------------------------------------------------------
+
+//
+// A consumer which maps the buffer read-only walks it forward by position
+// without taking the producer lock and without popping entries, the producer
+// overwrites the oldest entries instead.  Entries that were reused while
+// being read are detected through start_pos and discarded, lost entries
+// show up as gaps in the sequence numbers.
+//
+// The reader is kept header-only so it can be used by user mode consumers
+// and exercised against a synthetic producer built from log_buff.c
+//
+
+typedef struct _LOG_BUFFER_READER
+{
+	BOOLEAN positioned;				// read_pos and read_offset are valid
+	BOOLEAN synced;					// seq_number is valid
+	LOG_BUFFER_SEQ_T seq_number;	// sequence number of the last confirmed entry
+	LOG_BUFFER_SEQ_T entry_seq;		// sequence number of the last returned entry
+	ULONG entry_pos;				// absolute position of the last returned entry
+	ULONG read_pos;					// absolute position of the next entry
+	ULONG read_offset;				// offset of the next entry in buffer_data
+	ULONG64 dropped;				// number of entries lost so far
+} LOG_BUFFER_READER;
+
+
+static __inline void log_buffer_reader_copy(
+	CHAR* data, ULONG offset, ULONG size, const LOG_BUFFER_VIEW* ptr_buffer)
+{
+	ULONG tail = ptr_buffer->buffer_size - offset;
+	if (size <= tail)
+		memcpy(data, ptr_buffer->buffer_data + offset, size);
+	else {
+		memcpy(data, ptr_buffer->buffer_data + offset, tail);
+		memcpy(data + tail, ptr_buffer->buffer_data, size - tail);
+	}
+}
+
+
+static __inline ULONG log_buffer_reader_wrap(ULONG offset, const LOG_BUFFER_VIEW* ptr_buffer)
+{
+	return (offset >= ptr_buffer->buffer_size) ? offset - ptr_buffer->buffer_size : offset;
+}
+
+
+static __inline BOOLEAN log_buffer_reader_sync(
+	LOG_BUFFER_READER* reader, const LOG_BUFFER_VIEW* ptr_buffer)
+{
+	ULONG lock, pos, offset;
+
+	lock = ptr_buffer->start_lock;
+	MemoryBarrier();
+	pos = ptr_buffer->start_pos;
+	offset = ptr_buffer->buffer_start;
+	MemoryBarrier();
+	if ((lock & 1) || lock != ptr_buffer->start_lock)
+		return FALSE;
+
+	reader->read_pos = pos;
+	reader->read_offset = offset;
+	reader->positioned = TRUE;
+	return TRUE;
+}
+
+
+//
+// log_buffer_reader_next returns the data of the next entry in place,
+// or a copy in scratch (buffer_size bytes) when the entry wraps around
+// the end of the ring.  The returned data must be treated as tentative
+// until log_buffer_reader_check has confirmed it was not overwritten.
+//
+
+static __inline CHAR* log_buffer_reader_next(
+	LOG_BUFFER_READER* reader, const LOG_BUFFER_VIEW* ptr_buffer,
+	CHAR* scratch, LOG_BUFFER_SIZE_T* out_size)
+{
+	LOG_BUFFER_SIZE_T size, size2;
+	LOG_BUFFER_SEQ_T seq_number;
+	ULONG commit_pos, offset;
+	ULONG retry;
+
+	for (retry = 0; retry < 16; retry++) {
+
+		commit_pos = ptr_buffer->commit_pos;
+		MemoryBarrier();
+
+		if (! reader->positioned ||
+				(LONG)(ptr_buffer->start_pos - reader->read_pos) > 0) {
+
+			// the next entry was reused, continue with the oldest one
+			if (! log_buffer_reader_sync(reader, ptr_buffer))
+				continue;
+		}
+
+		if ((LONG)(commit_pos - reader->read_pos) <= 0)
+			return NULL; // no new complete entries
+
+		offset = reader->read_offset;
+		log_buffer_reader_copy((CHAR*)&size, offset, sizeof(size), ptr_buffer);
+		log_buffer_reader_copy((CHAR*)&seq_number,
+			log_buffer_reader_wrap(offset + sizeof(size), ptr_buffer), sizeof(seq_number), ptr_buffer);
+		if (size > ptr_buffer->buffer_size - LOG_BUFFER_ENTRY_OVERHEAD) {
+			reader->positioned = FALSE; // torn header, the entry is being reused
+			continue;
+		}
+		log_buffer_reader_copy((CHAR*)&size2,
+			log_buffer_reader_wrap(offset + sizeof(size) + sizeof(seq_number) + size, ptr_buffer), sizeof(size2), ptr_buffer);
+		if (size != size2) {
+			reader->positioned = FALSE;
+			continue;
+		}
+
+		reader->entry_seq = seq_number;
+		reader->entry_pos = reader->read_pos;
+
+		reader->read_pos += size + LOG_BUFFER_ENTRY_OVERHEAD;
+		reader->read_offset = log_buffer_reader_wrap(offset + size + LOG_BUFFER_ENTRY_OVERHEAD, ptr_buffer);
+
+		offset = log_buffer_reader_wrap(offset + sizeof(size) + sizeof(seq_number), ptr_buffer);
+		*out_size = size;
+		if (size > ptr_buffer->buffer_size - offset) {
+			log_buffer_reader_copy(scratch, offset, size, ptr_buffer);
+			return scratch;
+		}
+		return (CHAR*)ptr_buffer->buffer_data + offset;
+	}
+
+	return NULL;
+}
+
+
+//
+// log_buffer_reader_check must be called for every returned entry once
+// it has been consumed, it returns FALSE if the producer has started
+// reusing its space, in which case the entry must be discarded by the
+// caller and is accounted for by the sequence gap of the next entry
+//
+
+static __inline BOOLEAN log_buffer_reader_check(
+	LOG_BUFFER_READER* reader, const LOG_BUFFER_VIEW* ptr_buffer)
+{
+	MemoryBarrier();
+	if ((LONG)(ptr_buffer->start_pos - reader->entry_pos) > 0)
+		return FALSE;
+
+	if (reader->synced && reader->entry_seq != reader->seq_number + 1)
+		reader->dropped += (LOG_BUFFER_SEQ_T)(reader->entry_seq - reader->seq_number - 1);
+	reader->seq_number = reader->entry_seq;
+	reader->synced = TRUE;
+	return TRUE;
+}
+
+
 #endif // _MY_LOG_BUFFER_H
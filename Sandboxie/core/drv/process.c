@@ -150,6 +150,9 @@ _FX BOOLEAN Process_Init(void)
     if (! Mem_GetLockResource(&Process_ListLock, TRUE))
         return FALSE;
 
+    if (! Process_ForceInit())
+        return FALSE;
+
     if (! Process_Low_Init())
         return FALSE;
 
@@ -271,8 +274,10 @@ _FX void Process_Unload(BOOLEAN FreeLock)
 
     Process_Low_Unload();
 
-    if (FreeLock)
+    if (FreeLock) {
+        Process_ForceUnload();
         Mem_FreeLockResource(&Process_ListLock);
+    }
 }
 
 
@@ -426,6 +426,13 @@ void Process_GetCommandLine(
 BOX *Process_GetForcedStartBox(
     HANDLE ProcessId, HANDLE ParentId, const WCHAR *ImagePath, BOOLEAN* pHostInject, const WCHAR *pSidString);
 
+// Set up and free the cache of compiled force rules used by
+// Process_GetForcedStartBox
+
+BOOLEAN Process_ForceInit(void);
+
+void Process_ForceUnload(void);
+
 
 #ifdef DRV_BREAKOUT
 BOOLEAN Process_IsBreakoutProcess(BOX *box, const WCHAR *ImagePath);
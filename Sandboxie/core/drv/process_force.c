@@ -29,6 +29,7 @@
 #include "file.h"
 #include "token.h"
 #include "common/pattern.h"
+#include "common/map.h"
 #include "common/my_version.h"
 
 
@@ -48,8 +49,28 @@ typedef struct _FORCE_BOX {
     LIST AlertProcess;
     LIST HostInjectProcess;
 
+    // literal entries moved out of the lists above, keyed by FORCE_ENTRY
+
+    HASH_MAP ForceFolderIndex;
+    HASH_MAP ForceProcessIndex;
+    HASH_MAP ForceChildrenIndex;
+    HASH_MAP AlertFolderIndex;
+    HASH_MAP AlertProcessIndex;
+
 } FORCE_BOX;
 
+typedef struct _FORCE_DATA {
+
+    LIST_ELEM list_elem;
+    volatile LONG ref_count;
+    ULONG generation;
+    ULONG SessionId;
+    ULONG SidString_len;
+    WCHAR *SidString;
+    LIST boxes;
+
+} FORCE_DATA;
+
 typedef struct _FORCE_ENTRY {
 
     LIST_ELEM list_elem;
@@ -90,6 +111,14 @@ typedef struct _FORCE_PROCESS_3 {
 
 } FORCE_PROCESS_3;
 
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define FORCE_DATA_CACHE_MAX    8
+
 //---------------------------------------------------------------------------
 // Functions
 //---------------------------------------------------------------------------
@@ -116,10 +145,30 @@ static BOOLEAN Process_IsImmersiveProcess(
 
 //static BOOLEAN Process_IsProcessParent(HANDLE ParentId, WCHAR* Name);
 
-void Process_CreateForceData(
-    LIST *boxes, const WCHAR *SidString, ULONG SessionId);
+static FORCE_DATA *Process_GetForceData(
+    const WCHAR *SidString, ULONG SessionId);
+
+static void Process_ReleaseForceData(FORCE_DATA *data);
 
-void Process_DeleteForceData(LIST *boxes);
+static FORCE_DATA *Process_CreateForceData(
+    const WCHAR *SidString, ULONG SessionId);
+
+static void Process_DeleteForceData(FORCE_DATA *data);
+
+static unsigned int Process_ForceIndexHash(const void *key, size_t size);
+
+static BOOLEAN Process_ForceIndexMatch(const void *key1, const void *key2);
+
+static void Process_IndexForceEntries(
+    LIST *Entries, HASH_MAP *Index, BOOLEAN ByName);
+
+static void Process_DeleteForceIndex(HASH_MAP *Index);
+
+static BOOLEAN Process_CheckForceFolderIndex(
+    HASH_MAP *Index, ULONG prefix_len, const WCHAR *path);
+
+static BOOLEAN Process_CheckForceProcessIndex(
+    HASH_MAP *Index, const WCHAR *name);
 
 static BOX *Process_CheckBoxPath(LIST *boxes, const WCHAR *path);
 
@@ -141,6 +190,21 @@ static BOX *Process_CheckHostInjectProcess(
 static BOOLEAN Process_CheckMoTW(const WCHAR *path);
 
 
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+//
+// compiled force rules, one FORCE_DATA per SID and session, most recently
+// used first.  entries are never modified once built, they are dropped
+// when the configuration generation changes, and freed by the last user
+//
+
+static LIST Process_ForceCache;
+static PERESOURCE Process_ForceLock = NULL;
+
+
 //---------------------------------------------------------------------------
 // Process_GetForcedStartBox
 //---------------------------------------------------------------------------
@@ -159,7 +223,8 @@ _FX BOX *Process_GetForcedStartBox(
     PEPROCESS ProcessObject;
     WCHAR *CurDir, *DocArg;
     ULONG CurDir_len, DocArg_len;
-    LIST boxes;
+    FORCE_DATA *data;
+    LIST no_boxes, *boxes;
     BOX *box;
     ULONG alert;
     BOOLEAN check_force;
@@ -256,7 +321,13 @@ _FX BOX *Process_GetForcedStartBox(
     box = NULL;
     alert = 0;
 
-    Process_CreateForceData(&boxes, pSidString, SessionId);
+    data = Process_GetForceData(pSidString, SessionId);
+    if (data)
+        boxes = &data->boxes;
+    else {
+        List_Init(&no_boxes);
+        boxes = &no_boxes;
+    }
 
     //
     // check if process can be forced
@@ -264,7 +335,7 @@ _FX BOX *Process_GetForcedStartBox(
 
     if (check_force) {
 
-        box = Process_CheckBoxPath(&boxes, ImagePath2);
+        box = Process_CheckBoxPath(boxes, ImagePath2);
 
         //
         // when the process is start.exe we ignore the CurDir and DocArg
@@ -273,26 +344,26 @@ _FX BOX *Process_GetForcedStartBox(
         Process_IsSbieImage(ImagePath, &image_sbie, &is_start_exe);
 
         if ((! box) && CurDir && !is_start_exe)
-            box = Process_CheckBoxPath(&boxes, CurDir);
+            box = Process_CheckBoxPath(boxes, CurDir);
 
         if (!box) {
 
             box = Process_CheckForceFolder(
-                        &boxes, ImagePath2, force_alert, &alert);
+                        boxes, ImagePath2, force_alert, &alert);
 
             if ((! box) && (! alert)) {
                 box = Process_CheckForceProcess(
-                    &boxes, ImageName, ImagePath2, force_alert, &alert, ParentName, ParentPath);
+                    boxes, ImageName, ImagePath2, force_alert, &alert, ParentName, ParentPath);
             }
 
             if ((! box) && CurDir && !is_start_exe && (! alert)) {
                 box = Process_CheckForceFolder(
-                        &boxes, CurDir, force_alert, &alert);
+                        boxes, CurDir, force_alert, &alert);
             }
 
             if ((! box) && DocArg && !is_start_exe && (! alert)) {
                 box = Process_CheckForceFolder(
-                        &boxes, DocArg, force_alert, &alert);
+                        boxes, DocArg, force_alert, &alert);
             }
 
             if (box && (! Conf_Get_Boolean(NULL, L"AllowForceImmersive", 0, FALSE)) &&
@@ -322,7 +393,7 @@ _FX BOX *Process_GetForcedStartBox(
             if (Process_FcpCheck(ParentId, boxname)) {
 
                 ULONG boxname_len = (wcslen(boxname) + 1) * sizeof(WCHAR);
-                for (FORCE_BOX* cur_box = List_Head(&boxes); cur_box; cur_box = List_Next(cur_box)) {
+                for (FORCE_BOX* cur_box = List_Head(boxes); cur_box; cur_box = List_Next(cur_box)) {
                     if (cur_box->box->name_len == boxname_len
                         && _wcsicmp(cur_box->box->name, boxname) == 0) {
                         box = cur_box->box;
@@ -336,14 +407,14 @@ _FX BOX *Process_GetForcedStartBox(
 			force_alert = FALSE;
 
 		if ((! box) && (alert != 1))
-			Process_CheckAlertFolder(&boxes, ImagePath2, &alert);
+			Process_CheckAlertFolder(boxes, ImagePath2, &alert);
 
 		//
 		// for alerting we only care about the process path not about the working dir or command line
 		//
 
         if ((! box) && (alert != 1))
-            Process_CheckAlertProcess(&boxes, ImageName, ImagePath2, &alert);
+            Process_CheckAlertProcess(boxes, ImageName, ImagePath2, &alert);
     }
 
     //
@@ -363,7 +434,7 @@ _FX BOX *Process_GetForcedStartBox(
                 box = (BOX*)-1; // when box not found cancel process
 
                 ULONG MoTW_Box_len = (wcslen(MoTW_Box) + 1) * sizeof(WCHAR);
-                FORCE_BOX* fbox = List_Head(&boxes);
+                FORCE_BOX* fbox = List_Head(boxes);
                 while (fbox) {
                     if (MoTW_Box_len == fbox->box->name_len && _wcsicmp(MoTW_Box, fbox->box->name) == 0) {
                         box = fbox->box;
@@ -381,7 +452,7 @@ _FX BOX *Process_GetForcedStartBox(
 
     if ((! box) && (alert != 1) && pHostInject != NULL) {
         
-        box = Process_CheckHostInjectProcess(&boxes, ImageName);
+        box = Process_CheckHostInjectProcess(boxes, ImageName);
 
         if (box)
             *pHostInject = TRUE;
@@ -422,7 +493,8 @@ _FX BOX *Process_GetForcedStartBox(
     // finish
     //
 
-    Process_DeleteForceData(&boxes);
+    if (data)
+        Process_ReleaseForceData(data);
 
     if (nbuf)
 		Mem_Free(nbuf, nlen);
@@ -1137,26 +1209,218 @@ _FX void Process_AddForceProcesses(
 }
 
 
+//---------------------------------------------------------------------------
+// Process_ForceInit
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_ForceInit(void)
+{
+    List_Init(&Process_ForceCache);
+
+    if (! Mem_GetLockResource(&Process_ForceLock, TRUE))
+        return FALSE;
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceUnload
+//---------------------------------------------------------------------------
+
+
+_FX void Process_ForceUnload(void)
+{
+    FORCE_DATA *data;
+
+    if (! Process_ForceLock)
+        return;
+
+    while (1) {
+
+        data = List_Head(&Process_ForceCache);
+        if (! data)
+            break;
+
+        List_Remove(&Process_ForceCache, data);
+
+        Process_ReleaseForceData(data);
+    }
+
+    Mem_FreeLockResource(&Process_ForceLock);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_GetForceData
+//---------------------------------------------------------------------------
+
+
+_FX FORCE_DATA *Process_GetForceData(
+    const WCHAR *SidString, ULONG SessionId)
+{
+    FORCE_DATA *data, *next, *found;
+    LIST stale;
+    ULONG generation;
+    KIRQL irql;
+
+    //
+    // look for compiled rules of the current configuration generation,
+    // and move out any entries which were built from an older one
+    //
+
+    List_Init(&stale);
+
+    generation = Conf_GetGeneration();
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceLock, TRUE);
+
+    found = NULL;
+
+    data = List_Head(&Process_ForceCache);
+    while (data) {
+
+        next = List_Next(data);
+
+        if (data->generation != generation) {
+
+            List_Remove(&Process_ForceCache, data);
+            List_Insert_After(&stale, NULL, data);
+
+        } else if ((! found) && data->SessionId == SessionId
+                    && _wcsicmp(data->SidString, SidString) == 0) {
+
+            InterlockedIncrement(&data->ref_count);
+
+            List_Remove(&Process_ForceCache, data);
+            List_Insert_Before(&Process_ForceCache, NULL, data);
+
+            found = data;
+        }
+
+        data = next;
+    }
+
+    ExReleaseResourceLite(Process_ForceLock);
+    KeLowerIrql(irql);
+
+    while ((data = List_Head(&stale)) != NULL) {
+        List_Remove(&stale, data);
+        Process_ReleaseForceData(data);
+    }
+
+    if (found)
+        return found;
+
+    //
+    // otherwise compile the rules without holding the lock, and cache
+    // them unless the configuration was reloaded in the meantime or
+    // another thread was faster
+    //
+
+    data = Process_CreateForceData(SidString, SessionId);
+    if (! data)
+        return NULL;
+
+    KeRaiseIrql(APC_LEVEL, &irql);
+    ExAcquireResourceExclusiveLite(Process_ForceLock, TRUE);
+
+    found = List_Head(&Process_ForceCache);
+    while (found) {
+
+        if (found->generation == data->generation
+                && found->SessionId == SessionId
+                && _wcsicmp(found->SidString, SidString) == 0) {
+
+            InterlockedIncrement(&found->ref_count);
+            break;
+        }
+
+        found = List_Next(found);
+    }
+
+    next = NULL;
+
+    if ((! found) && data->generation == Conf_GetGeneration()) {
+
+        InterlockedIncrement(&data->ref_count);
+        List_Insert_Before(&Process_ForceCache, NULL, data);
+
+        if (List_Count(&Process_ForceCache) > FORCE_DATA_CACHE_MAX) {
+
+            next = List_Tail(&Process_ForceCache);
+            List_Remove(&Process_ForceCache, next);
+        }
+    }
+
+    ExReleaseResourceLite(Process_ForceLock);
+    KeLowerIrql(irql);
+
+    if (next)
+        Process_ReleaseForceData(next);
+
+    if (found) {
+
+        Process_ReleaseForceData(data);
+        data = found;
+    }
+
+    return data;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ReleaseForceData
+//---------------------------------------------------------------------------
+
+
+_FX void Process_ReleaseForceData(FORCE_DATA *data)
+{
+    if (InterlockedDecrement(&data->ref_count) == 0)
+        Process_DeleteForceData(data);
+}
+
+
 //---------------------------------------------------------------------------
 // Process_CreateForceData
 //---------------------------------------------------------------------------
 
 
-_FX void Process_CreateForceData(
-    LIST *boxes, const WCHAR *SidString, ULONG SessionId)
+_FX FORCE_DATA *Process_CreateForceData(
+    const WCHAR *SidString, ULONG SessionId)
 {
+    FORCE_DATA *data;
     ULONG index1;
     const WCHAR *section;
     FORCE_BOX *box;
-    
+
+    data = Mem_Alloc(Driver_Pool, sizeof(FORCE_DATA));
+    if (! data)
+        return NULL;
+
+    data->SidString_len = (wcslen(SidString) + 1) * sizeof(WCHAR);
+    data->SidString = Mem_Alloc(Driver_Pool, data->SidString_len);
+    if (! data->SidString) {
+        Mem_Free(data, sizeof(FORCE_DATA));
+        return NULL;
+    }
+    memcpy(data->SidString, SidString, data->SidString_len);
+
+    data->ref_count = 1;
+    data->SessionId = SessionId;
+
     //
     // scan list of boxes and create FORCE_BOX elements
     //
 
-    List_Init(boxes);
+    List_Init(&data->boxes);
 
     Conf_AdjustUseCount(TRUE);
 
+    data->generation = Conf_GetGeneration();
+
     index1 = 0;
 
     while (1) {
@@ -1194,7 +1458,13 @@ _FX void Process_CreateForceData(
         List_Init(&box->AlertProcess);
         List_Init(&box->HostInjectProcess);
 
-        List_Insert_After(boxes, NULL, box);
+        map_init(&box->ForceFolderIndex, Driver_Pool);
+        map_init(&box->ForceProcessIndex, Driver_Pool);
+        map_init(&box->ForceChildrenIndex, Driver_Pool);
+        map_init(&box->AlertFolderIndex, Driver_Pool);
+        map_init(&box->AlertProcessIndex, Driver_Pool);
+
+        List_Insert_After(&data->boxes, NULL, box);
 
         //
         // scan list of ForceFolder settings for the box
@@ -1234,9 +1504,22 @@ _FX void Process_CreateForceData(
         //
 
         Process_AddForceProcesses(&box->HostInjectProcess, L"HostInjectProcess", section);
+
+        //
+        // move literal folders and image names into hash indexes, so
+        // matching does not have to walk every entry of every box
+        //
+
+        Process_IndexForceEntries(&box->ForceFolder, &box->ForceFolderIndex, FALSE);
+        Process_IndexForceEntries(&box->ForceProcess, &box->ForceProcessIndex, TRUE);
+        Process_IndexForceEntries(&box->ForceChildren, &box->ForceChildrenIndex, TRUE);
+        Process_IndexForceEntries(&box->AlertFolder, &box->AlertFolderIndex, FALSE);
+        Process_IndexForceEntries(&box->AlertProcess, &box->AlertProcessIndex, TRUE);
     }
 
     Conf_AdjustUseCount(FALSE);
+
+    return data;
 }
 
 
@@ -1293,17 +1576,17 @@ _FX void Process_DeleteForceDataProcesses(LIST* Folders)
 //---------------------------------------------------------------------------
 
 
-_FX void Process_DeleteForceData(LIST *boxes)
+_FX void Process_DeleteForceData(FORCE_DATA *data)
 {
     FORCE_BOX *box;
 
     while (1) {
 
-        box = List_Head(boxes);
+        box = List_Head(&data->boxes);
         if (! box)
             break;
 
-        List_Remove(boxes, box);
+        List_Remove(&data->boxes, box);
 
         Process_DeleteForceDataFolders(&box->ForceFolder);
         //Process_DeleteForceDataProcesses(&box->ForceProcess);
@@ -1315,10 +1598,113 @@ _FX void Process_DeleteForceData(LIST *boxes)
         Process_DeleteForceDataFolders(&box->AlertProcess);
         Process_DeleteForceDataProcesses(&box->HostInjectProcess);
 
+        Process_DeleteForceIndex(&box->ForceFolderIndex);
+        Process_DeleteForceIndex(&box->ForceProcessIndex);
+        Process_DeleteForceIndex(&box->ForceChildrenIndex);
+        Process_DeleteForceIndex(&box->AlertFolderIndex);
+        Process_DeleteForceIndex(&box->AlertProcessIndex);
+
         Box_Free(box->box);
 
         Mem_Free(box, sizeof(FORCE_BOX));
     }
+
+    Mem_Free(data->SidString, data->SidString_len);
+    Mem_Free(data, sizeof(FORCE_DATA));
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceIndexHash
+//---------------------------------------------------------------------------
+
+
+_FX unsigned int Process_ForceIndexHash(const void *key, size_t size)
+{
+    const FORCE_ENTRY *entry = *(const FORCE_ENTRY **)key;
+    unsigned int hash = 5381;
+    ULONG i;
+
+    for (i = 0; i < entry->len; ++i)
+        hash = ((hash << 5) + hash) ^ RtlUpcaseUnicodeChar(entry->buf[i]);
+
+    return hash;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_ForceIndexMatch
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_ForceIndexMatch(const void *key1, const void *key2)
+{
+    const FORCE_ENTRY *entry1 = *(const FORCE_ENTRY **)key1;
+    const FORCE_ENTRY *entry2 = *(const FORCE_ENTRY **)key2;
+
+    return (entry1->len == entry2->len &&
+            Box_NlsStrCmp(entry1->buf, entry2->buf, entry1->len) == 0);
+}
+
+
+//---------------------------------------------------------------------------
+// Process_IndexForceEntries
+//---------------------------------------------------------------------------
+
+
+_FX void Process_IndexForceEntries(
+    LIST *Entries, HASH_MAP *Index, BOOLEAN ByName)
+{
+    FORCE_ENTRY *entry, *next;
+
+    Index->func_hash_key = Process_ForceIndexHash;
+    Index->func_match_key = Process_ForceIndexMatch;
+
+    entry = List_Head(Entries);
+    while (entry) {
+
+        next = List_Next(entry);
+
+        //
+        // folders without wildcards are compared literally, so all
+        // of them can be indexed.  image names go through
+        // Process_MatchImage, only plain names can be indexed there
+        //
+
+        if ((! entry->pat) && entry->len && ((! ByName) ||
+                (! wcschr(entry->buf, L'\\') && ! wcschr(entry->buf, L'?') &&
+                 ! wcschr(entry->buf, L'<') && ! wcschr(entry->buf, L'%')))) {
+
+            List_Remove(Entries, entry);
+
+            if (! map_insert(Index, entry, entry, 0))
+                List_Insert_After(Entries, NULL, entry);
+        }
+
+        entry = next;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Process_DeleteForceIndex
+//---------------------------------------------------------------------------
+
+
+_FX void Process_DeleteForceIndex(HASH_MAP *Index)
+{
+    FORCE_ENTRY *entry;
+
+    map_iter_t iter = map_iter();
+    while (map_next(Index, &iter)) {
+
+        entry = iter.value;
+
+        Mem_Free(entry->buf, entry->buf_len);
+        Mem_Free(entry, sizeof(FORCE_ENTRY));
+    }
+
+    map_clear(Index);
 }
 
 
@@ -1347,6 +1733,61 @@ _FX BOX *Process_CheckBoxPath(LIST *boxes, const WCHAR *path)
 }
 
 
+//---------------------------------------------------------------------------
+// Process_CheckForceFolderIndex
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_CheckForceFolderIndex(
+    HASH_MAP *Index, ULONG prefix_len, const WCHAR *path)
+{
+    FORCE_ENTRY key;
+    ULONG len;
+
+    if (! Index->nnodes)
+        return FALSE;
+
+    //
+    // a folder matches when it names any of the parent directories of
+    // path, so look up every prefix which ends before a backslash
+    //
+
+    key.buf = (WCHAR *)path;
+
+    for (len = 1; len <= prefix_len; ++len) {
+
+        if (path[len] != L'\\')
+            continue;
+
+        key.len = len;
+        if (map_get(Index, &key))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// Process_CheckForceProcessIndex
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Process_CheckForceProcessIndex(
+    HASH_MAP *Index, const WCHAR *name)
+{
+    FORCE_ENTRY key;
+
+    if (! Index->nnodes)
+        return FALSE;
+
+    key.buf = (WCHAR *)name;
+    key.len = wcslen(name);
+
+    return (map_get(Index, &key) != NULL);
+}
+
+
 //---------------------------------------------------------------------------
 // Process_CheckForceFolder
 //---------------------------------------------------------------------------
@@ -1459,7 +1900,8 @@ _FX BOX *Process_CheckForceFolder(
     box = List_Head(boxes);
     while (box) {
 
-        if (Process_CheckForceFolderList(box->box, &box->ForceFolder, prefix_len, path)) {
+        if (Process_CheckForceFolderIndex(&box->ForceFolderIndex, prefix_len, path) ||
+            Process_CheckForceFolderList(box->box, &box->ForceFolder, prefix_len, path)) {
 
             if (alert) {
                 *IsAlert = 1;
@@ -1578,7 +2020,8 @@ _FX BOX *Process_CheckForceProcess(
     box = List_Head(boxes);
     while (box) {
 
-        if (Process_CheckForceProcessList(box->box, &box->ForceProcess, name, path)) {
+        if (Process_CheckForceProcessIndex(&box->ForceProcessIndex, name) ||
+            Process_CheckForceProcessList(box->box, &box->ForceProcess, name, path)) {
             if (alert) {
                 *IsAlert = 1;
                 return NULL;
@@ -1587,7 +2030,9 @@ _FX BOX *Process_CheckForceProcess(
             return box->box;
         }
 
-        if (ParentName && Process_CheckForceProcessList(box->box, &box->ForceChildren, ParentName, ParentPath) && _wcsicmp(name, L"Sandman.exe") != 0) { // except for sandman exe
+        if (ParentName && (Process_CheckForceProcessIndex(&box->ForceChildrenIndex, ParentName) ||
+                           Process_CheckForceProcessList(box->box, &box->ForceChildren, ParentName, ParentPath))
+                && _wcsicmp(name, L"Sandman.exe") != 0) { // except for sandman exe
             if (alert) {
                 *IsAlert = 1;
                 return NULL;
@@ -1640,7 +2085,8 @@ _FX void Process_CheckAlertFolder(
     box = List_Head(boxes);
     while (box) {
 
-        if (Process_CheckForceFolderList(box->box, &box->AlertFolder, prefix_len, path)) {
+        if (Process_CheckForceFolderIndex(&box->AlertFolderIndex, prefix_len, path) ||
+            Process_CheckForceFolderList(box->box, &box->AlertFolder, prefix_len, path)) {
 
             *IsAlert = 1;
 			return;
@@ -1668,7 +2114,8 @@ static _FX void Process_CheckAlertProcess(
     box = List_Head(boxes);
     while (box) {
 
-        if (Process_CheckForceProcessList(box->box, &box->AlertProcess, name, path)) {
+        if (Process_CheckForceProcessIndex(&box->AlertProcessIndex, name) ||
+            Process_CheckForceProcessList(box->box, &box->AlertProcess, name, path)) {
             *IsAlert = 1;
             return;
         }
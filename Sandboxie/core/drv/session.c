@@ -74,10 +74,14 @@ struct _SESSION {
 
 	LOG_BUFFER* monitor_log;
 
+    HANDLE monitor_section;         // set if monitor_log is a view of a section
+
     BOOLEAN monitor_stack_trace;
 
     BOOLEAN monitor_overflow;
 
+    BOOLEAN monitor_mapped;
+
 };
 
 
@@ -96,6 +100,10 @@ static SESSION *Session_Get(
 
 static BOOLEAN Session_CheckAdminAccess2(const WCHAR *setting);
 
+static LOG_BUFFER *Session_MonitorAlloc(SIZE_T buffer_size, HANDLE *out_section);
+
+static void Session_MonitorFree(LOG_BUFFER *monitor_log, HANDLE section);
+
 
 //---------------------------------------------------------------------------
 
@@ -120,6 +128,8 @@ static NTSTATUS Session_Api_MonitorGetEx(PROCESS *proc, ULONG64 *parms);
 
 static NTSTATUS Session_Api_MonitorGet2(PROCESS *proc, ULONG64 *parms);
 
+static NTSTATUS Session_Api_MonitorMap(PROCESS *proc, ULONG64 *parms);
+
 //---------------------------------------------------------------------------
 // Variables
 //---------------------------------------------------------------------------
@@ -153,6 +163,7 @@ _FX BOOLEAN Session_Init(void)
     //Api_SetFunction(API_MONITOR_GET,            Session_Api_MonitorGet);
 	Api_SetFunction(API_MONITOR_GET_EX,			Session_Api_MonitorGetEx);
     Api_SetFunction(API_MONITOR_GET2,            Session_Api_MonitorGet2);
+    Api_SetFunction(API_MONITOR_MAP,            Session_Api_MonitorMap);
 
 
     return TRUE;
@@ -245,6 +256,8 @@ _FX void Session_Cancel(HANDLE ProcessId)
 {
     KIRQL irql;
     SESSION *session;
+    LOG_BUFFER *monitor_log = NULL;
+    HANDLE monitor_section = NULL;
 
     //
     // find an existing SESSION block with leader_pid == ProcessId
@@ -258,7 +271,8 @@ _FX void Session_Cancel(HANDLE ProcessId)
         if ((session->leader_pid == ProcessId) || (! ProcessId)) {
 
             if (session->monitor_log) {
-				log_buffer_free(session->monitor_log);
+                monitor_log = session->monitor_log;
+                monitor_section = session->monitor_section;
                 InterlockedDecrement(&Session_MonitorCount);
             }
 
@@ -272,6 +286,9 @@ _FX void Session_Cancel(HANDLE ProcessId)
     }
 
     Session_Unlock(irql);
+
+    if (monitor_log)
+        Session_MonitorFree(monitor_log, monitor_section);
 }
 
 
@@ -587,6 +604,102 @@ _FX void Session_MonitorPut(ULONG type, const WCHAR *name, HANDLE pid)
 }
 
 
+//---------------------------------------------------------------------------
+// Session_MonitorAlloc
+//---------------------------------------------------------------------------
+
+
+_FX LOG_BUFFER *Session_MonitorAlloc(SIZE_T buffer_size, HANDLE *out_section)
+{
+    NTSTATUS status;
+    OBJECT_ATTRIBUTES objattrs;
+    LARGE_INTEGER size;
+    PVOID section_object;
+    PVOID base;
+    SIZE_T view_size;
+    LOG_BUFFER *monitor_log;
+
+    //
+    // back the monitor buffer with a section so that it can also be mapped
+    // read-only into a monitoring process, see Session_Api_MonitorMap.
+    // if that fails fall back to pool memory which can only be read
+    // through API_MONITOR_GET2.
+    //
+    // the section only holds the entries and the published positions,
+    // the producer state stays in pool memory.  SEC_NO_CHANGE keeps the
+    // monitoring process from making its read-only view writable
+    //
+
+    monitor_log = Mem_Alloc(Driver_Pool, sizeof(LOG_BUFFER));
+    if (! monitor_log) {
+        *out_section = NULL;
+        return NULL;
+    }
+
+    InitializeObjectAttributes(&objattrs, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+    size.QuadPart = LOG_BUFFER_VIEW_SIZE(buffer_size);
+
+    status = ZwCreateSection(
+        out_section, SECTION_ALL_ACCESS, &objattrs, &size,
+        PAGE_READWRITE, SEC_COMMIT | SEC_NO_CHANGE, NULL);
+
+    if (NT_SUCCESS(status)) {
+
+        status = ObReferenceObjectByHandle(
+            *out_section, SECTION_MAP_READ | SECTION_MAP_WRITE, NULL,
+            KernelMode, &section_object, NULL);
+
+        if (NT_SUCCESS(status)) {
+
+            base = NULL;
+            view_size = 0;
+            status = MmMapViewInSystemSpace(section_object, &base, &view_size);
+
+            ObDereferenceObject(section_object);
+        }
+
+        if (NT_SUCCESS(status)) {
+
+            log_buffer_init_ex(monitor_log, (LOG_BUFFER_VIEW *)base, buffer_size);
+            return monitor_log;
+        }
+
+        ZwClose(*out_section);
+    }
+
+    Mem_Free(monitor_log, sizeof(LOG_BUFFER));
+
+    *out_section = NULL;
+    return log_buffer_init(buffer_size);
+}
+
+
+//---------------------------------------------------------------------------
+// Session_MonitorFree
+//---------------------------------------------------------------------------
+
+
+_FX void Session_MonitorFree(LOG_BUFFER *monitor_log, HANDLE section)
+{
+    if (section) {
+
+        //
+        // views mapped by monitoring processes outlive ours,
+        // flag the buffer so that they know to let go of it
+        //
+
+        monitor_log->view->buffer_flags |= LOG_BUFFER_FLAG_CLOSED;
+
+        MmUnmapViewInSystemSpace(monitor_log->view);
+        ZwClose(section);
+
+        Mem_Free(monitor_log, sizeof(LOG_BUFFER));
+
+    } else
+        log_buffer_free(monitor_log);
+}
+
+
 //---------------------------------------------------------------------------
 // Session_MonitorPutEx
 //---------------------------------------------------------------------------
@@ -623,7 +736,13 @@ _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths,
             entry_size += sizeof(WCHAR) + sizeof(ULONG) + sizeof(ULONG) + (frames * sizeof(PVOID));
         }
 
-		CHAR* write_ptr = log_buffer_push_entry((LOG_BUFFER_SIZE_T)entry_size, session->monitor_log, FALSE);
+        //
+        // once a monitoring process reads the buffer through a mapped view
+        // nothing pops entries anymore, so drop the oldest ones instead,
+        // the reader notices the loss from the sequence numbers
+        //
+
+		CHAR* write_ptr = log_buffer_push_entry((LOG_BUFFER_SIZE_T)entry_size, session->monitor_log, session->monitor_mapped);
 		if (write_ptr) {
             WCHAR null_char = L'\0';
             log_buffer_push_bytes((CHAR*)&timestamp.QuadPart, 8, &write_ptr, session->monitor_log);
@@ -647,6 +766,8 @@ _FX void Session_MonitorPutEx(ULONG type, const WCHAR** strings, ULONG* lengths,
                 log_buffer_push_bytes((CHAR*)&tag_len, sizeof(ULONG), &write_ptr, session->monitor_log);
                 log_buffer_push_bytes((CHAR*)backTrace, frames * sizeof(PVOID), &write_ptr, session->monitor_log);
             }
+
+            log_buffer_commit_entry(session->monitor_log);
 		}
         else if (!session->monitor_overflow) {
             session->monitor_overflow = TRUE;
@@ -672,6 +793,8 @@ _FX NTSTATUS Session_Api_MonitorControl(PROCESS *proc, ULONG64 *parms)
     SESSION *session;
     KIRQL irql;
     BOOLEAN EnableMonitor;
+    LOG_BUFFER *monitor_log = NULL;
+    HANDLE monitor_section = NULL;
 
     if (proc)
         return STATUS_NOT_IMPLEMENTED;
@@ -721,35 +844,65 @@ _FX NTSTATUS Session_Api_MonitorControl(PROCESS *proc, ULONG64 *parms)
         } else
             EnableMonitor = FALSE;
 
+        //
+        // the buffer is a section which can only be created and released
+        // at passive level, so do that outside of the session lock
+        //
+
+        if (EnableMonitor) {
+
+            session = Session_Get(FALSE, -1, &irql);
+            if (! session)
+                return STATUS_SUCCESS;
+            if (session->monitor_log)
+                EnableMonitor = FALSE;
+            Session_Unlock(irql);
+
+            if (! EnableMonitor)
+                return STATUS_SUCCESS;
+
+            ULONG BuffSize = Conf_Get_Number(NULL, L"TraceBufferPages", 0, 256) * PAGE_SIZE;
+
+            monitor_log = Session_MonitorAlloc(BuffSize * sizeof(WCHAR), &monitor_section);
+            if (!monitor_log) {
+                Log_Msg0(MSG_1201);
+                monitor_log = Session_MonitorAlloc(SESSION_MONITOR_BUF_SIZE * sizeof(WCHAR), &monitor_section);
+            }
+
+            if (! monitor_log) {
+                Log_Msg0(MSG_1201);
+                return STATUS_SUCCESS;
+            }
+        }
+
         session = Session_Get(FALSE, -1, &irql);
         if (session) {
 
             if (EnableMonitor && (! session->monitor_log)) {
 
-                ULONG BuffSize = Conf_Get_Number(NULL, L"TraceBufferPages", 0, 256) * PAGE_SIZE;
+                session->monitor_log = monitor_log;
+                session->monitor_section = monitor_section;
+                session->monitor_mapped = FALSE;
+                monitor_log = NULL;
 
-				session->monitor_log = log_buffer_init(BuffSize * sizeof(WCHAR));
-                if (!session->monitor_log) {
-                    Log_Msg0(MSG_1201);
-                    session->monitor_log = log_buffer_init(SESSION_MONITOR_BUF_SIZE * sizeof(WCHAR));
-                }
-
-                if (session->monitor_log) {
-                    InterlockedIncrement(&Session_MonitorCount);
-                } else
-                    Log_Msg0(MSG_1201);
+                InterlockedIncrement(&Session_MonitorCount);
 
                 session->monitor_stack_trace = Conf_Get_Boolean(NULL, L"MonitorStackTrace", 0, FALSE);
 
             } else if ((! EnableMonitor) && session->monitor_log) {
 
-				log_buffer_free(session->monitor_log);
+                monitor_log = session->monitor_log;
+                monitor_section = session->monitor_section;
 				session->monitor_log = NULL;
+                session->monitor_section = NULL;
                 InterlockedDecrement(&Session_MonitorCount);
             }
 
             Session_Unlock(irql);
         }
+
+        if (monitor_log)
+            Session_MonitorFree(monitor_log, monitor_section);
     }
 
     return STATUS_SUCCESS;
@@ -1108,7 +1261,7 @@ _FX NTSTATUS Session_Api_MonitorGetEx(PROCESS* proc, ULONG64* parms)
         //    read_ptr = log_buffer_get_next(*seq_num, session->monitor_log);
         //else 
         if (session->monitor_log->buffer_used > 0)
-            read_ptr = session->monitor_log->buffer_start_ptr;
+            read_ptr = LOG_BUFFER_START_PTR(session->monitor_log);
 
         if (!read_ptr) {
             if(session->monitor_overflow)
@@ -1219,7 +1372,7 @@ _FX NTSTATUS Session_Api_MonitorGet2(PROCESS *proc, ULONG64 *parms)
 
         while (session->monitor_log->buffer_used > 0)
         {
-            CHAR* read_ptr = session->monitor_log->buffer_start_ptr;
+            CHAR* read_ptr = LOG_BUFFER_START_PTR(session->monitor_log);
 
             LOG_BUFFER_SIZE_T entry_size = log_buffer_get_size(&read_ptr, session->monitor_log);
             LOG_BUFFER_SEQ_T seq_number = log_buffer_get_seq_num(&read_ptr, session->monitor_log);
@@ -1253,5 +1406,125 @@ _FX NTSTATUS Session_Api_MonitorGet2(PROCESS *proc, ULONG64 *parms)
 
     Session_Unlock(irql);
 
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// Session_Api_MonitorMap
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Session_Api_MonitorMap(PROCESS *proc, ULONG64 *parms)
+{
+    API_MONITOR_MAP_ARGS *args = (API_MONITOR_MAP_ARGS *)parms;
+    NTSTATUS status;
+    SESSION *session;
+    KIRQL irql;
+    PVOID section_object;
+    PVOID current_object;
+    HANDLE section;
+    PVOID base;
+    SIZE_T view_size;
+
+    if (proc)
+        return STATUS_NOT_IMPLEMENTED;
+
+    if (! Session_CheckAdminAccess2(L"MonitorAdminOnly"))
+        return STATUS_ACCESS_DENIED;
+
+    ProbeForWrite(args->map_base.val, sizeof(ULONG64), sizeof(ULONG64));
+    ProbeForWrite(args->map_size.val, sizeof(ULONG), sizeof(ULONG));
+
+    //
+    // reference the section of the monitor buffer
+    //
+
+    session = Session_Get(FALSE, -1, &irql);
+    if (!session)
+        return STATUS_UNSUCCESSFUL;
+
+    if (!session->monitor_log)
+        status = STATUS_DEVICE_NOT_READY;
+    else if (!session->monitor_section)
+        status = STATUS_NOT_SUPPORTED;
+    else {
+        status = ObReferenceObjectByHandle(
+            session->monitor_section, SECTION_MAP_READ, NULL,
+            KernelMode, &section_object, NULL);
+    }
+
+    Session_Unlock(irql);
+
+    if (! NT_SUCCESS(status))
+        return status;
+
+    //
+    // map a read-only view into the caller, the section was created
+    // with SEC_NO_CHANGE so the view can not be made writable
+    //
+
+    base = NULL;
+
+    status = ObOpenObjectByPointer(
+        section_object, OBJ_KERNEL_HANDLE, NULL, SECTION_MAP_READ,
+        NULL, KernelMode, &section);
+
+    if (NT_SUCCESS(status)) {
+
+        view_size = 0;
+        status = ZwMapViewOfSection(
+            section, NtCurrentProcess(), &base, 0, 0, NULL,
+            &view_size, ViewUnmap, 0, PAGE_READONLY);
+
+        ZwClose(section);
+    }
+
+    if (NT_SUCCESS(status)) {
+
+        __try {
+
+            *args->map_base.val = (ULONG64)(ULONG_PTR)base;
+            *args->map_size.val = (ULONG)view_size;
+
+        } __except (EXCEPTION_EXECUTE_HANDLER) {
+            status = GetExceptionCode();
+        }
+    }
+
+    //
+    // from now on the producer overwrites the oldest entries as the mapped
+    // reader does not pop them.  only flag the buffer if it is still the
+    // one we mapped, monitoring may have been restarted in the meantime
+    //
+
+    if (NT_SUCCESS(status)) {
+
+        status = STATUS_DEVICE_NOT_READY;
+
+        session = Session_Get(FALSE, -1, &irql);
+        if (session) {
+
+            if (session->monitor_section && NT_SUCCESS(ObReferenceObjectByHandle(
+                    session->monitor_section, 0, NULL,
+                    KernelMode, &current_object, NULL))) {
+
+                if (current_object == section_object) {
+                    session->monitor_mapped = TRUE;
+                    status = STATUS_SUCCESS;
+                }
+
+                ObDereferenceObject(current_object);
+            }
+
+            Session_Unlock(irql);
+        }
+    }
+
+    ObDereferenceObject(section_object);
+
+    if (! NT_SUCCESS(status) && base)
+        ZwUnmapViewOfSection(NtCurrentProcess(), base);
+
     return status;
 }
\ No newline at end of file
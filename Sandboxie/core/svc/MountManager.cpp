@@ -767,8 +767,17 @@ std::shared_ptr<BOX_MOUNT> MountManager::MountImDisk(const std::wstring& ImageFi
     }
 
     std::wstring cmd;
-    if (ImageFile.empty()) cmd = L"ImBox type=ram";
-    else cmd = L"ImBox type=img image=\"" + ImageFile + L"\"";
+    if (ImageFile.empty()) {
+        cmd = L"ImBox type=ram";
+        if (SbieApi_QueryConfBool(NULL, L"RamDiskCompact", FALSE)) // compressed and deduplicated blocks
+            cmd += L" compact";
+    }
+    else {
+        cmd = L"ImBox type=img image=\"" + ImageFile + L"\"";
+        ULONG PreallocKb = SbieApi_QueryConfNumber(NULL, L"ImagePreallocKb", 0); // grow the image in extents of this size
+        if (PreallocKb)
+            cmd += L" prealloc=" + std::to_wstring(PreallocKb);
+    }
     if (pPassword && *pPassword) cmd += L" cipher=AES";
     //cmd += L" size=" + std::to_wstring(sizeKb * 1024ull) + L" mount=" + std::wstring(Drive) + L" format=ntfs:" SBIEDISK_LABEL;
     cmd += L" size=" + std::to_wstring(sizeKb * 1024ull) + L" mount=" + std::wstring(Drive) + L" format=ntfs";
@@ -35,9 +35,13 @@
 //---------------------------------------------------------------------------
 
 
-#define MAX_REQUEST_LENGTH      (2048 * 1024)
 #define MSG_DATA_LEN            (MAX_PORTMSG_LENGTH - sizeof(PORT_MESSAGE))
 
+#define WORK_POOL_MIN_THREADS   (NUMBER_OF_PROCESSORS)
+#define WORK_POOL_MAX_THREADS   (NUMBER_OF_THREADS * 4)
+#define WORK_POOL_IDLE_MS       30000
+#define WORK_POOL_TARGET_LIMIT  (WORK_POOL_MAX_THREADS / 2)
+
 
 //---------------------------------------------------------------------------
 // Structures
@@ -50,6 +54,7 @@ typedef struct tagTARGET
     ULONG serverId;
     void *context;
     PipeServer::Handler handler;
+    ULONG work_class;
 } TARGET;
 
 
@@ -74,12 +79,11 @@ typedef struct tagCLIENT_THREAD
     LIST_ELEM list_elem;
 #endif
     HANDLE idThread;
-    BOOLEAN replying;
-    volatile BOOLEAN in_use;
-    UCHAR sequence;
+    volatile LONG in_use;               // threads serving the client
     HANDLE hPort;
-    MSG_HEADER *buf_hdr;
-    UCHAR *buf_ptr;
+    PORT_XFER_STATE xfer;
+    UCHAR *view;
+    ULONG view_size;
 } CLIENT_THREAD;
 
 
@@ -90,6 +94,13 @@ typedef struct tagCLIENT_TLS_DATA
 } CLIENT_TLS_DATA;
 
 
+typedef struct tagPORT_WORK
+{
+    CLIENT_THREAD *client;
+    UCHAR space[MAX_PORTMSG_LENGTH];
+} PORT_WORK;
+
+
 //---------------------------------------------------------------------------
 // Variables
 //---------------------------------------------------------------------------
@@ -134,7 +145,7 @@ PipeServer *PipeServer::GetPipeServer()
 
 PipeServer::PipeServer()
 {
-    InitializeCriticalSectionAndSpinCount(&m_lock, 1000);
+    InitializeSRWLock(&m_lock);
     List_Init(&m_targets);
 #ifdef USE_PROCESS_MAP
     map_init(&m_client_map, NULL);
@@ -150,6 +161,9 @@ PipeServer::PipeServer()
         memzero(m_Threads, len_threads);
     else
         LogEvent(MSG_9234, 0x9251, GetLastError());
+
+    m_WorkPool = new WorkPool(
+        WORK_POOL_MIN_THREADS, WORK_POOL_MAX_THREADS, WORK_POOL_IDLE_MS);
 }
 
 
@@ -212,14 +226,21 @@ PipeServer::~PipeServer()
         }
     }
 
+    //
+    // let the work pool finish the requests which are still running,
+    // they reply on the client ports
+    //
+
+    if (m_WorkPool) {
+        m_WorkPool->Stop();
+        delete m_WorkPool;
+    }
+
     if (PortHandle)
         NtClose(PortHandle);
 
     if (m_pool)
         Pool_Delete(m_pool);
-
-	// cleanup CS
-	DeleteCriticalSection(&m_lock);
 }
 
 
@@ -228,13 +249,16 @@ PipeServer::~PipeServer()
 //---------------------------------------------------------------------------
 
 
-void PipeServer::Register(ULONG serverId, void *context, Handler handler)
+void PipeServer::Register(
+    ULONG serverId, void *context, Handler handler, ULONG limit)
 {
     TARGET *target = (TARGET *)Pool_Alloc(m_pool, sizeof(TARGET));
     if (target) {
         target->serverId = serverId;
         target->context = context;
         target->handler = handler;
+        target->work_class = m_WorkPool->AddClass(
+                                limit ? limit : WORK_POOL_TARGET_LIMIT);
         List_Insert_After(&m_targets, NULL, target);
     }
 }
@@ -287,7 +311,16 @@ bool PipeServer::Start()
     InterlockedExchangePointer(&m_hServerPort, m_hServerPort);
 
     //
-    // create server threads
+    // start the work pool which runs the sub-server handlers
+    //
+
+    if (! m_WorkPool->Start()) {
+        LogEvent(MSG_9234, 0x9253, 0);
+        return false;
+    }
+
+    //
+    // create server threads, these only receive and reply on the port
     //
 
     for (i = 0; i < NUMBER_OF_THREADS; ++i) {
@@ -384,22 +417,24 @@ void PipeServer::Thread()
             if (! client)
                 continue;
 
-            if (! client->replying)
-                PortRequest(client->hPort, msg, client);
+            //
+            // a complete request is passed to the work pool, which
+            // sends the first chunk of the reply when the handler is done
+            //
+
+            if (! client->xfer.replying) {
+                if (PortRequest(client->hPort, msg, client))
+                    continue;
+            }
 
             msg->u2.ZeroInit = 0;
 
-            if (client->replying)
-                PortReply(msg, client);
-            else {
-                msg->u1.s1.DataLength = (USHORT) 0;
-                msg->u1.s1.TotalLength = sizeof(PORT_MESSAGE);
-            }
+            PortReply(msg, client);
 
             hReplyPort = client->hPort;
             ReplyMsg = msg;
 
-            client->in_use = FALSE;
+            InterlockedDecrement(&client->in_use);
 
         } else if (msg->u2.s2.Type == LPC_PORT_CLOSED ||
                    msg->u2.s2.Type == LPC_CLIENT_DIED) {
@@ -418,6 +453,7 @@ void PipeServer::Thread()
 void PipeServer::PortConnect(PORT_MESSAGE *msg)
 {
     NTSTATUS status;
+    REMOTE_PORT_VIEW_INFO ClientView;
     CLIENT_PROCESS *clientProcess;
     CLIENT_THREAD *clientThread;
 
@@ -425,7 +461,7 @@ void PipeServer::PortConnect(PORT_MESSAGE *msg)
     // find a previous connection to that same client, or create a new one
     //
 
-    EnterCriticalSection(&m_lock);
+    AcquireSRWLockExclusive(&m_lock);
 
     PortFindClientUnsafe(msg->ClientId, clientProcess, clientThread);
 
@@ -505,7 +541,7 @@ void PipeServer::PortConnect(PORT_MESSAGE *msg)
         HANDLE hPort;
         NtAcceptConnectPort(&hPort, NULL, msg, FALSE, NULL, NULL);
 
-        LeaveCriticalSection(&m_lock);
+        ReleaseSRWLockExclusive(&m_lock);
 
         return;
     }
@@ -516,32 +552,53 @@ void PipeServer::PortConnect(PORT_MESSAGE *msg)
 
     if (clientThread->hPort) {
 
+        PORT_XFER xfer;
+
         while (clientThread->in_use)
             Sleep(3);
 
+        PortXferInit(&xfer, clientThread);
+        PortXfer_Reset(&xfer, &clientThread->xfer);
+
         NtClose(clientThread->hPort);
-        if (clientThread->buf_hdr)
-            FreeMsg(clientThread->buf_hdr);
 
-        clientThread->replying = FALSE;
-        clientThread->in_use = FALSE;
-        clientThread->sequence = 0;
         clientThread->hPort = NULL;
-        clientThread->buf_hdr = NULL;
-        clientThread->buf_ptr = NULL;
+        clientThread->view = NULL;
+        clientThread->view_size = 0;
     }
 
     //
-    // if a new client structure was created, accept the connection
+    // if a new client structure was created, accept the connection.
+    // the client may offer a section view for long messages, which
+    // is mapped into our address space as part of the connection.
+    // confirm in the returned connection information that we use it,
+    // the client only sends doorbells once it sees this
     //
 
+    if (msg->u1.s1.DataLength >= sizeof(PORT_XFER_CONNECT)) {
+
+        PORT_XFER_CONNECT *Connect =
+            (PORT_XFER_CONNECT *)((UCHAR *)msg + sizeof(PORT_MESSAGE));
+        Connect->magic = PORT_XFER_MAGIC;
+    }
+
+    memzero(&ClientView, sizeof(ClientView));
+    ClientView.Length = sizeof(ClientView);
+
     status = NtAcceptConnectPort(
-        &clientThread->hPort, NULL, msg, TRUE, NULL, NULL);
+        &clientThread->hPort, NULL, msg, TRUE, NULL, &ClientView);
+
+    if (NT_SUCCESS(status) && ClientView.ViewBase &&
+                              ClientView.ViewSize >= PORT_XFER_VIEW_SIZE) {
+
+        clientThread->view = (UCHAR *)ClientView.ViewBase;
+        clientThread->view_size = PORT_XFER_VIEW_SIZE;
+    }
 
     if (NT_SUCCESS(status))
         status = NtCompleteConnectPort(clientThread->hPort);
 
-    LeaveCriticalSection(&m_lock);
+    ReleaseSRWLockExclusive(&m_lock);
 }
 
 
@@ -564,9 +621,11 @@ void PipeServer::PortDisconnectHelper(CLIENT_PROCESS *clientProcess, CLIENT_THRE
 #else
         List_Remove(&clientProcess->threads, clientThread);
 #endif
+        PORT_XFER xfer;
+        PortXferInit(&xfer, clientThread);
+        PortXfer_Reset(&xfer, &clientThread->xfer);
+
         NtClose(clientThread->hPort);
-        if (clientThread->buf_hdr)
-            FreeMsg(clientThread->buf_hdr);
         Pool_Free(clientThread, sizeof(CLIENT_THREAD));
     }
 
@@ -617,13 +676,13 @@ void PipeServer::PortDisconnect(PORT_MESSAGE *msg)
     // find a previous connection to that same client
     //
 
-    EnterCriticalSection(&m_lock);
+    AcquireSRWLockExclusive(&m_lock);
 
     PortFindClientUnsafe(msg->ClientId, clientProcess, clientThread);
 
     PortDisconnectHelper(clientProcess, clientThread);
 
-    LeaveCriticalSection(&m_lock);
+    ReleaseSRWLockExclusive(&m_lock);
 }
 
 
@@ -663,7 +722,7 @@ void PipeServer::PortDisconnectByCreateTime(LARGE_INTEGER *CreateTime)
     wsprintf(txt, L"Message has no CID but has timestamp %08X-%08X", CreateTime->HighPart, CreateTime->LowPart);
     OutputDebugString(txt);*/
 
-    EnterCriticalSection(&m_lock);
+    AcquireSRWLockExclusive(&m_lock);
 
     CLIENT_PROCESS *clientProcess = NULL;
     CLIENT_THREAD *clientThread = NULL;
@@ -737,7 +796,7 @@ void PipeServer::PortDisconnectByCreateTime(LARGE_INTEGER *CreateTime)
 
     PortDisconnectHelper(clientProcess, clientThread);
 
-    LeaveCriticalSection(&m_lock);
+    ReleaseSRWLockExclusive(&m_lock);
 }
 
 
@@ -746,64 +805,106 @@ void PipeServer::PortDisconnectByCreateTime(LARGE_INTEGER *CreateTime)
 //---------------------------------------------------------------------------
 
 
-void PipeServer::PortRequest(
+bool PipeServer::PortRequest(
     HANDLE PortHandle, PORT_MESSAGE *msg, void *voidClient)
 {
     CLIENT_THREAD *client = (CLIENT_THREAD *)voidClient;
-    ULONG buf_len;
+    PORT_XFER xfer;
     void *buf_ptr = NULL;
 
-    if (! client->buf_hdr) {
+    PortXferInit(&xfer, client);
+
+    //
+    // collect the incoming chunks, once the request is complete (or in
+    // error) pass it to the sub-server and keep its reply for PortReply.
+    // see also common/portxfer.c
+    //
 
-        ULONG *msg_Data = (ULONG *)msg->Data;
-        ULONG msgid = msg_Data[1];
+    if (! PortXfer_Receive(&xfer, &client->xfer,
+                           msg->Data, msg->u1.s1.DataLength))
+        return false;
 
-        client->sequence = ((UCHAR *)msg_Data)[3];
-        ((UCHAR *)msg_Data)[3] = 0;
+    if (client->xfer.buf) {
 
-        buf_len = msg_Data[0];
+        TARGET *target = (TARGET *)FindTarget(
+                                ((MSG_HEADER *)client->xfer.buf)->msgid);
+        if (target) {
 
-        if (msgid && buf_len &&
-                buf_len < MAX_REQUEST_LENGTH &&
-                buf_len >= sizeof(MSG_HEADER) &&
-                buf_len >= msg->u1.s1.DataLength) {
+            PORT_WORK *work =
+                (PORT_WORK *)Pool_Alloc(m_pool, sizeof(PORT_WORK));
+            if (work) {
 
-            client->buf_hdr = AllocMsg(buf_len);
-            client->buf_ptr = (UCHAR *)client->buf_hdr;
-        }
+                work->client = client;
+                memcpy(work->space, msg, sizeof(PORT_MESSAGE));
 
-        if (! client->buf_hdr) {
-            client->sequence = 0;
-            goto finish;
+                if (m_WorkPool->Submit(
+                        target->work_class, PortWorkStub, this, work))
+                    return true;
+
+                Pool_Free(work, sizeof(PORT_WORK));
+            }
         }
 
-        buf_len = 0;
+        buf_ptr = CallTarget((MSG_HEADER *)client->xfer.buf, PortHandle, msg);
+    }
 
-    } else {
+    PortXfer_SetReply(&xfer, &client->xfer, buf_ptr);
+    return false;
+}
 
-        buf_len = (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
 
-        if (buf_len + msg->u1.s1.DataLength > client->buf_hdr->length)
-            goto finish;
-    }
+//---------------------------------------------------------------------------
+// PortWorkStub
+//---------------------------------------------------------------------------
 
-    memcpy(client->buf_ptr, msg->Data, msg->u1.s1.DataLength);
-    client->buf_ptr += msg->u1.s1.DataLength;
-    buf_len += msg->u1.s1.DataLength;
 
-    if (buf_len < client->buf_hdr->length)
-        return;
+void PipeServer::PortWorkStub(void *context, void *param)
+{
+    ((PipeServer *)context)->PortWork(param);
+}
+
 
-    buf_ptr = CallTarget(client->buf_hdr, PortHandle, msg);
+//---------------------------------------------------------------------------
+// PortWork
+//---------------------------------------------------------------------------
 
-finish:
 
-    if (client->buf_hdr)
-        FreeMsg(client->buf_hdr);
+void PipeServer::PortWork(void *voidWork)
+{
+    PORT_WORK *work = (PORT_WORK *)voidWork;
+    CLIENT_THREAD *client = work->client;
+    PORT_MESSAGE *msg = (PORT_MESSAGE *)work->space;
+    PORT_XFER xfer;
+    void *buf_ptr;
 
-    client->buf_hdr = (MSG_HEADER *)buf_ptr;
-    client->buf_ptr = (UCHAR *)buf_ptr;
-    client->replying = TRUE;
+    //
+    // the client is still blocked in NtRequestWaitReplyPort, so the
+    // request message can be used to impersonate it, and to reply to it
+    // from this thread
+    //
+
+    buf_ptr = CallTarget((MSG_HEADER *)client->xfer.buf, client->hPort, msg);
+
+    PortXferInit(&xfer, client);
+    PortXfer_SetReply(&xfer, &client->xfer, buf_ptr);
+
+    msg->u2.ZeroInit = 0;
+
+    PortReply(msg, client);
+
+    //
+    // reply while the client is still in use, so PortDisconnectHelper
+    // can't close the port handle under us.  the client may send its next
+    // request as soon as the reply is sent, a receive thread then takes
+    // the client as well, so in_use counts the threads instead of being
+    // cleared
+    //
+
+    NtReplyPort(client->hPort, msg);
+
+    InterlockedDecrement(&client->in_use);
+
+    Pool_Free(work, sizeof(PORT_WORK));
 }
 
 
@@ -857,26 +958,31 @@ void *PipeServer::PortFindClient(PORT_MESSAGE *msg)
     CLIENT_PROCESS *clientProcess;
     CLIENT_THREAD *clientThread;
 
-    EnterCriticalSection(&m_lock);
+    //
+    // a client thread waits for each reply before it sends again, so only
+    // one receive thread at a time takes a client.  a pool thread which
+    // just replied may still hold it, see PortWork
+    //
+
+    AcquireSRWLockShared(&m_lock);
 
     PortFindClientUnsafe(msg->ClientId, clientProcess, clientThread);
 
     if (clientThread)
-        clientThread->in_use = TRUE;
+        InterlockedIncrement(&clientThread->in_use);
 
-    LeaveCriticalSection(&m_lock);
+    ReleaseSRWLockShared(&m_lock);
 
     return clientThread;
 }
 
 
 //---------------------------------------------------------------------------
-// CallTarget
+// FindTarget
 //---------------------------------------------------------------------------
 
 
-MSG_HEADER *PipeServer::CallTarget(
-    MSG_HEADER *msg, HANDLE PortHandle, PORT_MESSAGE *PortMessage)
+void *PipeServer::FindTarget(ULONG msgid)
 {
     //
     // find target server.
@@ -885,7 +991,6 @@ MSG_HEADER *PipeServer::CallTarget(
 
     TARGET *target = NULL;
 
-    ULONG msgid = msg->msgid;
     if ((msgid & 0xFF) != 0xFF) {
 
         ULONG serverId = msgid & 0xFFFFFF00;
@@ -897,6 +1002,34 @@ MSG_HEADER *PipeServer::CallTarget(
         }
     }
 
+    return target;
+}
+
+
+//---------------------------------------------------------------------------
+// GetTargetStats
+//---------------------------------------------------------------------------
+
+
+bool PipeServer::GetTargetStats(ULONG serverId, WorkPool::Stats *stats)
+{
+    TARGET *target = (TARGET *)FindTarget(serverId);
+    if (! target)
+        return false;
+
+    return m_WorkPool->GetStats(target->work_class, stats);
+}
+
+
+//---------------------------------------------------------------------------
+// CallTarget
+//---------------------------------------------------------------------------
+
+
+MSG_HEADER *PipeServer::CallTarget(
+    MSG_HEADER *msg, HANDLE PortHandle, PORT_MESSAGE *PortMessage)
+{
+    TARGET *target = (TARGET *)FindTarget(msg->msgid);
     if (! target)
         return AllocShortMsg(STATUS_INVALID_SYSTEM_SERVICE);
 
@@ -936,36 +1069,55 @@ MSG_HEADER *PipeServer::CallTarget(
 void PipeServer::PortReply(PORT_MESSAGE *msg, void *voidClient)
 {
     CLIENT_THREAD *client = (CLIENT_THREAD *)voidClient;
+    PORT_XFER xfer;
     ULONG buf_len;
 
-    if (! client->buf_ptr) {
-        msg->u1.s1.DataLength = (USHORT) 0;
-        msg->u1.s1.TotalLength = sizeof(PORT_MESSAGE);
-        client->replying = FALSE;
-        return;
-    }
-
-    buf_len = client->buf_hdr->length
-            - (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
-    if (buf_len > MSG_DATA_LEN)
-        buf_len = MSG_DATA_LEN;
+    PortXferInit(&xfer, client);
+    PortXfer_Send(&xfer, &client->xfer, msg->Data, &buf_len);
 
     msg->u1.s1.DataLength = (USHORT) buf_len;
     msg->u1.s1.TotalLength = (USHORT)(sizeof(PORT_MESSAGE) + buf_len);
-    memcpy(msg->Data, client->buf_ptr, buf_len);
+}
 
-    if (client->buf_ptr == (UCHAR *)client->buf_hdr)
-        ((UCHAR *)msg->Data)[3] = client->sequence;
 
-    client->buf_ptr += buf_len;
+//---------------------------------------------------------------------------
+// PortXferInit
+//---------------------------------------------------------------------------
 
-    buf_len = (ULONG)(client->buf_ptr - (UCHAR *)client->buf_hdr);
-    if (buf_len >= client->buf_hdr->length) {
-        FreeMsg(client->buf_hdr);
-        client->buf_hdr = NULL;
-        client->buf_ptr = NULL;
-        client->replying = FALSE;
-    }
+
+void PipeServer::PortXferInit(PORT_XFER *xfer, void *voidClient)
+{
+    CLIENT_THREAD *client = (CLIENT_THREAD *)voidClient;
+
+    xfer->Exchange = NULL;
+    xfer->Alloc = PortXferAlloc;
+    xfer->Free = PortXferFree;
+    xfer->View = client->view;
+    xfer->ViewSize = client->view_size;
+    xfer->MaxDataLen = MSG_DATA_LEN;
+    xfer->Context = this;
+}
+
+
+//---------------------------------------------------------------------------
+// PortXferAlloc
+//---------------------------------------------------------------------------
+
+
+void *PipeServer::PortXferAlloc(PORT_XFER *xfer, ULONG len)
+{
+    return ((PipeServer *)xfer->Context)->AllocMsg(len);
+}
+
+
+//---------------------------------------------------------------------------
+// PortXferFree
+//---------------------------------------------------------------------------
+
+
+void PipeServer::PortXferFree(PORT_XFER *xfer, void *ptr)
+{
+    ((PipeServer *)xfer->Context)->FreeMsg((MSG_HEADER *)ptr);
 }
 
 
@@ -29,6 +29,8 @@
 #include "common/list.h"
 #include "common/map.h"
 #include "common/pool.h"
+#include "common/portxfer.h"
+#include "WorkPool.h"
 #include "msgids.h"
 
 #define USE_PROCESS_MAP
@@ -75,11 +77,12 @@ public:
     /*
      * Register handler function for a known request message id.
      * if impersonate = TRUE, the sub-server handler will be invoked
-     * after impersonating the calling client
+     * after impersonating the calling client.  at most limit requests
+     * for the sub-server run at once, 0 selects the default limit
      */
 
     void Register(
-        ULONG serverId, void *context, Handler handler);
+        ULONG serverId, void *context, Handler handler, ULONG limit = 0);
 
     /*
      * Manufacture a short reply message with error
@@ -142,6 +145,12 @@ public:
 
     static bool IsCallerSigned();
 
+    /*
+     * Get request counters and handler latency histogram for a sub-server
+     */
+
+    bool GetTargetStats(ULONG serverId, WorkPool::Stats *stats);
+
 protected:
 
     /*
@@ -190,21 +199,45 @@ protected:
      * Port Request
      */
 
-    void PortRequest(
+    bool PortRequest(
         HANDLE PortHandle, PORT_MESSAGE *msg, void *voidClient);
 
+    /*
+     * Run a complete request in the work pool, and send the reply
+     */
+
+    static void PortWorkStub(void *context, void *param);
+
+    void PortWork(void *voidWork);
+
     /*
      * Port Reply
      */
 
     void PortReply(PORT_MESSAGE *msg, void *voidClient);
 
+    /*
+     * Prepare the chunk transfer with a client thread
+     */
+
+    void PortXferInit(PORT_XFER *xfer, void *voidClient);
+
+    static void *PortXferAlloc(PORT_XFER *xfer, ULONG len);
+
+    static void PortXferFree(PORT_XFER *xfer, void *ptr);
+
     /*
      * Port Find Client
      */
 
     void *PortFindClient(PORT_MESSAGE *msg);
 
+    /*
+     * Find the registered sub-server for a message id
+     */
+
+    void *FindTarget(ULONG msgid);
+
     /*
      * Call a registered sub-server
      */
@@ -230,12 +263,13 @@ protected:
 #else
     LIST m_clients;
 #endif
-    CRITICAL_SECTION m_lock;
+    SRWLOCK m_lock;
     POOL *m_pool;
     ULONG m_TlsIndex;
 
     volatile HANDLE m_hServerPort;
     HANDLE *m_Threads;
+    WorkPool *m_WorkPool;
 
     static PipeServer *m_instance;
 };
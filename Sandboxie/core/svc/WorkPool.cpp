@@ -0,0 +1,510 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Work Pool
+//---------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+#define _HAS_EXCEPTIONS 0       // same as stdafx.h, this file does not use it
+#endif
+
+#include "WorkPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+
+struct WORK_ITEM
+{
+    WorkPool::Routine routine;
+    void *context;
+    void *param;
+    uint32_t cls;
+};
+
+
+struct WORK_QUEUE
+{
+    std::mutex lock;
+    std::deque<WORK_ITEM> items;
+    std::atomic<uint32_t> size;
+    std::thread thread;
+    bool active;                // guarded by SWorkPool::lock
+};
+
+
+struct WORK_CLASS
+{
+    std::mutex lock;
+    uint32_t limit;
+    uint32_t running;
+    std::deque<WORK_ITEM> pending;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> histogram[WORK_POOL_BUCKETS];
+};
+
+
+struct SWorkPool
+{
+    uint32_t min_threads;
+    uint32_t max_threads;
+    uint32_t idle_ms;
+
+    std::vector<std::unique_ptr<WORK_QUEUE> > queues;  // one per thread slot
+    std::vector<std::unique_ptr<WORK_CLASS> > classes;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    uint32_t threads;
+    uint32_t idle;
+    bool started;
+    bool stopping;
+
+    std::atomic<int64_t> queued;    // items in all queues
+    std::atomic<uint32_t> next;
+};
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static thread_local SWorkPool *WorkPool_Pool = nullptr;
+static thread_local WORK_QUEUE *WorkPool_Queue = nullptr;
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static void WorkPool_Thread(SWorkPool *m, WORK_QUEUE *self);
+
+static bool WorkPool_Take(SWorkPool *m, WORK_QUEUE *self, WORK_ITEM *item);
+
+static void WorkPool_Run(SWorkPool *m, WORK_ITEM *item);
+
+static void WorkPool_Spawn(SWorkPool *m);
+
+
+//---------------------------------------------------------------------------
+// Constructor
+//---------------------------------------------------------------------------
+
+
+WorkPool::WorkPool(uint32_t minThreads, uint32_t maxThreads, uint32_t idleMs)
+{
+    m = new SWorkPool;
+
+    if (maxThreads < 1)
+        maxThreads = 1;
+    if (minThreads < 1)
+        minThreads = 1;
+    if (minThreads > maxThreads)
+        minThreads = maxThreads;
+
+    m->min_threads = minThreads;
+    m->max_threads = maxThreads;
+    m->idle_ms = idleMs;
+
+    for (uint32_t i = 0; i < maxThreads; ++i) {
+        WORK_QUEUE *queue = new WORK_QUEUE;
+        queue->size = 0;
+        queue->active = false;
+        m->queues.push_back(std::unique_ptr<WORK_QUEUE>(queue));
+    }
+
+    m->threads = 0;
+    m->idle = 0;
+    m->started = false;
+    m->stopping = false;
+    m->queued = 0;
+    m->next = 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Destructor
+//---------------------------------------------------------------------------
+
+
+WorkPool::~WorkPool()
+{
+    Stop();
+
+    delete m;
+}
+
+
+//---------------------------------------------------------------------------
+// AddClass
+//---------------------------------------------------------------------------
+
+
+uint32_t WorkPool::AddClass(uint32_t limit)
+{
+    WORK_CLASS *cls = new WORK_CLASS;
+    cls->limit = limit;
+    cls->running = 0;
+    cls->count = 0;
+    for (int i = 0; i < WORK_POOL_BUCKETS; ++i)
+        cls->histogram[i] = 0;
+
+    m->classes.push_back(std::unique_ptr<WORK_CLASS>(cls));
+    return (uint32_t)(m->classes.size() - 1);
+}
+
+
+//---------------------------------------------------------------------------
+// Start
+//---------------------------------------------------------------------------
+
+
+bool WorkPool::Start()
+{
+    std::lock_guard<std::mutex> guard(m->lock);
+
+    if (m->started)
+        return false;
+
+    m->started = true;
+    m->stopping = false;
+
+    while (m->threads < m->min_threads)
+        WorkPool_Spawn(m);
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// Stop
+//---------------------------------------------------------------------------
+
+
+void WorkPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m->lock);
+
+        if (! m->started)
+            return;
+
+        m->stopping = true;
+        m->wake.notify_all();
+    }
+
+    //
+    // the threads exit once all queues are empty, items which are held
+    // back by a class limit are run by the thread which runs that class
+    //
+
+    for (size_t i = 0; i < m->queues.size(); ++i) {
+        if (m->queues[i]->thread.joinable())
+            m->queues[i]->thread.join();
+    }
+
+    std::lock_guard<std::mutex> guard(m->lock);
+    m->started = false;
+}
+
+
+//---------------------------------------------------------------------------
+// Submit
+//---------------------------------------------------------------------------
+
+
+bool WorkPool::Submit(uint32_t cls, Routine routine, void *context, void *param)
+{
+    if (cls >= m->classes.size())
+        return false;
+
+    WORK_ITEM item;
+    item.routine = routine;
+    item.context = context;
+    item.param = param;
+    item.cls = cls;
+
+    std::unique_lock<std::mutex> guard(m->lock);
+
+    if (! m->started || m->stopping)
+        return false;
+
+    //
+    // a worker thread queues on its own queue, other threads spread their
+    // items over the queues of the running threads.  idle threads steal
+    // from the back of any queue
+    //
+
+    WORK_QUEUE *queue = (WorkPool_Pool == m) ? WorkPool_Queue : nullptr;
+
+    for (uint32_t i = 0; ! queue && i < m->max_threads; ++i) {
+        WORK_QUEUE *next = m->queues[m->next++ % m->max_threads].get();
+        if (next->active)
+            queue = next;
+    }
+
+    if (! queue)
+        queue = m->queues[0].get();
+
+    {
+        std::lock_guard<std::mutex> queue_guard(queue->lock);
+        queue->items.push_back(item);
+        ++queue->size;
+    }
+
+    ++m->queued;
+
+    if (m->idle)
+        m->wake.notify_one();
+    else if (m->threads < m->max_threads)
+        WorkPool_Spawn(m);
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// GetStats
+//---------------------------------------------------------------------------
+
+
+bool WorkPool::GetStats(uint32_t cls, Stats *stats)
+{
+    if (cls >= m->classes.size())
+        return false;
+
+    WORK_CLASS *work_class = m->classes[cls].get();
+
+    stats->count = work_class->count;
+    for (int i = 0; i < WORK_POOL_BUCKETS; ++i)
+        stats->histogram[i] = work_class->histogram[i];
+
+    std::lock_guard<std::mutex> guard(work_class->lock);
+    stats->running = work_class->running;
+    stats->pending = (uint32_t)work_class->pending.size();
+    stats->limit = work_class->limit;
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// GetThreadCount
+//---------------------------------------------------------------------------
+
+
+uint32_t WorkPool::GetThreadCount()
+{
+    std::lock_guard<std::mutex> guard(m->lock);
+    return m->threads;
+}
+
+
+//---------------------------------------------------------------------------
+// WorkPool_Spawn
+//---------------------------------------------------------------------------
+
+
+void WorkPool_Spawn(SWorkPool *m)
+{
+    //
+    // caller holds m->lock.  a slot is marked inactive by its thread
+    // while it holds m->lock, right before the thread returns
+    //
+
+    for (uint32_t i = 0; i < m->max_threads; ++i) {
+
+        WORK_QUEUE *queue = m->queues[i].get();
+        if (queue->active)
+            continue;
+
+        if (queue->thread.joinable())
+            queue->thread.join();
+
+        queue->active = true;
+        ++m->threads;
+
+        queue->thread = std::thread(WorkPool_Thread, m, queue);
+        return;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// WorkPool_Thread
+//---------------------------------------------------------------------------
+
+
+void WorkPool_Thread(SWorkPool *m, WORK_QUEUE *self)
+{
+    WORK_ITEM item;
+
+    WorkPool_Pool = m;
+    WorkPool_Queue = self;
+
+    while (1) {
+
+        if (WorkPool_Take(m, self, &item)) {
+            WorkPool_Run(m, &item);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(m->lock);
+
+        if (m->queued > 0)
+            continue;
+
+        bool exit = m->stopping;
+
+        if (! exit) {
+
+            ++m->idle;
+            bool signaled = m->wake.wait_for(guard,
+                std::chrono::milliseconds(m->idle_ms),
+                [m] { return m->queued > 0 || m->stopping; });
+            --m->idle;
+
+            //
+            // an item which was queued on this thread while it decided to
+            // exit is counted in m->queued, so an other thread steals it
+            //
+
+            if (! signaled && m->threads > m->min_threads)
+                exit = true;
+        }
+
+        if (exit) {
+            self->active = false;
+            --m->threads;
+            break;
+        }
+    }
+
+    WorkPool_Pool = nullptr;
+    WorkPool_Queue = nullptr;
+}
+
+
+//---------------------------------------------------------------------------
+// WorkPool_Take
+//---------------------------------------------------------------------------
+
+
+bool WorkPool_Take(SWorkPool *m, WORK_QUEUE *self, WORK_ITEM *item)
+{
+    if (self->size) {
+
+        std::lock_guard<std::mutex> guard(self->lock);
+        if (! self->items.empty()) {
+            *item = self->items.front();
+            self->items.pop_front();
+            --self->size;
+            --m->queued;
+            return true;
+        }
+    }
+
+    if (m->queued <= 0)
+        return false;
+
+    uint32_t first = m->next++;
+
+    for (uint32_t i = 0; i < m->max_threads; ++i) {
+
+        WORK_QUEUE *queue = m->queues[(first + i) % m->max_threads].get();
+        if (queue == self || ! queue->size)
+            continue;
+
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if (! queue->items.empty()) {
+            *item = queue->items.back();
+            queue->items.pop_back();
+            --queue->size;
+            --m->queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+//---------------------------------------------------------------------------
+// WorkPool_Run
+//---------------------------------------------------------------------------
+
+
+void WorkPool_Run(SWorkPool *m, WORK_ITEM *item)
+{
+    WORK_CLASS *cls = m->classes[item->cls].get();
+
+    //
+    // an item of a class which is at its limit is parked with the class,
+    // the thread which finishes the running item of that class picks it up
+    //
+
+    {
+        std::lock_guard<std::mutex> guard(cls->lock);
+        if (cls->limit && cls->running >= cls->limit) {
+            cls->pending.push_back(*item);
+            return;
+        }
+        ++cls->running;
+    }
+
+    while (1) {
+
+        std::chrono::steady_clock::time_point start =
+                                            std::chrono::steady_clock::now();
+
+        item->routine(item->context, item->param);
+
+        uint64_t us = (uint64_t)
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+        int bucket = 0;
+        while (bucket < WORK_POOL_BUCKETS - 1 && (us >> bucket))
+            ++bucket;
+
+        ++cls->histogram[bucket];
+        ++cls->count;
+
+        std::lock_guard<std::mutex> guard(cls->lock);
+        if (cls->pending.empty()) {
+            --cls->running;
+            break;
+        }
+
+        *item = cls->pending.front();
+        cls->pending.pop_front();
+    }
+}
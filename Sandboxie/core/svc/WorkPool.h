@@ -0,0 +1,109 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Work Pool
+//
+// Work stealing thread pool used by the PipeServer to run sub-server
+// handlers.  Only uses the C++ standard library, so it can be built
+// and exercised outside of SbieSvc
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_WORKPOOL_H
+#define _MY_WORKPOOL_H
+
+
+#include <stdint.h>
+
+
+#define WORK_POOL_BUCKETS   24  // bucket n counts runs shorter than 2^n us
+
+
+class WorkPool
+{
+public:
+
+    typedef void (*Routine)(void *context, void *param);
+
+    struct Stats {
+        uint64_t count;                         // completed work items
+        uint64_t histogram[WORK_POOL_BUCKETS];  // run time of the items
+        uint32_t running;
+        uint32_t pending;                       // held back by the limit
+        uint32_t limit;
+    };
+
+    /*
+     * Constructor, the pool keeps at least minThreads threads, and grows
+     * up to maxThreads while all threads are busy.  Threads above the
+     * minimum exit after being idle for idleMs milliseconds
+     */
+
+    WorkPool(uint32_t minThreads, uint32_t maxThreads, uint32_t idleMs);
+
+    /*
+     * Destructor, stops the pool
+     */
+
+    ~WorkPool();
+
+    /*
+     * Add a class of work items which never runs on more than limit
+     * threads at once, 0 for no limit.  Returns the class index.
+     * All classes must be added before the pool is started
+     */
+
+    uint32_t AddClass(uint32_t limit);
+
+    /*
+     * Start the minimum number of threads
+     */
+
+    bool Start();
+
+    /*
+     * Run all queued work items, then end all threads
+     */
+
+    void Stop();
+
+    /*
+     * Queue routine(context, param) to run in class cls
+     */
+
+    bool Submit(uint32_t cls, Routine routine, void *context, void *param);
+
+    /*
+     * Get counters and latency histogram for class cls
+     */
+
+    bool GetStats(uint32_t cls, Stats *stats);
+
+    /*
+     * Number of threads currently in the pool
+     */
+
+    uint32_t GetThreadCount();
+
+protected:
+
+    struct SWorkPool *m;
+};
+
+
+#endif /* _MY_WORKPOOL_H */
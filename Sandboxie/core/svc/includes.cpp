@@ -46,6 +46,10 @@ extern "C" {
 
 #include "common/stream.c"
 
+#include "common/ini_token.c"
+
+#include "common/portxfer.c"
+
 #include "common/str_util.c"
 
 #include "common/verify.c"
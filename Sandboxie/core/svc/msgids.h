@@ -99,6 +99,7 @@
 #define MSGID_SBIE_INI_DEL_SETTING              0x1814
 #define MSGID_SBIE_INI_GET_VERSION              0x18AA
 #define MSGID_SBIE_INI_GET_WAIT_HANDLE          0x18AB
+#define MSGID_SBIE_INI_GET_WORK_STATS           0x18AC
 #define MSGID_SBIE_INI_RUN_SBIE_CTRL            0x180A
 #define MSGID_SBIE_INI_RC4_CRYPT                0x180F
 #define MSGID_SBIE_INI_SET_DAT                  0x18D1
@@ -41,6 +41,7 @@
 #ifdef NEW_INI_MODE
 extern "C" {
     #include "common/stream.h"
+    #include "common/ini_token.h"
 }
 #include "common/ini.h"
 
@@ -193,6 +194,15 @@ MSG_HEADER *SbieIniServer::Handler2(MSG_HEADER *msg)
         return GetWaitHandle(idProcess);
     }
 
+    //
+    // handle get work stats request
+    //
+
+    if (msg->msgid == MSGID_SBIE_INI_GET_WORK_STATS) {
+
+        return GetWorkStats(msg);
+    }
+
     //
     // handle get user request
     //
@@ -369,6 +379,38 @@ MSG_HEADER *SbieIniServer::GetWaitHandle(HANDLE idProcess)
 }
 
 
+//---------------------------------------------------------------------------
+// GetWorkStats
+//---------------------------------------------------------------------------
+
+
+MSG_HEADER *SbieIniServer::GetWorkStats(MSG_HEADER *msg)
+{
+    SBIE_INI_GET_WORK_STATS_REQ *req = (SBIE_INI_GET_WORK_STATS_REQ *)msg;
+    if (req->h.length < sizeof(SBIE_INI_GET_WORK_STATS_REQ))
+        return SHORT_REPLY(STATUS_INVALID_PARAMETER);
+
+    WorkPool::Stats stats;
+    if (! PipeServer::GetPipeServer()->GetTargetStats(req->server_id, &stats))
+        return SHORT_REPLY(STATUS_NOT_FOUND);
+
+    ULONG rpl_len = sizeof(SBIE_INI_GET_WORK_STATS_RPL);
+    SBIE_INI_GET_WORK_STATS_RPL *rpl =
+        (SBIE_INI_GET_WORK_STATS_RPL *)LONG_REPLY(rpl_len);
+    if (! rpl)
+        return SHORT_REPLY(STATUS_INSUFFICIENT_RESOURCES);
+
+    rpl->running = stats.running;
+    rpl->pending = stats.pending;
+    rpl->limit = stats.limit;
+    rpl->count = stats.count;
+    for (ULONG i = 0; i < WORK_STATS_BUCKETS; i++)
+        rpl->histogram[i] = stats.histogram[i];
+
+    return &rpl->h;
+}
+
+
 //---------------------------------------------------------------------------
 // GetUser
 //---------------------------------------------------------------------------
@@ -911,17 +953,8 @@ ULONG SbieIniServer::CacheConfig()
         iniDataPtr = iniData = tmpData;
     }
     else {
-        if (encoding == 2) { //Unicode (UTF-16 BE) BOM
-            // swap all bytes
-            UCHAR* tmpData = (UCHAR*)iniDataPtr;
-            for (DWORD i = 0; i < bytesRead - 1; i += 2) {
-                UCHAR tmp = tmpData[i + 1];
-                tmpData[i + 1] = tmpData[i];
-                tmpData[i] = tmp;
-            }
-        }
-        //else if (encoding == 0) //Unicode (UTF-16 LE) BOM
-        bytesRead /= sizeof(wchar_t);
+        // Unicode (UTF-16 LE) is used as is, (UTF-16 BE) gets swapped in place
+        bytesRead = Ini_Decode((UCHAR*)iniDataPtr, bytesRead, encoding, iniDataPtr);
     }
 
     iniDataPtr[bytesRead] = L'\0';
@@ -929,16 +962,8 @@ ULONG SbieIniServer::CacheConfig()
     m_pConfigIni = new SConfigIni;
     m_pConfigIni->Encoding = encoding;
 
-    m_pConfigIni->Sections.push_back(SIniSection{});
-    SIniSection* pSection = &m_pConfigIni->Sections.back();
-    while(*iniDataPtr != L'\0' && pSection != NULL)
-    {
-        Ini_Read_ConfigSection(iniDataPtr, pSection->Entries);
-        if (*iniDataPtr == L'\0')
-            break;
-
-        pSection = Ini_Read_SectionHeader(iniDataPtr, m_pConfigIni);
-    }
+    // the text ends at the first null character
+    Ini_Read_ConfigIni(iniDataPtr, (ULONG)wcslen(iniDataPtr), m_pConfigIni);
 
     status = STATUS_SUCCESS;
 
@@ -54,6 +54,8 @@ protected:
 
     MSG_HEADER *GetWaitHandle(HANDLE idProcess);
 
+    MSG_HEADER *GetWorkStats(MSG_HEADER *msg);
+
     MSG_HEADER *GetUser(MSG_HEADER *msg);
 
     MSG_HEADER *GetPath(MSG_HEADER *msg);
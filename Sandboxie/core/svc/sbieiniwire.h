@@ -70,6 +70,33 @@ typedef struct tagSBIE_INI_GET_WAIT_HANDLE_REQ SBIE_INI_GET_WAIT_HANDLE_REQ;
 typedef struct tagSBIE_INI_GET_WAIT_HANDLE_RPL SBIE_INI_GET_WAIT_HANDLE_RPL;
 
 
+//---------------------------------------------------------------------------
+// Get Work Stats
+//---------------------------------------------------------------------------
+
+
+#define WORK_STATS_BUCKETS          24      // keep in sync with svc/WorkPool.h
+
+struct tagSBIE_INI_GET_WORK_STATS_REQ
+{
+    MSG_HEADER h;
+    ULONG server_id;                    // MSGID_PROCESS, MSGID_COM, ...
+};
+
+struct tagSBIE_INI_GET_WORK_STATS_RPL
+{
+    MSG_HEADER h;                       // status is STATUS_SUCCESS or STATUS_NOT_FOUND
+    ULONG running;
+    ULONG pending;                      // held back by the limit
+    ULONG limit;
+    ULONG64 count;                      // completed requests
+    ULONG64 histogram[WORK_STATS_BUCKETS];  // bucket n counts runs shorter than 2^n us
+};
+
+typedef struct tagSBIE_INI_GET_WORK_STATS_REQ SBIE_INI_GET_WORK_STATS_REQ;
+typedef struct tagSBIE_INI_GET_WORK_STATS_RPL SBIE_INI_GET_WORK_STATS_RPL;
+
+
 //---------------------------------------------------------------------------
 // Get Path
 //---------------------------------------------------------------------------
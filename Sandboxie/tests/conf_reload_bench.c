@@ -0,0 +1,149 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Configuration Reload Benchmark
+//
+// Loads a Sandboxie.ini and a Templates.ini through core/drv/conf.c, as
+// the driver does on Conf_Api_Reload, and reports the time per reload and
+// the memory held by the loaded configuration.  Checks that every reload
+// gives the same sections and the same memory use, that every section can
+// be queried, and that nothing is left after Conf_Unload.
+//
+// usage: conf_reload_bench Sandboxie.ini Templates.ini [count]
+//---------------------------------------------------------------------------
+
+
+#include "core/drv/conf.h"
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static WCHAR Test_Buffer[1 << 20];
+
+
+//---------------------------------------------------------------------------
+// Test_Reload
+//---------------------------------------------------------------------------
+
+
+static void Test_Reload(void)
+{
+    ULONG64 parms[3];
+    ULONG generation = Conf_GetGeneration();
+
+    parms[0] = API_RELOAD_CONF;
+    parms[1] = (ULONG)-1;           // session_id
+    parms[2] = 0;                   // flags
+
+    HOST_CHECK(Conf_Api_Reload(NULL, parms) == STATUS_SUCCESS);
+    HOST_CHECK(Conf_GetGeneration() != generation);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Query
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Query(void)
+{
+    API_QUERY_CONF_SECTION_ARGS args;
+    const WCHAR *section;
+    ULONG index, len, generation, strings = 0;
+    WCHAR *ptr;
+
+    //
+    // every section is returned by Conf_Api_QuerySection as a list of
+    // name and value pairs, ending with an empty string
+    //
+
+    Conf_AdjustUseCount(TRUE);
+
+    for (index = 0; (section = Conf_Get(NULL, NULL, index)) != NULL; ++index) {
+
+        memzero(&args, sizeof(args));
+        args.func_code = API_QUERY_CONF_SECTION;
+        args.section_name.val = (WCHAR *)section;
+        args.buffer_len.val = &len;
+        args.buffer_ptr.val = Test_Buffer;
+        args.generation.val = &generation;
+        len = sizeof(Test_Buffer);
+
+        HOST_CHECK(Conf_Api_QuerySection(NULL, (ULONG64 *)&args) == STATUS_SUCCESS);
+        HOST_CHECK(generation == Conf_GetGeneration());
+
+        for (ptr = Test_Buffer; *ptr; ptr += wcslen(ptr) + 1)
+            ++strings;
+        HOST_CHECK((strings & 1) == 0);
+        HOST_CHECK((ULONG)(ptr + 1 - Test_Buffer) * sizeof(WCHAR) == len);
+    }
+
+    Conf_AdjustUseCount(FALSE);
+
+    return index;
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG count = argc > 3 ? atoi(argv[3]) : 20;
+    ULONG i, sections, allocs;
+    size_t bytes;
+    double start;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: conf_reload_bench Sandboxie.ini Templates.ini [count]\n");
+        return 1;
+    }
+
+    Host_IniPath = argv[1];
+    Host_TemplatesPath = argv[2];
+
+    HOST_CHECK(Conf_Init());
+
+    sections = Test_Query();
+    HOST_CHECK(sections != 0);
+    bytes = Host_PoolBytes();
+    allocs = Host_MemAllocs;
+
+    start = Host_Time();
+    for (i = 0; i < count; i++) {
+        Test_Reload();
+        HOST_CHECK(Host_PoolBytes() == bytes);
+    }
+    start = (Host_Time() - start) * 1e3 / count;
+
+    HOST_CHECK(Test_Query() == sections);
+
+    printf("reload: %.2f ms, %u sections, %zu KB in %u allocations\n",
+           start, sections, bytes >> 10, allocs);
+
+    Conf_Unload();
+    HOST_CHECK(Host_PoolBytes() == 0);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Crypto Pool Test
+//
+// Runs the worker pool of ImBox CryptoIO.cpp with a stand-in cipher, which
+// like XTS derives its key stream from the sector number and takes the
+// offset it is given as the start of a sector, so every slice handed to a
+// worker must come out as if the whole request was encrypted at once.  Compares pooled and single threaded results for random request
+// sizes and offsets, with several pool sizes, several threads sharing a
+// pool and long runs of jobs back to back, then reports MB/s single
+// threaded and pooled for the request sizes of "ImBox bench".
+//
+// The ciphers of dc/crypto_fast are built with MASM, for the rates the
+// one here costs about as much as software AES, so they show what the
+// pool adds.
+//
+// usage: crypto_pool_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "pool.h"
+
+#include <chrono>
+
+
+//---------------------------------------------------------------------------
+// Crypto Pool
+//---------------------------------------------------------------------------
+
+
+//
+// SCryptoPool and its limits, taken from CryptoIO.cpp by the Makefile
+//
+
+#include "crypto_pool.cpp"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_MAX_SIZE       (4 << 20)
+
+#define TEST_PARITY_SIZE    (1 << 20)       // split by up to 8 threads
+
+#define TEST_BENCH_ROUNDS   12              // about 10 cycles per byte
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static int Test_Rounds = 1;     // mixing rounds of the key stream
+
+
+//---------------------------------------------------------------------------
+// Test_Random
+//---------------------------------------------------------------------------
+
+
+static ULONG64 Test_Random()
+{
+    static thread_local ULONG64 seed = 88172645463325252ull ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_KeyStream
+//---------------------------------------------------------------------------
+
+
+static inline ULONG64 Test_KeyStream(ULONG64 key, ULONG64 sector, ULONG64 word)
+{
+    ULONG64 x = key ^ (sector << 6) ^ word;
+    for (int i = 0; i < Test_Rounds; i++) {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 31;
+    }
+    return x;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Encrypt
+//---------------------------------------------------------------------------
+
+
+static void _stdcall Test_Encrypt(const unsigned char *in, unsigned char *out, size_t len, unsigned __int64 offset, void *key)
+{
+    ULONG64 k = ((xts_key *)key)->key;
+    for (size_t pos = 0; pos < len; pos += 8) {
+        ULONG64 v;
+        memcpy(&v, in + pos, 8);
+        v += Test_KeyStream(k, offset / XTS_SECTOR_SIZE + pos / XTS_SECTOR_SIZE, (pos % XTS_SECTOR_SIZE) / 8);
+        memcpy(out + pos, &v, 8);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Decrypt
+//---------------------------------------------------------------------------
+
+
+static void _stdcall Test_Decrypt(const unsigned char *in, unsigned char *out, size_t len, unsigned __int64 offset, void *key)
+{
+    ULONG64 k = ((xts_key *)key)->key;
+    for (size_t pos = 0; pos < len; pos += 8) {
+        ULONG64 v;
+        memcpy(&v, in + pos, 8);
+        v -= Test_KeyStream(k, offset / XTS_SECTOR_SIZE + pos / XTS_SECTOR_SIZE, (pos % XTS_SECTOR_SIZE) / 8);
+        memcpy(out + pos, &v, 8);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Key
+//---------------------------------------------------------------------------
+
+
+static xts_key Test_Key = { 0x243F6A8885A308D3ull, Test_Encrypt, Test_Decrypt };
+
+
+//---------------------------------------------------------------------------
+// Test_Size
+//---------------------------------------------------------------------------
+
+
+static int Test_Size()
+{
+    //
+    // mostly requests the pool takes, with sizes which do not split evenly,
+    // some just below and at the threshold and a few small ones
+    //
+
+    int op = Test_Random() % 8;
+    if (op == 0)
+        return (int)(Test_Random() % 16 + 1) * XTS_SECTOR_SIZE;
+    if (op == 1)
+        return CRYPTO_PARALLEL_MIN + ((int)(Test_Random() % 3) - 1) * XTS_SECTOR_SIZE;
+    return (int)(Test_Random() % (TEST_PARITY_SIZE / XTS_SECTOR_SIZE) + 1) * XTS_SECTOR_SIZE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Parity
+//---------------------------------------------------------------------------
+
+
+static void Test_Parity(SCryptoPool *pool, int rounds)
+{
+    std::vector<BYTE> data(TEST_PARITY_SIZE), buf(TEST_PARITY_SIZE), ref(TEST_PARITY_SIZE);
+
+    for (int i = 0; i < rounds; i++) {
+
+        int size = Test_Size();
+        __int64 offset = (__int64)(Test_Random() % (1ull << 28)) * XTS_SECTOR_SIZE;
+
+        for (int j = 0; j < size; j += 8)
+            *(ULONG64 *)&data[j] = Test_Random();
+
+        memcpy(ref.data(), data.data(), size);
+        xts_encrypt(ref.data(), ref.data(), size, offset, &Test_Key);
+
+        memcpy(buf.data(), data.data(), size);
+        pool->Crypt(buf.data(), size, offset, &Test_Key, true);
+        HOST_CHECK(memcmp(buf.data(), ref.data(), size) == 0);
+
+        pool->Crypt(buf.data(), size, offset, &Test_Key, false);
+        HOST_CHECK(memcmp(buf.data(), data.data(), size) == 0);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Pools
+//---------------------------------------------------------------------------
+
+
+static void Test_Pools(int rounds)
+{
+    static const int Workers[] = { 0, 1, 3, CRYPTO_MAX_THREADS - 1 };
+
+    for (int i = 0; i < (int)(sizeof(Workers) / sizeof(Workers[0])); i++) {
+        SCryptoPool pool(Workers[i]);
+        HOST_CHECK((int)pool.Threads.size() == Workers[i]);
+        Test_Parity(&pool, rounds);
+    }
+
+    SCryptoPool pool;
+    Test_Parity(&pool, rounds);
+
+    printf("parity: %d requests ok\n", rounds * 5);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Shared
+//---------------------------------------------------------------------------
+
+
+static void Test_Shared(int rounds)
+{
+    //
+    // requests from several threads, one gets the workers and the others
+    // encrypt inline meanwhile, as concurrent disk requests do
+    //
+
+    SCryptoPool pool(3);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+        threads.emplace_back(Test_Parity, &pool, rounds / 4 + 1);
+    for (auto I = threads.begin(); I != threads.end(); ++I)
+        I->join();
+
+    printf("shared pool: %d requests ok\n", (rounds / 4 + 1) * 4);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_BackToBack
+//---------------------------------------------------------------------------
+
+
+static void Test_BackToBack(int jobs)
+{
+    //
+    // the smallest requests the pool splits, one after the other, a worker
+    // late to check out of one job must not take slices of the next one
+    //
+
+    SCryptoPool pool(CRYPTO_MAX_THREADS - 1);
+
+    int size = CRYPTO_PARALLEL_MIN;
+    std::vector<BYTE> buf(size, 0), ref(size, 0);
+
+    for (int i = 0; i < jobs; i++) {
+        __int64 offset = (__int64)i * size;
+        xts_encrypt(ref.data(), ref.data(), size, offset, &Test_Key);
+        pool.Crypt(buf.data(), size, offset, &Test_Key, true);
+    }
+    HOST_CHECK(memcmp(buf.data(), ref.data(), size) == 0);
+
+    printf("back to back: %d jobs ok\n", jobs);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Bench
+//---------------------------------------------------------------------------
+
+
+static void Test_Bench()
+{
+    static const int Sizes[] = { 4 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+
+    std::vector<BYTE> buf(TEST_MAX_SIZE);
+    for (int j = 0; j < TEST_MAX_SIZE; j += 8)
+        *(ULONG64 *)&buf[j] = Test_Random();
+
+    Test_Rounds = TEST_BENCH_ROUNDS;
+
+    SCryptoPool pool;
+    printf("%d worker threads, MB/s for single threaded / pooled encryption\n", (int)pool.Threads.size());
+
+    for (int i = 0; i < (int)(sizeof(Sizes) / sizeof(Sizes[0])); i++) {
+        double rate[2];
+        for (int pooled = 0; pooled < 2; pooled++) {
+            auto start = std::chrono::steady_clock::now();
+            double elapsed;
+            ULONG64 total = 0;
+            do {
+                if (pooled)
+                    pool.Crypt(buf.data(), Sizes[i], total, &Test_Key, true);
+                else
+                    xts_encrypt(buf.data(), buf.data(), Sizes[i], total, &Test_Key);
+                total += Sizes[i];
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (elapsed < 0.2);
+            rate[pooled] = (double)total / (1024 * 1024) / elapsed;
+        }
+        printf("%5d KB: %8.1f / %8.1f\n", Sizes[i] / 1024, rate[0], rate[1]);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+    Test_Pools(rounds);
+    Test_Shared(rounds);
+    Test_BackToBack(rounds * 50);
+
+    Test_Bench();
+
+    printf("ok\n");
+    return 0;
+}
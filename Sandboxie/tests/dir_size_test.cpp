@@ -0,0 +1,690 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Dir Size Test
+//
+// Drives CDirSizeIndex of SandMan through a fake CDirWalker over an in
+// memory file system.  Checks the initial scan, single added, modified
+// and removed entries, files replaced by folders and the other way round,
+// changes below folders which are not indexed yet and case insensitive
+// names, then runs random changes reported the way the box monitor queues
+// them and compares every size with the file system after each batch.
+//
+// usage: dir_size_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "stdafx.h"
+#include "DirSizeIndex.h"
+
+#include <ctype.h>
+#include <map>
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_ROOT           "box"
+
+
+//---------------------------------------------------------------------------
+// Structures and Types
+//---------------------------------------------------------------------------
+
+
+struct TEST_ENTRY {
+    std::string Path;           // as created, with the case of every name
+    quint64 Size;
+    bool IsDir;
+};
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static std::map<std::string, TEST_ENTRY> Test_Fs;   // by Test_Key
+
+static bool Test_NoCase = false;
+
+
+//---------------------------------------------------------------------------
+// Test_Random
+//---------------------------------------------------------------------------
+
+
+static quint64 Test_Random()
+{
+    static quint64 seed = 88172645463325252ull;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Key
+//---------------------------------------------------------------------------
+
+
+static std::string Test_Key(const std::string &path)
+{
+    return Test_NoCase ? QString(path).toLower() : path;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Parent
+//---------------------------------------------------------------------------
+
+
+static std::string Test_Parent(const std::string &path)
+{
+    size_t pos = path.rfind('/');
+    return pos == std::string::npos ? std::string() : path.substr(0, pos);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Add
+//---------------------------------------------------------------------------
+
+
+static void Test_Add(const std::string &path, quint64 size, bool is_dir)
+{
+    std::string parent = Test_Parent(path);
+    HOST_CHECK(parent.empty() || Test_Fs.at(Test_Key(parent)).IsDir);
+
+    TEST_ENTRY entry = { path, is_dir ? 0 : size, is_dir };
+    Test_Fs[Test_Key(path)] = entry;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Remove
+//---------------------------------------------------------------------------
+
+
+static void Test_Remove(const std::string &path)
+{
+    std::string key = Test_Key(path);
+    for (auto I = Test_Fs.begin(); I != Test_Fs.end(); ) {
+        if (I->first == key || I->first.compare(0, key.length() + 1, key + "/") == 0)
+            I = Test_Fs.erase(I);
+        else
+            ++I;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Rename
+//---------------------------------------------------------------------------
+
+
+static void Test_Rename(const std::string &old_path, const std::string &new_path)
+{
+    std::string key = Test_Key(old_path);
+
+    std::vector<TEST_ENTRY> moved;
+    for (auto I = Test_Fs.begin(); I != Test_Fs.end(); ++I) {
+        if (I->first == key || I->first.compare(0, key.length() + 1, key + "/") == 0) {
+            TEST_ENTRY entry = I->second;
+            entry.Path = new_path + entry.Path.substr(old_path.length());
+            moved.push_back(entry);
+        }
+    }
+
+    Test_Remove(old_path);
+    for (auto I = moved.begin(); I != moved.end(); ++I)
+        Test_Fs[Test_Key(I->Path)] = *I;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_SizeOf
+//---------------------------------------------------------------------------
+
+
+static quint64 Test_SizeOf(const std::string &path)
+{
+    std::string key = Test_Key(path);
+
+    quint64 size = 0;
+    for (auto I = Test_Fs.begin(); I != Test_Fs.end(); ++I) {
+        if (key.empty() || I->first == key || I->first.compare(0, key.length() + 1, key + "/") == 0)
+            size += I->second.Size;
+    }
+    return size;
+}
+
+
+//---------------------------------------------------------------------------
+// CTestWalker
+//---------------------------------------------------------------------------
+
+
+class CTestWalker : public CDirWalker
+{
+public:
+    virtual bool List(const QString& Path, QList<SEntry>& Entries)
+    {
+        m_Lists++;
+
+        std::string path = Relative(Path);
+        if (!path.empty()) {
+            auto I = Test_Fs.find(Test_Key(path));
+            if (I == Test_Fs.end() || !I->second.IsDir)
+                return false;
+        }
+
+        std::string key = Test_Key(path);
+        for (auto I = Test_Fs.begin(); I != Test_Fs.end(); ++I) {
+            if (Test_Parent(I->first) != key)
+                continue;
+            SEntry Entry;
+            Entry.Name = I->second.Path.substr(I->second.Path.rfind('/') + 1);
+            Entry.Size = I->second.Size;
+            Entry.IsDir = I->second.IsDir;
+            Entries.append(Entry);
+        }
+        return true;
+    }
+
+    virtual bool Stat(const QString& Path, SEntry& Entry)
+    {
+        m_Stats++;
+
+        std::string path = Relative(Path);
+        auto I = Test_Fs.find(Test_Key(path));
+        if (I == Test_Fs.end())
+            return false;
+
+        Entry.Name = path.substr(path.rfind('/') + 1);
+        Entry.Size = I->second.Size;
+        Entry.IsDir = I->second.IsDir;
+        return true;
+    }
+
+    int m_Lists = 0;
+    int m_Stats = 0;
+
+protected:
+    static std::string Relative(const QString& Path)
+    {
+        HOST_CHECK(Path.compare(0, strlen(TEST_ROOT), TEST_ROOT) == 0);
+        std::string path = Path.substr(strlen(TEST_ROOT));
+        return path.empty() ? path : path.substr(1);
+    }
+};
+
+
+//---------------------------------------------------------------------------
+// Test_Check
+//---------------------------------------------------------------------------
+
+
+static void Test_Check(const CDirSizeIndex &index)
+{
+    HOST_CHECK(index.GetTotalSize() == Test_SizeOf(""));
+
+    for (auto I = Test_Fs.begin(); I != Test_Fs.end(); ++I)
+        HOST_CHECK(index.GetSize(QString(I->second.Path)) == Test_SizeOf(I->second.Path));
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Scan
+//---------------------------------------------------------------------------
+
+
+static void Test_Scan()
+{
+    Test_Fs.clear();
+    Test_NoCase = false;
+
+    Test_Add("a", 0, true);
+    Test_Add("a/x.txt", 10, false);
+    Test_Add("a/b", 0, true);
+    Test_Add("a/b/y", 20, false);
+    Test_Add("a/b/z", 5, false);
+    Test_Add("c", 7, false);
+    Test_Add("d", 0, true);
+
+    CTestWalker *walker = new CTestWalker;
+    CDirSizeIndex index(TEST_ROOT, walker);
+    HOST_CHECK(!index.IsScanned());
+
+    volatile bool abort = true;
+    index.Scan(&abort);
+    HOST_CHECK(!index.IsScanned());
+
+    index.Scan();
+    HOST_CHECK(index.IsScanned());
+    HOST_CHECK(walker->m_Lists == 4);
+
+    HOST_CHECK(index.GetTotalSize() == 42);
+    HOST_CHECK(index.GetSize("") == 42);
+    HOST_CHECK(index.GetSize("a") == 35);
+    HOST_CHECK(index.GetSize("a/b") == 25);
+    HOST_CHECK(index.GetSize("a\\b\\y") == 20);
+    HOST_CHECK(index.GetSize("/a/x.txt") == 10);
+    HOST_CHECK(index.GetSize("d") == 0);
+    HOST_CHECK(index.GetSize("A") == 0);
+    HOST_CHECK(index.GetSize("q/r") == 0);
+    Test_Check(index);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Update
+//---------------------------------------------------------------------------
+
+
+static void Test_Update()
+{
+    Test_Scan();
+
+    CTestWalker *walker = new CTestWalker;
+    CDirSizeIndex index(TEST_ROOT, walker);
+    index.Scan();
+
+    //
+    // a single file is only looked up, nothing gets listed again
+    //
+
+    int lists = walker->m_Lists;
+
+    Test_Add("a/b/new", 100, false);
+    index.Update(CDirSizeIndex::eAdded, "a/b/new");
+    HOST_CHECK(index.GetSize("a") == 135);
+    Test_Check(index);
+
+    Test_Fs[Test_Key("a/x.txt")].Size = 1;
+    index.Update(CDirSizeIndex::eModified, "a/x.txt");
+    index.Update(CDirSizeIndex::eModified, "a");
+    HOST_CHECK(index.GetTotalSize() == 133);
+    Test_Check(index);
+
+    HOST_CHECK(walker->m_Lists == lists);
+
+    //
+    // a file reported again, or one already gone when its change is applied
+    //
+
+    index.Update(CDirSizeIndex::eAdded, "a/b/new");
+    HOST_CHECK(index.GetTotalSize() == 133);
+
+    Test_Remove("c");
+    index.Update(CDirSizeIndex::eModified, "c");
+    HOST_CHECK(index.GetTotalSize() == 126);
+    Test_Check(index);
+
+    Test_Remove("a/b/y");
+    index.Update(CDirSizeIndex::eRemoved, "a/b/y");
+    HOST_CHECK(index.GetSize("a/b") == 105);
+    Test_Check(index);
+
+    //
+    // a removed folder takes its content along, a new one is listed whole
+    //
+
+    Test_Remove("a/b");
+    index.Update(CDirSizeIndex::eRemoved, "a/b");
+    HOST_CHECK(index.GetSize("a") == 1);
+    HOST_CHECK(index.GetSize("a/b/new") == 0);
+    Test_Check(index);
+
+    Test_Add("e", 0, true);
+    Test_Add("e/f", 3, false);
+    Test_Add("e/g", 0, true);
+    Test_Add("e/g/h", 4, false);
+    index.Update(CDirSizeIndex::eAdded, "e");
+    HOST_CHECK(index.GetSize("e") == 7);
+    Test_Check(index);
+
+    Test_Rename("e", "d/e2");
+    index.Update(CDirSizeIndex::eRemoved, "e");
+    index.Update(CDirSizeIndex::eAdded, "d/e2");
+    HOST_CHECK(index.GetSize("d") == 7);
+    HOST_CHECK(index.GetSize("e") == 0);
+    Test_Check(index);
+
+    index.Update(CDirSizeIndex::eRemoved, "");
+    index.Update(CDirSizeIndex::eRemoved, "nothing/here");
+    Test_Check(index);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Replace
+//---------------------------------------------------------------------------
+
+
+static void Test_Replace()
+{
+    Test_Scan();
+
+    CDirSizeIndex index(TEST_ROOT, new CTestWalker);
+    index.Scan();
+
+    //
+    // a file which became a folder
+    //
+
+    Test_Remove("c");
+    Test_Add("c", 0, true);
+    Test_Add("c/i", 9, false);
+    index.Update(CDirSizeIndex::eModified, "c");
+    HOST_CHECK(index.GetSize("c") == 9);
+    HOST_CHECK(index.GetTotalSize() == 44);
+    Test_Check(index);
+
+    //
+    // a folder which became a file, its old content must not be left over
+    //
+
+    Test_Remove("a");
+    Test_Add("a", 1, false);
+    index.Update(CDirSizeIndex::eModified, "a");
+    HOST_CHECK(index.GetSize("a") == 1);
+    HOST_CHECK(index.GetSize("a/b") == 0);
+    HOST_CHECK(index.GetTotalSize() == 10);
+    Test_Check(index);
+
+    //
+    // and reported as added, the way a rename over it shows up
+    //
+
+    Test_Remove("a");
+    Test_Add("a", 0, true);
+    Test_Add("a/j", 2, false);
+    index.Update(CDirSizeIndex::eAdded, "a");
+    HOST_CHECK(index.GetSize("a") == 2);
+    Test_Check(index);
+
+    Test_Remove("a");
+    Test_Add("a", 6, false);
+    index.Update(CDirSizeIndex::eAdded, "a");
+    HOST_CHECK(index.GetSize("a/j") == 0);
+    Test_Check(index);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MissingParent
+//---------------------------------------------------------------------------
+
+
+static void Test_MissingParent()
+{
+    Test_Scan();
+
+    CTestWalker *walker = new CTestWalker;
+    CDirSizeIndex index(TEST_ROOT, walker);
+    index.Scan();
+
+    //
+    // only the deepest file is reported, the index lists the topmost
+    // folder it does not know yet and all below it
+    //
+
+    Test_Add("n1", 0, true);
+    Test_Add("n1/g", 2, false);
+    Test_Add("n1/n2", 0, true);
+    Test_Add("n1/n2/n3", 0, true);
+    Test_Add("n1/n2/n3/f", 11, false);
+
+    int lists = walker->m_Lists;
+    index.Update(CDirSizeIndex::eAdded, "n1/n2/n3/f");
+    HOST_CHECK(walker->m_Lists == lists + 3);
+    HOST_CHECK(index.GetSize("n1") == 13);
+    HOST_CHECK(index.GetSize("n1/n2/n3") == 11);
+    Test_Check(index);
+
+    //
+    // the same below an indexed folder, and for a path already gone
+    //
+
+    Test_Add("a/b/m", 0, true);
+    Test_Add("a/b/m/k", 4, false);
+    index.Update(CDirSizeIndex::eModified, "a/b/m/k");
+    HOST_CHECK(index.GetSize("a/b/m") == 4);
+    Test_Check(index);
+
+    index.Update(CDirSizeIndex::eAdded, "gone/too/f");
+    HOST_CHECK(index.GetSize("gone") == 0);
+    Test_Check(index);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Case
+//---------------------------------------------------------------------------
+
+
+static void Test_Case()
+{
+    Test_Fs.clear();
+    Test_NoCase = true;
+
+    Test_Add("Dir", 0, true);
+    Test_Add("Dir/File.TXT", 5, false);
+
+    CDirSizeIndex index(TEST_ROOT, new CTestWalker, Qt::CaseInsensitive);
+    index.Scan();
+    HOST_CHECK(index.GetSize("dir/file.txt") == 5);
+    HOST_CHECK(index.GetSize("DIR") == 5);
+
+    Test_Fs[Test_Key("Dir/File.TXT")].Size = 6;
+    index.Update(CDirSizeIndex::eModified, "DIR/FILE.txt");
+    HOST_CHECK(index.GetTotalSize() == 6);
+    Test_Check(index);
+
+    Test_Add("dir/other", 1, false);
+    index.Update(CDirSizeIndex::eAdded, "dIr/OTHER");
+    index.Update(CDirSizeIndex::eAdded, "Dir/Other");
+    HOST_CHECK(index.GetTotalSize() == 7);
+    Test_Check(index);
+
+    Test_Remove("Dir");
+    index.Update(CDirSizeIndex::eRemoved, "dir");
+    HOST_CHECK(index.GetTotalSize() == 0);
+
+    //
+    // names differing in case only are separate entries otherwise
+    //
+
+    Test_Fs.clear();
+    Test_NoCase = false;
+
+    Test_Add("a", 1, false);
+    Test_Add("A", 2, false);
+
+    CDirSizeIndex index2(TEST_ROOT, new CTestWalker);
+    index2.Scan();
+    HOST_CHECK(index2.GetSize("a") == 1);
+    HOST_CHECK(index2.GetSize("A") == 2);
+
+    Test_Remove("A");
+    index2.Update(CDirSizeIndex::eRemoved, "A");
+    HOST_CHECK(index2.GetTotalSize() == 1);
+    Test_Check(index2);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Name
+//---------------------------------------------------------------------------
+
+
+static std::string Test_Name()
+{
+    static const char *names[] = { "a", "b", "Doc", "e.txt", "F.bin", "g" };
+    return names[Test_Random() % (sizeof(names) / sizeof(names[0]))];
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Recase
+//---------------------------------------------------------------------------
+
+
+static std::string Test_Recase(const std::string &path)
+{
+    if (!Test_NoCase)
+        return path;
+
+    std::string str = path;
+    for (size_t i = 0; i < str.length(); i++) {
+        if (Test_Random() % 2)
+            str[i] = (char)toupper(str[i]);
+        else
+            str[i] = (char)tolower(str[i]);
+    }
+    return str;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Fuzz
+//---------------------------------------------------------------------------
+
+
+static void Test_Fuzz(int rounds, bool no_case)
+{
+    Test_Fs.clear();
+    Test_NoCase = no_case;
+
+    CDirSizeIndex index(TEST_ROOT, new CTestWalker, no_case ? Qt::CaseInsensitive : Qt::CaseSensitive);
+    index.Scan();
+
+    //
+    // changes are queued as the box monitor does and applied in batches,
+    // so an entry may have changed again or be gone when it is looked up
+    //
+
+    std::vector<std::pair<CDirSizeIndex::EChange, std::string> > queue;
+
+    for (int i = 0; i < rounds; i++) {
+
+        std::vector<std::string> dirs(1);
+        std::vector<std::string> files;
+        for (auto I = Test_Fs.begin(); I != Test_Fs.end(); ++I)
+            (I->second.IsDir ? dirs : files).push_back(I->second.Path);
+
+        std::string dir = dirs[Test_Random() % dirs.size()];
+        std::string path = (dir.empty() ? "" : dir + "/") + Test_Name();
+        bool exists = Test_Fs.count(Test_Key(path)) != 0;
+
+        int op = Test_Random() % 10;
+
+        if (op < 3 && !exists) {
+
+            // new file, or new folder reported by itself or by its file only
+
+            if (Test_Random() % 3) {
+                Test_Add(path, Test_Random() % 1000, false);
+                queue.push_back(std::make_pair(CDirSizeIndex::eAdded, path));
+            } else {
+                Test_Add(path, 0, true);
+                std::string file = path + "/" + Test_Name();
+                Test_Add(file, Test_Random() % 1000, false);
+                queue.push_back(std::make_pair(CDirSizeIndex::eAdded, Test_Random() % 2 ? path : file));
+            }
+
+        } else if (op < 5 && !files.empty()) {
+
+            // modified file, the folder is reported as well
+
+            path = files[Test_Random() % files.size()];
+            Test_Fs[Test_Key(path)].Size = Test_Random() % 1000;
+            queue.push_back(std::make_pair(CDirSizeIndex::eModified, path));
+            if (!Test_Parent(path).empty())
+                queue.push_back(std::make_pair(CDirSizeIndex::eModified, Test_Parent(path)));
+
+        } else if (op < 7 && exists) {
+
+            Test_Remove(path);
+            queue.push_back(std::make_pair(CDirSizeIndex::eRemoved, path));
+
+        } else if (op < 8 && exists) {
+
+            // replaced by the other kind, reported as removed and added or,
+            // with the removal merged away, as added only
+
+            bool was_dir = Test_Fs[Test_Key(path)].IsDir;
+            Test_Remove(path);
+            Test_Add(path, Test_Random() % 1000, !was_dir);
+            if (!was_dir)
+                Test_Add(path + "/" + Test_Name(), Test_Random() % 1000, false);
+            if (Test_Random() % 2)
+                queue.push_back(std::make_pair(CDirSizeIndex::eRemoved, path));
+            queue.push_back(std::make_pair(CDirSizeIndex::eAdded, path));
+
+        } else if (op < 9 && exists) {
+
+            std::string target = dirs[Test_Random() % dirs.size()];
+            target = (target.empty() ? "" : target + "/") + Test_Name();
+            if (Test_Fs.count(Test_Key(target)) || Test_Key(target).compare(0, Test_Key(path).length(), Test_Key(path)) == 0)
+                continue;
+
+            Test_Rename(path, target);
+            queue.push_back(std::make_pair(CDirSizeIndex::eRemoved, path));
+            queue.push_back(std::make_pair(CDirSizeIndex::eAdded, target));
+        }
+
+        if (Test_Random() % 4 == 0) {
+            for (auto I = queue.begin(); I != queue.end(); ++I)
+                index.Update(I->first, Test_Recase(I->second));
+            queue.clear();
+            Test_Check(index);
+        }
+    }
+
+    for (auto I = queue.begin(); I != queue.end(); ++I)
+        index.Update(I->first, Test_Recase(I->second));
+    Test_Check(index);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+
+    Test_Scan();
+    Test_Update();
+    Test_Replace();
+    Test_MissingParent();
+    Test_Case();
+
+    Test_Fuzz(rounds, false);
+    Test_Fuzz(rounds, true);
+
+    printf("ok\n");
+    return 0;
+}
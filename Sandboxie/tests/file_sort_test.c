@@ -0,0 +1,349 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Directory Sort Test
+//
+// Sorts random directory listings with the red-black tree of the merge
+// cache in core/dll/file_dir.c, and compares the order with the ordered
+// list insertion which File_MergeCache, File_MergeCacheWin2000 and
+// File_MergeDummy used before.  Names come from a small alphabet in mixed
+// case, so there are many duplicates.  Then reports the time to sort a
+// large unsorted directory both ways.
+//
+// usage: file_sort_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include <wctype.h>
+#include "common/defines.h"
+#include "common/rbtree.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define STATUS_OBJECT_NAME_COLLISION    ((NTSTATUS)0x40000035L)
+
+#define TEST_NAME_LEN       16
+
+
+//
+// mode of the listing, as the callers of File_MergeCacheSortInsert
+//
+
+#define TEST_CACHE          0       // File_MergeCache, stops on a duplicate
+#define TEST_WIN2000        1       // File_MergeCacheWin2000, keeps duplicates
+#define TEST_DUMMY          2       // File_MergeDummy, skips duplicates
+#define TEST_FALLBACK       3       // File_MergeCache, then File_MergeCacheWin2000
+
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    WCHAR *Buffer;
+} UNICODE_STRING;
+
+
+typedef struct _FILE_MERGE_CACHE_FILE {
+
+    LIST_ELEM list_elem;
+    UNICODE_STRING name_uni;
+    ULONG id;
+    WCHAR name[TEST_NAME_LEN];
+
+} FILE_MERGE_CACHE_FILE;
+
+
+//---------------------------------------------------------------------------
+// RtlCompareUnicodeString
+//---------------------------------------------------------------------------
+
+
+static LONG RtlCompareUnicodeString(
+    const UNICODE_STRING *String1, const UNICODE_STRING *String2,
+    BOOLEAN CaseInSensitive)
+{
+    ULONG len1 = String1->Length / sizeof(WCHAR);
+    ULONG len2 = String2->Length / sizeof(WCHAR);
+    ULONG i;
+
+    for (i = 0; i < len1 && i < len2; i++) {
+        WCHAR c1 = String1->Buffer[i];
+        WCHAR c2 = String2->Buffer[i];
+        if (CaseInSensitive) {
+            c1 = towupper(c1);
+            c2 = towupper(c2);
+        }
+        if (c1 != c2)
+            return (LONG)c1 - (LONG)c2;
+    }
+
+    return (LONG)len1 - (LONG)len2;
+}
+
+
+//---------------------------------------------------------------------------
+// File Merge Cache Sort
+//---------------------------------------------------------------------------
+
+
+//
+// the structures and functions of the sort, taken from file_dir.c by
+// the Makefile
+//
+
+#include "file_sort.c"
+
+
+//---------------------------------------------------------------------------
+// Test_InsertList
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_InsertList(
+    LIST *cache_list, FILE_MERGE_CACHE_FILE *cache_file, int mode)
+{
+    FILE_MERGE_CACHE_FILE *ins_point;
+    LONG cmp;
+
+    //
+    // the ordered list insertion, as it was in file_dir.c, returns
+    // FALSE where File_MergeCache stops reading the directory
+    //
+
+    ins_point = List_Head(cache_list);
+    cmp = -1;
+    while (ins_point) {
+        cmp = RtlCompareUnicodeString(
+            &ins_point->name_uni, &cache_file->name_uni,
+            TRUE);                      // CaseInSensitive
+        if (mode == TEST_WIN2000 ? (cmp > 0) : (cmp >= 0))
+            break;
+        ins_point = List_Next(ins_point);
+    }
+
+    if (mode != TEST_WIN2000 && cmp == 0)
+        return (mode == TEST_DUMMY);
+
+    if (ins_point)
+        List_Insert_Before(cache_list, ins_point, cache_file);
+    else
+        List_Insert_After(cache_list, NULL, cache_file);
+
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_SortList
+//---------------------------------------------------------------------------
+
+
+static void Test_SortList(
+    LIST *cache_list, FILE_MERGE_CACHE_FILE **files, ULONG count, int mode)
+{
+    ULONG i;
+
+    List_Init(cache_list);
+
+    for (i = 0; i < count; i++) {
+        int m = (mode == TEST_FALLBACK) ? (i < count / 2 ? TEST_CACHE : TEST_WIN2000) : mode;
+        if (! Test_InsertList(cache_list, files[i], m))
+            break;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_SortTree
+//---------------------------------------------------------------------------
+
+
+static void Test_SortTree(
+    LIST *cache_list, FILE_MERGE_CACHE_FILE **files, ULONG count, int mode)
+{
+    FILE_MERGE_CACHE_SORT sort;
+    NTSTATUS status;
+    ULONG i;
+
+    List_Init(cache_list);
+    HOST_CHECK(File_MergeCacheSortInit(&sort));
+
+    for (i = 0; i < count; i++) {
+
+        int m = (mode == TEST_FALLBACK) ? (i < count / 2 ? TEST_CACHE : TEST_WIN2000) : mode;
+
+        status = File_MergeCacheSortInsert(&sort, files[i], m == TEST_WIN2000);
+        HOST_CHECK(NT_SUCCESS(status) || status == STATUS_OBJECT_NAME_COLLISION);
+
+        if (status == STATUS_OBJECT_NAME_COLLISION && m == TEST_CACHE)
+            break;
+    }
+
+    File_MergeCacheSortDone(&sort, cache_list);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Files
+//---------------------------------------------------------------------------
+
+
+static FILE_MERGE_CACHE_FILE **Test_Files(ULONG count, ULONG name_len, ULONG alphabet)
+{
+    FILE_MERGE_CACHE_FILE **files;
+    ULONG i, j, len;
+
+    files = (FILE_MERGE_CACHE_FILE **)malloc(sizeof(void *) * (count + 1));
+
+    for (i = 0; i < count; i++) {
+
+        FILE_MERGE_CACHE_FILE *file = (FILE_MERGE_CACHE_FILE *)calloc(1, sizeof(FILE_MERGE_CACHE_FILE));
+
+        len = name_len ? name_len : 1 + Host_Random() % 4;
+        for (j = 0; j < len; j++) {
+            ULONG c = Host_Random() % alphabet;
+            file->name[j] = (Host_Random() % 2) ? L'a' + c : L'A' + c;
+        }
+
+        file->name_uni.Length = (USHORT)(len * sizeof(WCHAR));
+        file->name_uni.MaximumLength = file->name_uni.Length;
+        file->name_uni.Buffer = file->name;
+        file->id = i;
+        files[i] = file;
+    }
+
+    return files;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_FreeFiles
+//---------------------------------------------------------------------------
+
+
+static void Test_FreeFiles(FILE_MERGE_CACHE_FILE **files, ULONG count)
+{
+    ULONG i;
+    for (i = 0; i < count; i++)
+        free(files[i]);
+    free(files);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Order
+//---------------------------------------------------------------------------
+
+
+static void Test_Order(ULONG rounds)
+{
+    FILE_MERGE_CACHE_FILE **files;
+    FILE_MERGE_CACHE_FILE *file1, *file2;
+    LIST list1, list2;
+    ULONG i, count;
+    int mode;
+
+    for (i = 0; i < rounds; i++) {
+
+        count = Host_Random() % 200;
+        mode = Host_Random() % 4;
+        files = Test_Files(count, 0, 1 + Host_Random() % 6);
+
+        //
+        // both must list the same files in the same order, and
+        // stop or skip at the same duplicates
+        //
+
+        Test_SortList(&list1, files, count, mode);
+        Test_SortTree(&list2, files, count, mode);
+
+        HOST_CHECK(list1.count == list2.count);
+
+        file1 = List_Head(&list1);
+        file2 = List_Head(&list2);
+        while (file1) {
+            HOST_CHECK(file1->id == file2->id);
+            file1 = List_Next(file1);
+            file2 = List_Next(file2);
+        }
+
+        HOST_CHECK(Host_PoolBytes() == 0);
+
+        Test_FreeFiles(files, count);
+    }
+
+    printf("order: %u listings ok\n", rounds);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Bench
+//---------------------------------------------------------------------------
+
+
+static void Test_Bench(ULONG count)
+{
+    FILE_MERGE_CACHE_FILE **files;
+    LIST list;
+    double start, tree, ordered;
+
+    //
+    // unique names in random order, as a large directory on FAT
+    //
+
+    files = Test_Files(count, 12, 26);
+
+    start = Host_Time();
+    Test_SortTree(&list, files, count, TEST_WIN2000);
+    tree = Host_Time() - start;
+
+    HOST_CHECK(list.count == (int)count);
+
+    start = Host_Time();
+    Test_SortList(&list, files, count, TEST_WIN2000);
+    ordered = Host_Time() - start;
+
+    printf("%u files: tree %.3f s, ordered list %.3f s\n", count, tree, ordered);
+
+    Test_FreeFiles(files, count);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG rounds = argc > 1 ? atoi(argv[1]) : 20000;
+
+    Test_Order(rounds);
+    Test_Bench(10000);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,481 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Driver Host Stand-ins
+//---------------------------------------------------------------------------
+
+
+#include <stdarg.h>
+#include "common/stream.h"
+#include "core/drv/conf.h"
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+POOL *Driver_Pool = NULL;
+
+WCHAR *Driver_RegistryPath = L"\\REGISTRY\\MACHINE\\SYSTEM\\CurrentControlSet\\Services\\SbieDrv";
+
+WCHAR *Driver_HomePathDos = L"\\??\\C:\\Program Files\\Sandboxie";
+
+ULONG Driver_OsVersion = DRIVER_WINDOWS_VISTA + 4;
+
+ULONG Driver_OsBuild = 19045;
+
+BOOLEAN Log_LogMessageEvents = FALSE;
+
+BOOLEAN Obj_CallbackInstalled = FALSE;
+
+BOOLEAN WFP_Enabled = FALSE;
+
+const char *Host_IniPath = NULL;
+
+const char *Host_TemplatesPath = NULL;
+
+ULONG Host_MemAllocs = 0;
+
+ULONG Host_StreamChunk = 4064;      // STREAM_DATA_SIZE on x64
+
+
+//---------------------------------------------------------------------------
+// Wide Strings
+//---------------------------------------------------------------------------
+
+
+static WCHAR Host_wcslwr1(WCHAR c)
+{
+    return (c >= L'A' && c <= L'Z') ? c + (L'a' - L'A') : c;
+}
+
+
+_FX size_t Host_wcslen(const WCHAR *s)
+{
+    size_t n = 0;
+    while (s[n])
+        ++n;
+    return n;
+}
+
+
+_FX WCHAR *Host_wcscpy(WCHAR *d, const WCHAR *s)
+{
+    return wmemcpy(d, s, Host_wcslen(s) + 1);
+}
+
+
+_FX WCHAR *Host_wcsncpy(WCHAR *d, const WCHAR *s, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n && s[i]; ++i)
+        d[i] = s[i];
+    for (; i < n; ++i)
+        d[i] = 0;
+    return d;
+}
+
+
+_FX WCHAR *Host_wcscat(WCHAR *d, const WCHAR *s)
+{
+    Host_wcscpy(d + Host_wcslen(d), s);
+    return d;
+}
+
+
+_FX WCHAR *Host_wcschr(const WCHAR *s, WCHAR c)
+{
+    for (; *s; s++) {
+        if (*s == c)
+            return (WCHAR *)s;
+    }
+    return c ? NULL : (WCHAR *)s;
+}
+
+
+_FX int Host_wcsnicmp(const WCHAR *a, const WCHAR *b, size_t n)
+{
+    for (; n; --n, ++a, ++b) {
+        int d = (int)Host_wcslwr1(*a) - (int)Host_wcslwr1(*b);
+        if (d || ! *a)
+            return d;
+    }
+    return 0;
+}
+
+
+_FX int Host_wcsicmp(const WCHAR *a, const WCHAR *b)
+{
+    return Host_wcsnicmp(a, b, (size_t)-1);
+}
+
+
+//---------------------------------------------------------------------------
+// Memory
+//---------------------------------------------------------------------------
+
+
+_FX void *Mem_AllocEx(POOL *pool, ULONG size, BOOLEAN InitMsg)
+{
+    void *ptr = Pool_Alloc(pool, size);
+    if (ptr)
+        ++Host_MemAllocs;
+    return ptr;
+}
+
+
+_FX void Mem_Free(void *ptr, ULONG size)
+{
+    --Host_MemAllocs;
+    Pool_Free(ptr, size);
+}
+
+
+_FX WCHAR *Mem_AllocStringEx(POOL *pool, const WCHAR *model_string, BOOLEAN InitMsg)
+{
+    ULONG num_bytes = (ULONG)(Host_wcslen(model_string) + 1) * sizeof(WCHAR);
+    WCHAR *str = Mem_AllocEx(pool, num_bytes, InitMsg);
+    if (str)
+        memcpy(str, model_string, num_bytes);
+    return str;
+}
+
+
+_FX void Mem_FreeString(WCHAR *string)
+{
+    Mem_Free(string, (ULONG)(Host_wcslen(string) + 1) * sizeof(WCHAR));
+}
+
+
+_FX BOOLEAN Mem_GetLockResource(PERESOURCE *ppResource, BOOLEAN InitMsg)
+{
+    *ppResource = (PERESOURCE)ppResource;
+    return TRUE;
+}
+
+
+_FX void Mem_FreeLockResource(PERESOURCE *ppResource)
+{
+    *ppResource = NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// Stream
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS Stream_Open(
+    STREAM **out_stream, const WCHAR *FullPath, ACCESS_MASK DesiredAccess,
+    ULONG FileAttributes, ULONG ShareAccess, ULONG CreateDisposition,
+    ULONG CreateOptions)
+{
+    static const WCHAR *templates = L"\\Templates.ini";
+    size_t path_len = Host_wcslen(FullPath);
+    size_t tmpl_len = Host_wcslen(templates);
+    const char *path = Host_IniPath;
+    STREAM *stream;
+    FILE *file;
+    long size;
+
+    if (path_len >= tmpl_len && Host_wcsicmp(FullPath + path_len - tmpl_len, templates) == 0)
+        path = Host_TemplatesPath;
+
+    file = path ? fopen(path, "rb") : NULL;
+    if (! file)
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    stream = (STREAM *)calloc(1, sizeof(STREAM));
+    stream->data = (UCHAR *)malloc(size + 1);
+    stream->len = (ULONG)fread(stream->data, 1, size, file);
+    fclose(file);
+
+    *out_stream = stream;
+    return STATUS_SUCCESS;
+}
+
+
+_FX void Stream_Close(STREAM *stream)
+{
+    free(stream->data);
+    free(stream);
+}
+
+
+_FX NTSTATUS Stream_Query_Size(STREAM *stream, ULONG64 *size)
+{
+    *size = stream->len;
+    return STATUS_SUCCESS;
+}
+
+
+_FX NTSTATUS Stream_Read_More(STREAM *stream)
+{
+    ULONG len = min(Host_StreamChunk, stream->len - stream->pos);
+
+    //
+    // hands out the file in chunks like ZwReadFile into the stream buffer,
+    // Read_BOM, Stream_Read_BOM and Stream_Read_Wchar are the ones from
+    // common/stream.c, taken by the Makefile
+    //
+
+    stream->data_ptr = stream->data + stream->pos;
+    stream->data_len = len;
+    stream->pos += len;
+
+    return len ? STATUS_SUCCESS : STATUS_END_OF_FILE;
+}
+
+
+_FX NTSTATUS Stream_Read_Bytes(STREAM *stream, ULONG len, UCHAR *v)
+{
+    ULONG n;
+
+    while (len) {
+
+        if (stream->data_len == 0) {
+            NTSTATUS status = Stream_Read_More(stream);
+            if (! NT_SUCCESS(status))
+                return status;
+        }
+
+        n = min(len, stream->data_len);
+        memcpy(v, stream->data_ptr, n);
+        stream->data_ptr += n;
+        stream->data_len -= n;
+        v += n;
+        len -= n;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// Log
+//---------------------------------------------------------------------------
+
+
+_FX void Log_Msg_Session(
+    NTSTATUS error_code, const WCHAR *string1, const WCHAR *string2,
+    ULONG session_id)
+{
+    fprintf(stderr, "log message %d\n", error_code);
+}
+
+
+_FX void Log_Status_Ex_Session(
+    NTSTATUS error_code, ULONG error_subcode, NTSTATUS nt_status,
+    const WCHAR *string2, ULONG session_id)
+{
+    fprintf(stderr, "log message %d, status %08X\n", error_code, nt_status);
+}
+
+
+//---------------------------------------------------------------------------
+// Rtl
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS RtlStringCbPrintfW(WCHAR *dest, size_t cb, const WCHAR *format, ...)
+{
+    size_t max = cb / sizeof(WCHAR) - 1, n = 0;
+    va_list args;
+
+    //
+    // only %s and %d, as used in conf.c
+    //
+
+    va_start(args, format);
+    for (; *format && n < max; ++format) {
+
+        if (format[0] == L'%' && format[1] == L's') {
+            const WCHAR *s = va_arg(args, const WCHAR *);
+            while (*s && n < max)
+                dest[n++] = *s++;
+            ++format;
+
+        } else if (format[0] == L'%' && format[1] == L'd') {
+            char num[16], *s = num;
+            snprintf(num, sizeof(num), "%d", va_arg(args, int));
+            while (*s && n < max)
+                dest[n++] = *s++;
+            ++format;
+
+        } else
+            dest[n++] = *format;
+    }
+    va_end(args);
+
+    dest[n] = 0;
+    return STATUS_SUCCESS;
+}
+
+
+_FX void RtlInitUnicodeString(UNICODE_STRING *uni, const WCHAR *str)
+{
+    uni->Buffer = (WCHAR *)str;
+    uni->Length = str ? (USHORT)(Host_wcslen(str) * sizeof(WCHAR)) : 0;
+    uni->MaximumLength = str ? uni->Length + sizeof(WCHAR) : 0;
+}
+
+
+_FX NTSTATUS RtlUnicodeStringToInteger(UNICODE_STRING *uni, ULONG base, ULONG *value)
+{
+    ULONG i, v = 0;
+    for (i = 0; i < uni->Length / sizeof(WCHAR); ++i) {
+        if (uni->Buffer[i] < L'0' || uni->Buffer[i] > L'9')
+            break;
+        v = v * 10 + (uni->Buffer[i] - L'0');
+    }
+    if (i == 0)
+        return STATUS_INVALID_PARAMETER;
+    *value = v;
+    return STATUS_SUCCESS;
+}
+
+
+_FX void RtlFreeUnicodeString(UNICODE_STRING *uni)
+{
+}
+
+
+//---------------------------------------------------------------------------
+// Driver
+//---------------------------------------------------------------------------
+
+
+_FX NTSTATUS GetRegString(ULONG RelativeTo, const WCHAR *Path, const WCHAR *ValueName, UNICODE_STRING *pData)
+{
+    return STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+
+_FX NTSTATUS MyValidateCertificate(void)
+{
+    return STATUS_SUCCESS;
+}
+
+
+_FX NTSTATUS Process_GetSidStringAndSessionId(
+    HANDLE ProcessHandle, HANDLE ProcessId,
+    UNICODE_STRING *SidString, ULONG *SessionId)
+{
+    return STATUS_NOT_IMPLEMENTED;
+}
+
+
+_FX BOOLEAN Box_IsValidName(const WCHAR *name)
+{
+    int i;
+
+    for (i = 0; i < (BOXNAME_COUNT - 2); ++i) {
+        if (! name[i])
+            break;
+        if (name[i] >= L'0' && name[i] <= L'9')
+            continue;
+        if (name[i] >= L'A' && name[i] <= L'Z')
+            continue;
+        if (name[i] >= L'a' && name[i] <= L'z')
+            continue;
+        if (name[i] == L'_')
+            continue;
+        return FALSE;
+    }
+    if (i == 0 || name[i])
+        return FALSE;
+    return TRUE;
+}
+
+
+_FX BOOLEAN Obj_Load_Filter(void)
+{
+    Obj_CallbackInstalled = TRUE;
+    return TRUE;
+}
+
+
+_FX void Obj_Unload_Filter(void)
+{
+    Obj_CallbackInstalled = FALSE;
+}
+
+
+_FX BOOLEAN WFP_Load(void)
+{
+    WFP_Enabled = TRUE;
+    return TRUE;
+}
+
+
+_FX void WFP_Unload(void)
+{
+    WFP_Enabled = FALSE;
+}
+
+
+_FX void Syscall_Update_Config(void)
+{
+}
+
+
+_FX void Api_SetFunction(ULONG func_code, P_Api_Function func_ptr)
+{
+}
+
+
+_FX BOOLEAN Api_SendServiceMessage(ULONG msgid, ULONG data_len, void *data)
+{
+    return TRUE;
+}
+
+
+_FX void Api_CopyStringToUser(UNICODE_STRING64 *uni, WCHAR *str, size_t len)
+{
+    memcpy((void *)(ULONG_PTR)uni->Buffer, str, len);
+    uni->Length = (USHORT)len - sizeof(WCHAR);
+}
+
+
+//---------------------------------------------------------------------------
+// Conf User
+//---------------------------------------------------------------------------
+
+
+_FX BOOLEAN Conf_Init_User(void)
+{
+    return TRUE;
+}
+
+
+_FX void Conf_Unload_User(void)
+{
+}
+
+
+_FX WCHAR *Conf_Expand(
+    CONF_EXPAND_ARGS *args, const WCHAR *model_value,
+    const WCHAR *setting_name)
+{
+    return Mem_AllocString(args->pool, model_value);
+}
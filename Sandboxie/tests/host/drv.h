@@ -0,0 +1,262 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Driver Host Stand-ins
+//
+// Force included after host/host.h to build driver sources which include
+// driver.h, such as conf.c.  Defines the include guards of the kernel only
+// headers, so the driver source takes the declarations below instead, and
+// the services behind them are in host/drv.c.  Built with -fshort-wchar,
+// so the wide string functions are replaced with 16 bit ones
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_HOST_DRV_H
+#define _MY_HOST_DRV_H
+
+
+#define KERNEL_MODE
+
+#define _MY_DRIVER_H
+#define _MY_PROCESS_H
+#define _MY_API_H
+#define _MY_OBJ_H
+#define _MY_UTIL_H
+
+#include "common/defines.h"
+#include "common/map.h"
+#include "common/my_version.h"
+
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+
+typedef uintptr_t           UINT_PTR;
+typedef ULONG               ACCESS_MASK;
+typedef UCHAR               KIRQL;
+typedef void               *PERESOURCE;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    WCHAR *Buffer;
+} UNICODE_STRING;
+
+typedef struct _UNICODE_STRING64 {
+    USHORT Length;
+    USHORT MaximumLength;
+    ULONG64 Buffer;
+} UNICODE_STRING64;
+
+typedef struct _BOX                 BOX;
+typedef struct _CONF_EXPAND_ARGS    CONF_EXPAND_ARGS;
+typedef struct _PROCESS             PROCESS;
+
+struct _BOX {
+    WCHAR name[BOXNAME_COUNT];
+    CONF_EXPAND_ARGS *expand_args;
+};
+
+struct _PROCESS {
+    BOX *box;
+};
+
+
+//
+// the first three fields are those of the kernel stream, which the
+// character decoding taken from common/stream.c works on
+//
+
+struct STREAM {
+    UCHAR *data_ptr;
+    ULONG data_len;
+    ULONG encoding;
+    UCHAR *data;            // the whole file
+    ULONG len;
+    ULONG pos;              // end of the chunks read so far
+};
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define STATUS_BUFFER_OVERFLOW          ((NTSTATUS)0x80000005L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_END_OF_FILE              ((NTSTATUS)0xC0000011L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_TYPE_MISMATCH     ((NTSTATUS)0xC0000024L)
+#define STATUS_OBJECT_NAME_NOT_FOUND    ((NTSTATUS)0xC0000034L)
+#define STATUS_OBJECT_PATH_NOT_FOUND    ((NTSTATUS)0xC000003AL)
+#define STATUS_TOO_MANY_COMMANDS        ((NTSTATUS)0xC00000C1L)
+#define STATUS_RESOURCE_NAME_NOT_FOUND  ((NTSTATUS)0xC000008BL)
+#define STATUS_OPERATION_IN_PROGRESS    ((NTSTATUS)0xC0000476L)
+
+#define MSG_CONF_NO_FILE                1401
+#define MSG_CONF_READ                   1402
+#define MSG_CONF_LINE_TOO_LONG          1403
+#define MSG_CONF_FILE_TOO_LONG          1404
+#define MSG_CONF_SYNTAX_ERROR           1405
+#define MSG_CONF_EXPAND                 1406
+#define MSG_CONF_USER_NAME              1408
+#define MSG_CONF_NO_TMPL_FILE           1409
+#define MSG_CONF_BAD_TMPL_FILE          1410
+#define MSG_CONF_MISSING_TMPL           1411
+
+#define DRIVER_WINDOWS_VISTA            4
+
+#define APC_LEVEL                       1
+#define RTL_REGISTRY_ABSOLUTE           0
+#define FILE_GENERIC_READ               0x00120089
+#define FILE_SHARE_READ                 0x00000001
+#define FILE_OPEN                       0x00000001
+
+#ifndef min
+#define min(a,b)            ((a) < (b) ? (a) : (b))
+#endif
+
+#define NtCurrentProcess()              ((HANDLE)(LONG_PTR)-1)
+#define PsGetCurrentProcessId()         ((ULONG_PTR)4)
+
+
+//
+// the lock and the IRQL do nothing, the tests run on one thread
+//
+
+#define KeRaiseIrql(irql,old)               (*(old) = (irql))
+#define KeLowerIrql(irql)                   ((void)(irql))
+#define ExAcquireResourceExclusiveLite(r,w) ((void)(r))
+#define ExAcquireResourceSharedLite(r,w)    ((void)(r))
+#define ExReleaseResourceLite(r)            ((void)(r))
+#define ZwYieldExecution()                  ((void)0)
+
+#define InterlockedIncrement(p)             __sync_add_and_fetch((p), 1)
+#define InterlockedDecrement(p)             __sync_sub_and_fetch((p), 1)
+#define InterlockedExchange(p,v)            __sync_lock_test_and_set((p), (v))
+#define InterlockedCompareExchange(p,v,c)   __sync_val_compare_and_swap((p), (c), (v))
+
+#define ProbeForRead(p,n,a)                 ((void)(p))
+#define ProbeForWrite(p,n,a)                ((void)(p))
+
+#define __try                               for (int __host_try = 1; __host_try; __host_try = 0)
+#define __leave                             break
+#define __except(x)                         if (0)
+#define GetExceptionCode()                  STATUS_UNSUCCESSFUL
+
+
+//
+// WCHAR is 16 bits with -fshort-wchar, the C library still works on
+// 32 bit characters, so the driver sources get these instead
+//
+
+#define wcslen          Host_wcslen
+#define wcscpy          Host_wcscpy
+#define wcsncpy         Host_wcsncpy
+#define wcscat          Host_wcscat
+#define wcschr          Host_wcschr
+#define _wcsicmp        Host_wcsicmp
+#define _wcsnicmp       Host_wcsnicmp
+
+#define wmemcpy(d,s,n)  ((WCHAR *)memcpy((d), (s), (n) * sizeof(WCHAR)))
+#define wmemmove(d,s,n) ((WCHAR *)memmove((d), (s), (n) * sizeof(WCHAR)))
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+extern POOL *Driver_Pool;
+extern WCHAR *Driver_RegistryPath;
+extern WCHAR *Driver_HomePathDos;
+extern ULONG Driver_OsVersion;
+extern ULONG Driver_OsBuild;
+
+extern BOOLEAN Log_LogMessageEvents;
+extern BOOLEAN Obj_CallbackInstalled;
+
+extern const char *Host_IniPath;        // opened for any ...\Sandboxie.ini
+extern const char *Host_TemplatesPath;  // opened for any ...\Templates.ini
+
+extern ULONG Host_MemAllocs;            // blocks from Mem_Alloc not given to Mem_Free
+
+extern ULONG Host_StreamChunk;          // bytes per Stream_Read_More, at least 16
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+size_t Host_wcslen(const WCHAR *s);
+WCHAR *Host_wcscpy(WCHAR *d, const WCHAR *s);
+WCHAR *Host_wcsncpy(WCHAR *d, const WCHAR *s, size_t n);
+WCHAR *Host_wcscat(WCHAR *d, const WCHAR *s);
+WCHAR *Host_wcschr(const WCHAR *s, WCHAR c);
+int Host_wcsicmp(const WCHAR *a, const WCHAR *b);
+int Host_wcsnicmp(const WCHAR *a, const WCHAR *b, size_t n);
+
+void *Mem_AllocEx(POOL *pool, ULONG size, BOOLEAN InitMsg);
+void Mem_Free(void *ptr, ULONG size);
+WCHAR *Mem_AllocStringEx(POOL *pool, const WCHAR *model_string, BOOLEAN InitMsg);
+void Mem_FreeString(WCHAR *string);
+BOOLEAN Mem_GetLockResource(PERESOURCE *ppResource, BOOLEAN InitMsg);
+void Mem_FreeLockResource(PERESOURCE *ppResource);
+
+#define Mem_Alloc(pool,size) Mem_AllocEx((pool),(size),FALSE)
+#define Mem_AllocString(pool,model) Mem_AllocStringEx((pool),(model),FALSE)
+
+NTSTATUS Stream_Read_More(struct STREAM *stream);
+
+void Log_Msg_Session(
+    NTSTATUS error_code, const WCHAR *string1, const WCHAR *string2,
+    ULONG session_id);
+void Log_Status_Ex_Session(
+    NTSTATUS error_code, ULONG error_subcode, NTSTATUS nt_status,
+    const WCHAR *string2, ULONG session_id);
+
+NTSTATUS RtlStringCbPrintfW(WCHAR *dest, size_t cb, const WCHAR *format, ...);
+void RtlInitUnicodeString(UNICODE_STRING *uni, const WCHAR *str);
+NTSTATUS RtlUnicodeStringToInteger(UNICODE_STRING *uni, ULONG base, ULONG *value);
+void RtlFreeUnicodeString(UNICODE_STRING *uni);
+
+NTSTATUS GetRegString(ULONG RelativeTo, const WCHAR *Path, const WCHAR *ValueName, UNICODE_STRING *pData);
+NTSTATUS MyValidateCertificate(void);
+
+NTSTATUS Process_GetSidStringAndSessionId(
+    HANDLE ProcessHandle, HANDLE ProcessId,
+    UNICODE_STRING *SidString, ULONG *SessionId);
+
+BOOLEAN Box_IsValidName(const WCHAR *name);
+
+BOOLEAN Obj_Load_Filter(void);
+void Obj_Unload_Filter(void);
+
+typedef NTSTATUS (*P_Api_Function)(PROCESS *, ULONG64 *parms);
+
+void Api_SetFunction(ULONG func_code, P_Api_Function func_ptr);
+BOOLEAN Api_SendServiceMessage(ULONG msgid, ULONG data_len, void *data);
+void Api_CopyStringToUser(UNICODE_STRING64 *uni, WCHAR *str, size_t len);
+
+#include "core/drv/api_defs.h"
+
+
+#endif /* _MY_HOST_DRV_H */
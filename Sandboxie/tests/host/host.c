@@ -0,0 +1,204 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Host Stand-ins
+//---------------------------------------------------------------------------
+
+
+#include <time.h>
+#include "common/defines.h"
+#include "common/pool.h"
+
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+
+typedef struct HOST_BLOCK {
+    struct HOST_BLOCK *next;
+    struct HOST_BLOCK *prev;
+    POOL *pool;
+    size_t size;
+} HOST_BLOCK;
+
+
+struct POOL {
+    HOST_BLOCK *blocks;
+};
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static size_t Host_Bytes = 0;
+
+static size_t Host_Peak = 0;
+
+static ULONG Host_Seed = 0x2545F491;
+
+
+//---------------------------------------------------------------------------
+// Pool_Create
+//---------------------------------------------------------------------------
+
+
+_FX POOL *Pool_Create(void)
+{
+    POOL *pool = (POOL *)calloc(1, sizeof(POOL));
+    return pool;
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_CreateTagged
+//---------------------------------------------------------------------------
+
+
+_FX POOL *Pool_CreateTagged(ULONG tag)
+{
+    return Pool_Create();
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_Delete
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Pool_Delete(POOL *pool)
+{
+    while (pool->blocks) {
+        HOST_BLOCK *block = pool->blocks;
+        pool->blocks = block->next;
+        Host_Bytes -= block->size;
+        free(block);
+    }
+
+    free(pool);
+    return 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_Alloc
+//---------------------------------------------------------------------------
+
+
+_FX void *Pool_Alloc(POOL *pool, ULONG size)
+{
+    HOST_BLOCK *block = (HOST_BLOCK *)malloc(sizeof(HOST_BLOCK) + size);
+    if (! block)
+        return NULL;
+
+    //
+    // a NULL pool is allowed for objects which the caller frees itself
+    //
+
+    block->pool = pool;
+    block->size = size;
+    block->prev = NULL;
+    block->next = pool ? pool->blocks : NULL;
+    if (block->next)
+        block->next->prev = block;
+    if (pool)
+        pool->blocks = block;
+
+    Host_Bytes += size;
+    if (Host_Peak < Host_Bytes)
+        Host_Peak = Host_Bytes;
+    return block + 1;
+}
+
+
+//---------------------------------------------------------------------------
+// Pool_Free
+//---------------------------------------------------------------------------
+
+
+_FX void Pool_Free(void *ptr, ULONG size)
+{
+    HOST_BLOCK *block = (HOST_BLOCK *)ptr - 1;
+
+    HOST_CHECK(block->size == size);
+
+    if (block->pool) {
+        if (block->prev)
+            block->prev->next = block->next;
+        else
+            block->pool->blocks = block->next;
+        if (block->next)
+            block->next->prev = block->prev;
+    }
+
+    Host_Bytes -= size;
+    free(block);
+}
+
+
+//---------------------------------------------------------------------------
+// Host_PoolBytes
+//---------------------------------------------------------------------------
+
+
+_FX size_t Host_PoolBytes(void)
+{
+    return Host_Bytes;
+}
+
+
+//---------------------------------------------------------------------------
+// Host_PoolPeak
+//---------------------------------------------------------------------------
+
+
+_FX size_t Host_PoolPeak(void)
+{
+    size_t peak = Host_Peak;
+    Host_Peak = Host_Bytes;
+    return peak;
+}
+
+
+//---------------------------------------------------------------------------
+// Host_Time
+//---------------------------------------------------------------------------
+
+
+_FX double Host_Time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+
+//---------------------------------------------------------------------------
+// Host_Random
+//---------------------------------------------------------------------------
+
+
+_FX ULONG Host_Random(void)
+{
+    Host_Seed ^= Host_Seed << 13;
+    Host_Seed ^= Host_Seed >> 17;
+    Host_Seed ^= Host_Seed << 5;
+    return Host_Seed;
+}
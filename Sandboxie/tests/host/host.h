@@ -0,0 +1,174 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Host Stand-ins
+//
+// Just enough of the Windows and NT definitions to build the portable
+// parts of the driver, SbieDll and SbieSvc with a plain C compiler, so
+// they can be tested and benchmarked outside of Windows.  Force included
+// into every test by the Makefile, the C++ tests take only its types and
+// HOST_CHECK
+//---------------------------------------------------------------------------
+
+
+#ifndef _MY_HOST_H
+#define _MY_HOST_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <wctype.h>
+
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+
+typedef wchar_t             WCHAR;
+typedef char                CHAR;
+typedef uint8_t             UCHAR;
+typedef uint16_t            USHORT;
+typedef int32_t             LONG;
+typedef uint32_t            ULONG;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef uint64_t            ULONG64;
+typedef intptr_t            LONG_PTR;
+typedef uintptr_t           ULONG_PTR;
+typedef uintptr_t           SIZE_T;
+typedef UCHAR               BOOLEAN;
+typedef LONG                NTSTATUS;
+typedef void               *PVOID;
+typedef void               *HANDLE;
+typedef ULONG              *PULONG;
+
+#define VOID                void
+
+#ifndef TRUE
+#define TRUE                1
+#define FALSE               0
+#endif
+
+#define IN
+#define OUT
+#define OPTIONAL
+
+#define __cdecl
+#define _CRTIMP
+#define _Check_return_
+#define _In_z_
+#define _Out_opt_
+#define _Deref_post_z_
+
+#define __declspec(x)
+#define __inline            inline
+
+#define NT_SUCCESS(s)       ((NTSTATUS)(s) >= 0)
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_PORT_MESSAGE_TOO_LONG    ((NTSTATUS)0xC000002FL)
+
+#define MemoryBarrier()     __sync_synchronize()
+
+#define MAX_PORTMSG_LENGTH  328     // as in common/win32_ntddk.h
+
+
+//
+// the tree builds pattern.c and friends after dll.h or driver.h,
+// which have the list and pool declarations in scope
+//
+
+#include "common/list.h"
+#include "common/pool.h"
+
+
+//---------------------------------------------------------------------------
+// Runtime
+//---------------------------------------------------------------------------
+
+
+static inline WCHAR *_wcslwr(WCHAR *s)
+{
+    WCHAR *p;
+    for (p = s; *p; ++p)
+        *p = (WCHAR)towlower(*p);
+    return s;
+}
+
+
+static inline int _wcsnicmp(const WCHAR *a, const WCHAR *b, size_t n)
+{
+    return wcsncasecmp(a, b, n);
+}
+
+
+static inline int _wcsicmp(const WCHAR *a, const WCHAR *b)
+{
+    return wcscasecmp(a, b);
+}
+
+
+static inline BOOLEAN _BitScanForward(ULONG *index, ULONG mask)
+{
+    if (! mask)
+        return FALSE;
+    *index = (ULONG)__builtin_ctz(mask);
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Test Helpers
+//---------------------------------------------------------------------------
+
+
+#define HOST_CHECK(cond) do {                                           \
+    if (! (cond)) {                                                     \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                __FILE__, __LINE__, #cond);                             \
+        exit(1);                                                        \
+    }                                                                   \
+} while (0)
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+double Host_Time(void);         // seconds, monotonic
+
+ULONG Host_Random(void);        // deterministic for every run
+
+size_t Host_PoolBytes(void);    // bytes currently held by Pool_Alloc
+
+size_t Host_PoolPeak(void);     // most bytes held since the last call
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* _MY_HOST_H */
@@ -0,0 +1,430 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// ImBox Host Stand-ins
+//
+// Replaces the framework.h of ImBox, so CImageFileIO and CVirtualMemoryIO
+// can be built with a plain C++ compiler.  The image file is an in memory
+// model of a sparse NTFS file with 4 KB clusters: clusters are allocated
+// as they are written and released when a hole is punched, the file only
+// grows on writes.  Virtual memory and heaps count the blocks they hand
+// out, the compression of ntdll is left to the test.
+//---------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+
+typedef int64_t             __int64;
+typedef uint64_t            ULONG64;
+typedef uint64_t            ULONGLONG;
+typedef uint32_t            ULONG;
+typedef uint32_t            DWORD;
+typedef DWORD              *LPDWORD;
+typedef int32_t             LONG;
+typedef int                 BOOL;
+typedef uint8_t             BYTE;
+typedef void               *HANDLE;
+typedef void               *LPVOID;
+typedef const wchar_t      *LPCWSTR;
+typedef uint8_t            *PUCHAR;
+typedef SIZE_T             *PSIZE_T;
+
+#define TRUE                1
+#define FALSE               0
+
+#define INVALID_HANDLE_VALUE    ((HANDLE)(intptr_t)-1)
+
+#define min(a,b)            ((a) < (b) ? (a) : (b))
+#define max(a,b)            ((a) > (b) ? (a) : (b))
+
+#define ZeroMemory(p,n)     memset((p), 0, (n))
+#define FIELD_OFFSET(t,f)   offsetof(t, f)
+#define _countof(a)         (sizeof(a) / sizeof((a)[0]))
+#define _rotl64(v,n)        (((v) << (n)) | ((v) >> (64 - (n))))
+
+#define NTSYSAPI
+#define NTAPI
+#define DbgPrint(...)
+
+#define MAX_PATH            260
+#define GENERIC_READ        0x80000000
+#define GENERIC_WRITE       0x40000000
+#define FILE_SHARE_READ     1
+#define CREATE_NEW          1
+#define OPEN_EXISTING       3
+
+#define FILE_FLAG_NO_BUFFERING      0
+#define FILE_FLAG_WRITE_THROUGH     0
+#define FILE_FLAG_OVERLAPPED        0
+
+#define FILE_SUPPORTS_SPARSE_FILES  0x00000040
+#define FILE_ATTRIBUTE_SPARSE_FILE  0x00000200
+
+#define ERROR_SUCCESS       0
+#define ERROR_INVALID_FUNCTION 1
+#define ERROR_HANDLE_EOF    38
+#define ERROR_MORE_DATA     234
+#define ERROR_IO_PENDING    997
+
+#define MEM_COMMIT          0x1000
+#define MEM_RESERVE         0x2000
+#define MEM_RELEASE         0x8000
+#define PAGE_READWRITE      0x04
+#define HEAP_NO_SERIALIZE   0x01
+
+#define COMPRESSION_FORMAT_XPRESS   0x0003
+#define COMPRESSION_ENGINE_STANDARD 0x0000
+
+enum { FSCTL_SET_SPARSE = 1, FSCTL_SET_ZERO_DATA, FSCTL_QUERY_ALLOCATED_RANGES };
+
+union LARGE_INTEGER {
+    struct { DWORD LowPart; LONG HighPart; };
+    long long QuadPart;
+};
+
+struct DEVICE_DATA_SET_RANGE { long long StartingOffset; ULONGLONG LengthInBytes; };
+struct FILE_ZERO_DATA_INFORMATION { LARGE_INTEGER FileOffset, BeyondFinalZero; };
+struct FILE_ALLOCATED_RANGE_BUFFER { LARGE_INTEGER FileOffset, Length; };
+struct BY_HANDLE_FILE_INFORMATION { DWORD dwFileAttributes; };
+struct OVERLAPPED { DWORD Offset, OffsetHigh; HANDLE hEvent; };
+struct CRITICAL_SECTION { std::mutex *m; };
+struct MEMORYSTATUSEX { DWORD dwLength; ULONG64 ullAvailPageFile; };
+
+
+//---------------------------------------------------------------------------
+// Image File Model
+//---------------------------------------------------------------------------
+
+
+#define HOST_CLUSTER        4096ull
+
+
+struct HOST_FILE
+{
+    std::vector<BYTE> data;             // the file length is data.size()
+    std::set<ULONG64> clusters;         // clusters taking space on the volume
+    bool sparse = false;
+    bool exists = false;
+    bool sparse_volume = true;          // volume supports sparse files
+    bool fail_zero = false;             // FSCTL_SET_ZERO_DATA fails
+    int reads = 0;
+    int writes = 0;
+};
+
+
+extern HOST_FILE *Host_File;            // the one file CreateFile opens
+
+extern thread_local DWORD Host_LastError;
+
+
+//---------------------------------------------------------------------------
+// Memory Model
+//---------------------------------------------------------------------------
+
+
+struct HOST_HEAP
+{
+    std::set<void *> blocks;
+};
+
+
+extern ULONG64 Host_AvailPageFile;      // what GlobalMemoryStatusEx reports
+
+extern size_t Host_VirtualBlocks;       // from NtAllocateVirtualMemory
+
+
+//---------------------------------------------------------------------------
+// Runtime
+//---------------------------------------------------------------------------
+
+
+inline void InitializeCriticalSection(CRITICAL_SECTION *c) { c->m = new std::mutex; }
+inline void DeleteCriticalSection(CRITICAL_SECTION *c) { delete c->m; }
+inline void EnterCriticalSection(CRITICAL_SECTION *c) { c->m->lock(); }
+inline void LeaveCriticalSection(CRITICAL_SECTION *c) { c->m->unlock(); }
+
+inline void *VirtualAlloc(void *, size_t n, DWORD, DWORD) { return calloc(1, n); }
+inline BOOL VirtualFree(void *p, size_t, DWORD) { free(p); return TRUE; }
+
+inline DWORD GetLastError() { return Host_LastError; }
+inline void SetLastError(DWORD e) { Host_LastError = e; }
+
+inline HANDLE CreateEvent(void *, BOOL, BOOL, void *) { return (HANDLE)1; }
+inline BOOL CloseHandle(HANDLE) { return TRUE; }
+
+
+inline HANDLE CreateFile(LPCWSTR, DWORD, DWORD, void *, DWORD disp, DWORD, void *)
+{
+    if (disp == OPEN_EXISTING && ! Host_File->exists) {
+        Host_LastError = 2; // ERROR_FILE_NOT_FOUND
+        return INVALID_HANDLE_VALUE;
+    }
+    Host_File->exists = true;
+    return (HANDLE)Host_File;
+}
+
+
+inline BOOL GetFileSizeEx(HANDLE, LARGE_INTEGER *size)
+{
+    size->QuadPart = Host_File->data.size();
+    return TRUE;
+}
+
+
+inline DWORD GetCompressedFileSize(LPCWSTR, LPDWORD high)
+{
+    ULONG64 size = Host_File->clusters.size() * HOST_CLUSTER;
+    *high = (DWORD)(size >> 32);
+    return (DWORD)size;
+}
+
+
+inline BOOL GetVolumeInformation(LPCWSTR, void *, DWORD, void *, void *, DWORD *flags, void *, DWORD)
+{
+    *flags = Host_File->sparse_volume ? FILE_SUPPORTS_SPARSE_FILES : 0;
+    return TRUE;
+}
+
+
+inline BOOL GetFileInformationByHandle(HANDLE, BY_HANDLE_FILE_INFORMATION *info)
+{
+    info->dwFileAttributes = Host_File->sparse ? FILE_ATTRIBUTE_SPARSE_FILE : 0;
+    return TRUE;
+}
+
+
+//
+// transfers complete right away, GetOverlappedResult reports the byte
+// count kept in OffsetHigh, a NULL event marks a read at the end of file
+//
+
+inline BOOL ReadFile(HANDLE, void *buf, DWORD len, DWORD *, OVERLAPPED *ov)
+{
+    ULONG64 pos = ov->Offset | ((ULONG64)ov->OffsetHigh << 32);
+    Host_File->reads++;
+
+    if (pos >= Host_File->data.size()) {
+        ov->hEvent = NULL;
+        Host_LastError = ERROR_HANDLE_EOF;
+        return FALSE;
+    }
+
+    DWORD count = (DWORD)min((ULONG64)len, Host_File->data.size() - pos);
+    memcpy(buf, &Host_File->data[pos], count);
+    ov->OffsetHigh = count;
+    return TRUE;
+}
+
+
+inline BOOL WriteFile(HANDLE, const void *buf, DWORD len, DWORD *, OVERLAPPED *ov)
+{
+    ULONG64 pos = ov->Offset | ((ULONG64)ov->OffsetHigh << 32);
+    ULONG64 i;
+    Host_File->writes++;
+
+    if (Host_File->data.size() < pos + len) {
+        // a file which is not sparse allocates everything it grows by
+        if (! Host_File->sparse) {
+            for (i = Host_File->data.size() / HOST_CLUSTER; i < (pos + len + HOST_CLUSTER - 1) / HOST_CLUSTER; i++)
+                Host_File->clusters.insert(i);
+        }
+        Host_File->data.resize(pos + len);
+    }
+
+    memcpy(&Host_File->data[pos], buf, len);
+    for (i = pos / HOST_CLUSTER; i < (pos + len + HOST_CLUSTER - 1) / HOST_CLUSTER; i++)
+        Host_File->clusters.insert(i);
+    ov->OffsetHigh = len;
+    return TRUE;
+}
+
+
+inline BOOL GetOverlappedResult(HANDLE, OVERLAPPED *ov, DWORD *count, BOOL)
+{
+    if (! ov->hEvent) {
+        *count = 0;
+        Host_LastError = ERROR_HANDLE_EOF;
+        return FALSE;
+    }
+    *count = ov->OffsetHigh;
+    return TRUE;
+}
+
+
+inline BOOL DeviceIoControl(HANDLE, DWORD code, void *in, DWORD, void *out, DWORD out_len, DWORD *returned, OVERLAPPED *)
+{
+    if (code == FSCTL_SET_SPARSE) {
+        Host_File->sparse = true;
+        return TRUE;
+    }
+
+    if (code == FSCTL_SET_ZERO_DATA) {
+
+        if (Host_File->fail_zero) {
+            Host_LastError = ERROR_INVALID_FUNCTION;
+            return FALSE;
+        }
+
+        //
+        // zeroes the range, a sparse file releases the clusters it covers
+        //
+
+        FILE_ZERO_DATA_INFORMATION *zero = (FILE_ZERO_DATA_INFORMATION *)in;
+        ULONG64 start = zero->FileOffset.QuadPart;
+        ULONG64 end = min((ULONG64)zero->BeyondFinalZero.QuadPart, (ULONG64)Host_File->data.size());
+        if (start < end)
+            memset(&Host_File->data[start], 0, end - start);
+        if (Host_File->sparse) {
+            for (ULONG64 i = (start + HOST_CLUSTER - 1) / HOST_CLUSTER; i < end / HOST_CLUSTER; i++)
+                Host_File->clusters.erase(i);
+        }
+        return TRUE;
+    }
+
+    if (code == FSCTL_QUERY_ALLOCATED_RANGES) {
+
+        if (! Host_File->sparse_volume) {
+            Host_LastError = ERROR_INVALID_FUNCTION;
+            return FALSE;
+        }
+
+        FILE_ALLOCATED_RANGE_BUFFER *query = (FILE_ALLOCATED_RANGE_BUFFER *)in;
+        FILE_ALLOCATED_RANGE_BUFFER *ranges = (FILE_ALLOCATED_RANGE_BUFFER *)out;
+        DWORD count = 0, max_count = out_len / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        ULONG64 first = query->FileOffset.QuadPart / HOST_CLUSTER;
+        ULONG64 end = (query->FileOffset.QuadPart + query->Length.QuadPart + HOST_CLUSTER - 1) / HOST_CLUSTER;
+
+        for (auto it = Host_File->clusters.lower_bound(first); it != Host_File->clusters.end() && *it < end; ++it) {
+
+            ULONG64 pos = *it * HOST_CLUSTER;
+            if (count && (ULONG64)(ranges[count - 1].FileOffset.QuadPart + ranges[count - 1].Length.QuadPart) == pos) {
+                ranges[count - 1].Length.QuadPart += HOST_CLUSTER;
+                continue;
+            }
+            if (count == max_count) {
+                *returned = count * sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+                Host_LastError = ERROR_MORE_DATA;
+                return FALSE;
+            }
+            ranges[count].FileOffset.QuadPart = pos;
+            ranges[count].Length.QuadPart = HOST_CLUSTER;
+            count++;
+        }
+
+        *returned = count * sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+        return TRUE;
+    }
+
+    Host_LastError = ERROR_INVALID_FUNCTION;
+    return FALSE;
+}
+
+
+//---------------------------------------------------------------------------
+// Virtual Memory and Heaps
+//---------------------------------------------------------------------------
+
+
+#define NtCurrentProcess()  ((HANDLE)(intptr_t)-1)
+
+
+inline NTSTATUS NtAllocateVirtualMemory(HANDLE, void **base, ULONG_PTR, PSIZE_T size, ULONG, ULONG)
+{
+    *base = calloc(1, *size);
+    if (! *base)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    Host_VirtualBlocks++;
+    return STATUS_SUCCESS;
+}
+
+
+inline NTSTATUS NtFreeVirtualMemory(HANDLE, void **base, PSIZE_T, ULONG)
+{
+    free(*base);
+    Host_VirtualBlocks--;
+    return STATUS_SUCCESS;
+}
+
+
+inline BOOL GlobalMemoryStatusEx(MEMORYSTATUSEX *stat)
+{
+    stat->ullAvailPageFile = Host_AvailPageFile;
+    return TRUE;
+}
+
+
+inline HANDLE HeapCreate(DWORD, SIZE_T, SIZE_T) { return new HOST_HEAP; }
+
+inline void *HeapAlloc(HANDLE heap, DWORD, SIZE_T size)
+{
+    void *p = malloc(size);
+    if (p)
+        ((HOST_HEAP *)heap)->blocks.insert(p);
+    return p;
+}
+
+inline BOOL HeapFree(HANDLE heap, DWORD, void *p)
+{
+    ((HOST_HEAP *)heap)->blocks.erase(p);
+    free(p);
+    return TRUE;
+}
+
+inline BOOL HeapDestroy(HANDLE heap)
+{
+    for (void *p : ((HOST_HEAP *)heap)->blocks)
+        free(p);
+    delete (HOST_HEAP *)heap;
+    return TRUE;
+}
+
+
+//
+// the benchmark seeds its data with the tick count, a constant one makes
+// every run write the same data
+//
+
+inline ULONG64 GetTickCount64() { return 1; }
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *freq) { freq->QuadPart = 1000000000; return TRUE; }
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER *now)
+{
+    now->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return TRUE;
+}
@@ -0,0 +1,3 @@
+//
+// empty stand-in, the ImBox sources under test use none of its helpers
+//
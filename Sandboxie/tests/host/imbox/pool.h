@@ -0,0 +1,171 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// ImBox Crypto Pool Host Stand-ins
+//
+// The Win32 threads and synchronization objects the crypto worker pool of
+// CryptoIO.cpp uses, on top of the C++ standard library, and the xts_key
+// of dc/crypto_fast/xts_fast.h with only its two procedures, so a test can
+// plug in its own cipher.  Handles are objects deleted by CloseHandle.
+//---------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+
+typedef uint32_t            DWORD;
+typedef int                 BOOL;
+typedef uint8_t             BYTE;
+typedef void               *LPVOID;
+
+#define __int64             long long   // also taken as unsigned __int64
+
+#define WINAPI
+#define _stdcall
+
+#define INFINITE            0xFFFFFFFF
+
+#define min(a,b)            ((a) < (b) ? (a) : (b))
+#define max(a,b)            ((a) > (b) ? (a) : (b))
+
+struct SYSTEM_INFO { DWORD dwNumberOfProcessors; };
+struct CRITICAL_SECTION { std::recursive_mutex *m; };
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+
+//---------------------------------------------------------------------------
+// XTS
+//---------------------------------------------------------------------------
+
+
+#define XTS_SECTOR_SIZE     512
+
+typedef void (_stdcall *xts_proc)(const unsigned char *in, unsigned char *out, size_t len, unsigned __int64 offset, void *key);
+
+typedef struct _xts_key {
+    unsigned __int64 key;
+    xts_proc encrypt;
+    xts_proc decrypt;
+} xts_key;
+
+#define xts_encrypt(_in, _out, _len, _offset, _key) ( (_key)->encrypt(_in, _out, _len, _offset, _key) )
+#define xts_decrypt(_in, _out, _len, _offset, _key) ( (_key)->decrypt(_in, _out, _len, _offset, _key) )
+
+
+//---------------------------------------------------------------------------
+// Handles
+//---------------------------------------------------------------------------
+
+
+struct HOST_OBJECT
+{
+    virtual ~HOST_OBJECT() {}
+    virtual void Wait() = 0;
+};
+
+
+//
+// a semaphore, and an event which is a semaphore of at most one, that
+// resets itself when it releases a waiter unless it is a manual reset one
+//
+
+struct HOST_SEMAPHORE : HOST_OBJECT
+{
+    HOST_SEMAPHORE(LONG count, LONG max_count, bool manual = false) : count(count), max_count(max_count), manual(manual) {}
+
+    void Release(LONG n)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        count = min(count + n, max_count);
+        cond.notify_all();
+    }
+
+    virtual void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return count > 0; });
+        if (! manual)
+            count--;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    LONG count, max_count;
+    bool manual;
+};
+
+
+struct HOST_THREAD : HOST_OBJECT
+{
+    HOST_THREAD(LPTHREAD_START_ROUTINE proc, LPVOID param) : thread(proc, param) {}
+    virtual ~HOST_THREAD() { if (thread.joinable()) thread.detach(); }
+
+    virtual void Wait() { if (thread.joinable()) thread.join(); }
+
+    std::thread thread;
+};
+
+
+//---------------------------------------------------------------------------
+// Runtime
+//---------------------------------------------------------------------------
+
+
+inline void GetSystemInfo(SYSTEM_INFO *si) { si->dwNumberOfProcessors = std::thread::hardware_concurrency(); }
+
+inline void InitializeCriticalSection(CRITICAL_SECTION *c) { c->m = new std::recursive_mutex; }
+inline void DeleteCriticalSection(CRITICAL_SECTION *c) { delete c->m; }
+inline void EnterCriticalSection(CRITICAL_SECTION *c) { c->m->lock(); }
+inline BOOL TryEnterCriticalSection(CRITICAL_SECTION *c) { return c->m->try_lock(); }
+inline void LeaveCriticalSection(CRITICAL_SECTION *c) { c->m->unlock(); }
+
+inline LONG InterlockedIncrement(volatile LONG *p) { return __sync_add_and_fetch(p, 1); }
+inline LONG InterlockedDecrement(volatile LONG *p) { return __sync_sub_and_fetch(p, 1); }
+
+inline HANDLE CreateSemaphore(void *, LONG count, LONG max_count, void *) { return new HOST_SEMAPHORE(count, max_count); }
+inline BOOL ReleaseSemaphore(HANDLE h, LONG n, LONG *) { ((HOST_SEMAPHORE *)h)->Release(n); return TRUE; }
+
+inline HANDLE CreateEvent(void *, BOOL manual, BOOL state, void *) { return new HOST_SEMAPHORE(state ? 1 : 0, 1, manual); }
+inline BOOL SetEvent(HANDLE h) { ((HOST_SEMAPHORE *)h)->Release(1); return TRUE; }
+
+inline HANDLE CreateThread(void *, size_t, LPTHREAD_START_ROUTINE proc, LPVOID param, DWORD, DWORD *) { return new HOST_THREAD(proc, param); }
+
+inline DWORD WaitForSingleObject(HANDLE h, DWORD) { ((HOST_OBJECT *)h)->Wait(); return 0; }
+
+inline DWORD WaitForMultipleObjects(DWORD n, const HANDLE *h, BOOL, DWORD)
+{
+    // waits for all, the only way the pool uses it
+    for (DWORD i = 0; i < n; i++)
+        ((HOST_OBJECT *)h[i])->Wait();
+    return 0;
+}
+
+inline BOOL CloseHandle(HANDLE h) { delete (HOST_OBJECT *)h; return TRUE; }
@@ -0,0 +1,3 @@
+//
+// empty stand-in, ImBox.h includes resource.h for the dialog ids only
+//
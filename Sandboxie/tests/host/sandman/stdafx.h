@@ -0,0 +1,225 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// SandMan Host Stand-ins
+//
+// Replaces the stdafx.h of SandMan with just enough of the Qt containers
+// and strings to build the portable helpers with a plain C++ compiler.
+// QString holds UTF-8 and toLower folds ASCII only, QHash iterates its
+// values as Qt does, and QRegularExpression only knows the one character
+// class the helpers split paths with.
+//---------------------------------------------------------------------------
+
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+//---------------------------------------------------------------------------
+// Types
+//---------------------------------------------------------------------------
+
+
+typedef uint64_t            quint64;
+typedef int64_t             qint64;
+
+namespace Qt
+{
+    enum CaseSensitivity { CaseInsensitive, CaseSensitive };
+    enum SplitBehaviorFlags { KeepEmptyParts, SkipEmptyParts };
+}
+
+#define foreach(decl, container)    for (decl : container)
+
+class QFileInfo;
+
+
+//---------------------------------------------------------------------------
+// QList
+//---------------------------------------------------------------------------
+
+
+template <class T> class QList : public std::vector<T>
+{
+public:
+    QList() {}
+    QList(std::initializer_list<T> list) : std::vector<T>(list) {}
+
+    void append(const T& value) { this->push_back(value); }
+    int count() const { return (int)this->size(); }
+    bool isEmpty() const { return this->empty(); }
+    const T& last() const { return this->back(); }
+
+    QList<T> mid(int pos, int len = -1) const
+    {
+        QList<T> list;
+        int end = (len < 0 || pos + len > count()) ? count() : pos + len;
+        for (int i = pos; i < end; i++)
+            list.append((*this)[i]);
+        return list;
+    }
+};
+
+
+//---------------------------------------------------------------------------
+// QString
+//---------------------------------------------------------------------------
+
+
+class QRegularExpression
+{
+public:
+    QRegularExpression(const char *pattern)
+    {
+        // a single character class, like "[\\\\/]"
+        for (const char *p = pattern; *p; p++) {
+            if (*p == '[' || *p == ']')
+                continue;
+            if (*p == '\\' && p[1])
+                p++;
+            m_Chars.push_back(*p);
+        }
+    }
+
+    bool matches(char c) const { return m_Chars.find(c) != std::string::npos; }
+
+protected:
+    std::string m_Chars;
+};
+
+class QStringList;
+
+class QString : public std::string
+{
+public:
+    QString() {}
+    QString(const char *str) : std::string(str) {}
+    QString(const std::string& str) : std::string(str) {}
+
+    QString toLower() const
+    {
+        QString str(*this);
+        std::transform(str.begin(), str.end(), str.begin(), [](char c) { return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c; });
+        return str;
+    }
+
+    bool isEmpty() const { return empty(); }
+
+    QStringList split(const QRegularExpression& sep, Qt::SplitBehaviorFlags behavior = Qt::KeepEmptyParts) const;
+};
+
+inline QString operator+(const QString& a, const QString& b) { return QString((const std::string&)a + (const std::string&)b); }
+inline QString operator+(const QString& a, const char *b) { return QString((const std::string&)a + b); }
+inline QString operator+(const char *a, const QString& b) { return QString(a + (const std::string&)b); }
+
+namespace std
+{
+    template <> struct hash<QString> : hash<std::string> {};
+}
+
+class QStringList : public QList<QString>
+{
+public:
+    QStringList() {}
+    QStringList(const QList<QString>& list) : QList<QString>(list) {}
+
+    QString join(const char *sep) const
+    {
+        QString str;
+        for (size_t i = 0; i < size(); i++) {
+            if (i > 0)
+                str += sep;
+            str += (*this)[i];
+        }
+        return str;
+    }
+};
+
+inline QStringList QString::split(const QRegularExpression& sep, Qt::SplitBehaviorFlags behavior) const
+{
+    QStringList list;
+    QString part;
+    for (char c : *this) {
+        if (!sep.matches(c)) {
+            part.push_back(c);
+            continue;
+        }
+        if (!part.empty() || behavior == Qt::KeepEmptyParts)
+            list.append(part);
+        part.clear();
+    }
+    if (!part.empty() || behavior == Qt::KeepEmptyParts)
+        list.append(part);
+    return list;
+}
+
+
+//---------------------------------------------------------------------------
+// QHash
+//---------------------------------------------------------------------------
+
+
+template <class K, class V> class QHash
+{
+    typedef std::unordered_map<K, V> map_t;
+
+public:
+    class const_iterator
+    {
+    public:
+        const_iterator(typename map_t::const_iterator it) : m_it(it) {}
+        const V& operator*() const { return m_it->second; }
+        const_iterator& operator++() { ++m_it; return *this; }
+        bool operator!=(const const_iterator& other) const { return m_it != other.m_it; }
+
+    protected:
+        typename map_t::const_iterator m_it;
+    };
+
+    const_iterator begin() const { return const_iterator(m_Map.begin()); }
+    const_iterator end() const { return const_iterator(m_Map.end()); }
+
+    void insert(const K& key, const V& value) { m_Map[key] = value; }
+    bool contains(const K& key) const { return m_Map.find(key) != m_Map.end(); }
+    int count() const { return (int)m_Map.size(); }
+    void clear() { m_Map.clear(); }
+
+    V value(const K& key) const
+    {
+        auto I = m_Map.find(key);
+        return I != m_Map.end() ? I->second : V();
+    }
+
+    V take(const K& key)
+    {
+        auto I = m_Map.find(key);
+        if (I == m_Map.end())
+            return V();
+        V value = I->second;
+        m_Map.erase(I);
+        return value;
+    }
+
+protected:
+    map_t m_Map;
+};
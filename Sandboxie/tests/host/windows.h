@@ -0,0 +1,6 @@
+//---------------------------------------------------------------------------
+// Host Stand-ins
+//
+// The user mode builds of the portable sources include windows.h,
+// the definitions they need come from the force included host.h
+//---------------------------------------------------------------------------
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Image File Test
+//
+// Runs random reads, writes and trims through CImageFileIO of ImBox, on
+// top of the sparse file model in host/imbox/framework.h, and compares
+// every read with a flat copy of the disk.  Covers images with and
+// without preallocated extents, on volumes with and without sparse file
+// support, and images closed and opened again in between, which rebuilds
+// the allocation map from the allocated ranges of the file.
+//
+// usage: image_file_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "framework.h"
+#include "ImBox.h"
+#include "ImageFileIO.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_DISK_SIZE      (64ull << 20)
+#define TEST_SECTOR         512
+#define TEST_GRANULE        (64ull << 10)   // IMAGE_GRANULE_SIZE
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+HOST_FILE *Host_File = nullptr;
+
+thread_local DWORD Host_LastError = 0;
+
+static std::wstring Test_Path = L"C:\\box.img";
+
+
+//---------------------------------------------------------------------------
+// Test_Random
+//---------------------------------------------------------------------------
+
+
+static ULONG64 Test_Random()
+{
+    static ULONG64 seed = 88172645463325252ull;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Open
+//---------------------------------------------------------------------------
+
+
+static CImageFileIO *Test_Open(ULONG prealloc_kb)
+{
+    CImageFileIO *io = new CImageFileIO(Test_Path, TEST_DISK_SIZE, prealloc_kb);
+    HOST_CHECK(io->Init() == ERR_OK);
+    HOST_CHECK(io->GetDiskSize() == TEST_DISK_SIZE);
+    return io;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Image
+//---------------------------------------------------------------------------
+
+
+static void Test_Image(ULONG rounds, ULONG prealloc_kb, bool sparse_volume, bool reopen)
+{
+    HOST_FILE file;
+    file.sparse_volume = sparse_volume;
+    Host_File = &file;
+
+    std::vector<BYTE> disk(TEST_DISK_SIZE);
+    std::vector<BYTE> buf(1 << 20);
+
+    CImageFileIO *io = Test_Open(prealloc_kb);
+
+    //
+    // an image opened again takes the disk size from its length, so write
+    // the last sector first, as formatting the volume does
+    //
+
+    memset(buf.data(), 0, TEST_SECTOR);
+    HOST_CHECK(io->DiskWrite(buf.data(), TEST_SECTOR, TEST_DISK_SIZE - TEST_SECTOR));
+
+    for (ULONG i = 0; i < rounds; i++) {
+
+        int op = Test_Random() % 10;
+        ULONG64 offset = (Test_Random() % (TEST_DISK_SIZE / TEST_SECTOR)) * TEST_SECTOR;
+        int size = (int)((Test_Random() % 256 + 1) * TEST_SECTOR);
+        if (offset + size > TEST_DISK_SIZE)
+            size = (int)(TEST_DISK_SIZE - offset);
+
+        if (op < 4) {
+
+            for (int j = 0; j < size; j++)
+                buf[j] = (BYTE)Test_Random();
+            HOST_CHECK(io->DiskWrite(buf.data(), size, offset));
+            memcpy(&disk[offset], buf.data(), size);
+
+        } else if (op < 9) {
+
+            HOST_CHECK(io->DiskRead(buf.data(), size, offset));
+            HOST_CHECK(memcmp(buf.data(), &disk[offset], size) == 0);
+
+        } else {
+
+            DEVICE_DATA_SET_RANGE range = { (long long)offset, (ULONGLONG)size };
+            io->TrimProcess(&range, 1);
+            memset(&disk[offset], 0, size);
+        }
+
+        if (reopen && (i % (rounds / 4 + 1)) == rounds / 4) {
+            delete io;
+            io = Test_Open(prealloc_kb);
+        }
+    }
+
+    //
+    // a sparse image takes no more space than the granules holding data
+    //
+
+    if (sparse_volume)
+        HOST_CHECK(io->GetAllocSize() <= io->GetUsedSize());
+
+    printf("prealloc %4u KB, sparse %d, reopen %d: file %6llu KB, allocated %6llu KB, used %6llu KB\n",
+           prealloc_kb, sparse_volume, reopen, (unsigned long long)file.data.size() >> 10,
+           (unsigned long long)io->GetAllocSize() >> 10, (unsigned long long)io->GetUsedSize() >> 10);
+
+    delete io;
+    Host_File = nullptr;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Fresh
+//---------------------------------------------------------------------------
+
+
+static void Test_Fresh()
+{
+    HOST_FILE file;
+    Host_File = &file;
+
+    std::vector<BYTE> buf(1 << 20, 0xA5);
+
+    //
+    // nothing was written yet, so reading the disk must not touch the file
+    //
+
+    CImageFileIO *io = Test_Open(0);
+    HOST_CHECK(io->CanBeFormated());
+    HOST_CHECK(io->DiskRead(buf.data(), (int)buf.size(), 0));
+    HOST_CHECK(file.reads == 0);
+    for (size_t i = 0; i < buf.size(); i++)
+        HOST_CHECK(buf[i] == 0);
+
+    //
+    // the file ends with the last write, the rest of the disk reads as zeros
+    //
+
+    memset(buf.data(), 0xA5, TEST_SECTOR);
+    HOST_CHECK(io->DiskWrite(buf.data(), TEST_SECTOR, TEST_GRANULE));
+    HOST_CHECK(file.data.size() == TEST_GRANULE + TEST_SECTOR);
+    HOST_CHECK(io->DiskRead(buf.data(), TEST_SECTOR * 2, TEST_GRANULE));
+    HOST_CHECK(buf[0] == 0xA5 && buf[TEST_SECTOR] == 0);
+    HOST_CHECK(! io->CanBeFormated());
+
+    printf("fresh image: ok\n");
+
+    delete io;
+    Host_File = nullptr;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Extents
+//---------------------------------------------------------------------------
+
+
+static void Test_Extents()
+{
+    HOST_FILE file;
+    Host_File = &file;
+
+    std::vector<BYTE> buf(TEST_SECTOR, 0xA5);
+
+    //
+    // a single sector written into an empty extent allocates all of it,
+    // the zero fill around the sector must not overwrite it
+    //
+
+    CImageFileIO *io = Test_Open(1000);     // rounded up to 1024 KB
+    HOST_CHECK(io->DiskWrite(buf.data(), TEST_SECTOR, (3 << 20) + TEST_SECTOR));
+    HOST_CHECK(file.data.size() == (4 << 20));
+    HOST_CHECK(io->GetAllocSize() == (1 << 20));
+    HOST_CHECK(io->GetUsedSize() == (1 << 20));
+
+    HOST_CHECK(io->DiskRead(buf.data(), TEST_SECTOR, (3 << 20) + TEST_SECTOR));
+    HOST_CHECK(buf[0] == 0xA5 && buf[TEST_SECTOR - 1] == 0xA5);
+    HOST_CHECK(file.data[(3 << 20) + TEST_SECTOR - 1] == 0 && file.data[(3 << 20) + TEST_SECTOR * 2] == 0);
+
+    printf("extents: ok\n");
+
+    delete io;
+    Host_File = nullptr;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_TrimFailed
+//---------------------------------------------------------------------------
+
+
+static void Test_TrimFailed()
+{
+    HOST_FILE file;
+    Host_File = &file;
+
+    std::vector<BYTE> buf(TEST_GRANULE * 2, 0xA5);
+
+    //
+    // the granules of a trim are unallocated before the hole is punched,
+    // when that fails they must read the data still in the file
+    //
+
+    CImageFileIO *io = Test_Open(0);
+    HOST_CHECK(io->DiskWrite(buf.data(), (int)buf.size(), 0));
+
+    DEVICE_DATA_SET_RANGE range = { 0, TEST_GRANULE * 2 };
+    file.fail_zero = true;
+    io->TrimProcess(&range, 1);
+    HOST_CHECK(io->GetUsedSize() == TEST_GRANULE * 2);
+
+    memset(buf.data(), 0, buf.size());
+    HOST_CHECK(io->DiskRead(buf.data(), (int)buf.size(), 0));
+    HOST_CHECK(buf[0] == 0xA5 && buf[buf.size() - 1] == 0xA5);
+
+    file.fail_zero = false;
+    io->TrimProcess(&range, 1);
+    HOST_CHECK(io->GetUsedSize() == 0);
+
+    printf("failed trim: ok\n");
+
+    delete io;
+    Host_File = nullptr;
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG rounds = argc > 1 ? atoi(argv[1]) : 2000;
+
+    Test_Fresh();
+    Test_Extents();
+    Test_TrimFailed();
+
+    Test_Image(rounds, 0, true, false);
+    Test_Image(rounds, 1024, true, false);
+    Test_Image(rounds, 0, true, true);
+    Test_Image(rounds, 100, true, true);
+    Test_Image(rounds, 256, false, true);
+
+    printf("ok\n");
+    return 0;
+}
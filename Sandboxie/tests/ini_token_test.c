@@ -0,0 +1,829 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Ini Tokenizer Test
+//
+// Reads random ini files through Conf_Read_File in core/drv/conf.c, which
+// decodes the whole file with Ini_Decode and splits it with Ini_Tokenize,
+// and through the line by line reader which conf.c used before, on top of
+// Stream_Read_Wchar and Conf_Read_Line.  Both must give the same status,
+// the same error line and the same sections and settings.  The files mix
+// encodings, byte order marks, CR and LF, null characters, overlong lines
+// and broken UTF-8, and the stream hands them out in chunks of any size.
+// Then reports the time to read a large configuration both ways.
+//
+// usage: ini_token_test scratch.ini [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "core/drv/conf.c"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_DATA_SIZE      (16 << 20)
+
+#define TEST_BENCH_LINES    96000
+
+
+//---------------------------------------------------------------------------
+// Functions
+//---------------------------------------------------------------------------
+
+
+static NTSTATUS Test_OldReadSections(
+    STREAM *stream, CONF_DATA *data, int *linenum);
+
+static NTSTATUS Test_OldReadSettings(
+    STREAM *stream, CONF_DATA *data, CONF_SECTION *section,
+    WCHAR *line, int *linenum);
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static const WCHAR *Test_IniPath = L"\\??\\C:\\Program Files\\Sandboxie\\Sandboxie.ini";
+
+static UCHAR Test_Data[TEST_DATA_SIZE];
+
+static ULONG Test_Len;
+
+static ULONG Test_Enc;
+
+static BOOLEAN Test_Clean;      // no lines which fail, to get past them
+
+// the valid names first, as for the characters in Test_PutText
+
+static const WCHAR *Test_Sections[] = {
+    L"GlobalSettings", L"DefaultBox", L"defaultbox", L"UserSettings_0A1B2C3D",
+    L"Template_Test", L"box_2", L"Box_2",
+    L"UserSettings_", L"Template_", L"Bad Name", L"",
+};
+
+static const WCHAR *Test_Names[] = {
+    L"Enabled", L"OpenFilePath", L"ClosedIpcPath", L"Template", L"x", L"",
+};
+
+#define TEST_COUNT(a)       (sizeof(a) / sizeof((a)[0]))
+
+#define TEST_PICK(a,bad)    (a)[Host_Random() % (TEST_COUNT(a) - (Test_Clean ? (bad) : 0))]
+
+
+//---------------------------------------------------------------------------
+// Test_OldReadSections
+//
+// Conf_Read_Sections as it was before conf.c read the whole file
+//---------------------------------------------------------------------------
+
+
+static NTSTATUS Test_OldReadSections(
+    STREAM *stream, CONF_DATA *data, int *linenum)
+{
+    const int line_len = (CONF_LINE_LEN + 2) * sizeof(WCHAR);
+    NTSTATUS status;
+    WCHAR *line;
+    WCHAR *ptr;
+    CONF_SECTION *section;
+
+    line = Mem_Alloc(data->pool, line_len);
+    if (! line)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    status = Conf_Read_Line(stream, line, linenum);
+    while (NT_SUCCESS(status)) {
+
+        if (line[0] != L'[') {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        ptr = &line[1];
+        while (*ptr && *ptr != L']')
+            ++ptr;
+        if (*ptr != L']') {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        *ptr = L'\0';
+
+        if (_wcsnicmp(&line[1], Conf_UserSettings_, 13) == 0) {
+            if (! line[14]) {
+                status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+        } else if (_wcsnicmp(&line[1], Conf_Template_, 9) == 0) {
+            if (! line[10]) {
+                status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+        } else if (! Box_IsValidName(&line[1])) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        section = map_get(&data->sections_map, &line[1]);
+
+        if (! section) {
+
+            section = Mem_Alloc(data->pool, sizeof(CONF_SECTION));
+            if (! section) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            if ((*linenum) >= CONF_TMPL_LINE_BASE)
+                section->from_template = TRUE;
+            else
+                section->from_template = FALSE;
+
+            section->name = Mem_AllocString(data->pool, &line[1]);
+            if (! section->name) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            List_Init(&section->settings);
+            List_Init(&section->layers);
+            section->layer_count = 0;
+            map_init(&section->settings_map, data->pool);
+            section->settings_map.func_key_size = NULL;
+            section->settings_map.func_match_key = &str_map_match;
+            section->settings_map.func_hash_key = &str_map_hash;
+
+            List_Insert_After(&data->sections, NULL, section);
+            if (map_insert(&data->sections_map, section->name, section, 0) == NULL) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+
+        status = Test_OldReadSettings(stream, data, section, line, linenum);
+    }
+
+    Mem_Free(line, line_len);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_OldReadSettings
+//
+// Conf_Read_Settings as it was before conf.c read the whole file
+//---------------------------------------------------------------------------
+
+
+static NTSTATUS Test_OldReadSettings(
+    STREAM *stream, CONF_DATA *data, CONF_SECTION *section,
+    WCHAR *line, int *linenum)
+{
+    NTSTATUS status;
+    WCHAR *ptr;
+    WCHAR *value;
+    CONF_SETTING *setting;
+
+    while (1) {
+
+        status = Conf_Read_Line(stream, line, linenum);
+        if (! NT_SUCCESS(status))
+            break;
+
+        if (line[0] == L'[' || line[0] == L']')
+            break;
+
+        ptr = line;
+        while (*ptr && *ptr != L'=')
+            ++ptr;
+        if ((! *ptr) || ptr == line) {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        value = &ptr[1];
+
+        while (ptr > line) {
+            --ptr;
+            if (*ptr > 32) {
+                ++ptr;
+                break;
+            }
+        }
+        *ptr = L'\0';
+
+        while (*value <= 32) {
+            if (! (*value))
+                break;
+            ++value;
+        }
+
+        if (*value == L'\0') {
+            status = STATUS_INVALID_PARAMETER;
+            break;
+        }
+
+        ptr = value + wcslen(value);
+        while (ptr > value) {
+            --ptr;
+            if (*ptr > 32) {
+                ++ptr;
+                break;
+            }
+        }
+        *ptr = L'\0';
+
+        setting = Mem_Alloc(data->pool, sizeof(CONF_SETTING));
+        if (! setting) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        if ((*linenum) >= CONF_TMPL_LINE_BASE)
+            setting->from_template = TRUE;
+        else
+            setting->from_template = FALSE;
+
+        setting->name = Mem_AllocString(data->pool, line);
+        setting->value = Mem_AllocString(data->pool, value);
+        if ((! setting->name) || (! setting->value)) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        List_Insert_After(&section->settings, NULL, setting);
+        if (map_append(&section->settings_map, setting->name, setting, 0) == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+    }
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Read
+//---------------------------------------------------------------------------
+
+
+static NTSTATUS Test_Read(CONF_DATA *data, int *linenum, BOOLEAN old)
+{
+    NTSTATUS status;
+    STREAM *stream;
+
+    memzero(data, sizeof(CONF_DATA));
+    data->pool = Pool_Create();
+    HOST_CHECK(data->pool);
+    List_Init(&data->sections);
+    map_init(&data->sections_map, data->pool);
+    data->sections_map.func_key_size = NULL;
+    data->sections_map.func_match_key = &str_map_match;
+    data->sections_map.func_hash_key = &str_map_hash;
+
+    status = Stream_Open(
+        &stream, Test_IniPath, FILE_GENERIC_READ, 0, FILE_SHARE_READ, FILE_OPEN, 0);
+    HOST_CHECK(NT_SUCCESS(status));
+
+    if (old) {
+
+        //
+        // as Conf_Read did it before
+        //
+
+        status = Stream_Read_BOM(stream, &data->encoding);
+
+        while (NT_SUCCESS(status))
+            status = Test_OldReadSections(stream, data, linenum);
+        if (status == STATUS_END_OF_FILE)
+            status = STATUS_SUCCESS;
+
+    } else
+        status = Conf_Read_File(stream, data, &data->encoding, linenum);
+
+    Stream_Close(stream);
+
+    return status;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_SameString
+//---------------------------------------------------------------------------
+
+
+static BOOLEAN Test_SameString(const WCHAR *a, const WCHAR *b)
+{
+    size_t len = wcslen(a);
+    return len == wcslen(b) && memcmp(a, b, len * sizeof(WCHAR)) == 0;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Compare
+//---------------------------------------------------------------------------
+
+
+static void Test_Compare(CONF_DATA *data1, CONF_DATA *data2)
+{
+    CONF_SECTION *section1, *section2;
+    CONF_SETTING *setting1, *setting2;
+
+    HOST_CHECK(data1->encoding == data2->encoding);
+    HOST_CHECK(data1->sections.count == data2->sections.count);
+
+    section1 = List_Head(&data1->sections);
+    section2 = List_Head(&data2->sections);
+    while (section1) {
+
+        HOST_CHECK(Test_SameString(section1->name, section2->name));
+        HOST_CHECK(section1->from_template == section2->from_template);
+        HOST_CHECK(section1->settings.count == section2->settings.count);
+        HOST_CHECK(map_get(&data2->sections_map, section1->name) == section2);
+
+        setting1 = List_Head(&section1->settings);
+        setting2 = List_Head(&section2->settings);
+        while (setting1) {
+
+            HOST_CHECK(Test_SameString(setting1->name, setting2->name));
+            HOST_CHECK(Test_SameString(setting1->value, setting2->value));
+            HOST_CHECK(setting1->from_template == setting2->from_template);
+
+            setting1 = List_Next(setting1);
+            setting2 = List_Next(setting2);
+        }
+
+        section1 = List_Next(section1);
+        section2 = List_Next(section2);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutByte
+//---------------------------------------------------------------------------
+
+
+static void Test_PutByte(ULONG b)
+{
+    if (Test_Len < TEST_DATA_SIZE)
+        Test_Data[Test_Len++] = (UCHAR)b;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutChar
+//---------------------------------------------------------------------------
+
+
+static void Test_PutChar(WCHAR ch)
+{
+    if (Test_Enc == 0) {
+        Test_PutByte(ch & 0xFF);
+        Test_PutByte(ch >> 8);
+    } else if (Test_Enc == 2) {
+        Test_PutByte(ch >> 8);
+        Test_PutByte(ch & 0xFF);
+    } else if (ch < 0x80) {
+        Test_PutByte(ch);
+    } else if (ch < 0x800) {
+        Test_PutByte(0xC0 | (ch >> 6));
+        Test_PutByte(0x80 | (ch & 0x3F));
+    } else {
+        Test_PutByte(0xE0 | (ch >> 12));
+        Test_PutByte(0x80 | ((ch >> 6) & 0x3F));
+        Test_PutByte(0x80 | (ch & 0x3F));
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutString
+//---------------------------------------------------------------------------
+
+
+static void Test_PutString(const WCHAR *s)
+{
+    while (*s)
+        Test_PutChar(*s++);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutBroken
+//---------------------------------------------------------------------------
+
+
+static void Test_PutBroken(void)
+{
+    switch (Host_Random() % (Test_Clean ? 4 : 7)) {
+
+    case 0:     // stray continuation byte
+        Test_PutByte(0x80 + Host_Random() % 0x40);
+        break;
+
+    case 1:     // not a lead byte at all
+        Test_PutByte(0xF8 + Host_Random() % 8);
+        break;
+
+    case 2:     // outside the BMP
+        Test_PutByte(0xF0);
+        Test_PutByte(0x9F);
+        Test_PutByte(0x98);
+        Test_PutByte(0x80);
+        break;
+
+    case 3:
+        //
+        // a surrogate keeps the character before it, which is only
+        // defined for the old reader after another character of the
+        // same line, so it always follows a letter
+        //
+        Test_PutByte('x');
+        Test_PutByte(0xED);
+        Test_PutByte(0xA0 + Host_Random() % 0x20);
+        Test_PutByte(0x80 + Host_Random() % 0x40);
+        break;
+
+    case 4:     // overlong null
+        Test_PutByte(0xC0);
+        Test_PutByte(0x80);
+        break;
+
+    case 5:     // lead byte which takes the next character along
+        Test_PutByte(0xC3);
+        break;
+
+    case 6:     // same with two more
+        Test_PutByte(0xE2);
+        Test_PutByte(0x82);
+        break;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutText
+//---------------------------------------------------------------------------
+
+
+static void Test_PutText(ULONG len)
+{
+    static const WCHAR odd[] = {
+        L'=', L'[', L']', L'#', L' ', L'\t', 0x01, 0x1F, 0x7F, 0xA0, 0xE9,
+        0x4E2D, 0xFE00, 0xFEFF, 0xFFFD, 0xFFFF, L'\0', L'\r',
+    };
+    ULONG i, r;
+
+    //
+    // in a clean file the text starts with a letter, and has no line
+    // breaks and null characters, which could leave a line without '='
+    //
+
+    for (i = 0; i < len; ++i) {
+
+        r = Host_Random() % 32;
+        if (r < 24 || (i == 0 && Test_Clean))
+            Test_PutChar(L'a' + (WCHAR)(Host_Random() % 26));
+        else if (r < 31 || Test_Enc != 1)
+            Test_PutChar(TEST_PICK(odd, 2));
+        else
+            Test_PutBroken();
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutBlanks
+//---------------------------------------------------------------------------
+
+
+static void Test_PutBlanks(void)
+{
+    static const WCHAR blanks[] = { L' ', L'\t', 0x01, 0x0B, 0xFE00, 0xFFFE };
+    ULONG n = Host_Random() % 4;
+
+    while (n--)
+        Test_PutChar(blanks[Host_Random() % (n ? 2 : TEST_COUNT(blanks))]);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutLine
+//---------------------------------------------------------------------------
+
+
+static void Test_PutLine(void)
+{
+    ULONG r = Host_Random() % 16;
+    ULONG n;
+
+    Test_PutBlanks();
+
+    if (r == 0) {
+
+        // blank
+
+    } else if (r == 1) {
+
+        Test_PutChar(L'#');
+        Test_PutText(Host_Random() % 20);
+
+    } else if (r <= 4) {
+
+        r = Test_Clean ? 2 + Host_Random() % 6 : Host_Random() % 8;
+        if (r != 0)
+            Test_PutChar(L'[');
+        Test_PutString(TEST_PICK(Test_Sections, 4));
+        if (r != 1)
+            Test_PutChar(L']');
+        if (r == 2)
+            Test_PutText(Host_Random() % 4);
+
+    } else if (r <= 12 || Test_Clean) {
+
+        Test_PutString(TEST_PICK(Test_Names, 1));
+        Test_PutBlanks();
+        if (Host_Random() % 16 || Test_Clean)
+            Test_PutChar(L'=');
+        Test_PutBlanks();
+        Test_PutText(Host_Random() % 24 + (Test_Clean ? 1 : 0));
+
+    } else if (r <= 14) {
+
+        Test_PutText(Host_Random() % 40);
+
+    } else {
+
+        //
+        // around the line limit, with the blanks in front
+        //
+
+        n = CONF_LINE_LEN - 6 + Host_Random() % 10;
+        Test_PutString(L"x=");
+        while (n--)
+            Test_PutChar(L'v');
+    }
+
+    Test_PutBlanks();
+}
+
+
+//---------------------------------------------------------------------------
+// Test_PutNewline
+//---------------------------------------------------------------------------
+
+
+static void Test_PutNewline(void)
+{
+    ULONG r = Host_Random() % 8;
+
+    if (r < 4) {
+        Test_PutChar(L'\r');
+        Test_PutChar(L'\n');
+    } else if (r < 6)
+        Test_PutChar(L'\n');
+    else if (r < 7)
+        Test_PutChar(L'\r');
+    else {
+        Test_PutChar(L'\n');
+        Test_PutChar(L'\r');
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeFile
+//---------------------------------------------------------------------------
+
+
+static void Test_MakeFile(void)
+{
+    ULONG i, n;
+
+    Test_Len = 0;
+    Test_Enc = Host_Random() % 3;
+    Test_Clean = (Host_Random() % 2) ? TRUE : FALSE;
+
+    if (Host_Random() % 64 == 0) {
+
+        //
+        // anything at all
+        //
+
+        n = Host_Random() % 256;
+        for (i = 0; i < n; ++i)
+            Test_PutByte(Host_Random());
+        return;
+    }
+
+    if (Host_Random() % 4) {
+        if (Test_Enc == 1) {
+            Test_PutByte(0xEF);
+            Test_PutByte(0xBB);
+            Test_PutByte(0xBF);
+        } else
+            Test_PutChar(0xFEFF);
+    }
+
+    if (Host_Random() % 256 == 0) {
+
+        //
+        // around the limit on the number of lines
+        //
+
+        n = CONF_MAX_LINES - 4 + Host_Random() % 8;
+        for (i = 0; i < n; ++i)
+            Test_PutChar(L'\n');
+    }
+
+    if (Test_Clean) {
+        Test_PutString(L"[GlobalSettings]");
+        Test_PutNewline();
+    }
+
+    n = Host_Random() % 48;
+    for (i = 0; i < n; ++i) {
+        if (Host_Random() % 2)
+            Test_PutString(L"[DefaultBox]");
+        else
+            Test_PutLine();
+        if (i + 1 < n || Host_Random() % 2)
+            Test_PutNewline();
+    }
+
+    if (Test_Enc != 1 && Host_Random() % 8 == 0)
+        Test_PutByte('x');
+}
+
+
+//---------------------------------------------------------------------------
+// Test_WriteFile
+//---------------------------------------------------------------------------
+
+
+static void Test_WriteFile(void)
+{
+    FILE *file = fopen(Host_IniPath, "wb");
+    HOST_CHECK(file);
+    HOST_CHECK(fwrite(Test_Data, 1, Test_Len, file) == Test_Len);
+    fclose(file);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Parity
+//---------------------------------------------------------------------------
+
+
+static void Test_Parity(ULONG rounds)
+{
+    CONF_DATA data1, data2;
+    NTSTATUS status1, status2;
+    int linenum1, linenum2;
+    ULONG i, failed = 0;
+
+    for (i = 0; i < rounds; i++) {
+
+        Test_MakeFile();
+        Test_WriteFile();
+
+        //
+        // the old reader took the BOM from the first chunk, which the
+        // check for a UTF-16 file without one needs 16 bytes of
+        //
+
+        Host_StreamChunk = (Host_Random() % 2) ? 16 + Host_Random() % 64 : 4064;
+
+        linenum1 = linenum2 = (Host_Random() % 2) ? 1 : 1 + CONF_TMPL_LINE_BASE;
+
+        status1 = Test_Read(&data1, &linenum1, FALSE);
+        status2 = Test_Read(&data2, &linenum2, TRUE);
+
+        HOST_CHECK(status1 == status2);
+        if (! NT_SUCCESS(status1)) {
+            HOST_CHECK(linenum1 == linenum2);
+            ++failed;
+        }
+
+        Test_Compare(&data1, &data2);
+        Test_Compare(&data2, &data1);
+
+        Pool_Delete(data1.pool);
+        Pool_Delete(data2.pool);
+        HOST_CHECK(Host_PoolBytes() == 0);
+    }
+
+    Host_StreamChunk = 4064;
+
+    printf("parity: %u files ok, %u with errors\n", rounds, failed);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Bench
+//---------------------------------------------------------------------------
+
+
+static void Test_Bench(ULONG encoding)
+{
+    static const WCHAR *names[] = {
+        L"OpenFilePath", L"ClosedFilePath", L"OpenKeyPath", L"OpenIpcPath",
+        L"ProcessGroup", L"Template",
+    };
+    WCHAR text[128];
+    CONF_DATA data;
+    double start, best[2] = { 0, 0 };
+    int linenum, lines = 0;
+    ULONG i, j;
+
+    //
+    // a configuration of TEST_BENCH_LINES lines, like a Templates.ini
+    // which has been added to for a long time
+    //
+
+    Test_Len = 0;
+    Test_Enc = encoding;
+    if (Test_Enc == 1) {
+        Test_PutByte(0xEF);
+        Test_PutByte(0xBB);
+        Test_PutByte(0xBF);
+    } else
+        Test_PutChar(0xFEFF);
+
+    for (i = 0; lines < TEST_BENCH_LINES; ++i) {
+
+        RtlStringCbPrintfW(text, sizeof(text), L"[Template_Program_%d]\r\n", i);
+        Test_PutString(text);
+        Test_PutString(L"# program settings\r\n");
+        lines += 2;
+
+        for (j = 0; j < 30 && lines < TEST_BENCH_LINES; ++j, ++lines) {
+            RtlStringCbPrintfW(text, sizeof(text), L"%s=program%d.exe,%%AppData%%\\Vendor\\Program%d\\*\r\n",
+                               names[j % (sizeof(names) / sizeof(names[0]))], i, j);
+            Test_PutString(text);
+        }
+    }
+
+    Test_WriteFile();
+
+    for (i = 0; i < 10; i++) {
+        for (j = 0; j < 2; j++) {
+
+            linenum = 1;
+            start = Host_Time();
+            HOST_CHECK(Test_Read(&data, &linenum, (BOOLEAN)j) == STATUS_SUCCESS);
+            start = Host_Time() - start;
+            if (i == 0 || start < best[j])
+                best[j] = start;
+
+            Pool_Delete(data.pool);
+        }
+    }
+
+    printf("%d lines %s: buffer %.1f ms, line by line %.1f ms\n",
+           lines, encoding == 1 ? "UTF-8" : "UTF-16", best[0] * 1e3, best[1] * 1e3);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG rounds = argc > 2 ? atoi(argv[2]) : 10000;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: ini_token_test scratch.ini [rounds]\n");
+        return 1;
+    }
+
+    Host_IniPath = argv[1];
+
+    Test_Parity(rounds);
+    Test_Bench(0);
+    Test_Bench(1);
+
+    remove(Host_IniPath);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Log Buffer Test
+//
+// Drives the monitor ring of log_buff.c with a synthetic producer and
+// reads it back through the mapped reader, checking that every entry is
+// either read intact or accounted for as dropped.  Also checks that the
+// producer keeps working when the shared view is scribbled over, as the
+// view is the only part a monitoring process can see.
+//
+// usage: log_buff_test
+//---------------------------------------------------------------------------
+
+
+#include "common/defines.h"
+#include "core/drv/log_buff.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_RING_SIZE      100
+
+
+//---------------------------------------------------------------------------
+// Test_Init
+//---------------------------------------------------------------------------
+
+
+static void Test_Init(LOG_BUFFER *ptr_buffer, SIZE_T size)
+{
+    LOG_BUFFER_VIEW *view = (LOG_BUFFER_VIEW *)malloc(LOG_BUFFER_VIEW_SIZE(size));
+    HOST_CHECK(view != NULL);
+    log_buffer_init_ex(ptr_buffer, view, size);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Push
+//---------------------------------------------------------------------------
+
+
+static void Test_Push(LOG_BUFFER *ptr_buffer, ULONG value)
+{
+    ULONG size = 4 + (value % 7) * 4;
+    ULONG i;
+
+    CHAR *write_ptr = log_buffer_push_entry(size, ptr_buffer, TRUE);
+    HOST_CHECK(write_ptr != NULL);
+    for (i = 0; i < size; i += 4)
+        log_buffer_push_bytes((CHAR *)&value, 4, &write_ptr, ptr_buffer);
+    log_buffer_commit_entry(ptr_buffer);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Reader
+//---------------------------------------------------------------------------
+
+
+static void Test_Reader(void)
+{
+    LOG_BUFFER ring;
+    LOG_BUFFER_READER reader;
+    CHAR scratch[TEST_RING_SIZE];
+    ULONG consumed = 0;
+    ULONG i;
+
+    Test_Init(&ring, TEST_RING_SIZE);
+    memset(&reader, 0, sizeof(reader));
+
+    for (i = 1; i <= 100000; i++) {
+
+        Test_Push(&ring, i);
+
+        if (i % 3) // let the producer lap the reader now and then
+            continue;
+
+        LOG_BUFFER_SIZE_T data_size;
+        CHAR *data;
+        while ((data = log_buffer_reader_next(&reader, ring.view, scratch, &data_size)) != NULL) {
+
+            ULONG value = *(ULONG *)(data + data_size - 4);
+            if (! log_buffer_reader_check(&reader, ring.view))
+                continue;
+            consumed++;
+            HOST_CHECK(value == reader.seq_number);
+            HOST_CHECK(consumed + reader.dropped == reader.seq_number);
+        }
+    }
+
+    HOST_CHECK(reader.seq_number == 99999);
+
+    printf("reader: read %u, dropped %u\n", consumed, (ULONG)reader.dropped);
+
+    free(ring.view);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Scribble
+//---------------------------------------------------------------------------
+
+
+static void Test_Scribble(void)
+{
+    LOG_BUFFER ring;
+    ULONG i, round;
+
+    Test_Init(&ring, TEST_RING_SIZE);
+
+    for (round = 0; round < 1000; round++) {
+
+        //
+        // the producer must neither read its positions back from the
+        // view nor step outside the ring on a bogus size tag
+        //
+
+        ring.view->buffer_size = Host_Random();
+        ring.view->start_pos = Host_Random();
+        ring.view->buffer_start = Host_Random();
+        ring.view->commit_pos = Host_Random();
+        ring.view->start_lock = Host_Random();
+        if (round % 5 == 0)
+            ring.view->buffer_data[Host_Random() % TEST_RING_SIZE] = (CHAR)Host_Random();
+
+        for (i = 0; i < 8; i++) {
+
+            Test_Push(&ring, round * 8 + i);
+
+            HOST_CHECK(ring.buffer_used <= ring.buffer_size);
+            HOST_CHECK(ring.buffer_start < ring.buffer_size);
+            HOST_CHECK(ring.view->commit_pos == ring.start_pos + ring.buffer_used);
+        }
+
+        while (ring.buffer_used)
+            log_buffer_pop_entry(&ring);
+
+        HOST_CHECK(ring.view->start_pos == ring.start_pos);
+        HOST_CHECK(ring.view->buffer_start == ring.buffer_start);
+        HOST_CHECK((ring.view->start_lock & 1) == 0);
+    }
+
+    printf("scribble: ok\n");
+
+    free(ring.view);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    Test_Reader();
+    Test_Scribble();
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Network Firewall Table Test
+//
+// Compiles random NetworkAccess rule sets with NetFw_CompileRules from
+// common/netfw.c, and compares NetFw_LookupTable with the rule list walk
+// of NetFw_BlockTraffic.  Rules mix match levels, protocols, port and
+// address ranges, and the queries hit the range boundaries.  Checks that
+// rule sets above the limits are not compiled, within the memory budget,
+// then reports the time per lookup both ways on a large rule set.
+//
+// usage: netfw_table_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "common/defines.h"
+#include "common/rbtree.h"
+
+struct in_addr;             // only named by netfw.h
+struct sockaddr;
+
+#include "common/netfw.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+// as in common/my_wsa.h
+
+#define IPPROTO_ICMP            1
+#define IPPROTO_TCP             6
+#define IPPROTO_UDP             17
+#define IPPROTO_ICMPV6          58
+#define IPPROTO_ANY             256
+
+
+#define TEST_QUERIES            3000
+
+#define TEST_BENCH_RULES        150         // about all which fit in NETFW_MAX_CELLS
+
+#define TEST_BENCH_LOOKUPS      1000000
+
+
+//---------------------------------------------------------------------------
+// Rule Table
+//---------------------------------------------------------------------------
+
+
+//
+// the rules, their matching and the compiled table, taken from netfw.c
+// by the Makefile, without the text helpers which need Winsock
+//
+
+#include "netfw_table.c"
+
+
+//---------------------------------------------------------------------------
+// Test_MakeIp
+//---------------------------------------------------------------------------
+
+
+static void Test_MakeIp(IP_ADDRESS *ip, ULONG v)
+{
+    //
+    // an IPv4 mapped address 10.0.x.y
+    //
+
+    memzero(ip, sizeof(IP_ADDRESS));
+    ip->Data[10] = 0xFF;
+    ip->Data[11] = 0xFF;
+    ip->Data[12] = 10;
+    ip->Data[14] = (UCHAR)(v >> 8);
+    ip->Data[15] = (UCHAR)v;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Port
+//---------------------------------------------------------------------------
+
+
+static USHORT Test_Port(void)
+{
+    ULONG r = Host_Random() % 10;
+
+    // mostly a few ports, so the rules overlap, and the ends of the range
+
+    if (r == 0)
+        return (USHORT)(65535 - Host_Random() % 3);
+    if (r == 1)
+        return (USHORT)(Host_Random() % 3);
+    return (USHORT)(Host_Random() % 60);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_MakeRules
+//---------------------------------------------------------------------------
+
+
+static void Test_MakeRules(LIST *list, POOL *pool)
+{
+    static const int levels[] = { 0, 1, 2, -1 };
+    static const int protocols[] = { IPPROTO_ANY, IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP };
+    NETFW_RULE *rule;
+    IP_ADDRESS ip1, ip2;
+    ULONG i, j, n, a, b;
+
+    List_Init(list);
+
+    n = 1 + Host_Random() % 12;
+    for (i = 0; i < n; i++) {
+
+        rule = NetFw_AllocRule(pool, levels[Host_Random() % 4]);
+        HOST_CHECK(rule);
+        NetFw_RuleSetBlockAction(rule, (BOOLEAN)(Host_Random() % 2));
+        NetFw_RuleSetProtocol(rule, protocols[Host_Random() % 4]);
+
+        //
+        // a rule without ports or addresses matches all of them
+        //
+
+        for (j = (Host_Random() % 3) ? Host_Random() % 4 : 0; j; j--) {
+            a = Test_Port();
+            b = (Host_Random() % 2) ? a : a + Host_Random() % 10;
+            if (b > 65535)
+                b = 65535;
+            NetFw_RuleAddPortRange(&rule->port_map, (USHORT)a, (USHORT)b, pool);
+        }
+
+        for (j = (Host_Random() % 3) ? Host_Random() % 4 : 0; j; j--) {
+            a = Host_Random() % 300;
+            b = (Host_Random() % 2) ? a : a + Host_Random() % 40;
+            Test_MakeIp(&ip1, a);
+            Test_MakeIp(&ip2, b);
+            if (Host_Random() % 20 == 0)
+                memset(&ip2, 0xFF, sizeof(ip2));
+            NetFw_RuleAddIpRange(&rule->ip_map, &ip1, &ip2, pool);
+        }
+
+        NetFw_AddRule(list, rule);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_FreeRules
+//---------------------------------------------------------------------------
+
+
+static void Test_FreeRules(LIST *list)
+{
+    NETFW_RULE *rule;
+
+    while ((rule = List_Head(list)) != NULL) {
+        List_Remove(list, rule);
+        NetFw_FreeRule(rule);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Parity
+//---------------------------------------------------------------------------
+
+
+static void Test_Parity(POOL *pool, ULONG rounds)
+{
+    static const int protocols[] = {
+        IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP, IPPROTO_ICMPV6, IPPROTO_ANY };
+    NETFW_TABLE *table;
+    IP_ADDRESS ip;
+    LIST list;
+    USHORT port;
+    size_t bytes;
+    int protocol;
+    ULONG i, q, blocked = 0;
+
+    for (i = 0; i < rounds; i++) {
+
+        Test_MakeRules(&list, pool);
+
+        bytes = Host_PoolBytes();
+        table = NetFw_CompileRules(&list, pool);
+        HOST_CHECK(table);
+
+        for (q = 0; q < TEST_QUERIES; q++) {
+
+            Test_MakeIp(&ip, Host_Random() % 400);
+            if (Host_Random() % 50 == 0)
+                memset(&ip, (Host_Random() % 2) ? 0xFF : 0, sizeof(ip));
+            port = Test_Port();
+            protocol = protocols[Host_Random() % 5];
+
+            HOST_CHECK(NetFw_LookupTable(table, &ip, port, protocol) ==
+                       NetFw_BlockTraffic(&list, &ip, port, protocol));
+            if (NetFw_BlockTraffic(&list, &ip, port, protocol))
+                ++blocked;
+        }
+
+        //
+        // the table must be one block, the rules keep the duplicate
+        // ranges which they could not insert until the pool goes
+        //
+
+        NetFw_FreeTable(table);
+        HOST_CHECK(Host_PoolBytes() == bytes);
+
+        Test_FreeRules(&list);
+    }
+
+    printf("parity: %u rule sets ok, %u of %u lookups blocked\n",
+           rounds, blocked, rounds * TEST_QUERIES);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Limits
+//---------------------------------------------------------------------------
+
+
+static void Test_Limits(POOL *pool)
+{
+    NETFW_RULE *rule;
+    NETFW_TABLE *table;
+    IP_ADDRESS ip;
+    LIST list;
+    size_t peak;
+    ULONG r, k;
+
+    //
+    // every rule has its own ports and addresses, over the cell limit
+    //
+
+    List_Init(&list);
+    for (r = 0; r < 400; r++) {
+        rule = NetFw_AllocRule(pool, 0);
+        NetFw_RuleSetBlockAction(rule, (BOOLEAN)(r % 2));
+        NetFw_RuleAddPortRange(&rule->port_map, (USHORT)(r * 100), (USHORT)(r * 100), pool);
+        NetFw_RuleAddPortRange(&rule->port_map, (USHORT)(50000 + r), (USHORT)(50000 + r), pool);
+        for (k = 0; k < 20; k++) {
+            Test_MakeIp(&ip, (r * 20 + k) * 3);
+            NetFw_RuleAddIpRange(&rule->ip_map, &ip, &ip, pool);
+        }
+        NetFw_AddRule(&list, rule);
+    }
+
+    Host_PoolPeak();
+    table = NetFw_CompileRules(&list, pool);
+    peak = Host_PoolPeak() - Host_PoolBytes();
+    HOST_CHECK(table == NULL);
+    printf("cell limit: not compiled, %zu KB peak\n", peak >> 10);
+    Test_FreeRules(&list);
+
+    //
+    // within the cell limit, but too many distinct rows for the budget
+    //
+
+    List_Init(&list);
+    rule = NetFw_AllocRule(pool, 1);
+    NetFw_RuleSetBlockAction(rule, TRUE);
+    for (k = 0; k < 4000; k++) {
+        Test_MakeIp(&ip, k * 3);
+        NetFw_RuleAddIpRange(&rule->ip_map, &ip, &ip, pool);
+    }
+    NetFw_AddRule(&list, rule);
+    for (r = 0; r < 60; r++) {
+        rule = NetFw_AllocRule(pool, 0);
+        NetFw_RuleAddPortRange(&rule->port_map, (USHORT)(1000 + r * 2), (USHORT)(1000 + r * 2), pool);
+        Test_MakeIp(&ip, r * 3);
+        NetFw_RuleAddIpRange(&rule->ip_map, &ip, &ip, pool);
+        NetFw_AddRule(&list, rule);
+    }
+
+    Host_PoolPeak();
+    table = NetFw_CompileRules(&list, pool);
+    peak = Host_PoolPeak() - Host_PoolBytes();
+    HOST_CHECK(table == NULL);
+    HOST_CHECK(peak <= 3 * NETFW_MAX_BYTES);
+    printf("byte budget: not compiled, %zu KB peak\n", peak >> 10);
+    Test_FreeRules(&list);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Bench
+//---------------------------------------------------------------------------
+
+
+static void Test_Bench(POOL *pool)
+{
+    NETFW_RULE *rule;
+    NETFW_TABLE *table;
+    IP_ADDRESS ip;
+    LIST list;
+    USHORT port;
+    size_t bytes;
+    double start, compile, walk, lookup;
+    ULONG r, k, i, blocked[2] = { 0, 0 };
+
+    //
+    // rules with a port and 10 addresses each, a quarter UDP only
+    //
+
+    List_Init(&list);
+    for (r = 0; r < TEST_BENCH_RULES; r++) {
+        rule = NetFw_AllocRule(pool, r % 3);
+        NetFw_RuleSetBlockAction(rule, (BOOLEAN)(r % 2));
+        NetFw_RuleSetProtocol(rule, r % 4 == 0 ? IPPROTO_UDP : IPPROTO_ANY);
+        port = (USHORT)(Host_Random() % 60000);
+        NetFw_RuleAddPortRange(&rule->port_map, port, (USHORT)(port + Host_Random() % 3), pool);
+        for (k = 0; k < 10; k++) {
+            Test_MakeIp(&ip, Host_Random() % 60000);
+            NetFw_RuleAddIpRange(&rule->ip_map, &ip, &ip, pool);
+        }
+        NetFw_AddRule(&list, rule);
+    }
+
+    bytes = Host_PoolBytes();
+    start = Host_Time();
+    table = NetFw_CompileRules(&list, pool);
+    compile = Host_Time() - start;
+    HOST_CHECK(table);
+    bytes = Host_PoolBytes() - bytes;
+
+    start = Host_Time();
+    for (i = 0; i < TEST_BENCH_LOOKUPS; i++) {
+        Test_MakeIp(&ip, i % 60000);
+        blocked[0] += NetFw_BlockTraffic(&list, &ip, (USHORT)(i % 60000), IPPROTO_UDP);
+    }
+    walk = Host_Time() - start;
+
+    start = Host_Time();
+    for (i = 0; i < TEST_BENCH_LOOKUPS; i++) {
+        Test_MakeIp(&ip, i % 60000);
+        blocked[1] += NetFw_LookupTable(table, &ip, (USHORT)(i % 60000), IPPROTO_UDP);
+    }
+    lookup = Host_Time() - start;
+
+    HOST_CHECK(blocked[0] == blocked[1]);
+
+    printf("%u rules: compile %.2f ms, table %zu KB, list %.1f ns, table %.1f ns per lookup\n",
+           TEST_BENCH_RULES, compile * 1e3, bytes >> 10,
+           walk * 1e9 / TEST_BENCH_LOOKUPS, lookup * 1e9 / TEST_BENCH_LOOKUPS);
+
+    NetFw_FreeTable(table);
+    Test_FreeRules(&list);
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    POOL *pool = Pool_Create();
+
+    Test_Parity(pool, rounds);
+    Test_Limits(pool);
+    Test_Bench(pool);
+
+    Pool_Delete(pool);
+
+    printf("ok\n");
+    return 0;
+}
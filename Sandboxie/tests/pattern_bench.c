@@ -0,0 +1,421 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Pattern Index Benchmark
+//
+// Loads the file path rules of all templates in Templates.ini, replays a
+// path corpus derived from them through Pattern_MatchPathList with and
+// without Pattern_CreateIndex, checks that both give the same result and
+// reports the time per lookup.  Also checks that an index is no longer
+// used once its list was modified.
+//
+// usage: pattern_bench [Templates.ini] [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "common/defines.h"
+#include "common/list.h"
+#include "common/pattern.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define BENCH_MAX_LINE      1024
+#define BENCH_MAX_PATH      512
+#define BENCH_MAX_VARS      256
+#define BENCH_MAX_PATHS     20000
+
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+
+typedef struct BENCH_VAR {
+    WCHAR name[64];
+    WCHAR value[BENCH_MAX_PATH];
+} BENCH_VAR;
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static const char *Bench_Settings[] = {
+    "NormalFilePath", "OpenFilePath", "ClosedFilePath",
+    "ReadFilePath", "WriteFilePath", NULL
+};
+
+static BENCH_VAR Bench_Vars[BENCH_MAX_VARS] = {
+    { L"appdata",           L"\\device\\harddiskvolume3\\users\\user\\appdata\\roaming" },
+    { L"local appdata",     L"\\device\\harddiskvolume3\\users\\user\\appdata\\local" },
+    { L"programfiles",      L"\\device\\harddiskvolume3\\program files" },
+    { L"programfiles(x86)", L"\\device\\harddiskvolume3\\program files (x86)" },
+    { L"programdata",       L"\\device\\harddiskvolume3\\programdata" },
+    { L"systemroot",        L"\\device\\harddiskvolume3\\windows" },
+    { L"windir",            L"\\device\\harddiskvolume3\\windows" },
+    { L"userprofile",       L"\\device\\harddiskvolume3\\users\\user" },
+    { L"personal",          L"\\device\\harddiskvolume3\\users\\user\\documents" },
+    { L"desktop",           L"\\device\\harddiskvolume3\\users\\user\\desktop" },
+    { L"favorites",         L"\\device\\harddiskvolume3\\users\\user\\favorites" },
+    { L"temp",              L"\\device\\harddiskvolume3\\users\\user\\appdata\\local\\temp" },
+};
+
+static ULONG Bench_NumVars = 12;
+
+static WCHAR *Bench_Paths[BENCH_MAX_PATHS];
+
+static ULONG Bench_NumPaths = 0;
+
+static volatile int Bench_Sink;     // keeps the matches of Bench_Run
+
+
+//---------------------------------------------------------------------------
+// Bench_Expand
+//---------------------------------------------------------------------------
+
+
+static void Bench_Expand(const WCHAR *src, WCHAR *dst)
+{
+    WCHAR *out = dst;
+    ULONG i;
+
+    while (*src && out - dst < BENCH_MAX_PATH - 1) {
+
+        const WCHAR *end = (*src == L'%') ? wcschr(src + 1, L'%') : NULL;
+        if (! end) {
+            *out++ = (WCHAR)towlower(*src++);
+            continue;
+        }
+
+        for (i = 0; i < Bench_NumVars; ++i) {
+            if (wcslen(Bench_Vars[i].name) == (size_t)(end - src - 1) &&
+                    _wcsnicmp(Bench_Vars[i].name, src + 1, end - src - 1) == 0)
+                break;
+        }
+
+        *out = L'\0';
+        if (i < Bench_NumVars)
+            Bench_Expand(Bench_Vars[i].value, out);
+        else
+            wcscpy(out, L"\\device\\harddiskvolume3\\unknown");
+        out += wcslen(out);
+
+        src = end + 1;
+    }
+
+    *out = L'\0';
+}
+
+
+//---------------------------------------------------------------------------
+// Bench_Load
+//---------------------------------------------------------------------------
+
+
+static ULONG Bench_Load(const char *path, LIST *list, LIST *indexed)
+{
+    char line[BENCH_MAX_LINE];
+    WCHAR value[BENCH_MAX_LINE], expanded[BENCH_MAX_PATH];
+    ULONG count = 0;
+    int pass;
+
+    FILE *file = fopen(path, "r");
+    if (! file)
+        return 0;
+
+    //
+    // first pass collects the Tmpl.* variables, second pass the rules
+    //
+
+    for (pass = 0; pass < 2; ++pass) {
+
+        rewind(file);
+
+        while (fgets(line, sizeof(line), file)) {
+
+            char *eq = strchr(line, '=');
+            char *nl = strpbrk(line, "\r\n");
+            const WCHAR *ptr, *bs;
+            int i;
+
+            if (nl)
+                *nl = '\0';
+            if (! eq)
+                continue;
+            *eq = '\0';
+
+            mbstowcs(value, eq + 1, BENCH_MAX_LINE - 1);
+            value[BENCH_MAX_LINE - 1] = L'\0';
+
+            if (pass == 0) {
+
+                if (strncmp(line, "Tmpl.", 5) == 0 &&
+                        Bench_NumVars < BENCH_MAX_VARS) {
+
+                    BENCH_VAR *var = &Bench_Vars[Bench_NumVars++];
+                    mbstowcs(var->name, line, 63);
+                    var->name[63] = L'\0';
+                    wcsncpy(var->value, value, BENCH_MAX_PATH - 1);
+                }
+                continue;
+            }
+
+            for (i = 0; Bench_Settings[i]; ++i) {
+                if (strcmp(line, Bench_Settings[i]) == 0)
+                    break;
+            }
+            if (! Bench_Settings[i])
+                continue;
+
+            //
+            // drop the process name of rules like program.exe,path
+            //
+
+            ptr = wcschr(value, L',');
+            bs = wcschr(value, L'\\');
+            if (ptr && (! bs || ptr < bs))
+                ++ptr;
+            else
+                ptr = value;
+
+            Bench_Expand(ptr, expanded);
+            if (! *expanded)
+                continue;
+
+            List_Insert_After(list, NULL, Pattern_Create(NULL, expanded, TRUE, 0));
+            List_Insert_After(indexed, NULL, Pattern_Create(NULL, expanded, TRUE, 0));
+            ++count;
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+
+//---------------------------------------------------------------------------
+// Bench_AddPath
+//---------------------------------------------------------------------------
+
+
+static void Bench_AddPath(const WCHAR *source)
+{
+    static const WCHAR *Segments[] = {
+        L"", L"a", L"cache", L"user data\\default", L"profile.ini",
+        L"x\\y\\z.dat", L"mozilla", L"temp\\~tmp01",
+    };
+    WCHAR path[BENCH_MAX_PATH];
+    WCHAR *out = path;
+
+    if (Bench_NumPaths >= BENCH_MAX_PATHS)
+        return;
+
+    while (*source && out - path < BENCH_MAX_PATH - 64) {
+
+        if (*source == L'*') {
+            const WCHAR *seg = Segments[Host_Random() % 8];
+            wcscpy(out, seg);
+            out += wcslen(seg);
+        } else if (*source == L'?')
+            *out++ = L'a' + Host_Random() % 26;
+        else
+            *out++ = *source;
+        ++source;
+    }
+
+    //
+    // most lookups are for something below the rule
+    //
+
+    if (Host_Random() % 2) {
+        wcscpy(out, L"\\file.txt");
+        out += wcslen(out);
+    }
+
+    *out = L'\0';
+
+    Bench_Paths[Bench_NumPaths] = (WCHAR *)malloc((out - path + 2) * sizeof(WCHAR));
+    wcscpy(Bench_Paths[Bench_NumPaths], path);
+    ++Bench_NumPaths;
+}
+
+
+//---------------------------------------------------------------------------
+// Bench_Corpus
+//---------------------------------------------------------------------------
+
+
+static void Bench_Corpus(LIST *list)
+{
+    static const WCHAR *Misses[] = {
+        L"\\device\\harddiskvolume3\\windows\\system32\\kernel32.dll",
+        L"\\device\\harddiskvolume3\\windows\\system32\\drivers\\etc\\hosts",
+        L"\\device\\harddiskvolume3\\users\\user\\documents\\report.docx",
+        L"\\device\\harddiskvolume3\\program files\\app\\app.exe",
+        L"\\device\\harddiskvolume1\\boot\\bcd",
+        L"\\device\\namedpipe\\lsass",
+    };
+    PATTERN *pat;
+    ULONG i;
+
+    for (pat = List_Head(list); pat; pat = List_Next(pat))
+        Bench_AddPath(Pattern_Source(pat));
+
+    for (i = 0; i < Bench_NumPaths / 4; ++i)
+        Bench_AddPath(Misses[Host_Random() % 6]);
+}
+
+
+//---------------------------------------------------------------------------
+// Bench_Compare
+//---------------------------------------------------------------------------
+
+
+static void Bench_Compare(LIST *list, LIST *indexed)
+{
+    ULONG i;
+
+    for (i = 0; i < Bench_NumPaths; ++i) {
+
+        WCHAR *path = Bench_Paths[i];
+        ULONG len = (ULONG)wcslen(path);
+        ULONG l1 = i % 4, l2 = l1, f1 = i % 2, f2 = f1;
+        USHORT w1 = -1, w2 = -1;
+        PATTERN *p1 = NULL, *p2 = NULL;
+        int m1, m2;
+
+        m1 = Pattern_MatchPathList(path, len, list, &l1, &f1, &w1, &p1);
+        m2 = Pattern_MatchPathList(path, len, indexed, &l2, &f2, &w2, &p2);
+
+        if (m1 != m2 || l1 != l2 || f1 != f2 || w1 != w2 || (! p1) != (! p2) ||
+                (p1 && wcscmp(Pattern_Source(p1), Pattern_Source(p2)) != 0)) {
+
+            fprintf(stderr, "mismatch for %ls: %d/%d\n", path, m1, m2);
+            exit(1);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Bench_Run
+//---------------------------------------------------------------------------
+
+
+static double Bench_Run(LIST *list, ULONG rounds)
+{
+    double start = Host_Time();
+    ULONG r, i;
+    int sum = 0;
+
+    for (r = 0; r < rounds; ++r) {
+        for (i = 0; i < Bench_NumPaths; ++i) {
+            ULONG level = -1, flags = 0;
+            USHORT wildc = -1;
+            sum += Pattern_MatchPathList(Bench_Paths[i], (ULONG)wcslen(Bench_Paths[i]),
+                                         list, &level, &flags, &wildc, NULL);
+        }
+    }
+
+    Bench_Sink = sum;
+
+    return (Host_Time() - start) * 1e9 / ((double)rounds * Bench_NumPaths);
+}
+
+
+//---------------------------------------------------------------------------
+// Bench_Modify
+//---------------------------------------------------------------------------
+
+
+static void Bench_Modify(LIST *list, const WCHAR *source)
+{
+    PATTERN *pat = List_Head(list);
+    PATTERN *prev;
+    int i;
+
+    //
+    // replace a pattern in the middle, so head, tail and count stay the same
+    //
+
+    for (i = 0; i < List_Count(list) / 2; ++i)
+        pat = List_Next(pat);
+
+    prev = List_Prev(pat);
+    List_Remove(list, pat);
+    Pattern_Free(pat);
+
+    List_Insert_After(list, prev, Pattern_Create(NULL, source, TRUE, 0));
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    const char *ini = argc > 1 ? argv[1] : "../install/Templates.ini";
+    ULONG rounds = argc > 2 ? atoi(argv[2]) : 20;
+    LIST list, indexed;
+    ULONG count;
+    double linear, index;
+
+    List_Init(&list);
+    List_Init(&indexed);
+
+    count = Bench_Load(ini, &list, &indexed);
+    if (! count) {
+        fprintf(stderr, "no rules loaded from %s\n", ini);
+        return 1;
+    }
+
+    Pattern_CreateIndex(NULL, &indexed);
+
+    Bench_Corpus(&list);
+    Bench_Compare(&list, &indexed);
+
+    linear = Bench_Run(&list, rounds);
+    index = Bench_Run(&indexed, rounds);
+
+    printf("%u rules, %u paths, linear %.0f ns, indexed %.0f ns per lookup (%.1fx)\n",
+           count, Bench_NumPaths, linear, index, linear / index);
+
+    //
+    // a stale index must not be used, the removed pattern is gone
+    // and the new one is only found by a full scan
+    //
+
+    Bench_Modify(&list, L"\\device\\harddiskvolume3\\stale\\*");
+    Bench_Modify(&indexed, L"\\device\\harddiskvolume3\\stale\\*");
+
+    Bench_AddPath(L"\\device\\harddiskvolume3\\stale\\*");
+    Bench_Compare(&list, &indexed);
+
+    Pattern_CreateIndex(NULL, &indexed);
+    Bench_Compare(&list, &indexed);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,403 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Port Transfer Test
+//
+// Runs requests and replies of random length through both ends of
+// common/portxfer.c, connected by PortXfer_InitLoopback, in chunks only,
+// through the shared view, and from a client which does not use the view
+// of the service.  Checks that a failing handler runs once and its reply
+// arrives whole.  Then feeds random chunks and random view contents to
+// the service end, and reports the time per call for a long message.
+//
+// usage: portxfer_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "common/defines.h"
+#include "common/portxfer.h"
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_CHUNK          (MAX_PORTMSG_LENGTH - 40)   // MSG_DATA_LEN on 64 bit
+#define TEST_MSGID          0x1234
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static UCHAR Test_View[PORT_XFER_VIEW_SIZE];
+
+static LONG Test_Allocs = 0;
+
+static ULONG Test_ReplyLength = 0;
+
+static ULONG Test_Calls = 0;
+
+static ULONG Test_ReplyMsgId = 0;
+
+static const ULONG Test_Lengths[] = {
+    8, 16, 17, TEST_CHUNK - 1, TEST_CHUNK, TEST_CHUNK + 1, 1000, 65536,
+    PORT_XFER_VIEW_SIZE, PORT_XFER_VIEW_SIZE + 1, 700000
+};
+
+
+//---------------------------------------------------------------------------
+// Test_Alloc
+//---------------------------------------------------------------------------
+
+
+static void *Test_Alloc(PORT_XFER *xfer, ULONG len)
+{
+    ++Test_Allocs;
+    return malloc(len);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Free
+//---------------------------------------------------------------------------
+
+
+static void Test_Free(PORT_XFER *xfer, void *ptr)
+{
+    --Test_Allocs;
+    free(ptr);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Length
+//---------------------------------------------------------------------------
+
+
+static ULONG Test_Length(void)
+{
+    if (Host_Random() % 2)
+        return Test_Lengths[Host_Random() % (sizeof(Test_Lengths) / sizeof(ULONG))];
+    return 8 + Host_Random() % 600000;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Byte
+//---------------------------------------------------------------------------
+
+
+static UCHAR Test_Byte(const UCHAR *req, ULONG i)
+{
+    ULONG req_len = ((ULONG *)req)[0];
+    return (UCHAR)((req_len > 8 ? req[8 + i % (req_len - 8)] : 0x5A) ^ i);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Handler
+//---------------------------------------------------------------------------
+
+
+static void *Test_Handler(void *context, void *msg)
+{
+    ULONG *req = (ULONG *)msg;
+    UCHAR *rpl;
+    ULONG i;
+
+    HOST_CHECK(req[1] == TEST_MSGID);
+    ++Test_Calls;
+
+    rpl = (UCHAR *)Test_Alloc(NULL, Test_ReplyLength);
+    for (i = 8; i < Test_ReplyLength; i++)
+        rpl[i] = Test_Byte((UCHAR *)msg, i);
+    ((ULONG *)rpl)[0] = Test_ReplyLength;
+    ((ULONG *)rpl)[1] = Test_ReplyMsgId ? Test_ReplyMsgId : req[1] ^ 0x55;
+    return rpl;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Init
+//---------------------------------------------------------------------------
+
+
+static void Test_Init(PORT_XFER *client, PORT_XFER_LOOPBACK *loop, int mode)
+{
+    //
+    // mode 0: no view, 1: shared view, 2: the service maps the view but
+    // the client does not use it, as when it could not write to it
+    //
+
+    memzero(client, sizeof(PORT_XFER));
+    client->Alloc = Test_Alloc;
+    client->Free = Test_Free;
+    client->View = (mode == 1) ? Test_View : NULL;
+    client->ViewSize = sizeof(Test_View);
+    client->MaxDataLen = TEST_CHUNK;
+
+    PortXfer_InitLoopback(client, loop, Test_Handler, loop);
+
+    if (mode == 2)
+        loop->Server.View = Test_View;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Call
+//---------------------------------------------------------------------------
+
+
+static void Test_Call(PORT_XFER *client, ULONG req_len, UCHAR sequence)
+{
+    UCHAR *req, *rpl;
+    ULONG error, rpl_len, i;
+    LONG status;
+
+    req = (UCHAR *)malloc(req_len);
+    for (i = 0; i < req_len; i++)
+        req[i] = (UCHAR)Host_Random();
+    ((ULONG *)req)[0] = req_len;
+    ((ULONG *)req)[1] = TEST_MSGID;
+
+    rpl = (UCHAR *)PortXfer_Call(client, req, sequence, &error, &status);
+    HOST_CHECK(rpl != NULL);
+
+    rpl_len = ((ULONG *)rpl)[0];
+    HOST_CHECK(rpl_len == Test_ReplyLength);
+    HOST_CHECK(((ULONG *)rpl)[1] == (Test_ReplyMsgId ? Test_ReplyMsgId : TEST_MSGID ^ 0x55));
+    for (i = 8; i < rpl_len; i++)
+        HOST_CHECK(rpl[i] == Test_Byte(req, i));
+    for (i = 0; i < 8; i++)
+        HOST_CHECK(rpl[rpl_len + i] == 0);
+
+    Test_Free(NULL, rpl);
+    free(req);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_RoundTrip
+//---------------------------------------------------------------------------
+
+
+static void Test_RoundTrip(ULONG rounds)
+{
+    PORT_XFER client;
+    PORT_XFER_LOOPBACK loop;
+    ULONG i;
+
+    for (i = 0; i < rounds; i++) {
+
+        int mode = i % 3;
+        ULONG req_len = Test_Length();
+
+        Test_Init(&client, &loop, mode);
+        Test_ReplyLength = Test_Length();
+
+        Test_Call(&client, req_len, (UCHAR)i);
+
+        if (mode == 1)
+            HOST_CHECK(client.View == Test_View);
+
+        HOST_CHECK(! loop.State.buf && ! loop.State.replying);
+    }
+
+    HOST_CHECK(Test_Allocs == 0);
+
+    printf("round trip: %u calls ok\n", rounds);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Failure
+//---------------------------------------------------------------------------
+
+
+static void Test_Failure(void)
+{
+    PORT_XFER client;
+    PORT_XFER_LOOPBACK loop;
+    int mode;
+
+    //
+    // a handler which fails with STATUS_INVALID_SYSTEM_SERVICE, as for an
+    // unknown sub-server, and replies with more than one chunk.  the call
+    // must run the handler once, keep the view, and get the whole reply
+    //
+
+    Test_ReplyMsgId = 0xC000001C;
+    Test_ReplyLength = TEST_CHUNK * 3;
+
+    for (mode = 0; mode < 3; mode++) {
+
+        Test_Init(&client, &loop, mode);
+        Test_Calls = 0;
+
+        Test_Call(&client, 8, (UCHAR)mode);
+        Test_Call(&client, TEST_CHUNK * 2, (UCHAR)mode + 1);
+
+        HOST_CHECK(Test_Calls == 2);
+        HOST_CHECK(client.View == ((mode == 1) ? Test_View : NULL));
+        HOST_CHECK(! loop.State.buf && ! loop.State.replying);
+    }
+
+    Test_ReplyMsgId = 0;
+
+    HOST_CHECK(Test_Allocs == 0);
+
+    printf("failure: ok\n");
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Garbage
+//---------------------------------------------------------------------------
+
+
+static void Test_Garbage(ULONG rounds)
+{
+    PORT_XFER server;
+    PORT_XFER_STATE state;
+    UCHAR chunk[MAX_PORTMSG_LENGTH];
+    UCHAR reply[MAX_PORTMSG_LENGTH];
+    ULONG i, j, len, reply_len;
+
+    //
+    // the client controls every chunk and the view, the service must
+    // fail such requests without reading or writing out of bounds
+    //
+
+    memzero(&server, sizeof(server));
+    server.Alloc = Test_Alloc;
+    server.Free = Test_Free;
+    server.View = Test_View;
+    server.ViewSize = sizeof(Test_View);
+    server.MaxDataLen = TEST_CHUNK;
+
+    memzero(&state, sizeof(state));
+
+    for (i = 0; i < rounds; i++) {
+
+        len = Host_Random() % (TEST_CHUNK + 1);
+        for (j = 0; j < len; j++)
+            chunk[j] = (UCHAR)Host_Random();
+
+        if (len >= sizeof(PORT_XFER_BELL) && (i % 4) == 0) {
+
+            PORT_XFER_BELL *bell = (PORT_XFER_BELL *)chunk;
+            bell->length = sizeof(PORT_XFER_BELL);
+            bell->msgid = PORT_XFER_MSGID_VIEW;
+            bell->magic = PORT_XFER_MAGIC;
+            bell->view_length = Test_Length();
+            len = sizeof(PORT_XFER_BELL);
+
+            ((ULONG *)Test_View)[0] = (i % 8) ? bell->view_length : Host_Random();
+            ((ULONG *)Test_View)[1] = Host_Random() % 2;
+
+        } else if (len >= 8 && (i % 4) == 1)
+            ((ULONG *)chunk)[0] = Host_Random() % 4096;
+
+        if (PortXfer_Receive(&server, &state, chunk, len)) {
+
+            if (state.buf) {
+                HOST_CHECK(((ULONG *)state.buf)[0] == (ULONG)(state.ptr - state.buf));
+                PortXfer_SetReply(&server, &state, NULL);
+            }
+
+            do {
+                PortXfer_Send(&server, &state, reply, &reply_len);
+                HOST_CHECK(reply_len <= TEST_CHUNK);
+            } while (state.replying);
+        }
+    }
+
+    PortXfer_Reset(&server, &state);
+
+    HOST_CHECK(Test_Allocs == 0);
+
+    printf("garbage: %u chunks ok\n", rounds);
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Bench
+//---------------------------------------------------------------------------
+
+
+static double Test_Bench(int mode, ULONG length, ULONG calls)
+{
+    PORT_XFER client;
+    PORT_XFER_LOOPBACK loop;
+    UCHAR *req;
+    void *rpl;
+    ULONG error, i;
+    LONG status;
+    double start;
+
+    Test_Init(&client, &loop, mode);
+    Test_ReplyLength = 64;
+
+    req = (UCHAR *)calloc(1, length);
+    ((ULONG *)req)[0] = length;
+    ((ULONG *)req)[1] = TEST_MSGID;
+
+    start = Host_Time();
+    for (i = 0; i < calls; i++) {
+        rpl = PortXfer_Call(&client, req, (UCHAR)i, &error, &status);
+        HOST_CHECK(rpl != NULL);
+        Test_Free(NULL, rpl);
+    }
+    start = (Host_Time() - start) * 1e6 / calls;
+
+    free(req);
+    return start;
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG rounds = argc > 1 ? atoi(argv[1]) : 1000;
+    double chunks, view;
+
+    Test_RoundTrip(rounds);
+    Test_Failure();
+    Test_Garbage(rounds * 20);
+
+    //
+    // the loopback has no port, so this only shows the cost of the
+    // framing, each chunk is a round trip through the kernel on Windows
+    //
+
+    chunks = Test_Bench(0, 65536, 2000);
+    view = Test_Bench(1, 65536, 2000);
+
+    printf("64 KB request: chunks %.1f us (%u exchanges), view %.1f us (1 exchange)\n",
+           chunks, (65536 + TEST_CHUNK - 1) / TEST_CHUNK, view);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,563 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// RAM Disk Test
+//
+// Runs random reads, writes and trims through CVirtualMemoryIO of ImBox,
+// plain and in block store mode, and compares every read with a flat copy
+// of the disk.  The data mixes zeroes, text, blocks written many times and
+// random bytes, so blocks get compressed, shared and released.  Checks the
+// used and allocated sizes, that shared blocks are stored once and freed
+// with their last user, and that writes fail when memory runs low.  Then
+// runs the "ImBox bench_ram" benchmark.
+//
+// XPRESS of ntdll is replaced by a small LZ77 coder, the memory savings of
+// the benchmark are those of that coder, not of XPRESS.
+//
+// usage: ram_disk_test [rounds]
+//---------------------------------------------------------------------------
+
+
+#include "framework.h"
+#include "ImBox.h"
+#include "ImDiskIO.h"
+#include "VirtualMemoryIO.h"
+
+#include <stdarg.h>
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_DISK_SIZE      (64ull << 20)
+#define TEST_SECTOR         512
+#define TEST_BLOCK          4096            // the block size of the store
+#define TEST_TEMPLATES      8
+
+#define TEST_LZ_HASH        4096            // entries of the match table
+#define TEST_LZ_MIN         4
+#define TEST_LZ_MAX         (TEST_LZ_MIN + 127)
+
+#define STATUS_BUFFER_TOO_SMALL     ((NTSTATUS)0xC0000023L)
+#define STATUS_BAD_COMPRESSION_BUFFER ((NTSTATUS)0xC0000242L)
+#define STATUS_NOT_SUPPORTED        ((NTSTATUS)0xC00000BBL)
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+HOST_FILE *Host_File = nullptr;
+
+thread_local DWORD Host_LastError = 0;
+
+ULONG64 Host_AvailPageFile = 1ull << 40;
+
+size_t Host_VirtualBlocks = 0;
+
+static bool Test_Compression = true;
+
+static bool Test_Mismatch = false;
+
+static std::vector<BYTE> Test_Templates[TEST_TEMPLATES];
+
+
+//---------------------------------------------------------------------------
+// data_search
+//---------------------------------------------------------------------------
+
+
+static bool Test_DataSearch(void *ptr, int size)
+{
+    for (int i = 0; i < size; i++) {
+        if (((BYTE *)ptr)[i])
+            return true;
+    }
+    return false;
+}
+
+bool (*data_search)(void *ptr, int size) = Test_DataSearch;
+
+
+//---------------------------------------------------------------------------
+// RtlGetCompressionWorkSpaceSize
+//---------------------------------------------------------------------------
+
+
+//
+// the stand-in coder writes a control byte below 128 for a run of that
+// many plus one literals, which follow, or 128 and up for a match of
+// TEST_LZ_MIN and more bytes, followed by the distance in two bytes
+//
+
+extern "C" NTSTATUS RtlGetCompressionWorkSpaceSize(USHORT, PULONG work_size, PULONG frag_size)
+{
+    if (! Test_Compression)
+        return STATUS_NOT_SUPPORTED;
+    *work_size = TEST_LZ_HASH * sizeof(int);
+    *frag_size = 0;
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// RtlCompressBuffer
+//---------------------------------------------------------------------------
+
+
+extern "C" NTSTATUS RtlCompressBuffer(USHORT, PUCHAR in, ULONG in_size, PUCHAR out, ULONG out_size, ULONG, PULONG final_size, PVOID work_space)
+{
+    int *table = (int *)work_space;
+    for (int i = 0; i < TEST_LZ_HASH; i++)
+        table[i] = -1;
+
+    ULONG pos = 0, lit = 0, len = 0;
+
+    auto flush = [&](ULONG end) {
+        while (lit < end) {
+            ULONG n = min(end - lit, 128u);
+            if (len + 1 + n > out_size)
+                return false;
+            out[len++] = (BYTE)(n - 1);
+            memcpy(out + len, in + lit, n);
+            len += n;
+            lit += n;
+        }
+        return true;
+    };
+
+    while (pos + TEST_LZ_MIN <= in_size) {
+
+        ULONG v;
+        memcpy(&v, in + pos, 4);
+        ULONG h = (v * 2654435761u) >> 20;
+        int cand = table[h];
+        table[h] = (int)pos;
+
+        if (cand < 0 || pos - cand > 0xFFFF || memcmp(in + cand, in + pos, TEST_LZ_MIN) != 0) {
+            pos++;
+            continue;
+        }
+
+        ULONG n = TEST_LZ_MIN;
+        while (n < TEST_LZ_MAX && pos + n < in_size && in[cand + n] == in[pos + n])
+            n++;
+
+        if (! flush(pos) || len + 3 > out_size)
+            return STATUS_BUFFER_TOO_SMALL;
+        out[len++] = (BYTE)(128 + n - TEST_LZ_MIN);
+        out[len++] = (BYTE)(pos - cand);
+        out[len++] = (BYTE)((pos - cand) >> 8);
+        pos += n;
+        lit = pos;
+    }
+
+    if (! flush(in_size))
+        return STATUS_BUFFER_TOO_SMALL;
+
+    *final_size = len;
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// RtlDecompressBuffer
+//---------------------------------------------------------------------------
+
+
+extern "C" NTSTATUS RtlDecompressBuffer(USHORT, PUCHAR out, ULONG out_size, PUCHAR in, ULONG in_size, PULONG final_size)
+{
+    ULONG pos = 0, len = 0;
+
+    while (pos < in_size) {
+        BYTE c = in[pos++];
+        if (c < 128) {
+            ULONG n = c + 1;
+            if (pos + n > in_size || len + n > out_size)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            memcpy(out + len, in + pos, n);
+            pos += n;
+            len += n;
+        } else {
+            ULONG n = c - 128 + TEST_LZ_MIN;
+            if (pos + 2 > in_size)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            ULONG dist = in[pos] | (in[pos + 1] << 8);
+            pos += 2;
+            if (dist == 0 || dist > len || len + n > out_size)
+                return STATUS_BAD_COMPRESSION_BUFFER;
+            for (ULONG i = 0; i < n; i++, len++)
+                out[len] = out[len - dist];
+        }
+    }
+
+    *final_size = len;
+    return STATUS_SUCCESS;
+}
+
+
+//---------------------------------------------------------------------------
+// BenchOutput
+//---------------------------------------------------------------------------
+
+
+HANDLE BenchOutput()
+{
+    return NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// BenchPrint
+//---------------------------------------------------------------------------
+
+
+void BenchPrint(HANDLE, const wchar_t *format, ...)
+{
+    //
+    // the format is written for the Microsoft CRT, %s takes a wide string
+    // there and %I64u a 64 bit number, both are spelled out for glibc
+    //
+
+    std::wstring fmt;
+    for (const wchar_t *p = format; *p; p++) {
+        fmt += *p;
+        if (*p != L'%')
+            continue;
+        if (p[1] == L'%') {
+            fmt += *++p;
+            continue;
+        }
+        while (p[1] && wcschr(L"-+ #0123456789.", p[1]))
+            fmt += *++p;
+        if (wcsncmp(p + 1, L"I64", 3) == 0) {
+            fmt += L"ll";
+            p += 3;
+        }
+        if (p[1] == L's')
+            fmt += L'l';
+    }
+
+    va_list va_args;
+    va_start(va_args, format);
+    wchar_t text[256];
+    vswprintf(text, 256, fmt.c_str(), va_args);
+    va_end(va_args);
+
+    printf("%ls", text);
+    if (wcsstr(text, L"MISMATCH"))
+        Test_Mismatch = true;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Random
+//---------------------------------------------------------------------------
+
+
+static ULONG64 Test_Random()
+{
+    static ULONG64 seed = 88172645463325252ull;
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Fill
+//---------------------------------------------------------------------------
+
+
+static void Test_Fill(BYTE *buf, int size, ULONG64 offset)
+{
+    static const char *Words[] = { "static ", "return ", "void ", "if (", ") {\r\n", "}\r\n", "DiskRead", "size", ";\r\n", "\t" };
+
+    int kind = Test_Random() % 5;
+
+    if (kind == 0) {
+
+        memset(buf, 0, size);
+
+    } else if (kind == 1) {
+
+        for (int i = 0; i < size; ) {
+            const char *word = Words[Test_Random() % _countof(Words)];
+            for (; *word && i < size; word++)
+                buf[i++] = *word;
+        }
+
+    } else if (kind == 2) {
+
+        //
+        // whole blocks of a few fixed contents, for the store to share,
+        // taken at the offset of the disk so they line up with its blocks
+        //
+
+        for (int i = 0; i < size; i++) {
+            ULONG64 pos = offset + i;
+            buf[i] = Test_Templates[(pos / TEST_BLOCK) % TEST_TEMPLATES][pos % TEST_BLOCK];
+        }
+
+    } else {
+
+        for (int i = 0; i < size; i++)
+            buf[i] = (BYTE)Test_Random();
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Test_UsedSize
+//---------------------------------------------------------------------------
+
+
+static ULONG64 Test_UsedSize(const std::vector<BYTE> &disk, ULONG64 block)
+{
+    // a block is held while it has any data, all zero blocks are released
+
+    ULONG64 used = 0;
+    for (ULONG64 pos = 0; pos < disk.size(); pos += block) {
+        if (Test_DataSearch((void *)&disk[pos], (int)block))
+            used += block;
+    }
+    return used;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Disk
+//---------------------------------------------------------------------------
+
+
+static void Test_Disk(ULONG rounds, bool store)
+{
+    ULONG64 block = store ? TEST_BLOCK : (1ull << 20);
+
+    std::vector<BYTE> disk(TEST_DISK_SIZE);
+    std::vector<BYTE> buf(256 * TEST_SECTOR);
+
+    CVirtualMemoryIO *io = new CVirtualMemoryIO(TEST_DISK_SIZE, store ? 12 : 20, store);
+    HOST_CHECK(io->Init() == ERR_OK);
+    HOST_CHECK(io->GetDiskSize() == TEST_DISK_SIZE);
+
+    for (ULONG i = 0; i < rounds; i++) {
+
+        int op = Test_Random() % 10;
+        ULONG64 offset = (Test_Random() % (TEST_DISK_SIZE / TEST_SECTOR)) * TEST_SECTOR;
+        int size = (int)((Test_Random() % 256 + 1) * TEST_SECTOR);
+        if (offset + size > TEST_DISK_SIZE)
+            size = (int)(TEST_DISK_SIZE - offset);
+
+        if (op < 4) {
+
+            Test_Fill(buf.data(), size, offset);
+            memcpy(&disk[offset], buf.data(), size);
+            HOST_CHECK(io->DiskWrite(buf.data(), size, offset));
+
+        } else if (op < 9) {
+
+            HOST_CHECK(io->DiskRead(buf.data(), size, offset));
+            HOST_CHECK(memcmp(buf.data(), &disk[offset], size) == 0);
+
+        } else {
+
+            DEVICE_DATA_SET_RANGE range = { (long long)offset, (ULONGLONG)size };
+            io->TrimProcess(&range, 1);
+            memset(&disk[offset], 0, size);
+        }
+
+        if (i % 256 == 0 || i == rounds - 1) {
+            HOST_CHECK(io->GetUsedSize() == Test_UsedSize(disk, block));
+            if (! store)
+                HOST_CHECK(io->GetAllocSize() == io->GetUsedSize());
+        }
+    }
+
+    //
+    // trimming all of the disk releases every block, the store keeps only
+    // its scratch blocks and the work space of the coder
+    //
+
+    DEVICE_DATA_SET_RANGE range = { 0, TEST_DISK_SIZE };
+    io->TrimProcess(&range, 1);
+    HOST_CHECK(io->GetUsedSize() == 0);
+    HOST_CHECK(io->GetAllocSize() == 0);
+    HOST_CHECK(Host_VirtualBlocks == 1);    // the block table
+
+    HOST_CHECK(io->DiskRead(buf.data(), (int)buf.size(), 0));
+    HOST_CHECK(! Test_DataSearch(buf.data(), (int)buf.size()));
+
+    // the table is left to the end of the process, as it was before
+
+    delete io;
+    Host_VirtualBlocks = 0;
+
+    printf("%s%s: ok\n", store ? "block store" : "plain", store && ! Test_Compression ? " without compression" : "");
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Shared
+//---------------------------------------------------------------------------
+
+
+static void Test_Shared()
+{
+    CVirtualMemoryIO io(TEST_DISK_SIZE, 12, true);
+    HOST_CHECK(io.Init() == ERR_OK);
+
+    std::vector<BYTE> rand(TEST_BLOCK), text(TEST_BLOCK), buf(TEST_BLOCK);
+    for (int i = 0; i < TEST_BLOCK; i++)
+        rand[i] = (BYTE)Test_Random();
+    for (int i = 0; i < TEST_BLOCK; i++)
+        text[i] = "static void DiskRead(size);\r\n"[i % 29];
+
+    //
+    // random data is kept as it is and stored once for all its copies
+    //
+
+    for (int i = 0; i < 1000; i++)
+        HOST_CHECK(io.DiskWrite(rand.data(), TEST_BLOCK, (ULONG64)i * TEST_BLOCK));
+    HOST_CHECK(io.GetUsedSize() == 1000 * TEST_BLOCK);
+    ULONG64 one = io.GetAllocSize();
+    HOST_CHECK(one >= TEST_BLOCK && one < TEST_BLOCK + 64);
+
+    //
+    // text shrinks, and is shared through its compressed form
+    //
+
+    for (int i = 0; i < 500; i++)
+        HOST_CHECK(io.DiskWrite(text.data(), TEST_BLOCK, (ULONG64)i * 2 * TEST_BLOCK));
+    HOST_CHECK(io.GetUsedSize() == 1000 * TEST_BLOCK);
+    ULONG64 two = io.GetAllocSize();
+    HOST_CHECK(two > one && two - one < TEST_BLOCK / 2);
+
+    HOST_CHECK(io.DiskRead(buf.data(), TEST_BLOCK, 998 * TEST_BLOCK));
+    HOST_CHECK(memcmp(buf.data(), text.data(), TEST_BLOCK) == 0);
+    HOST_CHECK(io.DiskRead(buf.data(), TEST_BLOCK, 999 * TEST_BLOCK));
+    HOST_CHECK(memcmp(buf.data(), rand.data(), TEST_BLOCK) == 0);
+
+    //
+    // a partial write makes a block of its own, the shared one stays
+    //
+
+    HOST_CHECK(io.DiskWrite(text.data(), TEST_SECTOR, 1 * TEST_BLOCK + TEST_SECTOR));
+    HOST_CHECK(io.GetAllocSize() > two);
+    HOST_CHECK(io.DiskRead(buf.data(), TEST_BLOCK, 3 * TEST_BLOCK));
+    HOST_CHECK(memcmp(buf.data(), rand.data(), TEST_BLOCK) == 0);
+
+    DEVICE_DATA_SET_RANGE range = { 1 * TEST_BLOCK, TEST_BLOCK };
+    io.TrimProcess(&range, 1);
+    HOST_CHECK(io.GetAllocSize() == two);
+
+    //
+    // the shared block goes with its last user
+    //
+
+    for (int i = 1; i < 1000; i += 2) {
+        DEVICE_DATA_SET_RANGE range = { (long long)i * TEST_BLOCK, TEST_BLOCK };
+        io.TrimProcess(&range, 1);
+        HOST_CHECK(io.GetAllocSize() == (i == 999 ? two - one : two));
+    }
+
+    memset(buf.data(), 0, TEST_BLOCK);
+    for (int i = 0; i < 1000; i += 2)
+        HOST_CHECK(io.DiskWrite(buf.data(), TEST_BLOCK, (ULONG64)i * TEST_BLOCK));
+    HOST_CHECK(io.GetUsedSize() == 0);
+    HOST_CHECK(io.GetAllocSize() == 0);
+
+    Host_VirtualBlocks = 0;
+    printf("shared blocks: ok\n");
+}
+
+
+//---------------------------------------------------------------------------
+// Test_LowMemory
+//---------------------------------------------------------------------------
+
+
+static void Test_LowMemory()
+{
+    std::vector<BYTE> data(TEST_BLOCK, 0x5A), other(TEST_BLOCK, 0xA5), buf(TEST_BLOCK);
+
+    for (int store = 0; store < 2; store++) {
+
+        CVirtualMemoryIO io(TEST_DISK_SIZE, store ? 12 : 20, !!store);
+        HOST_CHECK(io.Init() == ERR_OK);
+        HOST_CHECK(io.DiskWrite(data.data(), TEST_BLOCK, 0));
+
+        //
+        // new content is refused, content already held can still be
+        // written again, and as in the store it is shared, at any place
+        //
+
+        Host_AvailPageFile = MINIMAL_MEM - 1;
+
+        HOST_CHECK(! io.DiskWrite(other.data(), TEST_BLOCK, 16ull << 20));
+        HOST_CHECK(io.DiskRead(buf.data(), TEST_BLOCK, 16ull << 20));
+        HOST_CHECK(! Test_DataSearch(buf.data(), TEST_BLOCK));
+
+        HOST_CHECK(io.DiskWrite(data.data(), TEST_SECTOR, TEST_SECTOR));
+        if (store)
+            HOST_CHECK(io.DiskWrite(data.data(), TEST_BLOCK, 32ull << 20));
+
+        Host_AvailPageFile = 1ull << 40;
+
+        HOST_CHECK(io.DiskWrite(other.data(), TEST_BLOCK, 16ull << 20));
+        Host_VirtualBlocks = 0;
+    }
+
+    printf("low memory: ok\n");
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    ULONG rounds = argc > 1 ? atoi(argv[1]) : 5000;
+
+    for (int i = 0; i < TEST_TEMPLATES; i++) {
+        Test_Templates[i].resize(TEST_BLOCK);
+        for (int j = 0; j < TEST_BLOCK; j++)
+            Test_Templates[i][j] = (BYTE)(i & 1 ? Test_Random() : "DiskWrite(buf, size);\r\n"[j % 23] + i);
+    }
+
+    Test_Shared();
+    Test_LowMemory();
+
+    Test_Disk(rounds, false);
+    Test_Disk(rounds, true);
+    Test_Compression = false;
+    Test_Disk(rounds, true);
+    Test_Compression = true;
+
+    HOST_CHECK(CVirtualMemoryIO::Benchmark() == ERR_OK);
+    HOST_CHECK(! Test_Mismatch);
+
+    printf("ok\n");
+    return 0;
+}
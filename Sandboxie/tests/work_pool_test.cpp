@@ -0,0 +1,260 @@
+/*
+ * Copyright 2025 David Xanatos, xanasoft.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+//---------------------------------------------------------------------------
+// Work Pool Test
+//
+// Runs synthetic handlers through the WorkPool of SbieSvc, submitted from
+// several threads over classes with different limits, some of which
+// submit follow-up items from within the pool.  Checks that every item
+// runs exactly once, that no class exceeds its limit, that the pool grows
+// while busy and shrinks back once idle, and that the class statistics
+// add up.  Also meant to be run under -fsanitize=thread.
+//
+// usage: work_pool_test
+//---------------------------------------------------------------------------
+
+
+#include "core/svc/WorkPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+
+//---------------------------------------------------------------------------
+// Defines
+//---------------------------------------------------------------------------
+
+
+#define TEST_CLASSES        3
+#define TEST_SUBMITTERS     4
+#define TEST_ITEMS          600     // per submitter
+#define TEST_FOLLOW_UP      5       // every 5th item submits one more
+
+
+//---------------------------------------------------------------------------
+// Structures
+//---------------------------------------------------------------------------
+
+
+struct TEST_CLASS
+{
+    uint32_t index;
+    uint32_t limit;
+    std::atomic<uint32_t> running;
+    std::atomic<uint32_t> peak;
+    std::atomic<uint64_t> count;
+};
+
+
+struct TEST_ITEM
+{
+    TEST_CLASS *cls;
+    uint32_t id;
+    bool follow_up;
+};
+
+
+//---------------------------------------------------------------------------
+// Variables
+//---------------------------------------------------------------------------
+
+
+static WorkPool *Test_Pool = nullptr;
+
+static TEST_CLASS Test_Classes[TEST_CLASSES];
+
+static std::atomic<uint32_t> Test_Runs[TEST_SUBMITTERS * TEST_ITEMS * 2];
+
+static std::atomic<uint32_t> Test_NextId(0);
+
+static std::atomic<uint32_t> Test_PeakThreads(0);
+
+
+//---------------------------------------------------------------------------
+// Test_Handler
+//---------------------------------------------------------------------------
+
+
+static void Test_Handler(void *context, void *param)
+{
+    TEST_ITEM *item = (TEST_ITEM *)param;
+    TEST_CLASS *cls = item->cls;
+
+    uint32_t running = ++cls->running;
+    if (cls->limit)
+        HOST_CHECK(running <= cls->limit);
+
+    uint32_t peak = cls->peak;
+    while (running > peak && ! cls->peak.compare_exchange_weak(peak, running))
+        ;
+
+    //
+    // a handler either blocks for a while, like a process start,
+    // or returns right away, like most requests
+    //
+
+    if (item->id % 3 == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(200 + item->id % 800));
+
+    //
+    // sampled from within the pool, as it may shrink again before
+    // the submitters are done
+    //
+
+    uint32_t threads = Test_Pool->GetThreadCount();
+    uint32_t peak_threads = Test_PeakThreads;
+    while (threads > peak_threads && ! Test_PeakThreads.compare_exchange_weak(peak_threads, threads))
+        ;
+
+    ++Test_Runs[item->id];
+
+    if (item->follow_up) {
+
+        TEST_ITEM *next = new TEST_ITEM;
+        next->cls = &Test_Classes[(cls->index + 1) % TEST_CLASSES];
+        next->id = Test_NextId++;
+        next->follow_up = false;
+        HOST_CHECK(Test_Pool->Submit(next->cls->index, Test_Handler, context, next));
+    }
+
+    --cls->running;
+    ++cls->count;
+
+    delete item;
+}
+
+
+//---------------------------------------------------------------------------
+// Test_Submitter
+//---------------------------------------------------------------------------
+
+
+static void Test_Submitter(uint32_t n)
+{
+    for (uint32_t i = 0; i < TEST_ITEMS; ++i) {
+
+        TEST_ITEM *item = new TEST_ITEM;
+        item->cls = &Test_Classes[(n + i) % TEST_CLASSES];
+        item->id = Test_NextId++;
+        item->follow_up = (i % TEST_FOLLOW_UP) == 0;
+        HOST_CHECK(Test_Pool->Submit(item->cls->index, Test_Handler, nullptr, item));
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// main
+//---------------------------------------------------------------------------
+
+
+int main(int argc, char *argv[])
+{
+    static const uint32_t limits[TEST_CLASSES] = { 2, 1, 0 };
+    uint32_t i;
+
+    Test_Pool = new WorkPool(2, 16, 50);
+
+    for (i = 0; i < TEST_CLASSES; ++i) {
+        Test_Classes[i].index = Test_Pool->AddClass(limits[i]);
+        Test_Classes[i].limit = limits[i];
+        Test_Classes[i].running = 0;
+        Test_Classes[i].peak = 0;
+        Test_Classes[i].count = 0;
+        HOST_CHECK(Test_Classes[i].index == i);
+    }
+
+    HOST_CHECK(! Test_Pool->Submit(0, Test_Handler, nullptr, nullptr));
+    HOST_CHECK(Test_Pool->Start());
+    HOST_CHECK(! Test_Pool->Submit(TEST_CLASSES, Test_Handler, nullptr, nullptr));
+
+    std::vector<std::thread> submitters;
+    for (i = 0; i < TEST_SUBMITTERS; ++i)
+        submitters.push_back(std::thread(Test_Submitter, i));
+    for (i = 0; i < TEST_SUBMITTERS; ++i)
+        submitters[i].join();
+
+    //
+    // wait for the queues to drain, then for the extra threads to
+    // notice they are idle
+    //
+
+    uint32_t total = TEST_SUBMITTERS * TEST_ITEMS
+                   + TEST_SUBMITTERS * ((TEST_ITEMS + TEST_FOLLOW_UP - 1) / TEST_FOLLOW_UP);
+
+    for (int wait = 0; wait < 3000; ++wait) {
+        uint64_t done = 0;
+        for (i = 0; i < TEST_CLASSES; ++i)
+            done += Test_Classes[i].count;
+        if (done == total && Test_Pool->GetThreadCount() == 2)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    uint32_t busy = Test_PeakThreads;
+    uint32_t idle = Test_Pool->GetThreadCount();
+
+    Test_Pool->Stop();
+
+    HOST_CHECK(Test_NextId == total);
+    for (i = 0; i < total; ++i)
+        HOST_CHECK(Test_Runs[i] == 1);
+
+    uint64_t histogram_total = 0;
+    for (i = 0; i < TEST_CLASSES; ++i) {
+
+        WorkPool::Stats stats;
+        HOST_CHECK(Test_Pool->GetStats(i, &stats));
+        HOST_CHECK(stats.count == Test_Classes[i].count);
+        HOST_CHECK(stats.running == 0 && stats.pending == 0);
+        HOST_CHECK(stats.limit == limits[i]);
+        if (limits[i])
+            HOST_CHECK(Test_Classes[i].peak <= limits[i]);
+
+        uint64_t sum = 0;
+        for (int bucket = 0; bucket < WORK_POOL_BUCKETS; ++bucket)
+            sum += stats.histogram[bucket];
+        HOST_CHECK(sum == stats.count);
+        histogram_total += sum;
+
+        printf("class %u: limit %u, peak %u, ran %llu\n", i, limits[i],
+               (uint32_t)Test_Classes[i].peak, (unsigned long long)stats.count);
+    }
+
+    HOST_CHECK(histogram_total == total);
+    HOST_CHECK(busy > 2);
+    HOST_CHECK(idle == 2);
+
+    printf("%u items, %u threads while busy, %u when idle\n", total, busy, idle);
+
+    //
+    // a stopped pool refuses new work and can be started again
+    //
+
+    HOST_CHECK(! Test_Pool->Submit(0, Test_Handler, nullptr, nullptr));
+    HOST_CHECK(Test_Pool->Start());
+    Test_Pool->Stop();
+
+    delete Test_Pool;
+
+    printf("ok\n");
+    return 0;
+}
@@ -143,6 +143,7 @@ int CArchive::Open()
 			//TRACE(L" >> File %S: %S=%S", QS2CS(File.Properties["Path"].toString()), QS2CS(GetPropertyName(j)), QS2CS(Property.toString()));
 		}
 		m_Files.append(File);
+		IndexFile(m_Files.count() - 1);
 	}
 
 	return ERR_7Z_OK; // success
@@ -162,18 +163,19 @@ bool CArchive::Extract(QString Path)
 		Path.append("/");
 
 	QMap<int, QIODevice*> Files;
+	QSet<QString> KnownDirs;
 	foreach(const SFile& File, m_Files)
 	{
 		if(File.Properties["IsDir"].toBool())
 			continue;
 
-		Files.insert(File.ArcIndex, new QFile(PrepareExtraction(File.Properties["Path"].toString(), Path)));
+		Files.insert(File.ArcIndex, new QFile(PrepareExtraction(File.Properties["Path"].toString(), Path, &KnownDirs)));
 	}
 
 	return Extract(&Files);
 }
 
-bool CArchive::Extract(QMap<int, QIODevice*> *FileList, bool bDelete)
+bool CArchive::Extract(QMap<int, QIODevice*> *FileList, bool bDelete, int iThreads)
 {
 	if(!m_Archive)
 	{
@@ -181,15 +183,22 @@ bool CArchive::Extract(QMap<int, QIODevice*> *FileList, bool bDelete)
 		return false;
 	}
 
+	// solid blocks must be decoded in one go, else every thread can work on its own instance
+	if(iThreads > 1 && !m_pDevice && FileList->count() > iThreads && !IsSolid())
+		return ExtractParallel(FileList, bDelete, iThreads);
+
 	QMap<int, CArchiveIO*> Files;
+	std::vector<UInt32> Indices; // the keys are sorted, as 7z expects them to be
+	Indices.reserve(FileList->count());
 	foreach(int ArcIndex, FileList->keys())
 	{
 		FileProperty(ArcIndex, "Error", QVariant());
 		Files.insert(ArcIndex, new CArchiveIO(FileList->value(ArcIndex), QIODevice::NotOpen, bDelete));
+		Indices.push_back(ArcIndex);
 	}
 	
 	CMyComPtr<IArchiveExtractCallback> callback(new CArchiveExtractor(this, Files));
-	if(m_Archive->In->Extract(NULL, (UInt32)(Int32)(-1), false, callback) != S_OK)
+	if(m_Archive->In->Extract(Indices.data(), (UInt32)Indices.size(), false, callback) != S_OK)
 	{
 		LogError(QString("Error(s) While extracting from archive"));
 		return false;
@@ -204,9 +213,112 @@ bool CArchive::Extract(QMap<int, QIODevice*> *FileList, bool bDelete)
 	return true;
 }
 
+bool CArchive::ExtractParallel(QMap<int, QIODevice*> *FileList, bool bDelete, int iThreads)
+{
+	foreach(int ArcIndex, FileList->keys())
+		FileProperty(ArcIndex, "Error", QVariant());
+
+	// split the list into contiguous runs of about the same size, so each worker reads the archive sequentially
+	quint64 uTotal = 0;
+	foreach(int ArcIndex, FileList->keys())
+		uTotal += FileProperty(ArcIndex, "Size").toULongLong() + 0x1000;
+	quint64 uTarget = uTotal / iThreads + 1;
+
+	QVector<QMap<int, QIODevice*>> Parts(1);
+	quint64 uPart = 0;
+	for(auto I = FileList->begin(); I != FileList->end(); ++I)
+	{
+		if(uPart >= uTarget && Parts.count() < iThreads)
+		{
+			Parts.append(QMap<int, QIODevice*>());
+			uPart = 0;
+		}
+		Parts.last().insert(I.key(), I.value());
+		uPart += FileProperty(I.key(), "Size").toULongLong() + 0x1000;
+	}
+
+	struct SWorker
+	{
+		CArchive*	pArchive = NULL;
+		QThread*	pThread = NULL;
+		bool		bOpen = false;
+		bool		bOk = false;
+	};
+	QVector<SWorker> Workers(Parts.count());
+	for(int i = 0; i < Parts.count(); i++)
+	{
+		SWorker* pWorker = &Workers[i];
+		QMap<int, QIODevice*>* pPart = &Parts[i];
+		pWorker->pArchive = new CArchive(m_ArchivePath);
+		pWorker->pArchive->SetPassword(m_Password);
+		pWorker->pArchive->SetPartList(m_AuxParts);
+		pWorker->pThread = QThread::create([pWorker, pPart, bDelete]() {
+			pWorker->bOpen = pWorker->pArchive->Open() == ERR_7Z_OK;
+			if(pWorker->bOpen)
+				pWorker->bOk = pWorker->pArchive->Extract(pPart, bDelete);
+		});
+		pWorker->pThread->start();
+	}
+
+	foreach(const SWorker& Worker, Workers)
+	{
+		while(!Worker.pThread->wait(100))
+		{
+			quint64 uSumTotal = 0;
+			quint64 uSumCompleted = 0;
+			foreach(const SWorker& Other, Workers)
+			{
+				uSumTotal += Other.pArchive->m_Progress.uTotal;
+				uSumCompleted += Other.pArchive->m_Progress.uCompleted;
+			}
+			m_Progress.SetTotal(uSumTotal);
+			m_Progress.SetCompleted(uSumCompleted);
+		}
+	}
+
+	// parts whose worker could not open the archive are extracted here
+	bool bOk = true;
+	QMap<int, QIODevice*> Retry;
+	for(int i = 0; i < Workers.count(); i++)
+	{
+		SWorker& Worker = Workers[i];
+		if(!Worker.bOpen)
+		{
+			for(auto I = Parts[i].begin(); I != Parts[i].end(); ++I)
+				Retry.insert(I.key(), I.value());
+		}
+		else
+		{
+			if(!Worker.bOk)
+				bOk = false;
+			foreach(int ArcIndex, Parts[i].keys())
+				FileProperty(ArcIndex, "Error", Worker.pArchive->FileProperty(ArcIndex, "Error"));
+		}
+		delete Worker.pThread;
+		delete Worker.pArchive;
+	}
+
+	if(!Retry.isEmpty() && !Extract(&Retry, bDelete))
+		bOk = false;
+	return bOk;
+}
+
+bool CArchive::IsSolid()
+{
+	if(!m_Archive)
+		return false;
+
+	NWindows::NCOM::CPropVariant prop;
+	if(m_Archive->In->GetArchiveProperty(kpidSolid, &prop) != S_OK || prop.vt != VT_BOOL)
+		return false;
+	return VARIANT_BOOLToBool(prop.boolVal);
+}
+
 bool CArchive::Close()
 {
 	m_Files.clear();
+	m_IndexMap.clear();
+	m_PathMap.clear();
 	if(m_Archive)
 	{
 		delete m_Archive;
@@ -342,8 +454,9 @@ int CArchive::AddFile(QString Path)
 
 	SFile File(m_Files.isEmpty() ? 0 : m_Files.last().ArcIndex+1);
 	//File.NewData = true;
+	File.Properties.insert("Path", Path);
 	m_Files.append(File);
-	FileProperty(File.ArcIndex,"Path",Path);
+	IndexFile(m_Files.count() - 1);
 	return File.ArcIndex;
 }
 
@@ -351,12 +464,7 @@ int CArchive::FindByPath(QString Path)
 {
 	if(Path.left(1) == "/")
 		Path.remove(0,1);
-	foreach(const SFile& File, m_Files)
-	{
-		if(Path.compare(File.Properties["Path"].toString().replace("\\","/")) == 0)
-			return File.ArcIndex;
-	}
-	return -1;
+	return m_PathMap.value(Path, -1);
 }
 
 int CArchive::FindByIndex(int Index)
@@ -368,23 +476,43 @@ int CArchive::FindByIndex(int Index)
 
 int CArchive::GetIndex(int ArcIndex)
 {
+	return m_IndexMap.value(ArcIndex, -1);
+}
+
+void CArchive::IndexFile(int Index)
+{
+	const SFile& File = m_Files[Index];
+
+	// like the linear search this replaces, the first entry wins on duplicates
+	int OldIndex = m_IndexMap.value(File.ArcIndex, -1);
+	if(OldIndex == -1 || OldIndex > Index)
+		m_IndexMap.insert(File.ArcIndex, Index);
+
+	QString Path = File.Properties.value("Path").toString().replace("\\","/");
+	int OldArcIndex = m_PathMap.value(Path, -1);
+	if(OldArcIndex == -1 || GetIndex(OldArcIndex) > Index)
+		m_PathMap.insert(Path, File.ArcIndex);
+}
+
+void CArchive::ReIndexFiles()
+{
+	m_IndexMap.clear();
+	m_PathMap.clear();
 	for(int Index = 0; Index < m_Files.count(); Index++)
-	{
-		const SFile& File = m_Files[Index];
-		if(File.ArcIndex == ArcIndex)
-			return Index;
-	}
-	return -1;
+		IndexFile(Index);
 }
 
 void CArchive::RemoveFile(int ArcIndex)
 {
 	int Index = GetIndex(ArcIndex);
 	if(Index != -1)
+	{
 		m_Files.remove(Index);
+		ReIndexFiles();
+	}
 }
 
-QString CArchive::PrepareExtraction(QString FileName, QString Path)
+QString CArchive::PrepareExtraction(QString FileName, QString Path, QSet<QString>* pKnownDirs)
 {
 	// Cleanup
 	FileName.replace("\\","/");
@@ -397,8 +525,12 @@ QString CArchive::PrepareExtraction(QString FileName, QString Path)
 	int Pos = FileName.lastIndexOf("/");
 	if(Pos != -1)
 		SubPath += FileName.left(Pos);
+	if(pKnownDirs && pKnownDirs->contains(SubPath))
+		return Path + FileName;
 	if(!QDir().exists(SubPath))
 		QDir().mkpath(SubPath);
+	if(pKnownDirs)
+		pKnownDirs->insert(SubPath);
 
 	return Path + FileName;
 }
@@ -437,7 +569,18 @@ void CArchive::FileProperty(int ArcIndex, QString Name, QVariant Value)
 	int Index = GetIndex(ArcIndex);
 	if(Index != -1)
 	{
-		m_Files[Index].Properties.insert(Name, Value);
+		bool bPath = Name == "Path";
+		if(bPath && m_PathMap.value(m_Files[Index].Properties.value("Path").toString().replace("\\","/"), -1) == ArcIndex)
+		{
+			m_Files[Index].Properties.insert(Name, Value);
+			ReIndexFiles(); // an older duplicate may take over the old path
+		}
+		else
+		{
+			m_Files[Index].Properties.insert(Name, Value);
+			if(bPath)
+				IndexFile(Index);
+		}
 		//m_Files[Index].NewInfo = true;
 	}
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "../mischelpers_global.h"
+#include <QHash>
+#include <QSet>
+#include <atomic>
 
 // *Note* no archiver specific includes here
 
@@ -38,7 +41,7 @@ public:
 
 	int							Open();
 	bool						Extract(QString Path = "");
-	bool						Extract(QMap<int, QIODevice*> *FileList, bool bDelete = true);
+	bool						Extract(QMap<int, QIODevice*> *FileList, bool bDelete = true, int iThreads = 1);
 	bool						Close();
 
 	bool						Update(QMap<int, QIODevice*> *FileList, bool bDelete = true, const SCompressParams* Params = NULL, QMap<int, quint32> *AttribList = NULL);
@@ -58,10 +61,15 @@ public:
 
 	void						SetPartList(const QStringList& Parts)	{m_AuxParts = Parts;}
 
-	static QString				PrepareExtraction(QString FileName, QString Path);
+	bool						IsSolid();
+
+	static QString				PrepareExtraction(QString FileName, QString Path, QSet<QString>* pKnownDirs = NULL);
 
 protected:
 	int							GetIndex(int ArcIndex);
+	void						IndexFile(int Index);
+	void						ReIndexFiles();
+	bool						ExtractParallel(QMap<int, QIODevice*> *FileList, bool bDelete, int iThreads);
 
 	QString						GetNextPart(QString FileName);
 
@@ -96,8 +104,10 @@ protected:
 		//bool		NewInfo;
 	};
 	QVector<SFile>				m_Files;
+	QHash<int, int>				m_IndexMap;	// ArcIndex -> Index in m_Files
+	QHash<QString, int>			m_PathMap;	// normalized Path -> ArcIndex
 
-	struct SProgress
+	struct SProgress	// written by the 7z callbacks, read by ExtractParallel and the UI from other threads
 	{
 		SProgress(){
 			uTotal = 0;
@@ -111,8 +121,8 @@ protected:
 			double Completed = uCompleted;
 			return (Total > 0) ? Completed/Total : 0;
 		}
-		quint64			uTotal;
-		quint64			uCompleted;
+		std::atomic<quint64> uTotal;
+		std::atomic<quint64> uCompleted;
 	}							m_Progress;
 };
 
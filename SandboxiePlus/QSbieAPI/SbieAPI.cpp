@@ -32,6 +32,7 @@ typedef long NTSTATUS;
 
 #include "..\..\Sandboxie\core\drv\api_defs.h"
 #include "..\..\Sandboxie\core\drv\api_flags.h"
+#include "..\..\Sandboxie\core\drv\log_buff.h"
 
 #include "..\..\Sandboxie\core\svc\msgids.h"
 #include "..\..\Sandboxie\core\svc\ProcessWire.h"
@@ -63,6 +64,9 @@ struct SSbieAPI
 		//lastRecordNum = 0;
 		traceBuffer = NULL;
 		traceBufferLen = 0;
+		traceRing = NULL;
+		traceRingFailed = false;
+		memset(&traceReader, 0, sizeof(traceReader));
 
 		SbieMsgDll = NULL;
 
@@ -71,6 +75,8 @@ struct SSbieAPI
 	~SSbieAPI() {
 		if (traceBuffer) 
 			free(traceBuffer);
+		if (traceRing)
+			NtUnmapViewOfSection(NtCurrentProcess(), traceRing);
 	}
 
 	NTSTATUS IoControl(ULONG64 *parms)
@@ -98,6 +104,9 @@ struct SSbieAPI
 	//ULONG lastRecordNum;
 	UCHAR* traceBuffer;
 	ULONG traceBufferLen;
+	LOG_BUFFER_VIEW* traceRing;
+	LOG_BUFFER_READER traceReader;
+	bool traceRingFailed;
 
 	HMODULE SbieMsgDll;
 
@@ -138,6 +147,9 @@ CSbieAPI::CSbieAPI(QObject* parent) : QThread(parent)
 	m_bReloadPending = false;
 	m_bBoxesDirty = false;
 
+	m_IniCacheGeneration = 0;
+	m_bIniCacheFailed = false;
+
 	connect(&m_IniWatcher, SIGNAL(fileChanged(const QString&)), this, SLOT(OnIniChanged(const QString&)));
 	connect(this, SIGNAL(ProcessBoxed(quint32, const QString&, const QString&, quint32, const QString&)), this, SLOT(OnProcessBoxed(quint32, const QString&, const QString&, quint32, const QString&)));
 }
@@ -364,6 +376,8 @@ SB_STATUS CSbieAPI::Disconnect()
 	m_BoxedProxesses.clear();
 	m_bBoxesDirty = true;
 
+	InvalidateIniCache();
+
 	emit StatusChanged();
 	return SB_OK;
 }
@@ -800,6 +814,7 @@ void CSbieAPI::OnReloadConfig()
 {
 	m_bReloadPending = false;
 	m_bBoxesDirty = true;
+	InvalidateIniCache();
 	if (m_IniReLoad) 
 		ReloadConfig(true);
 }
@@ -1183,6 +1198,7 @@ retry:
 	SScoped<MSG_HEADER> rpl;
 	SB_STATUS Status = CallServer((MSG_HEADER *)RequestBuf, &rpl);
 	SecureZeroMemory(pPasswordWithinRequestBuf, sizeof(WCHAR) * 64);
+	InvalidateIniCache(); // the service may have reloaded the driver's configuration
 	if (!Status || !rpl)
 		return Status;
 	ULONG status = rpl->status;
@@ -1276,6 +1292,37 @@ QString CSbieAPI::SbieIniGetEx(const QString& Section, const QString& Setting)
 
 QString CSbieAPI::SbieIniGet(const QString& Section, const QString& Setting, quint32 Index, qint32* ErrCode)
 {
+	//
+	// unexpanded values of a named section are served from the section cache,
+	// following the same lookup order as Conf_Get in the driver
+	//
+
+	if ((Index & (CONF_GET_NO_EXPAND | CONF_JUST_EXPAND)) == CONF_GET_NO_EXPAND && (Index & 0xFFFF) <= 1000
+	 && !Section.isEmpty() && !Setting.isEmpty() && Setting.at(0) != L'%')
+	{
+		bool bNoTemplates = (Index & CONF_GET_NO_TEMPLS) != 0;
+		bool bWithGlobal = (Index & CONF_GET_NO_GLOBAL) == 0;
+
+		SIniSectionPtr pSection = QueryIniSection(Section, bNoTemplates);
+		SIniSectionPtr pGlobal = (pSection && bWithGlobal) ? QueryIniSection("GlobalSettings", bNoTemplates) : SIniSectionPtr();
+		if (pSection && (pGlobal || !bWithGlobal))
+		{
+			QString Name = Setting.toLower();
+			int index = Index & 0xFFFF;
+
+			QStringList Values = pSection->Values.value(Name);
+			if (index >= Values.count() && pGlobal) {
+				index -= Values.count();
+				Values = pGlobal->Values.value(Name);
+			}
+
+			bool bFound = index < Values.count();
+			if (ErrCode)
+				*ErrCode = bFound ? STATUS_SUCCESS : STATUS_RESOURCE_NAME_NOT_FOUND;
+			return bFound ? Values.at(index) : QString();
+		}
+	}
+
 	std::wstring section = Section.toStdWString();
 	std::wstring setting = Setting.toStdWString();
 
@@ -1299,6 +1346,84 @@ QString CSbieAPI::SbieIniGet(const QString& Section, const QString& Setting, qui
 	return QString::fromWCharArray(out_buffer);
 }
 
+CSbieAPI::SIniSectionPtr CSbieAPI::QueryIniSection(const QString& Section, bool bNoTemplates)
+{
+	QString Key = Section.toLower();
+	if (!bNoTemplates)
+		Key.prepend('*');
+
+	QMutexLocker Lock(&m_IniCacheMutex);
+
+	if (m_bIniCacheFailed)
+		return SIniSectionPtr();
+
+	SIniSectionPtr pSection = m_IniCache.value(Key);
+	if (pSection)
+		return pSection;
+
+	std::wstring section = Section.toStdWString();
+	std::vector<WCHAR> Buffer(0x1000);
+	ULONG Generation = 0;
+
+	NTSTATUS status;
+	for (;;)
+	{
+		ULONG BufferLen = (ULONG)(Buffer.size() * sizeof(WCHAR));
+
+		__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+		API_QUERY_CONF_SECTION_ARGS* args = (API_QUERY_CONF_SECTION_ARGS*)parms;
+
+		memset(parms, 0, sizeof(parms));
+		args->func_code = API_QUERY_CONF_SECTION;
+		args->section_name.val = (WCHAR*)section.c_str();
+		args->flags.val = bNoTemplates ? CONF_GET_NO_TEMPLS : 0;
+		args->buffer_len.val = &BufferLen;
+		args->buffer_ptr.val = Buffer.data();
+		args->generation.val = &Generation;
+
+		status = m->IoControl(parms);
+		if (status != STATUS_BUFFER_TOO_SMALL)
+			break;
+		Buffer.resize(BufferLen / sizeof(WCHAR) + 0x100); // leave some room in case the section grows in between
+	}
+
+	if (!NT_SUCCESS(status)) {
+		if (status == STATUS_INVALID_DEVICE_REQUEST) // older driver, stay with API_QUERY_CONF
+			m_bIniCacheFailed = true;
+		return SIniSectionPtr();
+	}
+
+	//
+	// the driver bumps the generation whenever it replaces its configuration,
+	// sections cached from an older generation must not be mixed with this one
+	//
+
+	if (Generation != m_IniCacheGeneration) {
+		m_IniCache.clear();
+		m_IniCacheGeneration = Generation;
+	}
+
+	pSection = SIniSectionPtr(new SIniSection());
+	for (WCHAR* ptr = Buffer.data(); *ptr; )
+	{
+		size_t NameLen = wcslen(ptr);
+		QString Name = QString::fromWCharArray(ptr, NameLen).toLower();
+		ptr += NameLen + 1;
+		size_t ValueLen = wcslen(ptr);
+		pSection->Values[Name].append(QString::fromWCharArray(ptr));
+		ptr += ValueLen + 1;
+	}
+
+	m_IniCache.insert(Key, pSection);
+	return pSection;
+}
+
+void CSbieAPI::InvalidateIniCache()
+{
+	QMutexLocker Lock(&m_IniCacheMutex);
+	m_IniCache.clear();
+}
+
 QString CSbieAPI::SbieIniGet2(const QString& Section, const QString& Setting, quint32 Index, bool bWithGlobal, bool bNoExpand, bool withTemplates)
 {
 	int flags = (bWithGlobal ? 0 : CONF_GET_NO_GLOBAL);
@@ -2090,6 +2215,7 @@ SB_STATUS CSbieAPI::ReloadConf(quint32 flags, quint32 SessionId)
 	parms[2] = flags;
 
 	NTSTATUS status = m->IoControl(parms);
+	InvalidateIniCache();
 	if (!NT_SUCCESS(status))
 		return SB_ERR(status);
 
@@ -2708,6 +2834,8 @@ SB_STATUS CSbieAPI__MonitorControl(SSbieAPI* m, ULONG *NewState, ULONG *OldState
 
 SB_STATUS CSbieAPI::EnableMonitor(bool Enable)
 {
+	if (Enable)
+		m->traceRingFailed = false;
 	ULONG uNewState = Enable ? TRUE : FALSE;
 	return CSbieAPI__MonitorControl(m, &uNewState, NULL);
 }
@@ -2719,6 +2847,139 @@ bool CSbieAPI::IsMonitoring()
 	return uOldState != FALSE;
 }
 
+void CSbieAPI__UnmapMonitor(SSbieAPI* m)
+{
+	NtUnmapViewOfSection(NtCurrentProcess(), m->traceRing);
+	m->traceRing = NULL;
+}
+
+bool CSbieAPI__MapMonitor(SSbieAPI* m)
+{
+	ULONG64 map_base = 0;
+	ULONG map_size = 0;
+
+	__declspec(align(8)) ULONG64 parms[API_NUM_ARGS];
+	API_MONITOR_MAP_ARGS* args = (API_MONITOR_MAP_ARGS*)parms;
+
+	memset(parms, 0, sizeof(parms));
+	args->func_code = API_MONITOR_MAP;
+	args->map_base.val = &map_base;
+	args->map_size.val = &map_size;
+
+	NTSTATUS status = m->IoControl(parms);
+	if (!NT_SUCCESS(status)) {
+		if (status != STATUS_DEVICE_NOT_READY) // older driver or a pool backed buffer, stay with API_MONITOR_GET2
+			m->traceRingFailed = true;
+		return false;
+	}
+
+	m->traceRing = (LOG_BUFFER_VIEW*)map_base;
+	if (map_size < sizeof(LOG_BUFFER_VIEW) || map_size - sizeof(LOG_BUFFER_VIEW) < m->traceRing->buffer_size) {
+		CSbieAPI__UnmapMonitor(m);
+		m->traceRingFailed = true;
+		return false;
+	}
+	memset(&m->traceReader, 0, sizeof(m->traceReader));
+
+	// entries which wrap around the end of the ring are assembled in the trace buffer
+	ULONG scratch_len = m->traceRing->buffer_size;
+	if (m->traceBufferLen < scratch_len) {
+		if (m->traceBuffer)
+			free(m->traceBuffer);
+		m->traceBufferLen = scratch_len;
+		m->traceBuffer = (UCHAR*)malloc(m->traceBufferLen);
+	}
+
+	return true;
+}
+
+CTraceEntryPtr CSbieAPI__ParseTraceEntry(const UCHAR* ptr, ULONG uSize)
+{
+	//[Time 8][Type 4][PID 4][TID 4][Data n*2](0xFFFF[ID1][LEN1][DATA1]...[IDn][LENn][DATAn])
+	if (uSize < sizeof(LONGLONG) + sizeof(ULONG) * 3)
+		return CTraceEntryPtr();
+
+	LONGLONG uTimestamp = *(LONGLONG*)ptr;
+	ptr += sizeof(LONGLONG);
+	uSize -= sizeof(LONGLONG);
+
+	ULONG uType = *(ULONG*)ptr;
+	ptr += sizeof(ULONG);
+	uSize -= sizeof(ULONG);
+
+	ULONG uPid = *(ULONG*)ptr;
+	ptr += sizeof(ULONG);
+	uSize -= sizeof(ULONG);
+
+	ULONG uTid = *(ULONG*)ptr;
+	ptr += sizeof(ULONG);
+	uSize -= sizeof(ULONG);
+
+	// Note: a mapped entry may get overwritten while we parse it, hence all lengths are bounded by uSize
+
+	QStringList LogData;
+	for (; uSize >= sizeof(WCHAR);) {
+		if (*(WCHAR*)ptr == 0xFFFF) { // end of strings marker
+			ptr += sizeof(WCHAR);
+			uSize -= sizeof(WCHAR);
+			break;
+		}
+		size_t len = wcsnlen((WCHAR*)ptr, uSize / sizeof(WCHAR));
+		QString str = QString::fromWCharArray((WCHAR*)ptr, len);
+		if ((len + 1) * sizeof(WCHAR) > uSize)
+			uSize = 0;
+		else {
+			ptr += (len + 1) * sizeof(WCHAR);
+			uSize -= (ULONG)(len + 1) * sizeof(WCHAR);
+		}
+		LogData.append(str);
+	}
+
+	QVector<quint64> Stack;
+
+	for (; uSize >= sizeof(ULONG) * 2;) {
+
+		ULONG uTagID = *(ULONG*)ptr;
+		ptr += sizeof(ULONG);
+		uSize -= sizeof(ULONG);
+
+		ULONG uTagLen = *(ULONG*)ptr;
+		ptr += sizeof(ULONG);
+		uSize -= sizeof(ULONG);
+
+		if (uTagLen > uSize)
+			break;
+
+		switch (uTagID) {
+		case 'STCK':
+			int PtrSize = sizeof(PVOID);
+#ifndef _WIN64
+			if (CSbieAPI::IsWow64())
+				PtrSize = sizeof(__int64);
+#endif
+			int Frames = uTagLen / PtrSize;
+			Stack.reserve(Frames);
+			for (int i = 0; i < Frames; i++) {
+				quint64 Address;
+#ifndef _WIN64
+				if (PtrSize == sizeof(quint32))
+					Address = ((quint32*)ptr)[i];
+				else
+#endif
+					Address = ((quint64*)ptr)[i];
+
+				if ((Address & 0x8000000000000000ull) == 0) // skip kernel addresses
+					Stack.append(Address);
+			}
+		}
+
+		ptr += uTagLen;
+		uSize -= uTagLen;
+	}
+
+	return CTraceEntryPtr(new CTraceEntry(FILETIME2ms(uTimestamp), uPid, uTid, uType, LogData, Stack));
+}
+
 bool CSbieAPI::GetMonitor()
 {
 #if 0
@@ -2763,13 +3024,56 @@ bool CSbieAPI::GetMonitor()
 
 	CTraceEntryPtr LogEntry = CTraceEntryPtr(new CTraceEntry(0, pid, tid, type, LogData));
 
-	QMutexLocker Lock(&m_TraceMutex);
-	m_TraceCache.append(LogEntry);
+	m_TraceQueue.Push(QVector<CTraceEntryPtr>() << LogEntry);
 
 	return true;
 
 #else // bulk retrieval starting with build 1.6.6
 
+	//
+	// when the driver can map the monitor buffer into our process read the entries
+	// in place, the driver then never waits for us and we notice lost entries from
+	// gaps in their sequence numbers
+	//
+
+	if (m->traceRing == NULL && !m->traceRingFailed)
+		CSbieAPI__MapMonitor(m);
+
+	if (m->traceRing != NULL)
+	{
+		QVector<CTraceEntryPtr> Entries;
+		ULONG64 Dropped = m->traceReader.dropped;
+		int Count = 0;
+
+		LOG_BUFFER_SIZE_T uSize;
+		UCHAR* ptr;
+		for (; Count < 0x1000 && (ptr = (UCHAR*)log_buffer_reader_next(&m->traceReader, m->traceRing, (CHAR*)m->traceBuffer, &uSize)) != NULL; Count++)
+		{
+			CTraceEntryPtr LogEntry;
+			if (!m->clearingBuffers)
+				LogEntry = CSbieAPI__ParseTraceEntry(ptr, uSize);
+
+			if (!log_buffer_reader_check(&m->traceReader, m->traceRing))
+				continue; // entry got overwritten while we were reading it
+
+			if (LogEntry)
+				Entries.append(LogEntry);
+		}
+
+		if (m->traceReader.dropped != Dropped && !m->clearingBuffers)
+			emit LogSbieMessage(0xC1020000 | 1242, QStringList() << "" << "" << "", GetCurrentProcessId()); // Monitor buffer overflow
+
+		if (Count == 0) {
+			if (m->traceRing->buffer_flags & LOG_BUFFER_FLAG_CLOSED) // monitor was disabled, map the next buffer once it gets enabled
+				CSbieAPI__UnmapMonitor(m);
+			return false;
+		}
+
+		m_TraceQueue.Push(std::move(Entries));
+
+		return Count >= 0x1000;
+	}
+
 	if (m->traceBuffer == NULL) {
 		m->traceBufferLen = 256 * PAGE_SIZE;
 		m->traceBuffer = (UCHAR*)malloc(m->traceBufferLen);
@@ -2793,116 +3097,65 @@ bool CSbieAPI::GetMonitor()
 	if (m->clearingBuffers)
 		return true; 
 
+	QVector<CTraceEntryPtr> Entries;
+
 	for (UCHAR* ptr = buffer; *(ULONG*)ptr > 0; ) {
 
 		ULONG uSize = *(ULONG*)ptr;
 		ptr += sizeof(ULONG);
 
-		LONGLONG uTimestamp = *(LONGLONG*)ptr;
-		ptr += sizeof(LONGLONG);
-		uSize -= sizeof(LONGLONG);
-
-		ULONG uType = *(ULONG*)ptr;
-		ptr += sizeof(ULONG);
-		uSize -= sizeof(ULONG);
-
-		ULONG uPid = *(ULONG*)ptr;
-		ptr += sizeof(ULONG);
-		uSize -= sizeof(ULONG);
-
-		ULONG uTid = *(ULONG*)ptr;
-		ptr += sizeof(ULONG);
-		uSize -= sizeof(ULONG);
-
-		QStringList LogData;
-		for (; uSize > 0;) {
-			if (*(WCHAR*)ptr == 0xFFFF) { // end of strings marker
-				ptr += sizeof(WCHAR);
-				uSize -= sizeof(WCHAR);
-				break;
-			}
-			size_t len = wcslen((WCHAR*)ptr);
-			QString str = QString::fromWCharArray((WCHAR*)ptr, len);
-			ptr += (len + 1) * sizeof(WCHAR);
-			uSize -= (len + 1) * sizeof(WCHAR);
-			LogData.append(str);
-		}
-
-		QVector<quint64> Stack;
-
-		for (; uSize > 0;) {
-
-			ULONG uTagID = *(ULONG*)ptr;
-			ptr += sizeof(ULONG);
-			uSize -= sizeof(ULONG);
-
-			ULONG uTagLen = *(ULONG*)ptr;
-			ptr += sizeof(ULONG);
-			uSize -= sizeof(ULONG);
-
-			switch (uTagID) {
-			case 'STCK':
-				int PtrSize = sizeof(PVOID);
-#ifndef _WIN64
-				if (IsWow64())
-					PtrSize = sizeof(__int64);
-#endif
-				int Frames = uTagLen / PtrSize;
-				Stack.reserve(Frames);
-				for (int i = 0; i < Frames; i++) {
-					quint64 Address;
-#ifndef _WIN64
-					if (PtrSize == sizeof(quint32))
-						Address = ((quint32*)ptr)[i];
-					else
-#endif
-						Address = ((quint64*)ptr)[i];
-
-					if ((Address & 0x8000000000000000ull) == 0) // skip kernel addresses
-						Stack.append(Address);
-				}
-			}
-
-			ptr += uTagLen;
-			uSize -= uTagLen;
-		}
-
-		CTraceEntryPtr LogEntry = CTraceEntryPtr(new CTraceEntry(FILETIME2ms(uTimestamp), uPid, uTid, uType, LogData, Stack));
-
-		QMutexLocker Lock(&m_TraceMutex);
-		m_TraceCache.append(LogEntry);
+		if (CTraceEntryPtr LogEntry = CSbieAPI__ParseTraceEntry(ptr, uSize))
+			Entries.append(LogEntry);
+		ptr += uSize;
 	}
 
+	m_TraceQueue.Push(std::move(Entries));
+
 	return status == STATUS_MORE_ENTRIES;
 #endif
 }
 
-const QVector<CTraceEntryPtr>& CSbieAPI::GetTrace()
+const CTraceStore& CSbieAPI::GetTrace()
 { 
-	QMutexLocker Lock(&m_TraceMutex);
+	// entries come in long runs from the same process, resolve each pid only once per drain
+	QHash<quint32, CBoxedProcessPtr> Processes;
+	quint32 LastPid = -1;
+	CBoxedProcessPtr pProcess;
 
-	for (int i = 0; i < m_TraceCache.count(); i++) 
+	QVector<QVector<CTraceEntryPtr>> Batches = m_TraceQueue.PopAll();
+	for (int b = 0; b < Batches.count(); b++)
 	{
-		CTraceEntryPtr& pEntry = m_TraceCache[i];
+		QVector<CTraceEntryPtr>& Batch = Batches[b];
+		for (int i = 0; i < Batch.count(); i++)
+		{
+			CTraceEntryPtr& pEntry = Batch[i];
 
 #ifdef USE_MERGE_TRACE
-		if (!m_TraceList.isEmpty() && m_TraceList.last()->Equals(pEntry)) {
-			m_TraceList.last()->Merge(pEntry);
-			continue;
-		}
+			if (!m_TraceList.IsEmpty() && m_TraceList.Equals(m_TraceList.Count() - 1, pEntry)) {
+				m_TraceList.Merge(m_TraceList.Count() - 1, pEntry);
+				continue;
+			}
 #endif
 
-		if (CBoxedProcessPtr proc = m_BoxedProxesses.value(pEntry->GetProcessId())) {
-			pEntry->SetProcessName(proc->GetProcessName());
-			pEntry->SetBoxPtr(proc->GetBoxPtr());
-			QVector<quint64> Stack = pEntry->GetStack();
-			if(!Stack.isEmpty())
-				proc->ResolveSymbols(Stack);
-		}
+			if (LastPid != pEntry->GetProcessId()) {
+				LastPid = pEntry->GetProcessId();
+				auto I = Processes.find(LastPid);
+				if (I == Processes.end())
+					I = Processes.insert(LastPid, m_BoxedProxesses.value(LastPid));
+				pProcess = I.value();
+			}
 
-		m_TraceList.append(pEntry);
+			if (pProcess) {
+				pEntry->SetProcessName(pProcess->GetProcessName());
+				pEntry->SetBoxPtr(pProcess->GetBoxPtr());
+				QVector<quint64> Stack = pEntry->GetStack();
+				if(!Stack.isEmpty())
+					pProcess->ResolveSymbols(Stack);
+			}
+
+			m_TraceList.Append(pEntry);
+		}
 	}
-	m_TraceCache.clear();
 
 	return m_TraceList; 
 }
@@ -144,9 +144,9 @@ public:
 	virtual SB_STATUS		EnableMonitor(bool Enable);
 	virtual bool			IsMonitoring();
 
-	virtual const QVector<CTraceEntryPtr>& GetTrace();
-	virtual int				GetTraceCount() const { return m_TraceList.count(); }
-	virtual void			ClearTrace() { m_TraceList.clear(); QMutexLocker Lock(&m_TraceMutex); m_TraceCache.clear(); }
+	virtual const CTraceStore& GetTrace();
+	virtual int				GetTraceCount() const { return m_TraceList.Count(); }
+	virtual void			ClearTrace() { m_TraceList.Clear(); m_TraceQueue.Clear(); }
 
 	// Other
 	virtual quint64			QueryProcessInfo(quint32 ProcessId, quint32 InfoClass = 0);
@@ -252,9 +252,8 @@ protected:
 	QMap<QString, CSandBoxPtr> m_SandBoxes;
 	QMap<quint32, CBoxedProcessPtr> m_BoxedProxesses;
 
-	mutable QMutex			m_TraceMutex;
-	QVector<CTraceEntryPtr>	m_TraceCache;
-	QVector<CTraceEntryPtr>	m_TraceList;
+	CTraceQueue				m_TraceQueue;
+	CTraceStore				m_TraceList;
 
 	mutable QReadWriteLock	m_DriveLettersMutex;
 	struct SDrive
@@ -282,6 +281,20 @@ protected:
 
 	QSharedPointer<CSbieIni>m_pGlobalSection;
 	QSharedPointer<CSbieIni>m_pUserSection;
+
+	struct SIniSection
+	{
+		QHash<QString, QStringList> Values; // lower case setting name -> values in ini order
+	};
+	typedef QSharedPointer<SIniSection> SIniSectionPtr;
+
+	virtual SIniSectionPtr	QueryIniSection(const QString& Section, bool bNoTemplates);
+	virtual void			InvalidateIniCache();
+
+	QMutex					m_IniCacheMutex;
+	QHash<QString, SIniSectionPtr> m_IniCache;
+	quint32					m_IniCacheGeneration;
+	bool					m_bIniCacheFailed;
 	QString					m_UserName;
 	QString					m_UserSid;
 
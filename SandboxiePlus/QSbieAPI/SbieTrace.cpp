@@ -18,6 +18,7 @@
 #include "stdafx.h"
 #include <QDebug>
 #include <QStandardPaths>
+#include <QtConcurrent>
 #include "SbieTrace.h"
 
 #include <ntstatus.h>
@@ -150,23 +151,31 @@ QString CTraceEntry::GetTypeStr(quint32 Type)
 	}
 }
 
-QString CTraceEntry::GetTypeStr() const
+QString CTraceEntry::GetTypeStr(quint32 Flags, const QString& SubType)
 {
-	QString Type = GetTypeStr(m_Type.Type);
-	if(Type.isEmpty())
-		Type = "Unknown: " + QString::number(m_Type.Type);
+	STraceType Type;
+	Type.Flags = Flags;
+
+	QString TypeStr = GetTypeStr(Type.Type);
+	if(TypeStr.isEmpty())
+		TypeStr = "Unknown: " + QString::number(Type.Type);
 
-	if(!m_SubType.isEmpty())
-		Type.append(" / " + m_SubType);
+	if(!SubType.isEmpty())
+		TypeStr.append(" / " + SubType);
 
-	if (m_Type.User)
-		Type.append(" (U)"); // user mode (sbiedll.dll)
-	//else if (m_Type.Agent)
-	//	Type.append(" (S)"); // system mode (sbiesvc.exe)
+	if (Type.User)
+		TypeStr.append(" (U)"); // user mode (sbiedll.dll)
+	//else if (Type.Agent)
+	//	TypeStr.append(" (S)"); // system mode (sbiesvc.exe)
 	else
-		Type.append(" (K)"); // kernel mode (sbiedrv.sys)
+		TypeStr.append(" (K)"); // kernel mode (sbiedrv.sys)
+
+	return TypeStr;
+}
 
-	return Type;
+QString CTraceEntry::GetTypeStr() const
+{
+	return GetTypeStr(m_Type.Flags, m_SubType);
 }
 
 bool CTraceEntry::IsOpen() const 
@@ -184,23 +193,495 @@ bool CTraceEntry::IsTrace() const
 	return m_Type.Trace;
 }
 
-QString CTraceEntry::GetStautsStr() const
+QString CTraceEntry::GetStautsStr(quint32 Flags, int Counter)
 {
+	STraceType Type;
+	Type.Flags = Flags;
+
 	QString Status;
-	if (IsOpen())
+	if ((Flags & MONITOR_DISPOSITION_MASK) == MONITOR_OPEN)
 		Status.append("Open ");
-	if (IsClosed())
+	if ((Flags & MONITOR_DISPOSITION_MASK) == MONITOR_DENY)
 		Status.append("Closed ");
 
-	if (IsTrace())
+	if (Type.Trace)
 		Status.append("Trace ");
 
+	if (Counter > 1)
+		Status.append(QString("(%1) ").arg(Counter));
+
+	return Status;
+}
+
+QString CTraceEntry::GetStautsStr() const
+{
 #ifdef USE_MERGE_TRACE
-	if (m_Counter > 1)
-		Status.append(QString("(%1) ").arg(m_Counter));
+	return GetStautsStr(m_Type.Flags, m_Counter);
+#else
+	return GetStautsStr(m_Type.Flags);
 #endif
+}
 
-	return Status;
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStringPool
+//
+
+CTraceStringPool::CTraceStringPool()
+{
+	m_Offsets.append(0);
+	m_Offsets.append(0);
+	m_Indexed = 0;
+}
+
+quint32 CTraceStringPool::Add(const QString& Str)
+{
+	if (Str.isEmpty())
+		return 0;
+
+	uint Hash = qHash(Str);
+	for (auto I = m_Index.constFind(Hash); I != m_Index.constEnd() && I.key() == Hash; ++I) {
+		if (Peek(I.value()) == Str)
+			return I.value();
+	}
+
+	int Offset = m_Data.count();
+	m_Data.resize(Offset + Str.size());
+	memcpy(m_Data.data() + Offset, Str.constData(), Str.size() * sizeof(QChar));
+	m_Offsets.append(m_Data.count());
+
+	quint32 Id = m_Offsets.count() - 2;
+	m_Index.insert(Hash, Id);
+	return Id;
+}
+
+QString CTraceStringPool::Peek(quint32 Id) const
+{
+	quint32 Offset = m_Offsets.at(Id);
+	return QString::fromRawData(m_Data.constData() + Offset, m_Offsets.at(Id + 1) - Offset);
+}
+
+QString CTraceStringPool::Get(quint32 Id) const
+{
+	quint32 Offset = m_Offsets.at(Id);
+	return QString(m_Data.constData() + Offset, m_Offsets.at(Id + 1) - Offset);
+}
+
+bool CTraceStringPool::Contains(quint32 Id, const QString& Exp, Qt::CaseSensitivity cs) const
+{
+	return Id != 0 && Peek(Id).contains(Exp, cs);
+}
+
+static inline quint64 CTraceStringPool__Fold(QChar Char)
+{
+	return Char.toCaseFolded().unicode();
+}
+
+void CTraceStringPool::UpdateIndex() const
+{
+	if (m_Indexed == 0)
+		m_Indexed = 1; // skip the empty string
+
+	for (; m_Indexed < Count(); m_Indexed++)
+	{
+		quint32 Offset = m_Offsets.at(m_Indexed);
+		int Length = m_Offsets.at(m_Indexed + 1) - Offset;
+		if (Length < 3)
+			continue;
+
+		const QChar* pStr = m_Data.constData() + Offset;
+		quint64 Gram = (CTraceStringPool__Fold(pStr[0]) << 16) | CTraceStringPool__Fold(pStr[1]);
+		for (int i = 2; i < Length; i++)
+		{
+			Gram = ((Gram << 16) | CTraceStringPool__Fold(pStr[i])) & 0xFFFFFFFFFFFFull;
+
+			QVector<quint32>& Ids = m_Grams[Gram];
+			if (Ids.isEmpty() || Ids.last() != (quint32)m_Indexed)
+				Ids.append(m_Indexed);
+		}
+	}
+}
+
+QBitArray CTraceStringPool::Match(const QString& Exp) const
+{
+	QBitArray Ids(Count());
+	if (Exp.isEmpty())
+		return Ids;
+
+	if (Exp.length() < 3) // to short for the index, test every string
+	{
+		for (int Id = 1; Id < Count(); Id++) {
+			if (Peek(Id).contains(Exp, Qt::CaseInsensitive))
+				Ids.setBit(Id);
+		}
+		return Ids;
+	}
+
+	UpdateIndex();
+
+	// only strings containing every trigram of Exp can match, verify the ones holding the rarest
+	const QVector<quint32>* pCandidates = NULL;
+	quint64 Gram = (CTraceStringPool__Fold(Exp.at(0)) << 16) | CTraceStringPool__Fold(Exp.at(1));
+	for (int i = 2; i < Exp.length(); i++)
+	{
+		Gram = ((Gram << 16) | CTraceStringPool__Fold(Exp.at(i))) & 0xFFFFFFFFFFFFull;
+
+		auto I = m_Grams.constFind(Gram);
+		if (I == m_Grams.constEnd())
+			return Ids;
+		if (!pCandidates || I->count() < pCandidates->count())
+			pCandidates = &I.value();
+	}
+
+	foreach(quint32 Id, *pCandidates) {
+		if (Peek(Id).contains(Exp, Qt::CaseInsensitive))
+			Ids.setBit(Id);
+	}
+	return Ids;
+}
+
+void CTraceStringPool::Clear()
+{
+	m_Data.clear();
+	m_Offsets.clear();
+	m_Offsets.append(0);
+	m_Offsets.append(0);
+	m_Index.clear();
+	m_Grams.clear();
+	m_Indexed = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStore
+//
+
+int CTraceStore::GetStatus(quint32 Flags)
+{
+	CTraceEntry::STraceType Type;
+	Type.Flags = Flags;
+
+	if ((Flags & MONITOR_DISPOSITION_MASK) == MONITOR_OPEN)
+		return 1;
+	if ((Flags & MONITOR_DISPOSITION_MASK) == MONITOR_DENY)
+		return 2;
+	if (Type.Trace)
+		return 3;
+	return 4;
+}
+
+CTraceStore::CTraceStore()
+{
+	m_StackPos.append(0);
+	m_Boxes.append(NULL);
+}
+
+void CTraceStore::Append(const CTraceEntryPtr& pEntry)
+{
+	m_UID.append(pEntry->m_uid);
+	m_TimeStamp.append(pEntry->m_TimeStamp);
+	m_ProcessId.append(pEntry->m_ProcessId);
+	m_ThreadId.append(pEntry->m_ThreadId);
+	m_Flags.append(pEntry->m_Type.Flags);
+	m_Name.append(m_Strings.Add(pEntry->m_Name));
+	m_Message.append(m_Strings.Add(pEntry->m_Message));
+	m_SubType.append(m_Strings.Add(pEntry->m_SubType));
+	m_ProcessName.append(m_Strings.Add(pEntry->m_ProcessName));
+#ifdef USE_MERGE_TRACE
+	m_Counter.append(pEntry->m_Counter);
+#endif
+
+	int Box = m_Boxes.indexOf(pEntry->m_BoxPtr);
+	if (Box == -1) {
+		Box = m_Boxes.count();
+		m_Boxes.append(pEntry->m_BoxPtr);
+	}
+	m_Box.append((quint16)Box);
+
+	m_StackArena.append(pEntry->m_Stack);
+	m_StackPos.append(m_StackArena.count());
+
+	int Row = m_UID.count() - 1;
+	m_PidRows[pEntry->m_ProcessId].append(Row);
+	m_TypeRows[pEntry->m_Type.Type].append(Row);
+	m_StatusRows[GetStatus(pEntry->m_Type.Flags) - 1].append(Row);
+}
+
+void CTraceStore::Clear()
+{
+	*this = CTraceStore();
+}
+
+QString CTraceStore::GetStautsStr(int Row) const
+{
+#ifdef USE_MERGE_TRACE
+	return CTraceEntry::GetStautsStr(m_Flags.at(Row), m_Counter.at(Row));
+#else
+	return CTraceEntry::GetStautsStr(m_Flags.at(Row));
+#endif
+}
+
+bool CTraceStore::IsOpen(int Row) const
+{
+	return (m_Flags.at(Row) & MONITOR_DISPOSITION_MASK) == MONITOR_OPEN;
+}
+
+bool CTraceStore::IsClosed(int Row) const
+{
+	return (m_Flags.at(Row) & MONITOR_DISPOSITION_MASK) == MONITOR_DENY;
+}
+
+bool CTraceStore::IsTrace(int Row) const
+{
+	CTraceEntry::STraceType Type;
+	Type.Flags = m_Flags.at(Row);
+	return Type.Trace;
+}
+
+static int CTraceStore__Count(const QList<const QVector<int>*>& Lists, int From, int To)
+{
+	int Total = 0;
+	foreach(const QVector<int>* pList, Lists)
+		Total += std::lower_bound(pList->constBegin(), pList->constEnd(), To) - std::lower_bound(pList->constBegin(), pList->constEnd(), From);
+	return Total;
+}
+
+static QVector<int> CTraceStore__Union(const QList<const QVector<int>*>& Lists, int From, int To)
+{
+	QVector<int> Rows;
+	foreach(const QVector<int>* pList, Lists)
+	{
+		auto I = std::lower_bound(pList->constBegin(), pList->constEnd(), From);
+		auto End = std::lower_bound(I, pList->constEnd(), To);
+		for (; I != End; ++I)
+			Rows.append(*I);
+	}
+	if (Lists.count() > 1)
+		std::sort(Rows.begin(), Rows.end());
+	return Rows;
+}
+
+QVector<int> CTraceStore::Select(const STraceFilter& Filter, int From, int To) const
+{
+	QVector<int> Result;
+	if (To < 0 || To > Count())
+		To = Count();
+	if (From >= To)
+		return Result;
+
+	int Box = 0;
+	if (Filter.pBox) {
+		Box = m_Boxes.indexOf(Filter.pBox);
+		if (Box == -1)
+			return Result;
+	}
+
+	//
+	// narrow the candidates down with the most selective posting list,
+	// every predicate is still checked on each candidate row below
+	//
+
+	QVector<int> Candidates;
+	bool bAll = true;
+	auto Narrow = [&](const QList<const QVector<int>*>& Lists) {
+		int Total = CTraceStore__Count(Lists, From, To);
+		if (bAll ? Total < To - From : Total < Candidates.count()) {
+			Candidates = CTraceStore__Union(Lists, From, To);
+			bAll = false;
+		}
+	};
+
+	if (!Filter.ShowPids.isEmpty()) {
+		QList<const QVector<int>*> Lists;
+		foreach(quint32 Pid, Filter.ShowPids) {
+			auto I = m_PidRows.constFind(Pid);
+			if (I != m_PidRows.constEnd())
+				Lists.append(&I.value());
+		}
+		Narrow(Lists);
+	}
+
+	if (!Filter.Types.isEmpty()) {
+		QList<const QVector<int>*> Lists;
+		foreach(quint32 Type, Filter.Types) {
+			auto I = m_TypeRows.constFind(Type);
+			if (I != m_TypeRows.constEnd())
+				Lists.append(&I.value());
+		}
+		Narrow(Lists);
+	}
+
+	if (Filter.Status >= 1 && Filter.Status <= 4)
+		Narrow(QList<const QVector<int>*>() << &m_StatusRows[Filter.Status - 1]);
+
+	if (!bAll && Candidates.isEmpty())
+		return Result;
+
+	QBitArray Text;
+	if (!Filter.Text.isEmpty()) {
+		if (Filter.TextIds.size() != m_Strings.Count())
+			Filter.TextIds = m_Strings.Match(Filter.Text);
+		Text = Filter.TextIds;
+		if (Text.count(true) == 0)
+			return Result;
+	}
+
+	auto Test = [&](int Row) {
+		if (Box && m_Box.at(Row) != Box)
+			return false;
+		quint32 Pid = m_ProcessId.at(Row);
+		if (!Filter.ShowPids.isEmpty() && !Filter.ShowPids.contains(Pid))
+			return false;
+		if (Filter.HidePids.contains(Pid))
+			return false;
+		if (Filter.Tid != 0 && Filter.Tid != m_ThreadId.at(Row))
+			return false;
+		if (!Filter.Types.isEmpty() && !Filter.Types.contains(GetType(Row)))
+			return false;
+		if (Filter.Status != 0 && (quint32)GetStatus(m_Flags.at(Row)) != Filter.Status)
+			return false;
+		if (!Text.isEmpty() && !Text.testBit(m_Name.at(Row)) && !Text.testBit(m_Message.at(Row)) && !Text.testBit(m_ProcessName.at(Row)))
+			return false;
+		return true;
+	};
+
+	//
+	// test the candidates in chunks on the global thread pool, 
+	// the chunks are concatenated in order so the result stays sorted
+	//
+
+	struct SChunk
+	{
+		int Begin;
+		int End;
+		QVector<int> Rows;
+	};
+
+	const int ChunkSize = 0x10000;
+	int Total = bAll ? To - From : Candidates.count();
+
+	QVector<SChunk> Chunks;
+	for (int Pos = 0; Pos < Total; Pos += ChunkSize) {
+		SChunk Chunk;
+		Chunk.Begin = Pos;
+		Chunk.End = qMin(Pos + ChunkSize, Total);
+		Chunks.append(Chunk);
+	}
+
+	auto TestChunk = [&](SChunk& Chunk) {
+		for (int i = Chunk.Begin; i < Chunk.End; i++) {
+			int Row = bAll ? From + i : Candidates.at(i);
+			if (Test(Row))
+				Chunk.Rows.append(Row);
+		}
+	};
+
+	if (Chunks.count() > 1)
+		QtConcurrent::blockingMap(Chunks, TestChunk);
+	else if (!Chunks.isEmpty())
+		TestChunk(Chunks.first());
+
+	foreach(const SChunk& Chunk, Chunks)
+		Result.append(Chunk.Rows);
+	return Result;
+}
+
+bool CTraceStore::Contains(int Row, const QString& Exp) const
+{
+	return m_Strings.Contains(m_Name.at(Row), Exp)
+		|| m_Strings.Contains(m_Message.at(Row), Exp)
+		|| m_Strings.Contains(m_ProcessName.at(Row), Exp);
+}
+
+CTraceEntryPtr CTraceStore::GetEntry(int Row) const
+{
+	CTraceEntry* pEntry = new CTraceEntry();
+	pEntry->m_Name = m_Strings.Get(m_Name.at(Row));
+	pEntry->m_Message = m_Strings.Get(m_Message.at(Row));
+	pEntry->m_SubType = m_Strings.Get(m_SubType.at(Row));
+	pEntry->m_ProcessId = m_ProcessId.at(Row);
+	pEntry->m_ThreadId = m_ThreadId.at(Row);
+	pEntry->m_TimeStamp = m_TimeStamp.at(Row);
+	pEntry->m_ProcessName = m_Strings.Get(m_ProcessName.at(Row));
+	pEntry->m_Stack = GetStack(Row);
+	pEntry->m_BoxPtr = GetBoxPtr(Row);
+	pEntry->m_Type.Flags = m_Flags.at(Row);
+	pEntry->m_uid = m_UID.at(Row);
+#ifdef USE_MERGE_TRACE
+	pEntry->m_Counter = m_Counter.at(Row);
+#endif
+	return CTraceEntryPtr(pEntry);
+}
+
+#ifdef USE_MERGE_TRACE
+bool CTraceStore::Equals(int Row, const CTraceEntryPtr& pEntry) const
+{
+	return pEntry->m_ProcessId == m_ProcessId.at(Row) && pEntry->m_ThreadId == m_ThreadId.at(Row)
+		&& m_Strings.Equals(m_Name.at(Row), pEntry->m_Name)
+		&& m_Strings.Equals(m_Message.at(Row), pEntry->m_Message);
+}
+
+void CTraceStore::Merge(int Row, const CTraceEntryPtr& pEntry)
+{
+	m_Counter[Row]++;
+
+	quint32 OldFlags = m_Flags.at(Row);
+	m_Flags[Row] |= pEntry->m_Type.Flags;
+
+	// Select rechecks every candidate, so a stale entry in the old lists is harmless
+	if (GetType(Row) != (OldFlags & 0xFF)) {
+		QVector<int>& Rows = m_TypeRows[GetType(Row)];
+		if (Rows.isEmpty() || Rows.last() != Row)
+			Rows.append(Row);
+	}
+	int Status = GetStatus(m_Flags.at(Row));
+	if (Status != GetStatus(OldFlags)) {
+		QVector<int>& Rows = m_StatusRows[Status - 1];
+		if (Rows.isEmpty() || Rows.last() != Row)
+			Rows.append(Row);
+	}
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceQueue
+//
+
+void CTraceQueue::Push(QVector<CTraceEntryPtr> Batch)
+{
+	if (Batch.isEmpty())
+		return;
+
+	SBatch* pBatch = new SBatch;
+	pBatch->Entries = std::move(Batch);
+	pBatch->pNext = m_Head.load(std::memory_order_relaxed);
+	while (!m_Head.compare_exchange_weak(pBatch->pNext, pBatch, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+QVector<QVector<CTraceEntryPtr>> CTraceQueue::PopAll()
+{
+	QVector<QVector<CTraceEntryPtr>> Batches;
+
+	SBatch* pBatch = m_Head.exchange(NULL, std::memory_order_acquire);
+	if (pBatch == NULL)
+		return Batches;
+
+	// the stack holds the newest batch first, reverse it
+	SBatch* pFirst = NULL;
+	while (pBatch) {
+		SBatch* pNext = pBatch->pNext;
+		pBatch->pNext = pFirst;
+		pFirst = pBatch;
+		pBatch = pNext;
+	}
+
+	while (pFirst) {
+		Batches.append(std::move(pFirst->Entries));
+		SBatch* pNext = pFirst->pNext;
+		delete pFirst;
+		pFirst = pNext;
+	}
+
+	return Batches;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <QThread>
+#include <QBitArray>
+#include <atomic>
 
 #include "qsbieapi_global.h"
 
@@ -39,7 +41,9 @@ public:
 	virtual quint8		GetType() const { return m_Type.Type; }
 	static QList<quint32>AllTypes();
 	static QString		GetTypeStr(quint32 Type);
+	static QString		GetTypeStr(quint32 Flags, const QString& SubType);
 	virtual QString		GetTypeStr() const;
+	static QString		GetStautsStr(quint32 Flags, int Counter = 1);
 	virtual QString		GetStautsStr() const;
 
 	virtual void		SetProcessName(const QString& name) { m_ProcessName = name; }
@@ -69,6 +73,10 @@ public:
 	quint64				GetUID() const { return m_uid; }
 
 protected:
+	friend class CTraceStore;
+
+	CTraceEntry() {}
+
 	QString m_Name;
 	QString m_Message;
 	QString m_SubType;
@@ -79,7 +87,7 @@ protected:
 	QVector<quint64> m_Stack;
 	void* m_BoxPtr;
 
-	union
+	union STraceType
 	{
 		quint32 Flags;
 		struct
@@ -109,3 +117,162 @@ protected:
 };
 
 typedef QSharedDataPointer<CTraceEntry> CTraceEntryPtr;
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStringPool
+//
+// All strings are kept back to back in a single UTF-16 arena, 
+// identical strings are stored only once, id 0 is the empty string
+//
+
+class QSBIEAPI_EXPORT CTraceStringPool
+{
+public:
+	CTraceStringPool();
+
+	quint32				Add(const QString& Str);
+	QString				Get(quint32 Id) const;
+	bool				Contains(quint32 Id, const QString& Exp, Qt::CaseSensitivity cs = Qt::CaseInsensitive) const;
+	bool				Equals(quint32 Id, const QString& Str) const { return Peek(Id) == Str; }
+	QBitArray			Match(const QString& Exp) const; // all ids containing Exp, case insensitive
+	void				UpdateIndex() const; // index strings added since the last Match
+
+	int					Count() const { return m_Offsets.count() - 1; }
+	void				Clear();
+
+protected:
+	QString				Peek(quint32 Id) const; // raw view into the arena, must not outlive it
+
+	QVector<QChar>		m_Data;
+	QVector<quint32>	m_Offsets;
+	QMultiHash<uint, quint32> m_Index;
+
+	// trigram index, case folded, built lazily on the first Match
+	mutable QHash<quint64, QVector<quint32>> m_Grams;
+	mutable int			m_Indexed;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// STraceFilter
+//
+
+struct STraceFilter
+{
+	STraceFilter() : pBox(NULL), Tid(0), Status(0) {}
+
+	void*				pBox;
+	QSet<quint32>		ShowPids;
+	QSet<quint32>		HidePids;
+	quint32				Tid;
+	QList<quint32>		Types;
+	quint32				Status;		// 0 any, 1 open, 2 closed, 3 trace, 4 other
+	QString				Text;		// matched against name, message and process name
+
+	mutable QBitArray	TextIds;	// Text resolved by Select, reused for further ranges of the same store
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceStore
+//
+// Columnar storage for the trace log, a row costs about 50 bytes plus its 
+// unique strings and stack frames, rows are materialized only on demand.
+// All members are implicitly shared so a copy is a cheap snapshot.
+//
+
+class QSBIEAPI_EXPORT CTraceStore
+{
+public:
+	CTraceStore();
+
+	int					Count() const					{ return m_UID.count(); }
+	bool				IsEmpty() const					{ return m_UID.isEmpty(); }
+
+	void				Append(const CTraceEntryPtr& pEntry);
+	void				Clear();
+
+	quint64				GetUID(int Row) const			{ return m_UID.at(Row); }
+	quint64				GetTimeStamp(int Row) const		{ return m_TimeStamp.at(Row); }
+	quint32				GetProcessId(int Row) const		{ return m_ProcessId.at(Row); }
+	quint32				GetThreadId(int Row) const		{ return m_ThreadId.at(Row); }
+	quint8				GetType(int Row) const			{ return m_Flags.at(Row) & 0xFF; }
+	QString				GetName(int Row) const			{ return m_Strings.Get(m_Name.at(Row)); }
+	QString				GetMessage(int Row) const		{ return m_Strings.Get(m_Message.at(Row)); }
+	QString				GetProcessName(int Row) const	{ return m_Strings.Get(m_ProcessName.at(Row)); }
+	void*				GetBoxPtr(int Row) const		{ return m_Boxes.at(m_Box.at(Row)); }
+	QVector<quint64>	GetStack(int Row) const			{ return m_StackArena.mid(m_StackPos.at(Row), m_StackPos.at(Row + 1) - m_StackPos.at(Row)); }
+
+	QString				GetTypeStr(int Row) const		{ return CTraceEntry::GetTypeStr(m_Flags.at(Row), m_Strings.Get(m_SubType.at(Row))); }
+	QString				GetStautsStr(int Row) const;
+	bool				IsOpen(int Row) const;
+	bool				IsClosed(int Row) const;
+	bool				IsTrace(int Row) const;
+
+	bool				Contains(int Row, const QString& Exp) const;
+	QVector<int>		Select(const STraceFilter& Filter, int From = 0, int To = -1) const;
+	void				UpdateIndex() const				{ m_Strings.UpdateIndex(); } // before handing a copy to an other thread, so Select does not modify it
+
+	CTraceEntryPtr		GetEntry(int Row) const;
+
+#ifdef USE_MERGE_TRACE
+	int					GetCount(int Row) const			{ return m_Counter.at(Row); }
+	bool				Equals(int Row, const CTraceEntryPtr& pEntry) const;
+	void				Merge(int Row, const CTraceEntryPtr& pEntry);
+#endif
+
+protected:
+	static int			GetStatus(quint32 Flags); // 1 open, 2 closed, 3 trace, 4 other
+
+	QVector<quint64>	m_UID;
+	QVector<quint64>	m_TimeStamp;
+	QVector<quint32>	m_ProcessId;
+	QVector<quint32>	m_ThreadId;
+	QVector<quint32>	m_Flags;
+	QVector<quint32>	m_Name;
+	QVector<quint32>	m_Message;
+	QVector<quint32>	m_SubType;
+	QVector<quint32>	m_ProcessName;
+	QVector<quint16>	m_Box;
+	QVector<quint32>	m_StackPos;		// Count() + 1 entries, a rows frames end where the next ones begin
+#ifdef USE_MERGE_TRACE
+	QVector<int>		m_Counter;
+#endif
+
+	QVector<void*>		m_Boxes;
+	QVector<quint64>	m_StackArena;
+	CTraceStringPool	m_Strings;
+
+	// posting lists, ascending row numbers
+	QHash<quint32, QVector<int>> m_PidRows;
+	QHash<quint32, QVector<int>> m_TypeRows;
+	QVector<int>		m_StatusRows[4];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceQueue
+//
+// Lock free multi producer single consumer handoff of whole entry batches,
+// producers push onto a stack, the consumer takes it all at once
+//
+
+class QSBIEAPI_EXPORT CTraceQueue
+{
+public:
+	CTraceQueue() : m_Head(NULL) {}
+	~CTraceQueue() { Clear(); }
+
+	void				Push(QVector<CTraceEntryPtr> Batch);
+	QVector<QVector<CTraceEntryPtr>> PopAll(); // oldest batch first, consumer only
+
+	void				Clear() { PopAll(); }
+
+protected:
+	Q_DISABLE_COPY(CTraceQueue)
+
+	struct SBatch
+	{
+		QVector<CTraceEntryPtr> Entries;
+		SBatch* pNext;
+	};
+
+	std::atomic<SBatch*> m_Head;
+};
@@ -15,33 +15,39 @@ CBoxMonitor::~CBoxMonitor()
 void CBoxMonitor::Notify(const std::wstring& strDirectory)
 {
 	m_Mutex.lock();
-	m_Boxes[QString::fromStdWString(strDirectory)].Changed = true;
+	SBox& Box = m_Boxes[QString::fromStdWString(strDirectory)];
+	Box.Changed = true;
+	Box.Overflow = true; // the changes are lost, the index must be rebuilt
+	Box.Changes.clear();
 	m_Mutex.unlock();
 }
 
-quint64 CBoxMonitor::CounDirSize(const QString& Directory, SBox* Box) 
+void CBoxMonitor::NotifyChanges(const std::wstring& strDirectory, const std::vector<TDirectoryChangeNotification>& Changes)
 {
-	quint64 TotalSize = 0;
-	if (m_bTerminate || Box->pBox.isNull())
-		return TotalSize;
-
-	QDir Dir(Directory);
-	foreach(const QFileInfo & Info, Dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot))
+	m_Mutex.lock();
+	SBox& Box = m_Boxes[QString::fromStdWString(strDirectory)];
+	Box.Changed = true;
+	if (!Box.Overflow) 
 	{
-		if (Info.isDir())
-			TotalSize += CounDirSize(Info.filePath(), Box);
-		else if (Info.isShortcut())
+		if (Box.Changes.count() + Changes.size() > 100000) { // a full rescan is cheaper than this
+			Box.Overflow = true;
+			Box.Changes.clear();
+		}
+		else for (auto I = Changes.begin(); I != Changes.end(); ++I) 
 		{
-			QFile File(Info.filePath());
-			if (File.open(QFile::ReadOnly))
-				TotalSize += File.size();
-			File.close();
+			CDirSizeIndex::EChange Change;
+			switch (I->first)
+			{
+			case FILE_ACTION_ADDED:
+			case FILE_ACTION_RENAMED_NEW_NAME:	Change = CDirSizeIndex::eAdded; break;
+			case FILE_ACTION_REMOVED:
+			case FILE_ACTION_RENAMED_OLD_NAME:	Change = CDirSizeIndex::eRemoved; break;
+			default:							Change = CDirSizeIndex::eModified;
+			}
+			Box.Changes.append(qMakePair(Change, QString::fromStdWString(I->second)));
 		}
-		else
-			TotalSize += QFile(Info.filePath()).size();
 	}
-
-	return TotalSize;
+	m_Mutex.unlock();
 }
 
 void CBoxMonitor::run()
@@ -60,15 +66,35 @@ void CBoxMonitor::run()
 
 			m_Mutex.lock();
 			SBox* Box = &m_Boxes[Key];
+			bool bRescan = Box->Overflow || !Box->pIndex || !Box->pIndex->IsScanned();
+			QList<QPair<CDirSizeIndex::EChange, QString>> Changes;
+			if (Box->Changed && !bRescan && !Box->ForceUpdate) {
+				Changes.swap(Box->Changes);
+				Box->Changed = false;
+			}
 			m_Mutex.unlock();
 
+			if (!Changes.isEmpty()) {
+
+				// apply the changes reported since the last pass to the index, without walking the box again
+				foreach(const auto& Change, Changes)
+					Box->pIndex->Update(Change.first, Change.second);
+
+				if (Box->TotalSize != Box->pIndex->GetTotalSize()) {
+					Box->TotalSize = Box->pIndex->GetTotalSize();
+					QMetaObject::invokeMethod(this, "UpdateBox", Qt::QueuedConnection,
+						Q_ARG(QString, Key)
+					);
+				}
+			}
+
 			quint64 MinScanInterval = Box->ScanDuration * 100;
 			if (MinScanInterval < 30 * 1000)
 				MinScanInterval = 30 * 1000;
 			if (MinScanInterval > 30 * 60 * 1000)
 				MinScanInterval = 30 * 60 * 1000;
 
-			if ((Box->Changed && (!Box->IsWatched || Box->LastScan == 0 || (CurTick - Box->LastScan) > MinScanInterval)) || Box->ForceUpdate) {
+			if ((Box->Changed && bRescan && (!Box->IsWatched || Box->LastScan == 0 || (CurTick - Box->LastScan) > MinScanInterval)) || Box->ForceUpdate) {
 
 				qDebug() << "Rescanning:" << Key << "(" + QDateTime::currentDateTime().toString() + ")";
 
@@ -76,7 +102,17 @@ void CBoxMonitor::run()
 
 				Box->ScanDuration = -1;
 
-				Box->TotalSize = CounDirSize(Key, Box);
+				// changes reported while scanning get applied on top, updating the index is idempotent
+				m_Mutex.lock();
+				Box->Changes.clear();
+				Box->Overflow = false;
+				m_Mutex.unlock();
+
+				if (!Box->pIndex)
+					Box->pIndex = QSharedPointer<CDirSizeIndex>(new CDirSizeIndex(Key, new CQtDirWalker(), Qt::CaseInsensitive));
+				Box->pIndex->Scan(&m_bTerminate);
+
+				Box->TotalSize = Box->pIndex->GetTotalSize();
 
 				Box->ScanDuration = GetCurTick() - ScanStart;
 				Box->LastScan = GetCurTick();
@@ -86,7 +122,9 @@ void CBoxMonitor::run()
 					Q_ARG(QString, Key)
 				);
 
-				Box->Changed = false;
+				m_Mutex.lock();
+				Box->Changed = Box->Overflow || !Box->Changes.isEmpty();
+				m_Mutex.unlock();
 				Box->ForceUpdate = false;
 			}
 
@@ -118,8 +156,10 @@ void CBoxMonitor::WatchBox(CSandBoxPlus* pBox)
 	SBox& Box = m_Boxes[pBox->GetFileRoot()];
 	Box.pBox = pBox;
 
+	if (!Box.IsWatched)
+		Box.Overflow = true; // the index may have missed changes, rebuild it on the next scan
 	Box.IsWatched = true;
-	AddDirectory(pBox->GetFileRoot().toStdWString().c_str(), true, FILE_NOTIFY_CHANGE_SIZE);
+	AddDirectory(pBox->GetFileRoot().toStdWString().c_str(), true, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_SIZE, 0x10000);
 }
 
 void CBoxMonitor::ScanBox(CSandBoxPlus* pBox)
@@ -143,6 +183,8 @@ void CBoxMonitor::CloseBox(CSandBoxPlus* pBox)
 	if(Box.IsWatched)
 		DetachDirectory(pBox->GetFileRoot().toStdWString().c_str());
 	Box.IsWatched = false;
+	Box.Overflow = true; // changes made while not watched are not seen, rebuild the index on the next scan
+	Box.Changes.clear();
 
 	//Box.Changed = true;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Helpers/ReadDirectoryChanges.h"
+#include "Helpers/DirSizeIndex.h"
 #include "SbiePlusAPI.h"
 
 class CBoxMonitor : public QThread, public CReadDirectoryChanges
@@ -11,6 +12,7 @@ public:
 	~CBoxMonitor();
 
 	virtual void Notify(const std::wstring& strDirectory);
+	virtual void NotifyChanges(const std::wstring& strDirectory, const std::vector<TDirectoryChangeNotification>& Changes);
 
 	virtual void run();
 
@@ -33,6 +35,7 @@ protected:
 		SBox() {
 			ForceUpdate = false;
 			Changed = false;
+			Overflow = false;
 			IsWatched = false;
 			LastScan = 0;
 			ScanDuration = 0;
@@ -42,14 +45,16 @@ protected:
 		QPointer<CSandBoxPlus> pBox;
 		bool ForceUpdate;
 		bool Changed;
+		bool Overflow;
 		bool IsWatched;
 		quint64 LastScan;
 		quint64 ScanDuration;
 
 		quint64 TotalSize;
-	};
 
-	quint64 CounDirSize(const QString& Dir, SBox* Box);
+		QSharedPointer<CDirSizeIndex> pIndex;
+		QList<QPair<CDirSizeIndex::EChange, QString>> Changes;
+	};
 
 	QMutex m_Mutex;
 	QMap<QString, SBox> m_Boxes;
@@ -159,32 +159,30 @@ QVariantList CSbieObject::ReadTrace(const QVariantMap& Options)
 
 	QVariantList List;
 
-	const QVector<CTraceEntryPtr> &ResourceLog = theAPI->GetTrace();
-	for (int i = Start; i < ResourceLog.count() && (!Count || Count > ResourceLog.count()); i++)
+	const CTraceStore& ResourceLog = theAPI->GetTrace();
+	for (int i = Start; i < ResourceLog.Count() && (!Count || Count > ResourceLog.Count()); i++)
 	{
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
-
-		if (pCurrentBox != NULL && pCurrentBox != pEntry->GetBoxPtr())
+		if (pCurrentBox != NULL && pCurrentBox != ResourceLog.GetBoxPtr(i))
 			continue;
 
-		if (FilterPid != 0 && FilterPid != pEntry->GetProcessId())
+		if (FilterPid != 0 && FilterPid != ResourceLog.GetProcessId(i))
 			continue;
 
-		if (FilterTid != 0 && FilterTid != pEntry->GetThreadId())
+		if (FilterTid != 0 && FilterTid != ResourceLog.GetThreadId(i))
 			continue;
 
-		//if (!FilterTypes.isEmpty() && !FilterTypes.contains(pEntry->GetType()))
+		//if (!FilterTypes.isEmpty() && !FilterTypes.contains(ResourceLog.GetType(i)))
 		//	continue;
 
 		QVariantMap Entry;
-		Entry["timeStamp"] = pEntry->GetTimeStamp();
-		Entry["process"] = pEntry->GetProcessName();
-		Entry["pid"] = pEntry->GetProcessId();
-		Entry["tid"] = pEntry->GetThreadId();
-		Entry["type"] = pEntry->GetTypeStr();
-		Entry["status"] = pEntry->GetStautsStr();
-		Entry["name"] = pEntry->GetName();
-		Entry["message"] = pEntry->GetMessage();
+		Entry["timeStamp"] = ResourceLog.GetTimeStamp(i);
+		Entry["process"] = ResourceLog.GetProcessName(i);
+		Entry["pid"] = ResourceLog.GetProcessId(i);
+		Entry["tid"] = ResourceLog.GetThreadId(i);
+		Entry["type"] = ResourceLog.GetTypeStr(i);
+		Entry["status"] = ResourceLog.GetStautsStr(i);
+		Entry["name"] = ResourceLog.GetName(i);
+		Entry["message"] = ResourceLog.GetMessage(i);
 		List.append(Entry);
 	}
 
@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "DirSizeIndex.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// CQtDirWalker
+//
+
+bool CQtDirWalker::List(const QString& Path, QList<SEntry>& Entries)
+{
+	QDir Dir(Path);
+	if (!Dir.exists())
+		return false;
+
+	foreach(const QFileInfo& Info, Dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot))
+	{
+		SEntry Entry;
+		Entry.Name = Info.fileName();
+		Entry.IsDir = Info.isDir();
+		if (!Entry.IsDir)
+			Entry.Size = GetSize(Info);
+		Entries.append(Entry);
+	}
+	return true;
+}
+
+bool CQtDirWalker::Stat(const QString& Path, SEntry& Entry)
+{
+	QFileInfo Info(Path);
+	if (!Info.exists())
+		return false;
+
+	Entry.Name = Info.fileName();
+	Entry.IsDir = Info.isDir();
+	Entry.Size = Entry.IsDir ? 0 : GetSize(Info);
+	return true;
+}
+
+quint64 CQtDirWalker::GetSize(const QFileInfo& Info)
+{
+	// measure shortcuts by opening the link file itself, as Qt may resolve them to their target
+	if (Info.isShortcut())
+	{
+		quint64 Size = 0;
+		QFile File(Info.filePath());
+		if (File.open(QFile::ReadOnly))
+			Size = File.size();
+		File.close();
+		return Size;
+	}
+	return Info.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CDirSizeIndex
+//
+
+CDirSizeIndex::CDirSizeIndex(const QString& Root, CDirWalker* pWalker, Qt::CaseSensitivity CaseSensitivity)
+{
+	m_RootPath = Root;
+	m_pWalker = pWalker;
+	m_CaseSensitivity = CaseSensitivity;
+	m_bScanned = false;
+}
+
+CDirSizeIndex::~CDirSizeIndex()
+{
+	ClearNode(&m_Root);
+	delete m_pWalker;
+}
+
+void CDirSizeIndex::Scan(const volatile bool* pAbort)
+{
+	ClearNode(&m_Root);
+	ScanNode(&m_Root, m_RootPath, pAbort);
+	m_bScanned = !(pAbort && *pAbort);
+}
+
+void CDirSizeIndex::ScanNode(SNode* pNode, const QString& Path, const volatile bool* pAbort)
+{
+	if (pAbort && *pAbort)
+		return;
+
+	QList<CDirWalker::SEntry> Entries;
+	m_pWalker->List(Path, Entries);
+	foreach(const CDirWalker::SEntry& Entry, Entries)
+	{
+		QString Key = MakeKey(Entry.Name);
+		if (Entry.IsDir)
+		{
+			SNode* pChild = new SNode;
+			pChild->Parent = pNode;
+			pNode->Dirs.insert(Key, pChild);
+			ScanNode(pChild, Path + "/" + Entry.Name, pAbort);
+			pNode->Size += pChild->Size;
+		}
+		else
+		{
+			pNode->Files.insert(Key, Entry.Size);
+			pNode->Size += Entry.Size;
+		}
+	}
+}
+
+void CDirSizeIndex::ClearNode(SNode* pNode)
+{
+	foreach(SNode* pChild, pNode->Dirs)
+	{
+		ClearNode(pChild);
+		delete pChild;
+	}
+	pNode->Dirs.clear();
+	pNode->Files.clear();
+	pNode->Size = 0;
+}
+
+void CDirSizeIndex::AddSize(SNode* pNode, qint64 Delta)
+{
+	for (; pNode; pNode = pNode->Parent)
+		pNode->Size += Delta;
+}
+
+QString CDirSizeIndex::MakePath(const QStringList& Names, int Count) const
+{
+	QString Path = m_RootPath;
+	for (int i = 0; i < Count; i++)
+		Path += "/" + Names[i];
+	return Path;
+}
+
+CDirSizeIndex::SNode* CDirSizeIndex::FindNode(const QStringList& Names, int Count) const
+{
+	SNode* pNode = (SNode*)&m_Root;
+	for (int i = 0; i < Count && pNode; i++)
+		pNode = pNode->Dirs.value(MakeKey(Names[i]));
+	return pNode;
+}
+
+quint64 CDirSizeIndex::GetSize(const QString& RelativePath) const
+{
+	QStringList Names = RelativePath.split(QRegularExpression("[\\\\/]"), Qt::SkipEmptyParts);
+	if (Names.isEmpty())
+		return m_Root.Size;
+
+	SNode* pParent = FindNode(Names, Names.count() - 1);
+	if (!pParent)
+		return 0;
+	QString Key = MakeKey(Names.last());
+	if (SNode* pNode = pParent->Dirs.value(Key))
+		return pNode->Size;
+	return pParent->Files.value(Key);
+}
+
+void CDirSizeIndex::RemoveEntry(SNode* pParent, const QString& Key)
+{
+	if (SNode* pNode = pParent->Dirs.take(Key))
+	{
+		AddSize(pParent, -(qint64)pNode->Size);
+		ClearNode(pNode);
+		delete pNode;
+	}
+	else if (pParent->Files.contains(Key))
+		AddSize(pParent, -(qint64)pParent->Files.take(Key));
+}
+
+void CDirSizeIndex::Update(EChange Change, const QString& RelativePath)
+{
+	QStringList Names = RelativePath.split(QRegularExpression("[\\\\/]"), Qt::SkipEmptyParts);
+	if (Names.isEmpty())
+		return;
+
+	SNode* pParent = FindNode(Names, Names.count() - 1);
+	if (!pParent)
+	{
+		// a parent folder is not known yet, index the topmost missing one instead
+		for (int Count = Names.count() - 1; Count > 0; Count--)
+		{
+			if (FindNode(Names, Count - 1))
+			{
+				Update(eAdded, QStringList(Names.mid(0, Count)).join("/"));
+				break;
+			}
+		}
+		return;
+	}
+
+	QString Key = MakeKey(Names.last());
+
+	CDirWalker::SEntry Entry;
+	if (Change == eRemoved || !m_pWalker->Stat(MakePath(Names, Names.count()), Entry))
+	{
+		RemoveEntry(pParent, Key);
+		return;
+	}
+
+	if (Entry.IsDir)
+	{
+		// the content of a modified folder is reported on its own, a new or renamed one gets indexed here
+		if (Change == eModified && pParent->Dirs.contains(Key))
+			return;
+
+		RemoveEntry(pParent, Key);
+
+		SNode* pNode = new SNode;
+		pNode->Parent = pParent;
+		ScanNode(pNode, MakePath(Names, Names.count()), NULL);
+		pParent->Dirs.insert(Key, pNode);
+		AddSize(pParent, pNode->Size);
+	}
+	else
+	{
+		if (pParent->Dirs.contains(Key))
+			RemoveEntry(pParent, Key);
+
+		quint64 OldSize = pParent->Files.value(Key);
+		pParent->Files.insert(Key, Entry.Size);
+		AddSize(pParent, (qint64)Entry.Size - (qint64)OldSize);
+	}
+}
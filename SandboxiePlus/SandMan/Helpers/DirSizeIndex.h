@@ -0,0 +1,81 @@
+#pragma once
+
+//
+// Size index of a directory tree, each directory caches the aggregate size of its content,
+// so single changes can be applied without walking the whole tree again.
+// The index does not use any OS specific API, the file system is accessed through a CDirWalker.
+//
+
+class CDirWalker
+{
+public:
+	virtual ~CDirWalker() {}
+
+	struct SEntry
+	{
+		QString Name;
+		quint64 Size = 0;
+		bool IsDir = false;
+	};
+
+	virtual bool List(const QString& Path, QList<SEntry>& Entries) = 0;
+	virtual bool Stat(const QString& Path, SEntry& Entry) = 0;
+};
+
+class CQtDirWalker : public CDirWalker
+{
+public:
+	virtual bool List(const QString& Path, QList<SEntry>& Entries);
+	virtual bool Stat(const QString& Path, SEntry& Entry);
+
+protected:
+	static quint64 GetSize(const QFileInfo& Info);
+};
+
+class CDirSizeIndex
+{
+public:
+	enum EChange
+	{
+		eAdded = 0,
+		eRemoved,
+		eModified
+	};
+
+	CDirSizeIndex(const QString& Root, CDirWalker* pWalker, Qt::CaseSensitivity CaseSensitivity = Qt::CaseSensitive); // takes ownership of the walker
+	~CDirSizeIndex();
+
+	void Scan(const volatile bool* pAbort = NULL);
+	bool IsScanned() const { return m_bScanned; }
+
+	void Update(EChange Change, const QString& RelativePath);
+
+	quint64 GetTotalSize() const { return m_Root.Size; }
+	quint64 GetSize(const QString& RelativePath) const;
+
+protected:
+	struct SNode
+	{
+		SNode* Parent = NULL;
+		quint64 Size = 0;
+		QHash<QString, quint64> Files;
+		QHash<QString, SNode*> Dirs;
+	};
+
+	QString MakeKey(const QString& Name) const { return m_CaseSensitivity == Qt::CaseSensitive ? Name : Name.toLower(); }
+	QString MakePath(const QStringList& Names, int Count) const;
+
+	SNode* FindNode(const QStringList& Names, int Count) const;
+
+	void ScanNode(SNode* pNode, const QString& Path, const volatile bool* pAbort);
+	static void ClearNode(SNode* pNode);
+	static void AddSize(SNode* pNode, qint64 Delta);
+
+	void RemoveEntry(SNode* pParent, const QString& Key);
+
+	QString m_RootPath;
+	CDirWalker* m_pWalker;
+	Qt::CaseSensitivity m_CaseSensitivity;
+	SNode m_Root;
+	bool m_bScanned;
+};
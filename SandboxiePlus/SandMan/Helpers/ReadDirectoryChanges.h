@@ -119,8 +119,16 @@ public:
 
 	void DetachDirectory( LPCWSTR wszDirectory );
 
+	/// <summary>
+	/// Called when the changes to a directory could not be tracked, because the buffer overflowed.
+	/// </summary>
 	virtual void Notify( const std::wstring& strDirectory ) {}
 
+	/// <summary>
+	/// Called with the changes to a directory, the file names are relative to it.
+	/// </summary>
+	virtual void NotifyChanges( const std::wstring& strDirectory, const std::vector<TDirectoryChangeNotification>& Changes ) { Notify(strDirectory); }
+
 	/// <summary>
 	/// Return a handle for the Win32 Wait... functions that will be
 	/// signaled when there is a queue entry.
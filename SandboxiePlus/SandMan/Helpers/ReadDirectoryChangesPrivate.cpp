@@ -124,9 +124,13 @@ VOID CALLBACK CReadChangesRequest::NotificationCompletion(
 		return;
 	}
 
-	// This might mean overflow? Not sure.
+	// The buffer overflowed, the changes are lost, only report that something changed.
 	if(!dwNumberOfBytesTransfered)
+	{
+		pBlock->BeginRead();
+		pBlock->m_pServer->m_pBase->Notify(pBlock->GetDirectory());
 		return;
+	}
 
 	// Can't use sizeof(FILE_NOTIFY_INFORMATION) because
 	// the structure is padded to 16 bytes.
@@ -139,15 +143,15 @@ VOID CALLBACK CReadChangesRequest::NotificationCompletion(
 	// again once the completion routine is called.
 	pBlock->BeginRead();
 
-	//pBlock->ProcessNotification();
-
-	pBlock->m_pServer->m_pBase->Notify(pBlock->GetDirectory());
+	pBlock->ProcessNotification();
 }
 
 void CReadChangesRequest::ProcessNotification()
 {
 	BYTE* pBase = m_BackupBuffer.data();
 
+	std::vector<TDirectoryChangeNotification> Changes;
+
 	for (;;)
 	{
 		FILE_NOTIFY_INFORMATION& fni = (FILE_NOTIFY_INFORMATION&)*pBase;
@@ -172,12 +176,19 @@ void CReadChangesRequest::ProcessNotification()
 				wstrFilename = wbuf;
 		}
 
-		//m_pServer->m_pBase->Push(fni.Action, wstrFilename);
+		// Report the name relative to the watched directory.
+		size_t uPrefix = m_wstrDirectory.length() + (m_wstrDirectory.back() != L'\\' ? 1 : 0);
+		if (wstrFilename.length() > uPrefix && _wcsnicmp(wstrFilename.c_str(), m_wstrDirectory.c_str(), m_wstrDirectory.length()) == 0)
+			Changes.push_back(TDirectoryChangeNotification(fni.Action, wstrFilename.substr(uPrefix)));
+		else
+			Changes.push_back(TDirectoryChangeNotification(fni.Action, std::wstring(fni.FileName, fni.FileNameLength/sizeof(wchar_t))));
 
 		if (!fni.NextEntryOffset)
 			break;
 		pBase += fni.NextEntryOffset;
 	};
+
+	m_pServer->m_pBase->NotifyChanges(m_wstrDirectory, Changes);
 }
 
 }
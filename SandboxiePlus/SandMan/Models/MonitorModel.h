@@ -27,15 +27,15 @@ public:
 	QString		GetTypeStr() const { return CTraceEntry::GetTypeStr(m_Type); }
 	int			GetCount() const { return m_Counter; }
 
-	void		Merge(const CTraceEntryPtr& pEntry) {
+	void		Merge(const CTraceStore& Store, int Row) {
 #ifdef USE_MERGE_TRACE
-		m_Counter += pEntry->GetCount(); 
+		m_Counter += Store.GetCount(Row); 
 #else
 		m_Counter++;
 #endif
-		if (!m_bOpen && pEntry->IsOpen())
+		if (!m_bOpen && Store.IsOpen(Row))
 			m_bOpen = true;
-		if (!m_bClosed && pEntry->IsClosed())
+		if (!m_bClosed && Store.IsClosed(Row))
 			m_bClosed = true;
 	}
 
@@ -346,7 +346,7 @@ QList<QVariant> CSbieModel::Sync(const QMap<QString, CSandBoxPtr>& BoxList, cons
 				switch (section)
 				{
 				//case eName:				ColValue.Formatted = Value.toString().replace("_", " "); break;
-				case eInfo:				ColValue.Formatted = Value.toULongLong() == -2 ? tr("Empty") : (Value.toULongLong() > 0 ? FormatSize(Value.toULongLong()) : ""); break;
+				case eInfo:				ColValue.Formatted = Value.toULongLong() == -2 ? tr("Empty") : (Value.toULongLong() > 0 ? (pBoxEx->GetImageSize() > 0 ? tr("%1 of %2").arg(FormatSize(Value.toULongLong())).arg(FormatSize(pBoxEx->GetImageSize())) : FormatSize(Value.toULongLong())) : ""); break;
 				}
 			}
 
@@ -12,6 +12,7 @@ CTraceModel::CTraceModel(QObject* parent)
 	:QAbstractItemModelEx(parent)
 {
 	m_bTree = false;
+	m_pStore = NULL;
 
 	m_Root = MkNode(0);
 
@@ -24,17 +25,19 @@ CTraceModel::~CTraceModel()
 	m_Root = NULL;
 }
 
-QList<QModelIndex> CTraceModel::Sync(const QVector<CTraceEntryPtr>& EntryList)
+QList<QModelIndex> CTraceModel::Sync(const CTraceStore& Store, const QVector<int>& RowList)
 {
 	QList<QModelIndex> NewBranches;
 
+	m_pStore = &Store;
+
 	// Note: since this is a log and we ever always only add entries we save cpu time by always skipping the already know portion of the list
 
 	int i = 0;
-	if (EntryList.count() >= m_LastCount && m_LastCount > 0)
+	if (RowList.count() >= m_LastCount && m_LastCount > 0)
 	{
 		i = m_LastCount - 1;
-		if (m_LastID == EntryList.at(i)->GetUID())
+		if (m_LastID == Store.GetUID(RowList.at(i)))
 			i++;
 		else
 			i = 0;
@@ -42,18 +45,18 @@ QList<QModelIndex> CTraceModel::Sync(const QVector<CTraceEntryPtr>& EntryList)
 
 	emit layoutAboutToBeChanged();
 
-	for (; i < EntryList.count(); i++)
+	for (; i < RowList.count(); i++)
 	{
-		const CTraceEntryPtr& pEntry = EntryList.at(i);
+		int Row = RowList.at(i);
 
-		quint64 ID = pEntry->GetUID();
+		quint64 ID = Store.GetUID(Row);
 
 		STreeNode* pNode = MkNode(ID);
-		pNode->pEntry = pEntry;
+		pNode->Entry = Row;
 		if (m_bTree)
 		{
-			quint64 Path = PROCESS_MARK | pEntry->GetProcessId();
-			Path |= quint64(THREAD_MARK | pEntry->GetThreadId()) << 32;
+			quint64 Path = PROCESS_MARK | Store.GetProcessId(Row);
+			Path |= quint64(THREAD_MARK | Store.GetThreadId(Row)) << 32;
 
 			pNode->Parent = FindParentNode(m_Root, Path, 0, &NewBranches);
 		}
@@ -66,9 +69,9 @@ QList<QModelIndex> CTraceModel::Sync(const QVector<CTraceEntryPtr>& EntryList)
 
 	emit layoutChanged();
 
-	m_LastCount = EntryList.count();
+	m_LastCount = RowList.count();
 	if(m_LastCount)
-		m_LastID = EntryList.last()->GetUID();
+		m_LastID = Store.GetUID(RowList.last());
 
 	return NewBranches;
 }
@@ -157,22 +160,24 @@ bool CTraceModel::TestHighLight(STreeNode* pNode) const
 
 QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
 {
-	const CTraceEntryPtr& pEntry = pNode->pEntry;
-	if(!pEntry.constData())
+	if(!HasEntry(pNode))
 	{
 		if (section != FIRST_COLUMN || (role != Qt::DisplayRole && role != Qt::EditRole))
 			return QVariant();
 
 		quint32 id = pNode->ID;
 		if (id & PROCESS_MARK) {
-			CTraceEntryPtr pProcEntry; // pick first log entry of first thread to query the process name
+			STreeNode* pProcNode = NULL; // pick first log entry of first thread to query the process name
 			if (!pNode->Children.isEmpty()) {
 				STreeNode* pSubNode = pNode->Children.first();
 				if (!pSubNode->Children.isEmpty())
-					pProcEntry = pSubNode->Children.first()->pEntry;
+					pProcNode = pSubNode->Children.first();
+			}
+			if (pProcNode && HasEntry(pProcNode)) {
+				QString Name = m_pStore->GetProcessName(pProcNode->Entry);
+				if (!Name.isEmpty())
+					return tr("%1 (%2)").arg(Name).arg(m_pStore->GetProcessId(pProcNode->Entry));
 			}
-			if (pProcEntry && !pProcEntry->GetProcessName().isEmpty())
-				return tr("%1 (%2)").arg(pProcEntry->GetProcessName()).arg(pProcEntry->GetProcessId());
 			return tr("Process %1").arg(id & 0x0FFFFFFF);
 		}
 		else if (id & THREAD_MARK)
@@ -181,6 +186,8 @@ QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
 			return QString::number(id, 16).rightJustified(8, '0');
 	}
 	
+	int Row = pNode->Entry;
+
 	switch(role)
 	{
 		case Qt::DisplayRole:
@@ -188,24 +195,25 @@ QVariant CTraceModel::NodeData(STreeNode* pNode, int role, int section) const
 		{
 			switch (section)
 			{
-			//case eProcess:		return pEntry->GetProcessId(); 
-			//case eTimeStamp:		return pEntry->GetUID();
+			//case eProcess:		return m_pStore->GetProcessId(Row); 
+			//case eTimeStamp:		return m_pStore->GetUID(Row);
 			case eProcess:		{
 									if(!m_bTree) {
-										QString Name = pEntry->GetProcessName();
+										QString Name = m_pStore->GetProcessName(Row);
 										return QString("%1 (%2, %3) - %4").arg(Name.isEmpty() ? tr("Unknown") : Name)
-											.arg(pEntry->GetProcessId()).arg(pEntry->GetThreadId())
-											.arg(QDateTime::fromMSecsSinceEpoch(pEntry->GetTimeStamp()).toString("hh:mm:ss.zzz"));
+											.arg(m_pStore->GetProcessId(Row)).arg(m_pStore->GetThreadId(Row))
+											.arg(QDateTime::fromMSecsSinceEpoch(m_pStore->GetTimeStamp(Row)).toString("hh:mm:ss.zzz"));
 									} else 
-										return QDateTime::fromMSecsSinceEpoch(pEntry->GetTimeStamp()).toString("hh:mm:ss.zzz");
+										return QDateTime::fromMSecsSinceEpoch(m_pStore->GetTimeStamp(Row)).toString("hh:mm:ss.zzz");
 								}
-			case eType:				return pEntry->GetTypeStr();
-			case eStatus:			return pEntry->GetStautsStr();
+			case eType:				return m_pStore->GetTypeStr(Row);
+			case eStatus:			return m_pStore->GetStautsStr(Row);
 			case eValue:		{			
-									QString sValue = pEntry->GetName();
-									if (!sValue.isEmpty() && !pEntry->GetMessage().isEmpty())
+									QString sValue = m_pStore->GetName(Row);
+									QString sMessage = m_pStore->GetMessage(Row);
+									if (!sValue.isEmpty() && !sMessage.isEmpty())
 										sValue += " ";
-									sValue += pEntry->GetMessage();
+									sValue += sMessage;
 									return sValue;
 								}
 			}
@@ -235,7 +243,9 @@ CTraceEntryPtr CTraceModel::GetEntry(const QModelIndex& index) const
 	STreeNode* pNode = static_cast<STreeNode*>(index.internalPointer());
 	ASSERT(pNode);
 
-	return pNode->pEntry;
+	if (!HasEntry(pNode))
+		return CTraceEntryPtr();
+	return m_pStore->GetEntry(pNode->Entry); // materialize the row only on demand
 }
 
 QVariant CTraceModel::data(const QModelIndex &index, int role) const
@@ -17,7 +17,7 @@ public:
 	
 	void			SetHighLight(const QString& Exp) { m_HighLightExp = Exp; }
 
-	QList<QModelIndex>	Sync(const QVector<CTraceEntryPtr>& EntryList);
+	QList<QModelIndex>	Sync(const CTraceStore& Store, const QVector<int>& RowList);
 
 	CTraceEntryPtr	GetEntry(const QModelIndex& index) const;
 	QVariant		GetItemID(const QModelIndex& index) const;
@@ -80,10 +80,13 @@ protected:
 		//int					Row = 0;
 		QVector<STreeNode*>	Children;
 
-		CTraceEntryPtr		pEntry;
+		int					Entry = -1; // row in the trace store
 	};
 
 
+	const CTraceStore*		m_pStore;
+	bool					HasEntry(STreeNode* pNode) const { return pNode->Entry != -1 && m_pStore && pNode->Entry < m_pStore->Count(); }
+
 	bool					m_bTree;
 	QVariant				m_LastID;
 	int						m_LastCount;
@@ -21,6 +21,7 @@ HEADERS += ./stdafx.h \
     ./Helpers/WinAdmin.h \
     ./Helpers/WinHelper.h \
     ./Helpers/StorageInfo.h \
+    ./Helpers/DirSizeIndex.h \
     ./Helpers/ReadDirectoryChanges.h \
     ./Helpers/ReadDirectoryChangesPrivate.h \
     ./Helpers/TabOrder.h \
@@ -73,6 +74,7 @@ SOURCES += ./main.cpp \
     ./Helpers/WinAdmin.cpp \
     ./Helpers/WinHelper.cpp \
     ./Helpers/StorageInfo.cpp \
+    ./Helpers/DirSizeIndex.cpp \
     ./Helpers/ReadDirectoryChanges.cpp \
     ./Helpers/ReadDirectoryChangesPrivate.cpp \
     ./Helpers/IniHighlighter.cpp \
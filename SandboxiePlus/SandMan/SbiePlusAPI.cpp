@@ -161,6 +161,7 @@ CSandBoxPlus::CSandBoxPlus(const QString& BoxName, class CSbieAPI* pAPI) : CSand
 	m_bRootAccessOpen = false;
 
 	m_TotalSize = theConf->GetValue("SizeCache/" + m_Name, -1).toLongLong();
+	m_ImageSize = 0;
 
 	m_SuspendRecovery = false;
 	m_IsEmpty = false;
@@ -180,10 +181,11 @@ CSandBoxPlus::~CSandBoxPlus()
 
 class QFileX : public QFile {
 public:
-	QFileX(const QString& path, const CSbieProgressPtr& pProgress, CArchive* pArchive) : QFile(path) 
+	QFileX(const QString& path, const CSbieProgressPtr& pProgress, CArchive* pArchive, qint64 KnownSize = -1) : QFile(path) 
 	{
 		m_pProgress = pProgress;
 		m_pArchive = pArchive;
+		m_KnownSize = KnownSize;
 	}
 
 	bool open(OpenMode flags) override
@@ -197,6 +199,8 @@ public:
 
 	qint64 size() const override
 	{
+		if (m_KnownSize != -1 && !isOpen())
+			return m_KnownSize;
 		qint64 Size = QFile::size();
 		if (QFileInfo(fileName()).isShortcut())
 		{
@@ -211,8 +215,64 @@ public:
 protected:
 	CSbieProgressPtr m_pProgress;
 	CArchive* m_pArchive;
+	qint64 m_KnownSize;
 };
 
+struct SBoxFile
+{
+	QString Path;
+	qint64 Size;
+	quint32 Attributes;
+};
+
+std::wstring CSandBoxPlus_LongPath(const QString& Path)
+{
+	// FindFirstFileExW is limited to MAX_PATH unless the path carries the long path prefix
+	// and does no normalization on such a path, so it must not contain empty or relative components
+	QString LongPath = QDir::toNativeSeparators(QDir::cleanPath(Path));
+	if (LongPath.startsWith("\\\\?\\"))
+		return LongPath.toStdWString();
+	if (LongPath.startsWith("\\\\"))
+		return QString("\\\\?\\UNC\\" + LongPath.mid(2)).toStdWString();
+	return QString("\\\\?\\" + LongPath).toStdWString();
+}
+
+bool CSandBoxPlus_ListFiles(const QString& RootPath, const QString& SubPath, QList<SBoxFile>& FileList, QString& Error)
+{
+	// one pass over the directory gives us the size and attributes without opening every file again
+	WIN32_FIND_DATAW FindData;
+	HANDLE hFind = FindFirstFileExW(CSandBoxPlus_LongPath(RootPath + SubPath + "*").c_str(), 
+		FindExInfoBasic, &FindData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		Error = CSandBox::tr("Failed to list folder: %1, error: %2").arg(RootPath + SubPath).arg(GetLastError());
+		return false;
+	}
+
+	QStringList Dirs;
+	do {
+		QString Name = QString::fromWCharArray(FindData.cFileName);
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			if (Name != "." && Name != "..")
+				Dirs.append(Name);
+		}
+		else
+			FileList.append(SBoxFile{ SubPath + Name, (qint64)(((quint64)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow), FindData.dwFileAttributes });
+	} while (FindNextFileW(hFind, &FindData));
+	DWORD LastError = GetLastError();
+	FindClose(hFind);
+
+	if (LastError != ERROR_NO_MORE_FILES) {
+		Error = CSandBox::tr("Failed to list folder: %1, error: %2").arg(RootPath + SubPath).arg(LastError);
+		return false;
+	}
+
+	foreach(const QString& Dir, Dirs) {
+		if (!CSandBoxPlus_ListFiles(RootPath, SubPath + Dir + "/", FileList, Error))
+			return false;
+	}
+	return true;
+}
+
 void CSandBoxPlus::ExportBoxAsync(const CSbieProgressPtr& pProgress, const QString& ExportPath, const QString& RootPath, const QString& Section, const QVariantMap& vParams)
 {
 	//CArchive Archive(ExportPath + ".tmp");
@@ -235,21 +295,21 @@ void CSandBoxPlus::ExportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 		File.close();
 	}
 
-	QStringList FileList = ListDir(RootPath + "\\");
-	foreach(const QString& File, FileList)
+	// an archive which silently misses part of the box would be worse than none
+	QList<SBoxFile> FileList;
+	QString Error;
+	if (!CSandBoxPlus_ListFiles(RootPath + "\\", "", FileList, Error)) {
+		File.remove();
+		pProgress->Finish(SB_ERR(SB_OtherError, QVariantList() << Error));
+		return;
+	}
+	foreach(const SBoxFile& File, FileList)
 	{
-		StrPair RootName = Split2(File, "\\", true);
-		if(RootName.second.isEmpty())
-		{
-			RootName.second = RootName.first;
-			RootName.first = "";
-		}
-		int ArcIndex = Archive.AddFile(RootName.second);
+		int ArcIndex = Archive.AddFile(File.Path);
 		if(ArcIndex != -1)
 		{
-			QString FileName = (RootName.first.isEmpty() ?  RootPath + "\\" : RootName.first) + RootName.second;
-			Files.insert(ArcIndex, new QFileX(FileName, pProgress, &Archive));
-			Attributes.insert(ArcIndex, GetFileAttributesW(QString(FileName).replace("/", "\\").toStdWString().c_str()));
+			Files.insert(ArcIndex, new QFileX(RootPath + "\\" + File.Path, pProgress, &Archive, File.Size));
+			Attributes.insert(ArcIndex, File.Attributes);
 		}
 		//else
 			// this file is already present in the archive, this should not happen !!!
@@ -318,6 +378,7 @@ void CSandBoxPlus::ImportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 	bool IsBoxArchive = false;
 
 	QMap<int, QIODevice*> Files;
+	QSet<QString> KnownDirs; // create each folder of the tree only once
 
 	for (int i = 0; i < Archive.FileCount(); i++) {
 		int ArcIndex = Archive.FindByIndex(i);
@@ -326,7 +387,7 @@ void CSandBoxPlus::ImportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 		QString File = Archive.FileProperty(ArcIndex, "Path").toString();
 		if (File == "BoxConfig.ini")
 			IsBoxArchive = true;
-		Files.insert(ArcIndex, new QFileX(CArchive::PrepareExtraction(File, RootPath + "\\"), pProgress, &Archive));
+		Files.insert(ArcIndex, new QFileX(CArchive::PrepareExtraction(File, RootPath + "\\", &KnownDirs), pProgress, &Archive));
 	}
 
 	if(!IsBoxArchive) {
@@ -335,7 +396,7 @@ void CSandBoxPlus::ImportBoxAsync(const CSbieProgressPtr& pProgress, const QStri
 	}
 
 	SB_STATUS Status = SB_OK;
-	if (!Archive.Extract(&Files))
+	if (!Archive.Extract(&Files, true, qMin(QThread::idealThreadCount(), 4))) // only non solid archives are extracted in parallel
 		Status = SB_ERR((ESbieMsgCodes)SBX_7zExtractFailed);
 
 	if (!Status.IsError() && !pProgress->IsCanceled())
@@ -692,10 +753,25 @@ void CSandBoxPlus::UpdateSize(bool bReset)
 	m_IsEmpty = IsEmpty();
 
 	if (m_bImageFile) {
+		// the image is sparse, never written and trimmed ranges take no space on the volume
 		LARGE_INTEGER liSparseFileCompressedSize;
 		liSparseFileCompressedSize.LowPart = GetCompressedFileSizeW(GetBoxImagePath().toStdWString().c_str(), (LPDWORD)&liSparseFileCompressedSize.HighPart);
+		if (liSparseFileCompressedSize.LowPart == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+			liSparseFileCompressedSize.QuadPart = 0;
 		m_TotalSize = liSparseFileCompressedSize.QuadPart;
+
+		// the logical size of a mounted image is the one ImBox took from the image and its header, else use the length of the file
+		m_ImageSize = 0;
+		if (!m_Mount.isEmpty()) {
+			auto res = theAPI->ImBoxQuery(m_RegPath);
+			if (!res.IsError())
+				m_ImageSize = res.GetValue().value("DiskSize").toULongLong();
+		}
+		if (m_ImageSize == 0)
+			m_ImageSize = QFileInfo(GetBoxImagePath()).size();
 	}
+	else
+		m_ImageSize = 0;
 
 	if (m_bImageFile && m_Mount.isEmpty())
 		return;
@@ -135,6 +135,7 @@ public:
 	virtual quint64			GetSize() const						{ if(m_TotalSize == -1) return 0; return m_TotalSize; }
 	virtual void			SetSize(quint64 Size);				//{ m_TotalSize = Size; }
 	virtual bool			IsSizePending() const;
+	virtual quint64			GetImageSize() const				{ return m_ImageSize; } // logical size of the image, GetSize is the space it takes on the volume
 
 	virtual bool			IsBoxexPath(const QString& Path);
 
@@ -250,6 +251,7 @@ protected:
 	bool					m_bRootAccessOpen;
 
 	quint64					m_TotalSize;
+	quint64					m_ImageSize;
 
 	bool					m_SuspendRecovery;
 	bool					m_IsEmpty;
@@ -233,6 +233,7 @@ CMonitorList::~CMonitorList()
 ////////////////////////////////////////////////////////////////////////////////////////
 // CTraceView
 
+#define TRACE_QUERY_SLICE 0x40000 // rows filtered per slice, larger refreshes run on a worker thread
 
 CTraceView::CTraceView(bool bStandAlone, QWidget* parent) : QWidget(parent)
 {
@@ -360,6 +361,8 @@ CTraceView::~CTraceView()
 	theConf->SetValue("Options/TraceAutoScroll", m_pTrace->m_pAutoScroll->isChecked());
 
 	killTimer(m_uTimerID);
+
+	CancelQuery();
 }
 
 void CTraceView::timerEvent(QTimerEvent* pEvent)
@@ -409,119 +412,168 @@ void CTraceView::Refresh()
 		qDebug() << "Clear took" << (GetCurCycle() - start) / 1000000.0 << "s";
 
 		m_pMonitor->m_pMonitorModel->Clear();
+		CancelQuery();
 		m_FullRefresh = false;
 	}
 
-	const QVector<CTraceEntryPtr> &ResourceLog = theAPI->GetTrace();
+	const CTraceStore& ResourceLog = theAPI->GetTrace();
 
 	bool bUpdateFilters = false;
 
 	int i = 0;
-	if (ResourceLog.count() >= m_LastCount && m_LastCount > 0)
+	if (ResourceLog.Count() >= m_LastCount && m_LastCount > 0)
 	{
 		i = m_LastCount - 1;
-		if (m_LastID == ResourceLog.at(i)->GetUID())
+		if (m_LastID == ResourceLog.GetUID(i))
 			i++;
 		else
 			i = 0;
 	}
 
 	if (i == 0) {
+		CancelQuery();
 		m_PidMap.clear();
-		m_TraceList.clear();
+		m_TraceRows.clear();
 		m_MonitorMap.clear();
 	}
+	else if (m_pQuery)
+		return; // the running query covers the log up to m_LastCount, newer rows are picked up once it is done
 
-	if (m_LastCount == ResourceLog.count())
+	if (m_LastCount == ResourceLog.Count())
 		return;
 
-	//bool bHasFilter = !m_pTrace->m_FilterExp.pattern().isEmpty();
-	bool bHasFilter = !m_pTrace->m_FilterExp.isEmpty();
-
 	quint64 start = GetCurCycle();
-	for (; i < ResourceLog.count(); i++)
+	quint32 LastPid = -1, LastTid = -1;
+	for (int j = i; j < ResourceLog.Count(); j++)
 	{
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
-
-		SProgInfo& Info = m_PidMap[pEntry->GetProcessId()];
+		quint32 pid = ResourceLog.GetProcessId(j);
+		quint32 tid = ResourceLog.GetThreadId(j);
+		if (pid == LastPid && tid == LastTid)
+			continue; // entries come in bursts from the same thread
+		LastPid = pid;
+		LastTid = tid;
+
+		SProgInfo& Info = m_PidMap[pid];
 		if (Info.Name.isEmpty()) {
-			Info.Name = pEntry->GetProcessName();
+			Info.Name = ResourceLog.GetProcessName(j);
 			bUpdateFilters = true;
 		}
-		if (!Info.Threads.contains(pEntry->GetThreadId())) {
-			Info.Threads.insert(pEntry->GetThreadId());
+		if (!Info.Threads.contains(tid)) {
+			Info.Threads.insert(tid);
 			bUpdateFilters = true;
 		}
+	}
 
-		if (m_pCurrentBox != NULL && m_pCurrentBox != pEntry->GetBoxPtr())
-			continue;
+	STraceFilter Filter;
+	Filter.pBox = m_pCurrentBox;
+	Filter.ShowPids = m_ShowPids;
+	Filter.HidePids = m_HidePids;
+	Filter.Tid = m_FilterTid;
+	Filter.Types = m_FilterTypes;
+	if (!bMonitorMode) {
+		Filter.Status = m_FilterStatus;
+		if (!m_pTrace->m_bHighLight)
+			Filter.Text = m_pTrace->m_FilterExp; // note: only name, message and process name are matched, don't filter on non static strings !!!
+	}
 
-		quint32 pid = pEntry->GetProcessId();
-		if (!((m_ShowPids.isEmpty() || m_ShowPids.contains(pid)) && !m_HidePids.contains(pid)))
-			continue;
+	if (ResourceLog.Count() - i > TRACE_QUERY_SLICE)
+		StartQuery(ResourceLog, Filter, i);
+	else
+		AddRows(ResourceLog, ResourceLog.Select(Filter, i));
+	qDebug() << "Filtering took" << (GetCurCycle() - start) / 1000000.0 << "s";
 
-		if (m_FilterTid != 0 && m_FilterTid != pEntry->GetThreadId())
-			continue;
+	m_LastCount = ResourceLog.Count();
+	if(m_LastCount)
+		m_LastID = ResourceLog.GetUID(m_LastCount - 1);
 
-		if (!m_FilterTypes.isEmpty() && !m_FilterTypes.contains(pEntry->GetType()))
-			continue;
+	if (bUpdateFilters && !m_bUpdatePending)
+	{
+		m_bUpdatePending = true;
+		QTimer::singleShot(500, this, SLOT(UpdateFilters()));
+	}
+
+	SyncModel(ResourceLog);
+}
+
+void CTraceView::StartQuery(const CTraceStore& ResourceLog, const STraceFilter& Filter, int From)
+{
+	//
+	// filter a snapshot of the log on a worker thread and stream the matching rows back in slices,
+	// the log is only ever appended to or cleared, so the row numbers stay valid until CancelQuery
+	//
+
+	QSharedPointer<QAtomicInt> pQuery(new QAtomicInt(0));
+	m_pQuery = pQuery;
+
+	ResourceLog.UpdateIndex();
+	CTraceStore Snapshot = ResourceLog;
+
+	QPointer<CTraceView> pView = this;
+	QtConcurrent::run([pView, pQuery, Snapshot, Filter, From]() {
+		for (int Pos = From; Pos < Snapshot.Count() && !pQuery->loadAcquire(); Pos += TRACE_QUERY_SLICE)
+		{
+			QVector<int> Rows = Snapshot.Select(Filter, Pos, Pos + TRACE_QUERY_SLICE);
+			bool bDone = Pos + TRACE_QUERY_SLICE >= Snapshot.Count();
+			if (Rows.isEmpty() && !bDone)
+				continue;
+
+			QMetaObject::invokeMethod(qApp, [pView, pQuery, Rows, bDone]() {
+				if (pView) pView->OnQueryRows(pQuery, Rows, bDone);
+			}, Qt::QueuedConnection);
+		}
+	});
+}
+
+void CTraceView::CancelQuery()
+{
+	if (!m_pQuery)
+		return;
+	m_pQuery->storeRelease(1);
+	m_pQuery.clear();
+}
 
-		if (bMonitorMode)
+void CTraceView::OnQueryRows(const QSharedPointer<QAtomicInt>& pQuery, const QVector<int>& Rows, bool bDone)
+{
+	if (pQuery != m_pQuery)
+		return; // canceled, the rows may no longer exist
+
+	if (bDone)
+		m_pQuery.clear();
+
+	const CTraceStore& ResourceLog = theAPI->GetTrace();
+
+	AddRows(ResourceLog, Rows);
+	SyncModel(ResourceLog);
+}
+
+void CTraceView::AddRows(const CTraceStore& ResourceLog, const QVector<int>& Rows)
+{
+	if (m_pMonitorMode->isChecked())
+	{
+		foreach(int Row, Rows)
 		{
-			QString Name = pEntry->GetName();
+			QString Name = ResourceLog.GetName(Row);
 			if (Name.isEmpty())
-				Name = pEntry->GetMessage();
+				Name = ResourceLog.GetMessage(Row);
 			CMonitorEntryPtr& pItem = m_MonitorMap[Name.toLower()];
 			if (pItem.data() == NULL) {
 				//if (Name.left(9).compare("\\REGISTRY", Qt::CaseInsensitive) == 0) {
 				//	int pos = Name.indexOf("\\", 10);
 				//	Name = Name.left(pos).toUpper() + Name.mid(pos);
 				//}
-				pItem = CMonitorEntryPtr(new CMonitorEntry(Name, pEntry->GetType()));
-			}
-
-			pItem->Merge(pEntry);
-		}
-		else
-		{
-			if (bHasFilter && !m_pTrace->m_bHighLight) {
-				if (!pEntry->GetName().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive)
-					&& !pEntry->GetMessage().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive)
-					//&& !pEntry->GetTypeStr().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive) // don't filter on non static strings !!!
-					//&& !pEntry->GetStautsStr().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive) // don't filter on non static strings !!!
-					&& !pEntry->GetProcessName().contains(m_pTrace->m_FilterExp, Qt::CaseInsensitive))
-						continue;
-			}
-	
-			if (m_FilterStatus != 0) {
-				if (pEntry->IsOpen()) {
-					if (m_FilterStatus != 1) continue;
-				} else if (pEntry->IsClosed()) {
-					if (m_FilterStatus != 2) continue;
-				} else if (pEntry->IsTrace()) {
-					if (m_FilterStatus != 3) continue;
-				} else {
-					if (m_FilterStatus != 4) continue;
-				}
+				pItem = CMonitorEntryPtr(new CMonitorEntry(Name, ResourceLog.GetType(Row)));
 			}
 
-			m_TraceList.append(pEntry);
+			pItem->Merge(ResourceLog, Row);
 		}
 	}
-	qDebug() << "Filtering took" << (GetCurCycle() - start) / 1000000.0 << "s";
-
-	m_LastCount = ResourceLog.count();
-	if(m_LastCount)
-		m_LastID = ResourceLog.last()->GetUID();
-
-	if (bUpdateFilters && !m_bUpdatePending)
-	{
-		m_bUpdatePending = true;
-		QTimer::singleShot(500, this, SLOT(UpdateFilters()));
-	}
-
+	else
+		m_TraceRows += Rows;
+}
 
-	if (bMonitorMode)
+void CTraceView::SyncModel(const CTraceStore& ResourceLog)
+{
+	if (m_pMonitorMode->isChecked())
 	{
 		QList<QModelIndex> NewBranches = m_pMonitor->m_pMonitorModel->Sync(m_MonitorMap, this);
 
@@ -543,7 +595,7 @@ void CTraceView::Refresh()
 			m_pTrace->m_pTraceModel->SetHighLight(QString());
 
 		quint64 start = GetCurCycle();
-		QList<QModelIndex> NewBranches = m_pTrace->m_pTraceModel->Sync(m_TraceList);
+		QList<QModelIndex> NewBranches = m_pTrace->m_pTraceModel->Sync(ResourceLog, m_TraceRows);
 		qDebug() << "Sync took" << (GetCurCycle() - start) / 1000000.0 << "s";
 
 		if (m_pTrace->m_pTraceModel->IsTree())
@@ -570,6 +622,7 @@ void CTraceView::Clear()
 	m_pTraceTid->clear();
 	m_pTraceTid->addItem(tr("[All]"), 0);
 
+	CancelQuery();
 	theAPI->ClearTrace();
 	m_pTrace->m_pTraceModel->Clear(true);
 	m_pMonitor->m_pMonitorModel->Clear();
@@ -751,7 +804,7 @@ void CTraceView::SaveToFile()
 	File.close();
 }
 
-void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTraceEntryPtr> ResourceLog, QIODevice* pFile)
+void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, CTraceStore ResourceLog, QIODevice* pFile)
 {
 	pProgress->ShowMessage(tr("Saving TraceLog..."));
 
@@ -759,34 +812,32 @@ void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTra
 
 	quint64 LastTimeStamp = 0;
 	QByteArray LastTimeStampStr;
-	for (int i = 0; i < ResourceLog.count() && !pProgress->IsCanceled(); i++)
+	for (int i = 0; i < ResourceLog.Count() && !pProgress->IsCanceled(); i++)
 	{
 		if (i % 10000 == 0)
-			pProgress->SetProgress(100 * i / ResourceLog.count());
-
-		const CTraceEntryPtr& pEntry = ResourceLog.at(i);
+			pProgress->SetProgress(100 * i / ResourceLog.Count());
 
-		if (LastTimeStamp != pEntry->GetTimeStamp()) {
-			LastTimeStamp = pEntry->GetTimeStamp();
-			LastTimeStampStr = QDateTime::fromMSecsSinceEpoch(pEntry->GetTimeStamp()).toString("dd.MM.yyyy hh:mm:ss.zzz").toUtf8();
+		if (LastTimeStamp != ResourceLog.GetTimeStamp(i)) {
+			LastTimeStamp = ResourceLog.GetTimeStamp(i);
+			LastTimeStampStr = QDateTime::fromMSecsSinceEpoch(ResourceLog.GetTimeStamp(i)).toString("dd.MM.yyyy hh:mm:ss.zzz").toUtf8();
 		}
 
 		pFile->write(LastTimeStampStr);
 		pFile->write("\t");
-		QString Name = pEntry->GetProcessName();
+		QString Name = ResourceLog.GetProcessName(i);
 		pFile->write(Name.isEmpty() ? Unknown : Name.toUtf8());
 		pFile->write("\t");
-		pFile->write(QByteArray::number(pEntry->GetProcessId()));
+		pFile->write(QByteArray::number(ResourceLog.GetProcessId(i)));
 		pFile->write("\t");
-		pFile->write(QByteArray::number(pEntry->GetThreadId()));
+		pFile->write(QByteArray::number(ResourceLog.GetThreadId(i)));
 		pFile->write("\t");
-		pFile->write(pEntry->GetTypeStr().toUtf8());
+		pFile->write(ResourceLog.GetTypeStr(i).toUtf8());
 		pFile->write("\t");
-		pFile->write(pEntry->GetStautsStr().toUtf8());
+		pFile->write(ResourceLog.GetStautsStr(i).toUtf8());
 		pFile->write("\t");
-		pFile->write(pEntry->GetName().toUtf8());
+		pFile->write(ResourceLog.GetName(i).toUtf8());
 		pFile->write("\t");
-		pFile->write(pEntry->GetMessage().toUtf8());
+		pFile->write(ResourceLog.GetMessage(i).toUtf8());
 		pFile->write("\n");
 	}
 
@@ -796,7 +847,7 @@ void CTraceView::SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTra
 bool CTraceView::SaveToFile(QIODevice* pFile)
 {
 	pFile->write("Timestamp\tProcess\tPID\tTID\tType\tStatus\tName\tMessage\n"); // don't translate log
-	QVector<CTraceEntryPtr> ResourceLog = theAPI->GetTrace();
+	CTraceStore ResourceLog = theAPI->GetTrace();
 	CSbieProgressPtr pProgress = CSbieProgressPtr(new CSbieProgress());
 	QtConcurrent::run(CTraceView::SaveToFileAsync, pProgress, ResourceLog, pFile);
 	theGUI->AddAsyncOp(pProgress, true);
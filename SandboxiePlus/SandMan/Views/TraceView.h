@@ -96,7 +96,13 @@ protected:
 	void				timerEvent(QTimerEvent* pEvent);
 	int					m_uTimerID;
 
-	static void			SaveToFileAsync(const CSbieProgressPtr& pProgress, QVector<CTraceEntryPtr> ResourceLog, QIODevice* pFile);
+	static void			SaveToFileAsync(const CSbieProgressPtr& pProgress, CTraceStore ResourceLog, QIODevice* pFile);
+
+	void				StartQuery(const CTraceStore& ResourceLog, const STraceFilter& Filter, int From);
+	void				CancelQuery();
+	void				OnQueryRows(const QSharedPointer<QAtomicInt>& pQuery, const QVector<int>& Rows, bool bDone);
+	void				AddRows(const CTraceStore& ResourceLog, const QVector<int>& Rows);
+	void				SyncModel(const CTraceStore& ResourceLog);
 
 	struct SProgInfo
 	{
@@ -109,7 +115,8 @@ protected:
 	quint64					m_LastID;
 	int						m_LastCount;
 	bool					m_bUpdatePending;
-	QVector<CTraceEntryPtr> m_TraceList;
+	QVector<int>		m_TraceRows;
+	QSharedPointer<QAtomicInt> m_pQuery; // cancel flag of the running query
 	QMap<QString, CMonitorEntryPtr> m_MonitorMap;
 
 	QSet<quint32>		m_ShowPids;
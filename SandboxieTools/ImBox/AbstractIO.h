@@ -8,6 +8,7 @@ public:
 	virtual ULONG64 GetAllocSize() const = 0;
 	virtual ULONG64 GetDiskSize() const = 0;
 	virtual bool CanBeFormated() const = 0;
+	virtual bool CanRunConcurrently() const { return false; } // DiskRead/DiskWrite/TrimProcess may be called from multiple threads at once
 
 	virtual int Init() = 0;
 	virtual void PrepViewOfFile(BYTE*) = 0;
@@ -57,6 +57,136 @@ struct SSecureBuffer
 	T* ptr;
 };
 
+//
+// Large requests are split into sector aligned slices, which are encrypted by a small
+// worker pool, the calling thread processes slices as well, xts_key is only read.
+//
+
+#define CRYPTO_PARALLEL_MIN		(128 * 1024)
+#define CRYPTO_SLICE_MIN		(32 * 1024)
+#define CRYPTO_MAX_THREADS		8
+
+struct SCryptoPool
+{
+	SCryptoPool(int iWorkers = -1)
+	{
+		if (iWorkers < 0) {
+			SYSTEM_INFO si;
+			GetSystemInfo(&si);
+			iWorkers = min((int)si.dwNumberOfProcessors, CRYPTO_MAX_THREADS) - 1;
+		}
+
+		bTerminate = false;
+		hWork = CreateSemaphore(NULL, 0, CRYPTO_MAX_THREADS, NULL);
+		hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+		InitializeCriticalSection(&Lock);
+
+		for (int i = 0; i < iWorkers && hWork && hDone; i++) {
+			HANDLE hThread = CreateThread(NULL, 0, WorkerProc, this, 0, NULL);
+			if (!hThread)
+				break;
+			Threads.push_back(hThread);
+		}
+	}
+
+	~SCryptoPool()
+	{
+		bTerminate = true;
+		if (!Threads.empty()) {
+			ReleaseSemaphore(hWork, (LONG)Threads.size(), NULL);
+			WaitForMultipleObjects((DWORD)Threads.size(), Threads.data(), TRUE, INFINITE);
+			for (HANDLE hThread : Threads)
+				CloseHandle(hThread);
+		}
+		if (hWork) CloseHandle(hWork);
+		if (hDone) CloseHandle(hDone);
+		DeleteCriticalSection(&Lock);
+	}
+
+	void Crypt(BYTE* buf, int size, __int64 offset, xts_key* key, bool encrypt)
+	{
+		if (Threads.empty() || size < CRYPTO_PARALLEL_MIN) {
+			if (encrypt)
+				xts_encrypt(buf, buf, size, offset, key);
+			else
+				xts_decrypt(buf, buf, size, offset, key);
+			return;
+		}
+
+		// with concurrent requests the workers may be busy with an other one, then this one is done inline
+		if (!TryEnterCriticalSection(&Lock)) {
+			if (encrypt)
+				xts_encrypt(buf, buf, size, offset, key);
+			else
+				xts_decrypt(buf, buf, size, offset, key);
+			return;
+		}
+
+		int parts = (int)Threads.size() + 1;
+		iSlice = ((size / parts) + XTS_SECTOR_SIZE - 1) & ~(XTS_SECTOR_SIZE - 1);
+		if (iSlice < CRYPTO_SLICE_MIN)
+			iSlice = CRYPTO_SLICE_MIN;
+		iSlices = (size + iSlice - 1) / iSlice;
+		int helpers = min(iSlices - 1, (int)Threads.size());
+
+		pBuf = buf;
+		iSize = size;
+		iOffset = offset;
+		pKey = key;
+		bEncrypt = encrypt;
+		iNext = 0;
+		iRefs = helpers + 1; // the job is done once every woken worker checked out, so none can see the next one half set up
+
+		ReleaseSemaphore(hWork, helpers, NULL);
+		RunSlices();
+		WaitForSingleObject(hDone, INFINITE);
+
+		LeaveCriticalSection(&Lock);
+	}
+
+	void RunSlices()
+	{
+		for (LONG i; (i = InterlockedIncrement(&iNext) - 1) < iSlices; ) {
+			int pos = i * iSlice;
+			int len = min(iSlice, iSize - pos);
+			if (bEncrypt)
+				xts_encrypt(pBuf + pos, pBuf + pos, len, iOffset + pos, pKey);
+			else
+				xts_decrypt(pBuf + pos, pBuf + pos, len, iOffset + pos, pKey);
+		}
+		if (InterlockedDecrement(&iRefs) == 0)
+			SetEvent(hDone);
+	}
+
+	static DWORD WINAPI WorkerProc(LPVOID lpThreadParameter)
+	{
+		SCryptoPool* pool = (SCryptoPool*)lpThreadParameter;
+		for (;;) {
+			WaitForSingleObject(pool->hWork, INFINITE);
+			if (pool->bTerminate)
+				break;
+			pool->RunSlices();
+		}
+		return 0;
+	}
+
+	std::vector<HANDLE> Threads;
+	HANDLE hWork;
+	HANDLE hDone;
+	CRITICAL_SECTION Lock;
+	volatile bool bTerminate;
+
+	BYTE* pBuf;
+	int iSize;
+	__int64 iOffset;
+	xts_key* pKey;
+	bool bEncrypt;
+	int iSlice;
+	int iSlices;
+	volatile LONG iNext;
+	volatile LONG iRefs;
+};
+
 struct SCryptoIO
 {
 	std::wstring Cipher;
@@ -65,6 +195,10 @@ struct SCryptoIO
 	SSecureBuffer<dc_pass> password;
 
 	xts_key benc_k;
+
+	SCryptoPool* pool;
+
+	CRITICAL_SECTION IoLock; // serializes the underlying IO if it can not run concurrently
 };
 
 CCryptoIO::CCryptoIO(CAbstractIO* pIO, const WCHAR* pKey, const std::wstring& Cipher)
@@ -72,6 +206,8 @@ CCryptoIO::CCryptoIO(CAbstractIO* pIO, const WCHAR* pKey, const std::wstring& Ci
 	m = new SCryptoIO;
 	m->Cipher = Cipher;
 	m->AllowFormat = false;
+	m->pool = NULL;
+	InitializeCriticalSection(&m->IoLock);
 
 	if (m->password) {
 		m->password->size = wcslen(pKey) * sizeof(wchar_t);
@@ -87,6 +223,8 @@ CCryptoIO::CCryptoIO(CAbstractIO* pIO, const WCHAR* pKey, const std::wstring& Ci
 
 CCryptoIO::~CCryptoIO()
 {
+	delete m->pool;
+	DeleteCriticalSection(&m->IoLock);
 	delete m;
 }
 
@@ -175,6 +313,8 @@ int CCryptoIO::InitCrypto()
 
 	if (ret == ERR_OK) {
 		xts_set_key(header->key_1, header->alg_1, &m->benc_k);
+		if (!m->pool)
+			m->pool = new SCryptoPool();
 		DbgPrint(L" SUCCESS.\n");
 	}
 	else
@@ -266,9 +406,12 @@ bool CCryptoIO::DiskWrite(void* buf, int size, __int64 offset)
 		DbgPrint(L"DiskWrite not full sector\n");
 #endif
 
-	xts_encrypt((BYTE*)buf, (BYTE*)buf, size, offset, &m->benc_k);
+	m->pool->Crypt((BYTE*)buf, size, offset, &m->benc_k, true);
 
+	bool bLock = !m_pIO->CanRunConcurrently();
+	if (bLock) EnterCriticalSection(&m->IoLock);
 	bool ret = m_pIO->DiskWrite(buf, size, offset + DC_AREA_SIZE);
+	if (bLock) LeaveCriticalSection(&m->IoLock);
 
 	//xts_decrypt((BYTE*)buf, (BYTE*)buf, size, offset, &m->benc_k); // restore buffer - not needed
 
@@ -282,10 +425,13 @@ bool CCryptoIO::DiskRead(void* buf, int size, __int64 offset)
 		DbgPrint(L"DiskRead not full sector\n");
 #endif
 
+	bool bLock = !m_pIO->CanRunConcurrently();
+	if (bLock) EnterCriticalSection(&m->IoLock);
 	bool ret = m_pIO->DiskRead(buf, size, offset + DC_AREA_SIZE);
+	if (bLock) LeaveCriticalSection(&m->IoLock);
 
 	if (ret)
-		xts_decrypt((BYTE*)buf, (BYTE*)buf, size, offset, &m->benc_k);
+		m->pool->Crypt((BYTE*)buf, size, offset, &m->benc_k, false);
 
 	return ret;
 }
@@ -300,7 +446,10 @@ void CCryptoIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
 #endif
 	}
 
+	bool bLock = !m_pIO->CanRunConcurrently();
+	if (bLock) EnterCriticalSection(&m->IoLock);
 	m_pIO->TrimProcess(range, n);
+	if (bLock) LeaveCriticalSection(&m->IoLock);
 }
 
 int CCryptoIO::BackupHeader(CAbstractIO* pIO, const std::wstring& Path)
@@ -365,4 +514,64 @@ int CCryptoIO::RestoreHeader(CAbstractIO* pIO, const std::wstring& Path)
 		ret = ERR_FILE_NOT_OPENED;
 
 	return ret;
-}
\ No newline at end of file
+}
+
+int CCryptoIO::Benchmark(const std::wstring& Cipher)
+{
+	//
+	// measures the XTS throughput of every cipher chain for a range of request sizes,
+	// once on the calling thread only and once with the worker pool used by DiskRead/DiskWrite
+	// 
+
+	static const wchar_t* Ciphers[CF_CIPHERS_NUM] = { L"AES", L"TWOFISH", L"SERPENT", L"AES-TWOFISH", L"TWOFISH-SERPENT", L"SERPENT-AES", L"AES-TWOFISH-SERPENT" };
+	static const int Sizes[] = { 4 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+
+	HANDLE hOut = BenchOutput();
+
+	xts_init(1);
+
+	SSecureBuffer<xts_key> key;
+	SSecureBuffer<UCHAR> dk(DISKKEY_SIZE);
+	BYTE* buf = (BYTE*)VirtualAlloc(NULL, Sizes[_countof(Sizes) - 1], MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!key || !dk || !buf) {
+		if (buf) VirtualFree(buf, 0, MEM_RELEASE);
+		return ERR_MALLOC_ERROR;
+	}
+	make_rand(dk.ptr, DISKKEY_SIZE);
+	make_rand(buf, Sizes[_countof(Sizes) - 1]);
+
+	SCryptoPool pool;
+	BenchPrint(hOut, L"XTS benchmark, %d worker threads, MB/s for single threaded / pooled encryption\r\n", (int)pool.Threads.size());
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+
+	for (int cipher = 0; cipher < CF_CIPHERS_NUM; cipher++) {
+		if (!Cipher.empty() && _wcsicmp(Cipher.c_str(), Ciphers[cipher]) != 0)
+			continue;
+
+		xts_set_key(dk.ptr, cipher, key.ptr);
+
+		for (int i = 0; i < _countof(Sizes); i++) {
+			double rate[2];
+			for (int pooled = 0; pooled < 2; pooled++) {
+				LARGE_INTEGER start, now;
+				QueryPerformanceCounter(&start);
+				ULONG64 total = 0;
+				do {
+					if (pooled)
+						pool.Crypt(buf, Sizes[i], total, key.ptr, true);
+					else
+						xts_encrypt(buf, buf, Sizes[i], total, key.ptr);
+					total += Sizes[i];
+					QueryPerformanceCounter(&now);
+				} while (now.QuadPart - start.QuadPart < freq.QuadPart / 2);
+				rate[pooled] = (double)total / (1024 * 1024) / ((double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+			}
+			BenchPrint(hOut, L"%-20s %5d KB: %8.1f / %8.1f\r\n", Ciphers[cipher], Sizes[i] / 1024, rate[0], rate[1]);
+		}
+	}
+
+	VirtualFree(buf, 0, MEM_RELEASE);
+	return ERR_OK;
+}
@@ -10,6 +10,7 @@ public:
 	virtual ULONG64 GetAllocSize() const { return m_pIO->GetAllocSize(); }
 	virtual ULONG64 GetDiskSize() const;
 	virtual bool CanBeFormated() const;
+	virtual bool CanRunConcurrently() const { return true; }
 
 	virtual int Init();
 	virtual void PrepViewOfFile(BYTE* p) { m_pIO->PrepViewOfFile(p); }
@@ -22,6 +23,8 @@ public:
 	static int BackupHeader(CAbstractIO* pIO, const std::wstring& Path);
 	static int RestoreHeader(CAbstractIO* pIO, const std::wstring& Path);
 
+	static int Benchmark(const std::wstring& Cipher = std::wstring());
+
 protected:
 	virtual int InitCrypto();
 	virtual int WriteHeader(struct _dc_header* header);
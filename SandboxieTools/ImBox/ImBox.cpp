@@ -23,6 +23,8 @@
 #include "PhysicalMemoryIO.h"
 #include "ImageFileIO.h"
 #include "CryptoIO.h"
+#include "SnapshotIO.h"
+#include "IoRing.h"
 #include "..\Common\helpers.h"
 
 bool HasFlag(const std::vector<std::wstring>& arguments, std::wstring name)
@@ -41,6 +43,32 @@ std::wstring GetArgument(const std::vector<std::wstring>& arguments, std::wstrin
 	return L"";
 }
 
+HANDLE BenchOutput()
+{
+	HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+	if ((hOut == NULL || hOut == INVALID_HANDLE_VALUE) && AttachConsole(ATTACH_PARENT_PROCESS))
+		hOut = CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hOut == NULL)
+		hOut = INVALID_HANDLE_VALUE;
+	return hOut;
+}
+
+void BenchPrint(HANDLE hOut, const wchar_t* format, ...)
+{
+	va_list va_args;
+	va_start(va_args, format);
+	wchar_t text[256];
+	_vsnwprintf_s(text, _countof(text), _TRUNCATE, format, va_args);
+	va_end(va_args);
+
+	OutputDebugStringW(text);
+	if (hOut != INVALID_HANDLE_VALUE) {
+		std::string str = g_str_conv.to_bytes(text);
+		DWORD written;
+		WriteFile(hOut, str.c_str(), (DWORD)str.length(), &written, NULL);
+	}
+}
+
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     _In_opt_ HINSTANCE hPrevInstance,
     _In_ LPWSTR    lpCmdLine,
@@ -68,6 +96,8 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     std::wstring format = GetArgument(arguments, L"format");
     std::wstring params = GetArgument(arguments, L"params");
 
+    std::wstring snapshot = GetArgument(arguments, L"snapshot");
+
     std::wstring new_key = GetArgument(arguments, L"new_key");
     std::wstring backup = GetArgument(arguments, L"backup");
     std::wstring restore = GetArgument(arguments, L"restore");
@@ -76,6 +106,14 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     std::wstring event = GetArgument(arguments, L"event");
     std::wstring section = GetArgument(arguments, L"section");
 
+    // bench [cipher=AES]
+    if (HasFlag(arguments, L"bench"))
+        return CCryptoIO::Benchmark(cipher);
+
+    // bench_ram - memory savings and latency of the RAM disk block store
+    if (HasFlag(arguments, L"bench_ram"))
+        return CVirtualMemoryIO::Benchmark();
+
     ULONG64 uSize = 0;
     if(size.empty())
         uSize = 2ull * (1024 * 1024 * 1024); // 2GB;
@@ -87,17 +125,37 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     //
 
     CAbstractIO* pIO = NULL;
-    if (_wcsicmp(type.c_str(), L"virtual") == 0 || _wcsicmp(type.c_str(), L"ram") == 0)
-        pIO = new CVirtualMemoryIO(uSize);
+    if (_wcsicmp(type.c_str(), L"virtual") == 0 || _wcsicmp(type.c_str(), L"ram") == 0) {
+        bool bCompact = HasFlag(arguments, L"compact"); // compressed and deduplicated 4 KB blocks
+        pIO = new CVirtualMemoryIO(uSize, bCompact ? 12 : 20, bCompact);
+    }
     else if (_wcsicmp(type.c_str(), L"physical") == 0 || _wcsicmp(type.c_str(), L"awe") == 0)
         pIO = new CPhysicalMemoryIO(uSize);
-    else if (_wcsicmp(type.c_str(), L"image") == 0 || _wcsicmp(type.c_str(), L"img") == 0)
-        pIO = new CImageFileIO(image, uSize);
+    else if (_wcsicmp(type.c_str(), L"image") == 0 || _wcsicmp(type.c_str(), L"img") == 0) {
+        std::wstring prealloc = GetArgument(arguments, L"prealloc"); // prealloc=1024 - grow the image in zero filled extents of this many KB
+        pIO = new CImageFileIO(image, uSize, prealloc.empty() ? 0 : _wtoi(prealloc.c_str()));
+    }
     else {
         DbgPrint(L"Invalid disk type.\n");
         return -1;
     }
 
+    //
+    // snapshot="c:\temp\1.snap;c:\temp\2.snap" - copy on write layers over the disk, the last one takes the writes,
+    // a missing delta file is created empty, with merge the last layer is merged into the one below it
+    //
+
+    if (!snapshot.empty()) {
+        std::vector<std::wstring> Deltas = SplitStr(snapshot, L";", false);
+        for (size_t i = 0; i < Deltas.size(); i++)
+            pIO = new CSnapshotIO(pIO, Deltas[i]);
+
+        if (HasFlag(arguments, L"merge")) {
+            int ret = pIO->Init();
+            return ret ? ret : ((CSnapshotIO*)pIO)->MergeDown();
+        }
+    }
+
     if (!backup.empty())
         return CCryptoIO::BackupHeader(pIO, backup);
     if (!restore.empty())
@@ -130,6 +188,10 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     if (ret)
         return ret;
 
+    // bench_io type=ram [write] - IOPS of the request ring at queue depth 1/4/16 and 1 MB requests split by the ring, write overwrites the disk content
+    if (HasFlag(arguments, L"bench_io"))
+        return CIoRing::Benchmark(pIO, HasFlag(arguments, L"write"));
+
 
     CImDiskIO* pImDisk = new CImDiskIO(pIO, mount, format, params);
 
@@ -16,3 +16,7 @@
 #define ERR_IMDISK_TIMEOUT	11
 #define ERR_UNKNOWN_COMMAND	12
 #define ERR_MALLOC_ERROR	13
+#define ERR_SNAPSHOT_INVALID	14
+
+HANDLE BenchOutput();
+void BenchPrint(HANDLE hOut, const wchar_t* format, ...);
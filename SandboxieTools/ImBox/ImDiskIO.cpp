@@ -4,6 +4,7 @@
 #include "..\ImDisk\inc\imdproxy.h"
 #include "..\ImDisk\inc\imdisk.h"
 #include "ImDiskIO.h"
+#include "IoRing.h"
 #include "ImBox.h"
 
 
@@ -350,31 +351,28 @@ int CImDiskIO::DoComm()
 	proxy_info.flags = IMDPROXY_FLAG_SUPPORTS_UNMAP; // TRIM
 	memcpy(shm_view, &proxy_info, sizeof proxy_info);
 
+	//
+	// the ImDisk proxy protocol has a single request window, the driver sends the next request
+	// only once this one was answered, so the ring splits large reads and writes over its workers
+	//
+
+	CIoRing Ring(m_pIO, IO_RING_MAX_THREADS, 0);
+
 	for (;;) {
 		NtSignalAndWaitForSingleObject(shm_response_event, shm_request_event, FALSE, NULL);
 
-		if (req_block->request_code == IMDPROXY_REQ_READ) {
-			if (!m_pIO->DiskRead(main_buf, req_block->length, req_block->offset)) {
-				DbgPrint(L"DiskRead error.\n");
-			}
-		}
-		else if (req_block->request_code == IMDPROXY_REQ_WRITE) {
-			if (!m_pIO->DiskWrite(main_buf, req_block->length, req_block->offset)) {
-				DbgPrint(L"DiskWrite error, SOME DATA WILL BE LOST.");
-			}
-		}
-		else if (req_block->request_code == IMDPROXY_REQ_UNMAP) {
-			m_pIO->TrimProcess((DEVICE_DATA_SET_RANGE*)main_buf, trim_block->length / sizeof(DEVICE_DATA_SET_RANGE));
-		}
-		else if (req_block->request_code == IMDPROXY_REQ_CLOSE) {
+		if (req_block->request_code == IMDPROXY_REQ_CLOSE)
 			return ERR_OK;
-		}
-		else { // unknown command
-			DbgPrint(L"Unknown Command: %d\n", req_block->request_code);
+
+		CIoRing::SRequest request;
+		request.Code = req_block->request_code;
+		request.Offset = req_block->offset;
+		request.Length = req_block->request_code == IMDPROXY_REQ_UNMAP ? trim_block->length : req_block->length;
+		request.Buffer = main_buf;
+		if (!Ring.Run(&request))
 			return ERR_UNKNOWN_COMMAND;
-		}
 
-		resp_block->errorno = 0;
+		resp_block->errorno = 0; // failed requests are only logged
 		resp_block->length = req_block->length;
 	}
 }
@@ -2,27 +2,96 @@
 #include "ImageFileIO.h"
 #include "ImBox.h"
 #include "..\Common\helpers.h"
+#include <atomic>
 
-BOOL GetSparseRanges(HANDLE hFile);
+#define IMAGE_GRANULE_SHIFT	16 // the allocation map tracks 64 KB granules
+#define IMAGE_GRANULE_SIZE	(1ull << IMAGE_GRANULE_SHIFT)
+
+//
+// One bit per granule of the disk, a clear bit means the granule was never written or was trimmed
+// as a whole, so it reads as zeros without touching the file. Granules outside the map count as
+// allocated. The map is plain C++ and does not depend on the volume supporting sparse files.
+//
+
+struct SAllocMap
+{
+	void Init(ULONG64 uGranules)
+	{
+		Bits.reset(new std::atomic<ULONG>[(size_t)((uGranules + 31) / 32)]());
+		uCount = uGranules;
+		uSet = 0;
+	}
+
+	bool Test(ULONG64 i) const
+	{
+		return i >= uCount || (Bits[(size_t)(i / 32)] & (1ul << (i % 32))) != 0;
+	}
+
+	bool TestAll(ULONG64 first, ULONG64 end) const
+	{
+		for (ULONG64 i = first; i < end; i++) {
+			if (!Test(i))
+				return false;
+		}
+		return true;
+	}
+
+	void Set(ULONG64 first, ULONG64 end)
+	{
+		for (ULONG64 i = first; i < end && i < uCount; i++) {
+			ULONG bit = 1ul << (i % 32);
+			if ((Bits[(size_t)(i / 32)].fetch_or(bit) & bit) == 0)
+				uSet++;
+		}
+	}
+
+	void Clear(ULONG64 first, ULONG64 end)
+	{
+		for (ULONG64 i = first; i < end && i < uCount; i++) {
+			ULONG bit = 1ul << (i % 32);
+			if ((Bits[(size_t)(i / 32)].fetch_and(~bit) & bit) != 0)
+				uSet--;
+		}
+	}
+
+	std::unique_ptr<std::atomic<ULONG>[]> Bits;
+	ULONG64 uCount = 0;
+	std::atomic<ULONG64> uSet{ 0 };
+};
+
+static bool GetSparseRanges(HANDLE hFile, SAllocMap& Map);
+static BOOL ImageIoControl(HANDLE hFile, DWORD dwIoControlCode, LPVOID lpInBuffer, DWORD nInBufferSize, LPVOID lpOutBuffer, DWORD nOutBufferSize, LPDWORD lpBytesReturned);
 
 struct SImageFileIO
 {
 	std::wstring FilePath;
     ULONG64 uSize = 0;
 	HANDLE Handle = INVALID_HANDLE_VALUE;
+
+	SAllocMap Map;
+
+	ULONG64 uPrealloc = 0;			// extent size, 0 lets the file grow only where it is written
+	BYTE* pZeroes = NULL;
+	CRITICAL_SECTION PreallocLock;
 };
 
-CImageFileIO::CImageFileIO(std::wstring& FilePath, ULONG64 uSize)
+CImageFileIO::CImageFileIO(std::wstring& FilePath, ULONG64 uSize, ULONG uPreallocKb)
 {
 	m = new SImageFileIO;
 	m->FilePath = FilePath;
     m->uSize = uSize;
+	// extents are made of whole granules
+	m->uPrealloc = ((ULONG64)uPreallocKb * 1024 + IMAGE_GRANULE_SIZE - 1) & ~(IMAGE_GRANULE_SIZE - 1);
+	InitializeCriticalSection(&m->PreallocLock);
 }
 
 CImageFileIO::~CImageFileIO()
 {
 	if (m->Handle != INVALID_HANDLE_VALUE)
 		CloseHandle(m->Handle);
+	if (m->pZeroes)
+		VirtualFree(m->pZeroes, 0, MEM_RELEASE);
+	DeleteCriticalSection(&m->PreallocLock);
 	delete m;
 }
 
@@ -38,6 +107,11 @@ ULONG64 CImageFileIO::GetAllocSize() const
     return liSparseFileCompressedSize.QuadPart;
 }
 
+ULONG64 CImageFileIO::GetUsedSize() const
+{
+	return m->Map.uSet << IMAGE_GRANULE_SHIFT;
+}
+
 bool CImageFileIO::CanBeFormated() const
 {
     if (m->Handle == INVALID_HANDLE_VALUE) 
@@ -58,9 +132,12 @@ int CImageFileIO::Init()
     // Ntfs.sys!NtfsCopyWriteA 
     // 
     // This issue also affects DiscUtilsDevio.exe
+    //
+    // The file is opened for overlapped IO, so that concurrent requests from the CIoRing
+    // are not serialized on the file object
     //
 
-	m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+	m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_OVERLAPPED, NULL);
     if (m->Handle == INVALID_HANDLE_VALUE) {
         
         //
@@ -68,7 +145,7 @@ int CImageFileIO::Init()
         //
 
         if(m->uSize)
-            m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+            m->Handle = CreateFile(m->FilePath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH | FILE_FLAG_OVERLAPPED, NULL);
 
         if (m->Handle == INVALID_HANDLE_VALUE)
             return ERR_FILE_NOT_OPENED;
@@ -103,30 +180,158 @@ int CImageFileIO::Init()
             // the FSCTL_SET_ZERO_DATA control code will actually write zero bytes to
             // the file instead of marking the region as sparse zero area.
             DWORD dwTemp;
-            if (!DeviceIoControl(m->Handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwTemp, NULL)) {
+            if (!ImageIoControl(m->Handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &dwTemp)) {
                 DbgPrint(L"Failed to make image file sparse: %s\n", m->FilePath.c_str());
             }
         }
-        //else {
-        //    GetSparseRanges(m->Handle);
-        //}
     }
 
+	//
+	// build the allocation map from the ranges the file system has allocated,
+	// when it can not tell, all data held by the file is taken as allocated
+	//
+
+	m->Map.Init((m->uSize + IMAGE_GRANULE_SIZE - 1) >> IMAGE_GRANULE_SHIFT);
+	if (!GetSparseRanges(m->Handle, m->Map)) {
+		LARGE_INTEGER liFileSize;
+		GetFileSizeEx(m->Handle, &liFileSize);
+		m->Map.Clear(0, m->Map.uCount);
+		m->Map.Set(0, (liFileSize.QuadPart + IMAGE_GRANULE_SIZE - 1) >> IMAGE_GRANULE_SHIFT);
+	}
+
+	if (m->uPrealloc) {
+		m->pZeroes = (BYTE*)VirtualAlloc(NULL, IMAGE_GRANULE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!m->pZeroes)
+			return ERR_MALLOC_ERROR;
+	}
+
 	return ERR_OK;
 }
 
+static bool ImageTransfer(HANDLE hFile, bool bWrite, void* buf, int size, __int64 offset)
+{
+	OVERLAPPED ov = { 0 };
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!ov.hEvent)
+		return false;
+
+	DWORD dwBytes = 0;
+	BOOL bRet = bWrite ? WriteFile(hFile, buf, size, NULL, &ov) : ReadFile(hFile, buf, size, NULL, &ov);
+	if (bRet || GetLastError() == ERROR_IO_PENDING)
+		bRet = GetOverlappedResult(hFile, &ov, &dwBytes, TRUE);
+	DWORD dwError = bRet ? ERROR_SUCCESS : GetLastError();
+	CloseHandle(ov.hEvent);
+
+	// the image grows as it is written, what lies behind its end reads as zeros
+	if (!bWrite && (bRet || dwError == ERROR_HANDLE_EOF)) {
+		if (dwBytes < (DWORD)size)
+			ZeroMemory((BYTE*)buf + dwBytes, size - dwBytes);
+		return true;
+	}
+	return !!bRet;
+}
+
+static BOOL ImageIoControl(HANDLE hFile, DWORD dwIoControlCode, LPVOID lpInBuffer, DWORD nInBufferSize, LPVOID lpOutBuffer, DWORD nOutBufferSize, LPDWORD lpBytesReturned)
+{
+	OVERLAPPED ov = { 0 };
+	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!ov.hEvent)
+		return FALSE;
+
+	BOOL bRet = DeviceIoControl(hFile, dwIoControlCode, lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize, lpBytesReturned, &ov);
+	if (!bRet && GetLastError() == ERROR_IO_PENDING)
+		bRet = GetOverlappedResult(hFile, &ov, lpBytesReturned, TRUE);
+	DWORD dwError = GetLastError();
+	CloseHandle(ov.hEvent);
+	SetLastError(dwError);
+	return bRet;
+}
+
+bool CImageFileIO::Preallocate(__int64 offset, int size)
+{
+	//
+	// zero fill the not yet allocated granules of all extents the write touches, except for what
+	// the write itself covers, so that the file grows by whole extents and does not fragment.
+	// Writers into unallocated granules are serialized here, a granule is marked allocated only
+	// after it was filled, hence no fill can land on data written concurrently by an other request
+	//
+
+	bool bRet = true;
+	EnterCriticalSection(&m->PreallocLock);
+
+	ULONG64 uStart = (offset / m->uPrealloc) * m->uPrealloc;
+	ULONG64 uEnd = ((offset + size + m->uPrealloc - 1) / m->uPrealloc) * m->uPrealloc;
+	if (uEnd > m->uSize)
+		uEnd = m->uSize;
+
+	for (ULONG64 i = uStart >> IMAGE_GRANULE_SHIFT; bRet && (i << IMAGE_GRANULE_SHIFT) < uEnd; i++) {
+		if (m->Map.Test(i))
+			continue;
+
+		ULONG64 uFrom = i << IMAGE_GRANULE_SHIFT;
+		ULONG64 uTo = min(uFrom + IMAGE_GRANULE_SIZE, uEnd);
+
+		if (uFrom < (ULONG64)offset)
+			bRet = ImageTransfer(m->Handle, true, m->pZeroes, (int)(min(uTo, (ULONG64)offset) - uFrom), uFrom);
+		if (bRet && uTo > (ULONG64)(offset + size)) {
+			ULONG64 uPos = max(uFrom, (ULONG64)(offset + size));
+			bRet = ImageTransfer(m->Handle, true, m->pZeroes, (int)(uTo - uPos), uPos);
+		}
+
+		if (bRet)
+			m->Map.Set(i, i + 1);
+	}
+
+	LeaveCriticalSection(&m->PreallocLock);
+	return bRet;
+}
+
 bool CImageFileIO::DiskWrite(void* buf, int size, __int64 offset)
 {
-	SetFilePointerEx(m->Handle, *(LARGE_INTEGER*)&offset, NULL, FILE_BEGIN);
-    DWORD BytesWritten;
-	return !!WriteFile(m->Handle, buf, size, &BytesWritten, NULL);
+	ULONG64 uFirst = offset >> IMAGE_GRANULE_SHIFT;
+	ULONG64 uEnd = (offset + size + IMAGE_GRANULE_SIZE - 1) >> IMAGE_GRANULE_SHIFT;
+
+	if (m->uPrealloc && !m->Map.TestAll(uFirst, uEnd)) {
+		if (!Preallocate(offset, size))
+			return false;
+	}
+
+	if (!ImageTransfer(m->Handle, true, buf, size, offset))
+		return false;
+
+	// the rest of a partially written granule is a hole or lies behind the end of the file, both read as zeros
+	m->Map.Set(uFirst, uEnd);
+	return true;
 }
 
 bool CImageFileIO::DiskRead(void* buf, int size, __int64 offset)
 {
-	SetFilePointerEx(m->Handle, *(LARGE_INTEGER*)&offset, NULL, FILE_BEGIN);
-    DWORD BytesRead;
-	return !!ReadFile(m->Handle, buf, size, &BytesRead, NULL);
+	//
+	// split the request into runs of allocated and unallocated granules,
+	// only the allocated ones are read from the file, the others are zeroed
+	//
+
+	ULONG64 uPos = offset;
+	ULONG64 uEnd = offset + size;
+	while (uPos < uEnd) {
+		bool bAllocated = m->Map.Test(uPos >> IMAGE_GRANULE_SHIFT);
+		ULONG64 uNext = ((uPos >> IMAGE_GRANULE_SHIFT) + 1) << IMAGE_GRANULE_SHIFT;
+		while (uNext < uEnd && m->Map.Test(uNext >> IMAGE_GRANULE_SHIFT) == bAllocated)
+			uNext += IMAGE_GRANULE_SIZE;
+		if (uNext > uEnd)
+			uNext = uEnd;
+
+		BYTE* pBuf = (BYTE*)buf + (uPos - offset);
+		if (!bAllocated)
+			ZeroMemory(pBuf, (size_t)(uNext - uPos));
+		else if (!ImageTransfer(m->Handle, false, pBuf, (int)(uNext - uPos), uPos))
+			return false;
+
+		uPos = uNext;
+	}
+	return true;
 }
 
 void CImageFileIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
@@ -138,18 +343,30 @@ void CImageFileIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
         fzdi.FileOffset.QuadPart = range->StartingOffset;
         fzdi.BeyondFinalZero.QuadPart = range->StartingOffset + range->LengthInBytes;
 
+        // only granules which are zeroed as a whole become unallocated, they are cleared before the hole
+        // is punched, so a write which lands on them meanwhile sets its bits again and is not lost
+        ULONG64 uFirst = (fzdi.FileOffset.QuadPart + IMAGE_GRANULE_SIZE - 1) >> IMAGE_GRANULE_SHIFT;
+        ULONG64 uEnd = fzdi.BeyondFinalZero.QuadPart >> IMAGE_GRANULE_SHIFT;
+        EnterCriticalSection(&m->PreallocLock);
+        m->Map.Clear(uFirst, uEnd);
+        LeaveCriticalSection(&m->PreallocLock);
+
+        // punch the hole, if that fails the data is still there and the granules count as allocated again
         DWORD dwTemp;
-        DeviceIoControl(m->Handle, FSCTL_SET_ZERO_DATA, &fzdi, sizeof(fzdi), NULL, 0, &dwTemp, NULL);
+        if (!ImageIoControl(m->Handle, FSCTL_SET_ZERO_DATA, &fzdi, sizeof(fzdi), NULL, 0, &dwTemp))
+            m->Map.Set(uFirst, uEnd);
 
 		range++;
 		n--;
 	}
 }
 
-BOOL GetSparseRanges(HANDLE hFile)
+static bool GetSparseRanges(HANDLE hFile, SAllocMap& Map)
 {
     LARGE_INTEGER liFileSize;
     GetFileSizeEx(hFile, &liFileSize);
+    if (liFileSize.QuadPart == 0)
+        return true;
 
     // Range to be examined (the whole file)
     FILE_ALLOCATED_RANGE_BUFFER queryRange;
@@ -159,19 +376,17 @@ BOOL GetSparseRanges(HANDLE hFile)
     // Allocated areas info
     FILE_ALLOCATED_RANGE_BUFFER allocRanges[1024];
 
-    DWORD nbytes;
+    DWORD nbytes = 0;
     BOOL fFinished;
-    DbgPrint(L"\nAllocated ranges in the file:");
     do
     {
-        fFinished = DeviceIoControl(hFile,
+        fFinished = ImageIoControl(hFile,
                                     FSCTL_QUERY_ALLOCATED_RANGES,
                                     &queryRange,
                                     sizeof(queryRange),
                                     allocRanges,
                                     sizeof(allocRanges),
-                                    &nbytes,
-                                    NULL);
+                                    &nbytes);
 
         if (!fFinished)
         {
@@ -181,20 +396,18 @@ BOOL GetSparseRanges(HANDLE hFile)
             if (dwError != ERROR_MORE_DATA)
             {
                 DbgPrint(L"DeviceIoControl failed w/err 0x%08lx\n", dwError);
-                CloseHandle(hFile);
-                return FALSE;
+                return false;
             }
         }
 
         // Calculate the number of records returned
         DWORD dwAllocRangeCount = nbytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
 
-        // Print each allocated range
+        // Mark every granule an allocated range touches
         for (DWORD i = 0; i < dwAllocRangeCount; i++)
         {
-            DbgPrint(L"allocated range: [%I64u] [%I64u]\n",
-                    allocRanges[i].FileOffset.QuadPart,
-                    allocRanges[i].Length.QuadPart);
+            Map.Set(allocRanges[i].FileOffset.QuadPart >> IMAGE_GRANULE_SHIFT,
+                    (allocRanges[i].FileOffset.QuadPart + allocRanges[i].Length.QuadPart + IMAGE_GRANULE_SIZE - 1) >> IMAGE_GRANULE_SHIFT);
         }
 
         // Set starting address and size for the next query
@@ -208,5 +421,5 @@ BOOL GetSparseRanges(HANDLE hFile)
 
     } while (!fFinished);
 
-    return TRUE;
+    return true;
 }
@@ -4,12 +4,14 @@
 class CImageFileIO : public CAbstractIO
 {
 public:
-	CImageFileIO(std::wstring& FilePath, ULONG64 uSize = 0);
+	CImageFileIO(std::wstring& FilePath, ULONG64 uSize = 0, ULONG uPreallocKb = 0);
 	virtual ~CImageFileIO();
 
 	virtual ULONG64 GetDiskSize() const;
-	virtual ULONG64 GetAllocSize() const;
+	virtual ULONG64 GetAllocSize() const; // space taken on the volume
+	virtual ULONG64 GetUsedSize() const; // size of all granules holding data
 	virtual bool CanBeFormated() const;
+	virtual bool CanRunConcurrently() const { return true; }
 
 	virtual int Init();
 	virtual void PrepViewOfFile(BYTE*) {}
@@ -19,6 +21,8 @@ public:
 	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n);
 
 protected:
+	bool Preallocate(__int64 offset, int size);
+
 	struct SImageFileIO* m;
 };
 
@@ -0,0 +1,336 @@
+#include "framework.h"
+#include "..\ImDisk\inc\imdproxy.h"
+#include "IoRing.h"
+#include "ImBox.h"
+#include "..\Common\helpers.h"
+
+struct SIoRing
+{
+	CAbstractIO* pIO;
+
+	std::vector<CIoRing::SRequest> Slots;
+	BYTE* pBuffers;
+	SIZE_T uBuffersSize;
+
+	CRITICAL_SECTION Lock;
+	std::deque<int> Pending;
+	std::deque<int> Completed;
+	HANDLE hWork;		// counts pending requests
+	HANDLE hDone;		// counts completed requests
+
+	std::vector<HANDLE> Threads;
+	volatile bool bTerminate;
+};
+
+CIoRing::CIoRing(CAbstractIO* pIO, int iSlots, int iBufferSize)
+{
+	m = new SIoRing;
+	m->pIO = pIO;
+	m->bTerminate = false;
+	InitializeCriticalSection(&m->Lock);
+
+	if (iSlots < 1) iSlots = 1;
+	if (iSlots > IO_RING_MAX_SLOTS) iSlots = IO_RING_MAX_SLOTS;
+
+	// page aligned buffers, as required for unbuffered file IO
+	iBufferSize = (iBufferSize + 0xFFF) & ~0xFFF;
+	m->uBuffersSize = (SIZE_T)iSlots * iBufferSize;
+	m->pBuffers = m->uBuffersSize ? (BYTE*)VirtualAlloc(NULL, m->uBuffersSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE) : NULL;
+
+	m->hWork = CreateSemaphore(NULL, 0, IO_RING_MAX_SLOTS + IO_RING_MAX_THREADS, NULL);
+	m->hDone = CreateSemaphore(NULL, 0, IO_RING_MAX_SLOTS, NULL);
+	if ((m->uBuffersSize && !m->pBuffers) || !m->hWork || !m->hDone) {
+		DbgPrint(L"Failed to setup the IO ring.\n");
+		return;
+	}
+
+	m->Slots.resize(iSlots);
+	for (int i = 0; i < iSlots; i++) {
+		memset(&m->Slots[i], 0, sizeof(SRequest));
+		m->Slots[i].Buffer = m->pBuffers ? m->pBuffers + (SIZE_T)i * iBufferSize : NULL;
+	}
+
+	int iThreads = m->pIO->CanRunConcurrently() ? min(iSlots, IO_RING_MAX_THREADS) : 1;
+	for (int i = 0; i < iThreads; i++) {
+		HANDLE hThread = CreateThread(NULL, 0, WorkerProc, m, 0, NULL);
+		if (!hThread)
+			break;
+		m->Threads.push_back(hThread);
+	}
+	if (m->Threads.empty())
+		m->Slots.clear();
+}
+
+CIoRing::~CIoRing()
+{
+	m->bTerminate = true;
+	if (!m->Threads.empty()) {
+		ReleaseSemaphore(m->hWork, (LONG)m->Threads.size(), NULL);
+		WaitForMultipleObjects((DWORD)m->Threads.size(), m->Threads.data(), TRUE, INFINITE);
+		for (HANDLE hThread : m->Threads)
+			CloseHandle(hThread);
+	}
+	if (m->hWork) CloseHandle(m->hWork);
+	if (m->hDone) CloseHandle(m->hDone);
+	if (m->pBuffers) VirtualFree(m->pBuffers, 0, MEM_RELEASE);
+	DeleteCriticalSection(&m->Lock);
+	delete m;
+}
+
+int CIoRing::GetSlotCount() const
+{
+	return (int)m->Slots.size();
+}
+
+int CIoRing::GetThreadCount() const
+{
+	return (int)m->Threads.size();
+}
+
+CIoRing::SRequest* CIoRing::GetRequest(int iSlot)
+{
+	if (iSlot < 0 || iSlot >= (int)m->Slots.size())
+		return NULL;
+	return &m->Slots[iSlot];
+}
+
+bool CIoRing::Submit(int iSlot)
+{
+	if (iSlot < 0 || iSlot >= (int)m->Slots.size())
+		return false;
+
+	EnterCriticalSection(&m->Lock);
+	m->Pending.push_back(iSlot);
+	LeaveCriticalSection(&m->Lock);
+	ReleaseSemaphore(m->hWork, 1, NULL);
+	return true;
+}
+
+int CIoRing::WaitCompletion(DWORD dwTimeout)
+{
+	if (WaitForSingleObject(m->hDone, dwTimeout) != WAIT_OBJECT_0)
+		return -1;
+
+	EnterCriticalSection(&m->Lock);
+	int iSlot = m->Completed.front();
+	m->Completed.pop_front();
+	LeaveCriticalSection(&m->Lock);
+	return iSlot;
+}
+
+bool CIoRing::Run(SRequest* pRequest)
+{
+	//
+	// the stripes of a large read or write run on all workers at once, all of them complete
+	// before this returns, so for the issuer the request executes as a whole, in its order
+	//
+
+	ULONGLONG uStripes = 1;
+	if (pRequest->Code == IMDPROXY_REQ_READ || pRequest->Code == IMDPROXY_REQ_WRITE)
+		uStripes = min(pRequest->Length / IO_RING_MIN_STRIPE, (ULONGLONG)min(m->Slots.size(), m->Threads.size()));
+	if (uStripes <= 1)
+		return Execute(m->pIO, pRequest);
+
+	// whole pages, so every stripe stays sector aligned
+	ULONGLONG uStripe = (pRequest->Length / uStripes + 0xFFF) & ~0xFFFull;
+
+	int iSubmitted = 0;
+	for (ULONGLONG uPos = 0; uPos < pRequest->Length; uPos += uStripe) {
+		SRequest* pStripe = &m->Slots[iSubmitted];
+		pStripe->Code = pRequest->Code;
+		pStripe->Offset = pRequest->Offset + uPos;
+		pStripe->Length = min(uStripe, pRequest->Length - uPos);
+		pStripe->Buffer = pRequest->Buffer + uPos;
+		Submit(iSubmitted++);
+	}
+
+	pRequest->Failed = false;
+	while (iSubmitted-- > 0) {
+		int iSlot = WaitCompletion();
+		if (m->Slots[iSlot].Failed)
+			pRequest->Failed = true;
+	}
+	return true;
+}
+
+DWORD WINAPI CIoRing::WorkerProc(LPVOID lpThreadParameter)
+{
+	SIoRing* m = (SIoRing*)lpThreadParameter;
+	for (;;) {
+		WaitForSingleObject(m->hWork, INFINITE);
+		if (m->bTerminate)
+			break;
+
+		EnterCriticalSection(&m->Lock);
+		int iSlot = m->Pending.front();
+		m->Pending.pop_front();
+		LeaveCriticalSection(&m->Lock);
+
+		SRequest* pRequest = &m->Slots[iSlot];
+		if (!Execute(m->pIO, pRequest))
+			pRequest->Failed = true;
+
+		EnterCriticalSection(&m->Lock);
+		m->Completed.push_back(iSlot);
+		LeaveCriticalSection(&m->Lock);
+		ReleaseSemaphore(m->hDone, 1, NULL);
+	}
+	return 0;
+}
+
+bool CIoRing::Execute(CAbstractIO* pIO, SRequest* pRequest)
+{
+	pRequest->Failed = false;
+
+	if (pRequest->Code == IMDPROXY_REQ_READ) {
+		if (!pIO->DiskRead(pRequest->Buffer, (int)pRequest->Length, pRequest->Offset)) {
+			DbgPrint(L"DiskRead error.\n");
+			pRequest->Failed = true;
+		}
+	}
+	else if (pRequest->Code == IMDPROXY_REQ_WRITE) {
+		if (!pIO->DiskWrite(pRequest->Buffer, (int)pRequest->Length, pRequest->Offset)) {
+			DbgPrint(L"DiskWrite error, SOME DATA WILL BE LOST.");
+			pRequest->Failed = true;
+		}
+	}
+	else if (pRequest->Code == IMDPROXY_REQ_UNMAP) {
+		pIO->TrimProcess((DEVICE_DATA_SET_RANGE*)pRequest->Buffer, (int)(pRequest->Length / sizeof(DEVICE_DATA_SET_RANGE)));
+	}
+	else { // unknown command
+		DbgPrint(L"Unknown Command: %d\n", pRequest->Code);
+		return false;
+	}
+	return true;
+}
+
+int CIoRing::Benchmark(CAbstractIO* pIO, bool bWrite)
+{
+	//
+	// an in process stand in for the ImDisk driver, it keeps up to depth random 4 KB requests
+	// in flight and submits the next one to every slot as soon as it completes
+	//
+
+	static const int Depths[] = { 1, 4, 16 };
+	const int Block = 4096;
+
+	HANDLE hOut = BenchOutput();
+
+	ULONG64 uSpan = pIO->GetDiskSize() & ~(ULONG64)(Block - 1);
+	if (uSpan > (1ull << 30))
+		uSpan = 1ull << 30; // bounds the memory a ram disk allocates for the write pass
+	ULONG64 uBlocks = uSpan / Block;
+	if (!uBlocks)
+		return ERR_INTERNAL;
+
+	ULONG64 uSeed = GetTickCount64() | 1;
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+
+	BenchPrint(hOut, L"IO ring benchmark, random %d KB requests over %I64u MB\r\n", Block / 1024, uSpan >> 20);
+
+	// writes go first, so that a fresh ram disk has allocated blocks to read
+	for (int write = bWrite ? 1 : 0; write >= 0; write--) {
+		for (int i = 0; i < _countof(Depths); i++) {
+
+			CIoRing Ring(pIO, Depths[i], Block);
+			if (Ring.GetSlotCount() != Depths[i])
+				return ERR_MALLOC_ERROR;
+
+			auto Prepare = [&](SRequest* pRequest) {
+				uSeed ^= uSeed << 13;
+				uSeed ^= uSeed >> 7;
+				uSeed ^= uSeed << 17;
+				pRequest->Code = write ? IMDPROXY_REQ_WRITE : IMDPROXY_REQ_READ;
+				pRequest->Offset = (uSeed % uBlocks) * Block;
+				pRequest->Length = Block;
+				if (write)
+					memset(pRequest->Buffer, 0xA5, Block);
+			};
+
+			LARGE_INTEGER start, now;
+			QueryPerformanceCounter(&start);
+
+			int iInFlight = 0;
+			for (int iSlot = 0; iSlot < Depths[i]; iSlot++) {
+				Prepare(Ring.GetRequest(iSlot));
+				Ring.Submit(iSlot);
+				iInFlight++;
+			}
+
+			ULONG64 uDone = 0;
+			ULONG64 uFailed = 0;
+			while (iInFlight > 0) {
+				int iSlot = Ring.WaitCompletion();
+				if (iSlot < 0)
+					break;
+				iInFlight--;
+				uDone++;
+				if (Ring.GetRequest(iSlot)->Failed)
+					uFailed++;
+
+				QueryPerformanceCounter(&now);
+				if (now.QuadPart - start.QuadPart < freq.QuadPart / 2) {
+					Prepare(Ring.GetRequest(iSlot));
+					Ring.Submit(iSlot);
+					iInFlight++;
+				}
+			}
+			QueryPerformanceCounter(&now);
+
+			double iops = (double)uDone / ((double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+			BenchPrint(hOut, L"%-5s QD %2d, %2d workers: %10.0f IOPS %8.1f MB/s%s\r\n", write ? L"write" : L"read", Depths[i], Ring.GetThreadCount(),
+				iops, iops * Block / (1024 * 1024), uFailed ? L" (errors)" : L"");
+		}
+	}
+
+	//
+	// the driver itself sends one request at a time, large ones are split over the workers by Run
+	//
+
+	const int Large = 1 << 20;
+	if (uSpan < Large)
+		return ERR_OK;
+
+	BYTE* pBuffer = (BYTE*)VirtualAlloc(NULL, Large, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!pBuffer)
+		return ERR_MALLOC_ERROR;
+	memset(pBuffer, 0xA5, Large);
+
+	CIoRing Ring(pIO, IO_RING_MAX_THREADS, 0);
+
+	for (int write = bWrite ? 1 : 0; write >= 0; write--) {
+		double mbps[2];
+		for (int split = 0; split < 2; split++) {
+
+			SRequest request;
+			request.Code = write ? IMDPROXY_REQ_WRITE : IMDPROXY_REQ_READ;
+			request.Offset = 0;
+			request.Length = Large;
+			request.Buffer = pBuffer;
+
+			LARGE_INTEGER start, now;
+			QueryPerformanceCounter(&start);
+
+			ULONG64 uDone = 0;
+			do {
+				if (split)
+					Ring.Run(&request);
+				else
+					Execute(pIO, &request);
+				uDone++;
+				request.Offset = (request.Offset + Large) % (uSpan & ~(ULONG64)(Large - 1));
+				QueryPerformanceCounter(&now);
+			} while (now.QuadPart - start.QuadPart < freq.QuadPart / 2);
+
+			mbps[split] = (double)uDone / ((double)(now.QuadPart - start.QuadPart) / freq.QuadPart);
+		}
+		BenchPrint(hOut, L"%-5s 1 MB, QD 1: %8.1f MB/s, split over %2d workers: %8.1f MB/s\r\n", write ? L"write" : L"read",
+			mbps[0], Ring.GetThreadCount(), mbps[1]);
+	}
+
+	VirtualFree(pBuffer, 0, MEM_RELEASE);
+
+	return ERR_OK;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "AbstractIO.h"
+
+//
+// Multi slot request ring, submitted requests are picked up by a pool of worker threads and
+// complete in any order, so a disk IO which can run concurrently gets several requests at once.
+// Overlapping requests in flight at the same time are not ordered, this is up to the issuer.
+// An issuer with a single request window, like the ImDisk proxy, uses Run to split large reads
+// and writes over the workers instead.
+//
+
+#define IO_RING_MAX_SLOTS	64
+#define IO_RING_MAX_THREADS	16
+#define IO_RING_MIN_STRIPE	(64 << 10)	// smaller parts of a request are not worth a worker
+
+class CIoRing
+{
+public:
+	CIoRing(CAbstractIO* pIO, int iSlots, int iBufferSize); // without a buffer size the issuer sets the slot buffers
+	~CIoRing();
+
+	struct SRequest
+	{
+		UCHAR		Code;		// IMDPROXY_REQ_READ, IMDPROXY_REQ_WRITE or IMDPROXY_REQ_UNMAP
+		bool		Failed;
+		ULONGLONG	Offset;
+		ULONGLONG	Length;		// for unmap the size of the range list in bytes
+		BYTE*		Buffer;
+	};
+
+	int			GetSlotCount() const;
+	int			GetThreadCount() const;
+	SRequest*	GetRequest(int iSlot);
+
+	bool		Submit(int iSlot);
+	int			WaitCompletion(DWORD dwTimeout = INFINITE); // slot of any completed request, or -1
+
+	bool		Run(SRequest* pRequest); // executes one request and waits for it, not to be mixed with Submit
+
+	static bool	Execute(CAbstractIO* pIO, SRequest* pRequest); // false for an unknown request code
+
+	static int	Benchmark(CAbstractIO* pIO, bool bWrite);
+
+protected:
+	static DWORD WINAPI WorkerProc(LPVOID lpThreadParameter);
+
+	struct SIoRing* m;
+};
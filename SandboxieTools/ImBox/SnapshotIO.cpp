@@ -0,0 +1,368 @@
+#include "framework.h"
+#include "SnapshotIO.h"
+#include "ImageFileIO.h"
+#include "ImBox.h"
+#include "..\Common\helpers.h"
+
+//
+// Delta file layout: header page, block bitmap rounded up to full pages, then the disk image itself,
+// of which only the changed blocks are ever written, the rest stays sparse.
+// Block data is written before the bitmap, so after a crash a block is either complete or not used.
+//
+
+#define SNAPSHOT_MAGIC			0x4E534249 // "IBSN"
+#define SNAPSHOT_VERSION		1
+#define SNAPSHOT_HEADER_SIZE	0x1000
+#define SNAPSHOT_MERGE_CHUNK	(1 << 20)
+
+struct SSnapshotHeader
+{
+	ULONG Magic;
+	ULONG Version;
+	ULONG BlockShift;
+	ULONG Reserved;
+	ULONG64 DiskSize;
+	ULONG64 BitmapOffset;
+	ULONG64 BitmapSize;
+	ULONG64 DataOffset;
+};
+
+struct SSnapshotIO
+{
+	std::wstring DeltaPath;
+	CAbstractIO* pDelta = NULL;
+
+	int BlockShift = 12;
+	int BlockSize = 0;
+	size_t Blocks = 0;
+
+	ULONG64 BitmapOffset = 0;
+	ULONG64 BitmapSize = 0;		// rounded up to full pages
+	ULONG64 DataOffset = 0;
+	ULONG64* Bitmap = NULL;		// page aligned, as it is written to the delta file as is
+	BYTE* Block = NULL;			// copy up buffer
+
+	SRWLOCK Lock = SRWLOCK_INIT;
+};
+
+static inline bool TestBlock(const ULONG64* Bitmap, size_t index)
+{
+	return (Bitmap[index >> 6] >> (index & 63)) & 1;
+}
+
+static inline void SetBlock(ULONG64* Bitmap, size_t index)
+{
+	Bitmap[index >> 6] |= 1ull << (index & 63);
+}
+
+CSnapshotIO::CSnapshotIO(CAbstractIO* pBase, const std::wstring& DeltaPath, int BlockShift)
+{
+	m = new SSnapshotIO;
+	m->DeltaPath = DeltaPath;
+	m->BlockShift = max(BlockShift, 12);
+
+	m_pBase = pBase;
+}
+
+CSnapshotIO::~CSnapshotIO()
+{
+	delete m->pDelta;
+	if (m->Bitmap) VirtualFree(m->Bitmap, 0, MEM_RELEASE);
+	if (m->Block) VirtualFree(m->Block, 0, MEM_RELEASE);
+	delete m;
+}
+
+ULONG64 CSnapshotIO::GetAllocSize() const
+{
+	return m_pBase->GetAllocSize() + (m->pDelta ? m->pDelta->GetAllocSize() : 0);
+}
+
+bool CSnapshotIO::CanRunConcurrently() const
+{
+	return m_pBase->CanRunConcurrently() && m->pDelta && m->pDelta->CanRunConcurrently();
+}
+
+int CSnapshotIO::Init()
+{
+	if (m->Bitmap) // already initialized, as a base of a new snapshot
+		return ERR_OK;
+
+	int ret = m_pBase->Init();
+	if (ret != ERR_OK)
+		return ret;
+
+	ULONG64 uDiskSize = m_pBase->GetDiskSize();
+
+	SSnapshotHeader* header = (SSnapshotHeader*)VirtualAlloc(NULL, SNAPSHOT_HEADER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!header)
+		return ERR_MALLOC_ERROR;
+
+	//
+	// a new delta file gets only its header written, this is all it takes to create a snapshot,
+	// the bitmap of an empty delta are the zeros read behind the end of the file
+	//
+
+	for (int i = 0; i < 2 && ret == ERR_OK; i++) {
+
+		m->BlockSize = 1 << m->BlockShift;
+		m->Blocks = (size_t)((uDiskSize + m->BlockSize - 1) >> m->BlockShift);
+		m->BitmapOffset = SNAPSHOT_HEADER_SIZE;
+		m->BitmapSize = ((m->Blocks + 7) / 8 + 0xFFF) & ~0xFFFull;
+		m->DataOffset = (m->BitmapOffset + m->BitmapSize + m->BlockSize - 1) & ~(ULONG64)(m->BlockSize - 1);
+
+		if (!m->pDelta) {
+			m->pDelta = new CImageFileIO(m->DeltaPath, m->DataOffset + uDiskSize);
+			ret = m->pDelta->Init();
+			if (ret == ERR_OK && !m->pDelta->DiskRead(header, SNAPSHOT_HEADER_SIZE, 0))
+				ret = ERR_FILE_NOT_OPENED;
+			if (ret != ERR_OK)
+				break;
+
+			if (header->Magic == 0) {
+				ZeroMemory(header, SNAPSHOT_HEADER_SIZE);
+				header->Magic = SNAPSHOT_MAGIC;
+				header->Version = SNAPSHOT_VERSION;
+				header->BlockShift = m->BlockShift;
+				header->DiskSize = uDiskSize;
+				header->BitmapOffset = m->BitmapOffset;
+				header->BitmapSize = m->BitmapSize;
+				header->DataOffset = m->DataOffset;
+				if (!m->pDelta->DiskWrite(header, SNAPSHOT_HEADER_SIZE, 0))
+					ret = ERR_FILE_NOT_OPENED;
+				break;
+			}
+
+			// an existing delta keeps its own block size
+			if (header->Magic == SNAPSHOT_MAGIC && header->Version == SNAPSHOT_VERSION && header->BlockShift != (ULONG)m->BlockShift
+			  && header->BlockShift >= 12 && header->BlockShift <= 24) {
+				m->BlockShift = header->BlockShift;
+				continue;
+			}
+		}
+
+		if (header->Magic != SNAPSHOT_MAGIC || header->Version != SNAPSHOT_VERSION || header->DiskSize != uDiskSize
+		  || header->BitmapOffset != m->BitmapOffset || header->BitmapSize != m->BitmapSize || header->DataOffset != m->DataOffset) {
+			DbgPrint(L"Snapshot %s does not match its base.\n", m->DeltaPath.c_str());
+			ret = ERR_SNAPSHOT_INVALID;
+		}
+		break;
+	}
+
+	VirtualFree(header, 0, MEM_RELEASE);
+	if (ret != ERR_OK)
+		return ret;
+
+	m->Bitmap = (ULONG64*)VirtualAlloc(NULL, (SIZE_T)m->BitmapSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	m->Block = (BYTE*)VirtualAlloc(NULL, m->BlockSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!m->Bitmap || !m->Block)
+		return ERR_MALLOC_ERROR;
+
+	if (!m->pDelta->DiskRead(m->Bitmap, (int)m->BitmapSize, m->BitmapOffset))
+		return ERR_FILE_NOT_OPENED;
+
+	return ERR_OK;
+}
+
+bool CSnapshotIO::SaveBitmap(size_t first, size_t last)
+{
+	ULONG64 from = (first >> 3) & ~0xFFFull;
+	ULONG64 to = ((last >> 3) + 0x1000) & ~0xFFFull;
+	return m->pDelta->DiskWrite((BYTE*)m->Bitmap + from, (int)(to - from), m->BitmapOffset + from);
+}
+
+bool CSnapshotIO::DiskRead(void* buf, int size, __int64 offset)
+{
+	bool ret = true;
+	__int64 pos = offset;
+	__int64 end = offset + size;
+
+	AcquireSRWLockShared(&m->Lock);
+
+	//
+	// read runs of blocks from the same layer directly into the callers buffer
+	//
+
+	while (pos < end) {
+		size_t index = (size_t)(pos >> m->BlockShift);
+		bool delta = TestBlock(m->Bitmap, index);
+
+		__int64 run_end = (__int64)(index + 1) << m->BlockShift;
+		while (run_end < end && TestBlock(m->Bitmap, ++index) == delta)
+			run_end += m->BlockSize;
+		if (run_end > end)
+			run_end = end;
+
+		BYTE* ptr = (BYTE*)buf + (pos - offset);
+		if (!(delta ? m->pDelta->DiskRead(ptr, (int)(run_end - pos), m->DataOffset + pos) : m_pBase->DiskRead(ptr, (int)(run_end - pos), pos)))
+			ret = false;
+		pos = run_end;
+	}
+
+	ReleaseSRWLockShared(&m->Lock);
+
+	return ret;
+}
+
+bool CSnapshotIO::DiskWrite(void* buf, int size, __int64 offset)
+{
+	bool ret = true;
+	__int64 pos = offset;
+	__int64 end = offset + size;
+	size_t first = (size_t)-1, last = 0;
+
+	AcquireSRWLockExclusive(&m->Lock);
+
+	while (pos < end) {
+		size_t index = (size_t)(pos >> m->BlockShift);
+		__int64 block_start = (__int64)index << m->BlockShift;
+		__int64 block_end = block_start + m->BlockSize;
+		BYTE* ptr = (BYTE*)buf + (pos - offset);
+
+		if (!TestBlock(m->Bitmap, index) && (pos > block_start || end < block_end)) {
+
+			//
+			// partial write to a block the delta does not hold yet, copy it up first
+			//
+
+			int len = (int)(min(end, block_end) - pos);
+			if (m_pBase->DiskRead(m->Block, m->BlockSize, block_start)) {
+				memcpy(m->Block + (pos - block_start), ptr, len);
+				if (m->pDelta->DiskWrite(m->Block, m->BlockSize, m->DataOffset + block_start)) {
+					SetBlock(m->Bitmap, index);
+					first = min(first, index);
+					last = max(last, index);
+				}
+				else
+					ret = false;
+			}
+			else
+				ret = false;
+			pos += len;
+			continue;
+		}
+
+		// the run goes on over blocks the delta holds already or which get overwritten completely
+		__int64 run_end = block_end;
+		while (run_end < end && (TestBlock(m->Bitmap, (size_t)(run_end >> m->BlockShift)) || run_end + m->BlockSize <= end))
+			run_end += m->BlockSize;
+		if (run_end > end)
+			run_end = end;
+
+		if (m->pDelta->DiskWrite(ptr, (int)(run_end - pos), m->DataOffset + pos)) {
+			for (size_t i = index; i <= (size_t)((run_end - 1) >> m->BlockShift); i++) {
+				if (!TestBlock(m->Bitmap, i)) {
+					SetBlock(m->Bitmap, i);
+					first = min(first, i);
+					last = max(last, i);
+				}
+			}
+		}
+		else
+			ret = false;
+		pos = run_end;
+	}
+
+	if (first <= last && !SaveBitmap(first, last))
+		ret = false;
+
+	ReleaseSRWLockExclusive(&m->Lock);
+
+	return ret;
+}
+
+void CSnapshotIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
+{
+	//
+	// only whole blocks held by the delta are released, they stay in use and read as zeros,
+	// the base is never changed
+	//
+
+	std::vector<DEVICE_DATA_SET_RANGE> Ranges;
+
+	AcquireSRWLockExclusive(&m->Lock);
+
+	for (; n; range++, n--) {
+		size_t index = (size_t)((range->StartingOffset + m->BlockSize - 1) >> m->BlockShift);
+		size_t end = (size_t)((range->StartingOffset + range->LengthInBytes) >> m->BlockShift);
+		if (end > m->Blocks)
+			end = m->Blocks;
+		while (index < end) {
+			if (!TestBlock(m->Bitmap, index)) {
+				index++;
+				continue;
+			}
+			size_t count = 1;
+			while (index + count < end && TestBlock(m->Bitmap, index + count))
+				count++;
+
+			DEVICE_DATA_SET_RANGE delta_range = { 0 };
+			delta_range.StartingOffset = m->DataOffset + ((ULONG64)index << m->BlockShift);
+			delta_range.LengthInBytes = (ULONG64)count << m->BlockShift;
+			Ranges.push_back(delta_range);
+
+			index += count;
+		}
+	}
+
+	if (!Ranges.empty())
+		m->pDelta->TrimProcess(Ranges.data(), (int)Ranges.size());
+
+	ReleaseSRWLockExclusive(&m->Lock);
+}
+
+int CSnapshotIO::MergeDown()
+{
+	//
+	// the delta is emptied only once all blocks are in the base, an interrupted merge can be
+	// repeated, the stacked view does not change in either case
+	//
+
+	BYTE* buf = (BYTE*)VirtualAlloc(NULL, SNAPSHOT_MERGE_CHUNK, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!buf)
+		return ERR_MALLOC_ERROR;
+
+	int ret = ERR_OK;
+	ULONG64 uDiskSize = m_pBase->GetDiskSize();
+	size_t max_count = SNAPSHOT_MERGE_CHUNK >> m->BlockShift;
+
+	AcquireSRWLockExclusive(&m->Lock);
+
+	for (size_t index = 0; index < m->Blocks && ret == ERR_OK; ) {
+		if (m->Bitmap[index >> 6] == 0) {
+			index = (index | 63) + 1;
+			continue;
+		}
+		if (!TestBlock(m->Bitmap, index)) {
+			index++;
+			continue;
+		}
+
+		size_t count = 1;
+		while (index + count < m->Blocks && count < max_count && TestBlock(m->Bitmap, index + count))
+			count++;
+
+		ULONG64 pos = (ULONG64)index << m->BlockShift;
+		int len = (int)min((ULONG64)count << m->BlockShift, uDiskSize - pos);
+		if (!m->pDelta->DiskRead(buf, len, m->DataOffset + pos) || !m_pBase->DiskWrite(buf, len, pos))
+			ret = ERR_FILE_NOT_OPENED;
+
+		index += count;
+	}
+
+	if (ret == ERR_OK) {
+		ZeroMemory(m->Bitmap, (SIZE_T)m->BitmapSize);
+		if (!m->pDelta->DiskWrite(m->Bitmap, (int)m->BitmapSize, m->BitmapOffset))
+			ret = ERR_FILE_NOT_OPENED;
+		else {
+			DEVICE_DATA_SET_RANGE range = { 0 };
+			range.StartingOffset = m->DataOffset;
+			range.LengthInBytes = uDiskSize;
+			m->pDelta->TrimProcess(&range, 1);
+		}
+	}
+
+	ReleaseSRWLockExclusive(&m->Lock);
+
+	VirtualFree(buf, 0, MEM_RELEASE);
+	return ret;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "AbstractIO.h"
+
+//
+// Copy on write layer, the base disk is only read, all writes go to a sparse delta file
+// which keeps every changed block at its own offset, a block bitmap tells which blocks it holds.
+// Snapshots stack, the base of a layer may be an other CSnapshotIO.
+//
+
+class CSnapshotIO : public CAbstractIO
+{
+public:
+	CSnapshotIO(CAbstractIO* pBase, const std::wstring& DeltaPath, int BlockShift = 12);
+	virtual ~CSnapshotIO();
+
+	virtual ULONG64 GetAllocSize() const;
+	virtual ULONG64 GetDiskSize() const { return m_pBase->GetDiskSize(); }
+	virtual bool CanBeFormated() const { return m_pBase->CanBeFormated(); }
+	virtual bool CanRunConcurrently() const;
+
+	virtual int Init();
+	virtual void PrepViewOfFile(BYTE* p) { m_pBase->PrepViewOfFile(p); }
+
+	virtual bool DiskWrite(void* buf, int size, __int64 offset);
+	virtual bool DiskRead(void* buf, int size, __int64 offset);
+	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n);
+
+	virtual int MergeDown(); // writes all changed blocks to the base and empties the delta
+
+protected:
+	bool SaveBitmap(size_t first, size_t last);
+
+	struct SSnapshotIO* m;
+
+public:
+	CAbstractIO* m_pBase;
+};
@@ -3,24 +3,55 @@
 #include "ImBox.h"
 #include "VirtualMemoryIO.h"
 #include "..\Common\helpers.h"
+#include <unordered_map>
+
+extern "C" {
+	NTSYSAPI NTSTATUS NTAPI RtlGetCompressionWorkSpaceSize(USHORT CompressionFormatAndEngine, PULONG CompressBufferWorkSpaceSize, PULONG CompressFragmentWorkSpaceSize);
+	NTSYSAPI NTSTATUS NTAPI RtlCompressBuffer(USHORT CompressionFormatAndEngine, PUCHAR UncompressedBuffer, ULONG UncompressedBufferSize, PUCHAR CompressedBuffer, ULONG CompressedBufferSize, ULONG UncompressedChunkSize, PULONG FinalCompressedSize, PVOID WorkSpace);
+	NTSYSAPI NTSTATUS NTAPI RtlDecompressBuffer(USHORT CompressionFormat, PUCHAR UncompressedBuffer, ULONG UncompressedBufferSize, PUCHAR CompressedBuffer, ULONG CompressedBufferSize, PULONG FinalUncompressedSize);
+}
+
+//
+// In block store mode the ptr_table entries point to SStoreBlock's, allocated from a private heap,
+// block content is compressed with XPRESS and blocks with identical content are stored only once,
+// they are found by a content hash and shared with a reference count
+//
+
+struct SStoreBlock
+{
+	ULONG64 hash;
+	LONG refs;
+	ULONG size;			// stored size, equal to the block size when the block is kept uncompressed
+	BYTE data[1];
+};
+
+#define STORE_BLOCK_SIZE(size)	(FIELD_OFFSET(SStoreBlock, data) + (size))
 
 struct SVirtualMemory
 {
-	ULONG64 uSize;
+	ULONG64 uSize = 0;
 	
-	int mem_block_size, mem_block_size_mask, mem_block_size_shift; 
+	int mem_block_size = 0, mem_block_size_mask = 0, mem_block_size_shift = 0; 
 
-	size_t table_size;
-	void **ptr_table;
+	size_t table_size = 0;
+	void **ptr_table = NULL;
 
 	volatile size_t n_block = 0;
+
+	bool store = false;
+	HANDLE heap = NULL;
+	std::unordered_multimap<ULONG64, SStoreBlock*> blocks;
+	ULONG64 stored_size = 0;
+	BYTE* plain = NULL;		// scratch blocks, the store is not used concurrently
+	BYTE* packed = NULL;
+	PVOID work_space = NULL;
 };
 
-CVirtualMemoryIO::CVirtualMemoryIO(ULONG64 uSize, int BlockSize)
+CVirtualMemoryIO::CVirtualMemoryIO(ULONG64 uSize, int BlockSize, bool bBlockStore)
 {
 	m = new SVirtualMemory;
-	memset(m, 0, sizeof SVirtualMemory);
 	m->uSize = uSize;
+	m->store = bBlockStore;
 
 	m->mem_block_size_shift = BlockSize;
 	if (m->mem_block_size_shift < 12) m->mem_block_size_shift = 12;
@@ -31,6 +62,8 @@ CVirtualMemoryIO::CVirtualMemoryIO(ULONG64 uSize, int BlockSize)
 
 CVirtualMemoryIO::~CVirtualMemoryIO()
 {
+	if (m->heap)
+		HeapDestroy(m->heap);
 	delete m;
 }
 
@@ -40,6 +73,13 @@ ULONG64 CVirtualMemoryIO::GetDiskSize() const
 }
 
 ULONG64 CVirtualMemoryIO::GetAllocSize() const
+{ 
+	if (m->store)
+		return m->stored_size;
+	return GetUsedSize();
+}
+
+ULONG64 CVirtualMemoryIO::GetUsedSize() const
 { 
 	return (ULONG64)m->n_block * m->mem_block_size; 
 }
@@ -51,6 +91,23 @@ int CVirtualMemoryIO::Init()
 	SIZE_T alloc_size = m->table_size * sizeof(size_t);
 	NtAllocateVirtualMemory(NtCurrentProcess(), (void**)&m->ptr_table, 0, &alloc_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 
+	if (m->store) {
+		m->heap = HeapCreate(HEAP_NO_SERIALIZE, 0, 0);
+		if (!m->heap)
+			return ERR_MALLOC_ERROR;
+		m->plain = (BYTE*)HeapAlloc(m->heap, 0, m->mem_block_size);
+		m->packed = (BYTE*)HeapAlloc(m->heap, 0, m->mem_block_size);
+		if (!m->plain || !m->packed)
+			return ERR_MALLOC_ERROR;
+
+		// without a work space blocks are only deduplicated
+		ULONG work_size, frag_size;
+		if (NT_SUCCESS(RtlGetCompressionWorkSpaceSize(COMPRESSION_FORMAT_XPRESS | COMPRESSION_ENGINE_STANDARD, &work_size, &frag_size)))
+			m->work_space = HeapAlloc(m->heap, 0, work_size);
+		if (!m->work_space)
+			DbgPrint(L"Block compression is not available\n");
+	}
+
 	return ERR_OK;
 }
 
@@ -79,6 +136,9 @@ void CVirtualMemoryIO::Expand(ULONG64 uSize)
 
 bool CVirtualMemoryIO::DiskWrite(void* buf, int size, __int64 offset)
 {
+	if (m->store)
+		return StoreWrite((BYTE*)buf, size, offset);
+
 	bool ret = true;
 	size_t index = offset >> m->mem_block_size_shift;
 	int current_size;
@@ -128,6 +188,9 @@ bool CVirtualMemoryIO::DiskWrite(void* buf, int size, __int64 offset)
 
 bool CVirtualMemoryIO::DiskRead(void* buf, int size, __int64 offset)
 {
+	if (m->store)
+		return StoreRead((BYTE*)buf, size, offset);
+
 	size_t index = offset >> m->mem_block_size_shift;
 	int current_size;
 	int block_offset = offset & m->mem_block_size_mask;
@@ -157,6 +220,11 @@ void CVirtualMemoryIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
 	void *ptr;
 	SIZE_T alloc_size;
 
+	if (m->store) {
+		StoreTrim(range, n);
+		return;
+	}
+
 	while (n) {
 		index = range->StartingOffset >> m->mem_block_size_shift;
 		block_offset = range->StartingOffset & m->mem_block_size_mask;
@@ -180,4 +248,284 @@ void CVirtualMemoryIO::TrimProcess(DEVICE_DATA_SET_RANGE* range, int n)
 		range++;
 		n--;
 	}
-}
\ No newline at end of file
+}
+
+static ULONG64 StoreHash(const BYTE* ptr, int size)
+{
+	const ULONG64* data = (const ULONG64*)ptr;
+	ULONG64 hash = 0x9E3779B97F4A7C15ull ^ size;
+	for (int i = 0; i < size / 8; i++) {
+		hash ^= data[i] * 0x87C37B91114253D5ull;
+		hash = _rotl64(hash, 31) * 0x4CF5AD432745937Full;
+	}
+	return hash ^ (hash >> 29);
+}
+
+void CVirtualMemoryIO::StoreLoad(size_t index, BYTE* buf)
+{
+	SStoreBlock* block = (SStoreBlock*)m->ptr_table[index];
+	if (!block)
+		ZeroMemory(buf, m->mem_block_size);
+	else if (block->size == (ULONG)m->mem_block_size)
+		memcpy(buf, block->data, m->mem_block_size);
+	else {
+		ULONG final_size = 0;
+		if (!NT_SUCCESS(RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS, buf, m->mem_block_size, block->data, block->size, &final_size)))
+			final_size = 0;
+		if (final_size < (ULONG)m->mem_block_size)
+			ZeroMemory(buf + final_size, m->mem_block_size - final_size);
+	}
+}
+
+void CVirtualMemoryIO::StoreSet(size_t index, SStoreBlock* block)
+{
+	SStoreBlock* old_block = (SStoreBlock*)m->ptr_table[index];
+	m->ptr_table[index] = block;
+	
+	if (!old_block)
+		m->n_block++;
+	else if (--old_block->refs == 0) {
+		auto range = m->blocks.equal_range(old_block->hash);
+		for (auto I = range.first; I != range.second; ++I) {
+			if (I->second == old_block) {
+				m->blocks.erase(I);
+				break;
+			}
+		}
+		m->stored_size -= STORE_BLOCK_SIZE(old_block->size);
+		HeapFree(m->heap, 0, old_block);
+	}
+	if (!block)
+		m->n_block--;
+}
+
+bool CVirtualMemoryIO::StoreSave(size_t index, BYTE* buf)
+{
+	if (!data_search(buf, m->mem_block_size)) {
+		if (m->ptr_table[index])
+			StoreSet(index, NULL);
+		return true;
+	}
+
+	ULONG64 hash = StoreHash(buf, m->mem_block_size);
+
+	//
+	// look for a block with the same content, the hash only selects the candidates
+	//
+
+	auto range = m->blocks.equal_range(hash);
+	for (auto I = range.first; I != range.second; ++I) {
+		SStoreBlock* block = I->second;
+		if (block->size == (ULONG)m->mem_block_size) {
+			if (memcmp(block->data, buf, m->mem_block_size) != 0)
+				continue;
+		}
+		else {
+			ULONG final_size = 0;
+			if (!NT_SUCCESS(RtlDecompressBuffer(COMPRESSION_FORMAT_XPRESS, m->packed, m->mem_block_size, block->data, block->size, &final_size))
+				|| final_size != (ULONG)m->mem_block_size || memcmp(m->packed, buf, m->mem_block_size) != 0)
+				continue;
+		}
+
+		if (block != m->ptr_table[index]) {
+			block->refs++;
+			StoreSet(index, block);
+		}
+		return true;
+	}
+
+	MEMORYSTATUSEX mem_stat;
+	mem_stat.dwLength = sizeof mem_stat;
+	GlobalMemoryStatusEx(&mem_stat);
+	if (mem_stat.ullAvailPageFile < MINIMAL_MEM)
+		return false;
+
+	// blocks which do not shrink by at least 1/8 are kept uncompressed
+	ULONG size = m->mem_block_size;
+	BYTE* data = buf;
+	ULONG packed_size = 0;
+	if (m->work_space && NT_SUCCESS(RtlCompressBuffer(COMPRESSION_FORMAT_XPRESS | COMPRESSION_ENGINE_STANDARD, buf, m->mem_block_size, 
+	  m->packed, m->mem_block_size, 4096, &packed_size, m->work_space)) && packed_size > 0 && packed_size <= size - size / 8) {
+		size = packed_size;
+		data = m->packed;
+	}
+
+	SStoreBlock* block = (SStoreBlock*)HeapAlloc(m->heap, 0, STORE_BLOCK_SIZE(size));
+	if (!block)
+		return false;
+	block->hash = hash;
+	block->refs = 1;
+	block->size = size;
+	memcpy(block->data, data, size);
+
+	m->blocks.emplace(hash, block);
+	m->stored_size += STORE_BLOCK_SIZE(size);
+
+	StoreSet(index, block);
+	return true;
+}
+
+bool CVirtualMemoryIO::StoreWrite(BYTE* buf, int size, __int64 offset)
+{
+	bool ret = true;
+	size_t index = offset >> m->mem_block_size_shift;
+	int current_size;
+	int block_offset = offset & m->mem_block_size_mask;
+
+	do {
+		if (index >= m->table_size)
+			Expand(offset + size);
+		current_size = min(size + block_offset, m->mem_block_size) - block_offset;
+		if (current_size == m->mem_block_size) {
+			if (!StoreSave(index, buf))
+				ret = false;
+		}
+		else {
+			StoreLoad(index, m->plain);
+			memcpy(m->plain + block_offset, buf, current_size);
+			if (!StoreSave(index, m->plain))
+				ret = false;
+		}
+		block_offset = 0;
+		buf += current_size;
+		index++;
+		size -= current_size;
+	} while (size > 0);
+
+	return ret;
+}
+
+bool CVirtualMemoryIO::StoreRead(BYTE* buf, int size, __int64 offset)
+{
+	size_t index = offset >> m->mem_block_size_shift;
+	int current_size;
+	int block_offset = offset & m->mem_block_size_mask;
+
+	do {
+		if (index >= m->table_size)
+			Expand(offset + size);
+		current_size = min(size + block_offset, m->mem_block_size) - block_offset;
+		if (!m->ptr_table[index])
+			ZeroMemory(buf, current_size);
+		else if (current_size == m->mem_block_size)
+			StoreLoad(index, buf);
+		else {
+			StoreLoad(index, m->plain);
+			memcpy(buf, m->plain + block_offset, current_size);
+		}
+		block_offset = 0;
+		buf += current_size;
+		index++;
+		size -= current_size;
+	} while (size > 0);
+
+	return true;
+}
+
+void CVirtualMemoryIO::StoreTrim(DEVICE_DATA_SET_RANGE* range, int n)
+{
+	size_t index;
+	int current_size, block_offset;
+	__int64 size;
+
+	for (; n; range++, n--) {
+		index = range->StartingOffset >> m->mem_block_size_shift;
+		block_offset = range->StartingOffset & m->mem_block_size_mask;
+		for (size = range->LengthInBytes; size > 0; size -= current_size) {
+			if (index >= m->table_size)
+				break;
+			current_size = min(size + block_offset, (__int64)m->mem_block_size) - block_offset;
+			if (m->ptr_table[index]) {
+				if (current_size == m->mem_block_size)
+					StoreSet(index, NULL);
+				else {
+					StoreLoad(index, m->plain);
+					ZeroMemory(m->plain + block_offset, current_size);
+					StoreSave(index, m->plain);
+				}
+			}
+			block_offset = 0;
+			index++;
+		}
+	}
+}
+
+int CVirtualMemoryIO::Benchmark()
+{
+	//
+	// writes a data set resembling a box with build intermediates and duplicated binaries to a plain
+	// and to a block store RAM disk, then reads it back with random 4 KB requests and verifies it
+	//
+
+	const int Chunk = 64 * 1024, Block = 4096, Reads = 16384;
+	const int TextSize = 32 << 20, BinSize = 8 << 20, BinCopies = 3, RandSize = 8 << 20;
+	const int Total = TextSize + BinSize * BinCopies + RandSize;
+
+	static const char* Words[] = { "static ", "return ", "void ", "int ", "if (", ") {\r\n", "}\r\n", "m_pIO->", "DiskRead", "DiskWrite",
+		"size", "offset", ";\r\n", "\t", "0x0000", ".obj", "#include ", "<windows.h>", "const ", "= NULL", "ptr_table[index]" };
+
+	HANDLE hOut = BenchOutput();
+
+	BYTE* set = (BYTE*)VirtualAlloc(NULL, Total, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	BYTE* tmp = (BYTE*)VirtualAlloc(NULL, Block, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!set || !tmp) {
+		if (set) VirtualFree(set, 0, MEM_RELEASE);
+		if (tmp) VirtualFree(tmp, 0, MEM_RELEASE);
+		return ERR_MALLOC_ERROR;
+	}
+
+	ULONG64 seed = GetTickCount64() | 1;
+	auto Next = [&seed]() {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		return seed;
+	};
+
+	BYTE* ptr = set;
+	for (BYTE* end = set + TextSize; ptr < end; ) {
+		const char* word = Words[Next() % _countof(Words)];
+		for (; *word && ptr < end; word++)
+			*ptr++ = *word;
+	}
+	for (int i = 0; i < BinSize + RandSize; i += 8, ptr += 8)
+		*(ULONG64*)ptr = Next();
+	for (int i = 1; i < BinCopies; i++, ptr += BinSize)
+		memcpy(ptr, set + TextSize, BinSize);
+
+	LARGE_INTEGER freq, start, now;
+	QueryPerformanceFrequency(&freq);
+
+	BenchPrint(hOut, L"RAM disk benchmark, %d MB of text, %d MB binaries stored %d times, %d MB random data\r\n", TextSize >> 20, BinSize >> 20, BinCopies, RandSize >> 20);
+
+	for (int store = 0; store < 2; store++) {
+
+		CVirtualMemoryIO Disk(Total * 2ull, store ? 12 : 20, !!store);
+		if (Disk.Init() != ERR_OK)
+			break;
+
+		QueryPerformanceCounter(&start);
+		for (int pos = 0; pos < Total; pos += Chunk)
+			Disk.DiskWrite(set + pos, Chunk, pos);
+		QueryPerformanceCounter(&now);
+		double write_us = (double)(now.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart / (Total / Chunk);
+
+		int errors = 0;
+		QueryPerformanceCounter(&start);
+		for (int i = 0; i < Reads; i++) {
+			int pos = (int)(Next() % (Total / Block)) * Block;
+			Disk.DiskRead(tmp, Block, pos);
+			if (memcmp(tmp, set + pos, Block) != 0)
+				errors++;
+		}
+		QueryPerformanceCounter(&now);
+		double read_us = (double)(now.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart / Reads;
+
+		BenchPrint(hOut, L"%-11s used %4I64u MB, allocated %4I64u MB, write %7.1f us / 64 KB, read %6.1f us / 4 KB%s\r\n", store ? L"block store" : L"plain",
+			Disk.GetUsedSize() >> 20, Disk.GetAllocSize() >> 20, write_us, read_us, errors ? L", DATA MISMATCH" : L"");
+	}
+
+	VirtualFree(set, 0, MEM_RELEASE);
+	VirtualFree(tmp, 0, MEM_RELEASE);
+	return ERR_OK;
+}
@@ -4,11 +4,12 @@
 class CVirtualMemoryIO : public CAbstractIO
 {
 public:
-	CVirtualMemoryIO(ULONG64 uSize, int BlockSize = 20);
+	CVirtualMemoryIO(ULONG64 uSize, int BlockSize = 20, bool bBlockStore = false);
 	virtual ~CVirtualMemoryIO();
 
 	virtual ULONG64 GetDiskSize() const;
-	virtual ULONG64 GetAllocSize() const;
+	virtual ULONG64 GetAllocSize() const; // memory used, in block store mode after compression and deduplication
+	virtual ULONG64 GetUsedSize() const; // size of all blocks holding data
 	virtual bool CanBeFormated() const { return true; }
 
 	virtual int Init();
@@ -18,9 +19,18 @@ public:
 	virtual bool DiskRead(void* buf, int size, __int64 offset);
 	virtual void TrimProcess(DEVICE_DATA_SET_RANGE* range, int n);
 
+	static int Benchmark();
+
 protected:
 	void Expand(ULONG64 uSize);
 
+	void StoreLoad(size_t index, BYTE* buf);
+	void StoreSet(size_t index, struct SStoreBlock* block);
+	bool StoreSave(size_t index, BYTE* buf);
+	bool StoreWrite(BYTE* buf, int size, __int64 offset);
+	bool StoreRead(BYTE* buf, int size, __int64 offset);
+	void StoreTrim(DEVICE_DATA_SET_RANGE* range, int n);
+
 	struct SVirtualMemory* m;
 };
 
@@ -340,39 +340,6 @@ bool DeleteDirectoryRecursively(const std::wstring& root, const std::wstring& pa
 }
 
 
-std::shared_ptr<SRelease> ScanDir(std::wstring Path) 
-{
-	if (Path.back() != L'\\') 
-		Path.push_back(L'\\');
-
-	std::shared_ptr<SRelease> pFiles = std::make_shared<SRelease>();
-
-	std::vector<std::wstring> Entries;
-	Entries.push_back(Path);
-
-	for (int i = 0; i < Entries.size(); i++)
-	{
-		if (Entries[i].back() == '\\') {
-			ListDir(Entries[i], Entries);
-			continue;
-		}
-
-		ULONG hashSize;
-		PVOID hash = NULL;
-		if (NT_SUCCESS(MyHashFile(Entries[i].c_str(), &hash, &hashSize)))
-		{
-			std::shared_ptr<SFile> pFile = std::make_shared<SFile>();
-			pFile->Path = Entries[i].substr(Path.length());
-			pFile->Hash = hexStr((unsigned char*)hash, hashSize);
-			pFiles->Map[pFile->Path] = pFile;
-
-			free(hash);
-		}
-	}
-
-	return pFiles;
-}
-
 std::wstring GetJSONStringSafe(const JSONObject& root, const std::wstring& key, const std::wstring& def = L"")
 {
 	auto I = root.find(key);
@@ -413,6 +380,236 @@ JSONArray GetJSONArraySafe(const JSONObject& root, const std::wstring& key)
 	return I->second->AsArray();
 }
 
+struct SFileStamp
+{
+	SFileStamp() : Size(0), MTime(0), FileId(0), Volume(0) {}
+
+	bool operator==(const SFileStamp& Other) const {
+		return Size == Other.Size && MTime == Other.MTime && FileId == Other.FileId && Volume == Other.Volume;
+	}
+
+	ULONGLONG		Size;
+	ULONGLONG		MTime;
+	ULONGLONG		FileId;
+	ULONG			Volume;
+};
+
+bool GetFileStamp(const std::wstring& FilePath, SFileStamp& Stamp)
+{
+	HANDLE hFile = CreateFileW(FilePath.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	BY_HANDLE_FILE_INFORMATION Info;
+	BOOL ok = GetFileInformationByHandle(hFile, &Info);
+	CloseHandle(hFile);
+	if (!ok || (Info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+
+	Stamp.Size = ((ULONGLONG)Info.nFileSizeHigh << 32) | Info.nFileSizeLow;
+	Stamp.MTime = ((ULONGLONG)Info.ftLastWriteTime.dwHighDateTime << 32) | Info.ftLastWriteTime.dwLowDateTime;
+	Stamp.FileId = ((ULONGLONG)Info.nFileIndexHigh << 32) | Info.nFileIndexLow;
+	Stamp.Volume = Info.dwVolumeSerialNumber;
+	return true;
+}
+
+struct SHashEntry
+{
+	SFileStamp		Stamp;
+	std::wstring	Hash;
+};
+
+typedef std::map<std::wstring, SHashEntry> THashCache; // full lower case path -> entry
+
+std::wstring MakeCacheKey(std::wstring FilePath)
+{
+	std::transform(FilePath.begin(), FilePath.end(), FilePath.begin(), ::towlower);
+	return FilePath;
+}
+
+// note: json numbers are doubles, 64 bit values are stored as hex strings
+std::wstring U64ToHex(ULONGLONG Value)
+{
+	wchar_t Buffer[24];
+	_ui64tow_s(Value, Buffer, ARRAYSIZE(Buffer), 16);
+	return Buffer;
+}
+
+ULONGLONG HexToU64(const std::wstring& Value)
+{
+	return wcstoull(Value.c_str(), NULL, 16);
+}
+
+void LoadHashCache(const std::wstring& cache_path, THashCache& Cache)
+{
+	char* aJson = NULL;
+	if (NT_SUCCESS(MyReadFile((wchar_t*)cache_path.c_str(), 16 * 1024 * 1024, (PVOID*)&aJson, NULL)) && aJson != NULL)
+	{
+		JSONValue* jsonObject = JSON::Parse(aJson);
+		if (jsonObject) {
+			if (jsonObject->IsObject()) {
+				JSONArray jsonFiles = GetJSONArraySafe(jsonObject->AsObject(), L"files");
+				for (auto I = jsonFiles.begin(); I != jsonFiles.end(); ++I) {
+					if (!(*I)->IsObject())
+						continue;
+					JSONObject jsonFile = (*I)->AsObject();
+
+					SHashEntry Entry;
+					Entry.Stamp.Size = HexToU64(GetJSONStringSafe(jsonFile, L"size"));
+					Entry.Stamp.MTime = HexToU64(GetJSONStringSafe(jsonFile, L"mtime"));
+					Entry.Stamp.FileId = HexToU64(GetJSONStringSafe(jsonFile, L"id"));
+					Entry.Stamp.Volume = (ULONG)HexToU64(GetJSONStringSafe(jsonFile, L"volume"));
+					Entry.Hash = GetJSONStringSafe(jsonFile, L"hash");
+
+					std::wstring Path = GetJSONStringSafe(jsonFile, L"path");
+					if (!Path.empty() && !Entry.Hash.empty())
+						Cache[Path] = Entry;
+				}
+			}
+			delete jsonObject;
+		}
+		free(aJson);
+	}
+}
+
+void StoreHashCache(const std::wstring& cache_path, const THashCache& Cache)
+{
+	JSONObject root;
+
+	JSONArray files;
+	for (auto I = Cache.begin(); I != Cache.end(); ++I)
+	{
+		JSONObject file;
+		file[L"path"] = new JSONValue(I->first);
+		file[L"size"] = new JSONValue(U64ToHex(I->second.Stamp.Size));
+		file[L"mtime"] = new JSONValue(U64ToHex(I->second.Stamp.MTime));
+		file[L"id"] = new JSONValue(U64ToHex(I->second.Stamp.FileId));
+		file[L"volume"] = new JSONValue(U64ToHex(I->second.Stamp.Volume));
+		file[L"hash"] = new JSONValue(I->second.Hash);
+		files.push_back(new JSONValue(file));
+	}
+	root[L"files"] = new JSONValue(files);
+
+	JSONValue *value = new JSONValue(root);
+	std::string Json = g_str_conv.to_bytes(value->Stringify());
+	delete value;
+
+	MyWriteFile((wchar_t*)cache_path.c_str(), (PVOID)Json.c_str(), (ULONG)Json.length());
+}
+
+#define MAX_HASH_THREADS	8
+
+std::map<std::wstring, std::wstring> HashFiles(const std::wstring& base_dir, const std::vector<std::wstring>& Files, THashCache* pCache)
+{
+	struct SJob
+	{
+		SJob() : Hashed(false) {}
+		std::wstring	Key;
+		SFileStamp		Stamp;
+		std::wstring	Hash;
+		bool			Hashed;
+	};
+
+	std::vector<SJob> Jobs(Files.size());
+
+	//
+	// the workers only read the cache, all updates are done after they are joined,
+	// the stamp is taken before hashing such that a file changed in between
+	// will mismatch on the next run and be hashed again
+	//
+
+	std::atomic<size_t> Next(0);
+	auto Worker = [&]() {
+		for (size_t i; (i = Next++) < Jobs.size(); )
+		{
+			SJob& Job = Jobs[i];
+			std::wstring FilePath = base_dir + Files[i];
+			if (!GetFileStamp(FilePath, Job.Stamp))
+				continue; // missing or inaccessible
+
+			if (pCache) {
+				Job.Key = MakeCacheKey(FilePath);
+				auto I = pCache->find(Job.Key);
+				if (I != pCache->end() && I->second.Stamp == Job.Stamp) {
+					Job.Hash = I->second.Hash;
+					continue;
+				}
+			}
+
+			ULONG hashSize;
+			PVOID hash = NULL;
+			if (NT_SUCCESS(MyHashFile(FilePath.c_str(), &hash, &hashSize)))
+			{
+				Job.Hash = hexStr((unsigned char*)hash, hashSize);
+				Job.Hashed = true;
+
+				free(hash);
+			}
+		}
+	};
+
+	size_t ThreadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), MAX_HASH_THREADS);
+	if (ThreadCount > Jobs.size())
+		ThreadCount = Jobs.size();
+
+	std::vector<std::thread> Threads;
+	for (size_t i = 1; i < ThreadCount; i++)
+		Threads.emplace_back(Worker);
+	Worker();
+	for (auto I = Threads.begin(); I != Threads.end(); ++I)
+		I->join();
+
+	std::map<std::wstring, std::wstring> Hashes;
+	for (size_t i = 0; i < Jobs.size(); i++)
+	{
+		SJob& Job = Jobs[i];
+		if (Job.Hash.empty())
+			continue;
+		Hashes[Files[i]] = Job.Hash;
+
+		if (pCache && Job.Hashed) {
+			SHashEntry& Entry = (*pCache)[Job.Key];
+			Entry.Stamp = Job.Stamp;
+			Entry.Hash = Job.Hash;
+		}
+	}
+
+	return Hashes;
+}
+
+std::shared_ptr<SRelease> ScanDir(std::wstring Path, THashCache* pCache = NULL)
+{
+	if (Path.back() != L'\\') 
+		Path.push_back(L'\\');
+
+	std::shared_ptr<SRelease> pFiles = std::make_shared<SRelease>();
+
+	std::vector<std::wstring> Entries;
+	Entries.push_back(Path);
+
+	std::vector<std::wstring> Files;
+	for (int i = 0; i < Entries.size(); i++)
+	{
+		if (Entries[i].back() == '\\') {
+			ListDir(Entries[i], Entries);
+			continue;
+		}
+
+		Files.push_back(Entries[i].substr(Path.length()));
+	}
+
+	std::map<std::wstring, std::wstring> Hashes = HashFiles(Path, Files, pCache);
+	for (auto I = Hashes.begin(); I != Hashes.end(); ++I)
+	{
+		std::shared_ptr<SFile> pFile = std::make_shared<SFile>();
+		pFile->Path = I->first;
+		pFile->Hash = I->second;
+		pFiles->Map[pFile->Path] = pFile;
+	}
+
+	return pFiles;
+}
+
 std::string WriteUpdate(std::shared_ptr<SRelease> pFiles)
 {
 	JSONObject root;
@@ -582,22 +779,44 @@ bool InScope(std::shared_ptr<TScope> pScope, std::wstring name)
 	return false;
 }
 
-int FindChanges(std::shared_ptr<SRelease> pNewFiles, std::wstring base_dir, std::wstring temp_dir, std::shared_ptr<TScope> pScope)
+int FindChanges(std::shared_ptr<SRelease> pNewFiles, std::wstring base_dir, std::wstring temp_dir, std::shared_ptr<TScope> pScope, bool bTrustCache)
 {
-	std::shared_ptr<SRelease> pOldFiles = ScanDir(base_dir);
-	if (!pOldFiles)
-		return ERROR_SCAN;
+	//
+	// only the files of the release which are in scope are relevant, 
+	// so we hash just those instead of scanning the entire installation
+	//
 
-	int Count = 0;
+	std::vector<std::wstring> Files;
 	for (auto I = pNewFiles->Map.begin(); I != pNewFiles->Map.end(); ++I)
 	{
 		I->second->State = SFile::eNone;
-		if (!InScope(pScope, I->second->Path))
-			continue;
+		if (InScope(pScope, I->second->Path))
+			Files.push_back(I->first);
+	}
+
+	std::wstring cache_path = temp_dir + L"\\" _T(HASH_CACHE_FILE);
+
+	//
+	// the cache lives in the user writable temp folder, so it may only be used
+	// to decide what to download, before applying an update every file is
+	// hashed again and the cache is rebuilt from those results
+	//
+
+	THashCache Cache;
+	if (bTrustCache)
+		LoadHashCache(cache_path, Cache);
+	std::map<std::wstring, std::wstring> OldHashes = HashFiles(base_dir + L"\\", Files, &Cache);
+	CreateDirectoryW(temp_dir.c_str(), NULL);
+	StoreHashCache(cache_path, Cache);
+
+	int Count = 0;
+	for (auto I = Files.begin(); I != Files.end(); ++I)
+	{
+		std::shared_ptr<SFile> pFile = pNewFiles->Map[*I];
 
-		auto J = pOldFiles->Map.find(I->first);
-		if (J == pOldFiles->Map.end() || J->second->Hash != I->second->Hash) {
-			I->second->State = SFile::eChanged;
+		auto J = OldHashes.find(*I);
+		if (J == OldHashes.end() || J->second != pFile->Hash) {
+			pFile->State = SFile::eChanged;
 			Count++;
 		}
 	}
@@ -755,7 +974,8 @@ int ProcessUpdate(std::shared_ptr<SRelease>& pFiles, const std::wstring& step, c
 		std::shared_ptr<TScope> pScope;
 		if (!scope.empty()) pScope = GetScope(scope);
 
-		ret = FindChanges(pFiles, base_dir, temp_dir, pScope);
+		bool bApply = step.empty() || step == L"apply";
+		ret = FindChanges(pFiles, base_dir, temp_dir, pScope, !bApply);
 		//pFiles->Status = SRelease::eScanned;
 		if (ret <= 0)
 			return ret; // error or nothing todo
@@ -4,6 +4,7 @@
 
 #define UPDATE_FILE			"update.json"
 #define ADDONS_FILE			"addons.json"
+#define HASH_CACHE_FILE		"hashcache.json"
 #define ADDONS_PATH			"\\addons\\"
 
 
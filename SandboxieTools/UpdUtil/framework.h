@@ -28,4 +28,6 @@
 #include <memory>
 #include <locale>
 #include <codecvt>
-#include <algorithm>
\ No newline at end of file
+#include <algorithm>
+#include <thread>
+#include <atomic>
\ No newline at end of file